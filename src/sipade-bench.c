@@ -0,0 +1,503 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   sipade-bench.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Micro benchmarks of the hot functions of the engine, run with "make bench".
+ * The CDR results are built in memory, so no database is needed. The results
+ * are written as JSON, one benchmark per line, and can be compared against
+ * a baseline saved from an earlier run:
+ *
+ *   ./sipade-bench -c ../conf/sipade.yaml -o baseline.json
+ *   ./sipade-bench -c ../conf/sipade.yaml -b baseline.json -r 10
+ */
+
+#include <getopt.h>
+#include "sipade.h"
+#include "util-detection.h"
+#include "util-conf.h"
+#include "util-log.h"
+#include "util-timer.h"
+#include "util-wheel.h"
+#include "util-concurrency.h"
+
+#define BENCH_DEFAULT_ROWS      10000
+#define BENCH_DEFAULT_TIME      0.5     /* seconds per benchmark */
+#define BENCH_MAX_BASELINE      32
+#define BENCH_NAME_LEN          32
+#define BENCH_WHEEL_TENANTS     100000
+
+uint8_t run_mode;
+
+typedef struct SipBench_ {
+    const char *name;
+    uint64_t items;     /* items processed per operation */
+    void (*run)(uint64_t);
+} SipBench;
+
+typedef struct SipBenchBaseline_ {
+    char name[BENCH_NAME_LEN];
+    double ns_per_op;
+} SipBenchBaseline;
+
+static PGresult *bench_result = NULL;
+static Hd bench_testing;
+static Hd bench_detection;
+static uint32_t bench_rows = BENCH_DEFAULT_ROWS;
+static SipBenchBaseline baseline[BENCH_MAX_BASELINE];
+static int baseline_cnt = 0;
+
+/* Tenants with intervals between 5 and 60 minutes, scheduled in the wheel */
+static const uint32_t bench_intervals[] = { 300, 600, 900, 1800, 3600 };
+static SipWheel bench_wheel;
+static SipWheelEntry *bench_tenants = NULL;
+
+/* Calltype mix of the generated CDRs, in percent */
+static const struct {
+    const char *name;
+    uint32_t share;
+} bench_mix[] = {
+    { "DOMESTIC", 50 },
+    { "MOBILE", 30 },
+    { "INTERNATIONAL", 8 },
+    { "SERVICE", 6 },
+    { "PREMIUM", 4 },
+    { "EMERGENCY", 2 },
+};
+
+static const char *bench_conf_keys[] = {
+    "institution",
+    "ad-algo.sensitivity",
+    "call-duration.premium",
+    "cdr-database.table",
+};
+
+/**
+ * \brief   Function to build a result of the interval query in memory, with
+ *          the columns of SipGetQuery and a fixed calltype mix.
+ */
+static PGresult *SipBenchMakeResult(uint32_t rows)
+{
+    PGresult *res = NULL;
+    PGresAttDesc attrs[7];
+    const char *names[7] = { "id", "calldate", "src", "dst", "billsec",
+                             "calltype", "accountcode" };
+    char value[32];
+    uint32_t seed = 12345;
+    uint32_t row = 0;
+    uint32_t pick = 0;
+    uint8_t i = 0;
+
+    res = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+    if (res == NULL)
+        return NULL;
+
+    memset(attrs, 0, sizeof(attrs));
+    for (i = 0; i < 7; i++) {
+        attrs[i].name = (char *)names[i];
+        attrs[i].typid = 25; /* text */
+        attrs[i].typlen = -1;
+        attrs[i].atttypmod = -1;
+    }
+    if (PQsetResultAttrs(res, 7, attrs) == 0)
+        goto error;
+
+    for (row = 0; row < rows; row++) {
+        seed = seed * 1103515245 + 12345;
+        pick = (seed >> 16) % 100;
+        for (i = 0; pick >= bench_mix[i].share; i++)
+            pick -= bench_mix[i].share;
+
+        snprintf(value, sizeof(value), "%"PRIu32, row + 1);
+        if (PQsetvalue(res, row, 0, value, strlen(value)) == 0)
+            goto error;
+        snprintf(value, sizeof(value), "2010-01-11 %02u:%02u:%02u",
+                (row / 3600) % 24, (row / 60) % 60, row % 60);
+        if (PQsetvalue(res, row, 1, value, strlen(value)) == 0)
+            goto error;
+        snprintf(value, sizeof(value), "2200%04u", row % 10000);
+        if (PQsetvalue(res, row, 2, value, strlen(value)) == 0)
+            goto error;
+        snprintf(value, sizeof(value), "9%07u", (seed >> 8) % 10000000);
+        if (PQsetvalue(res, row, 3, value, strlen(value)) == 0)
+            goto error;
+        snprintf(value, sizeof(value), "%u", (seed >> 4) % 600);
+        if (PQsetvalue(res, row, 4, value, strlen(value)) == 0)
+            goto error;
+        if (PQsetvalue(res, row, 5, (char *)bench_mix[i].name,
+                    strlen(bench_mix[i].name)) == 0 ||
+                PQsetvalue(res, row, 6, "Test", 4) == 0)
+        {
+            goto error;
+        }
+    }
+
+    return res;
+
+error:
+    PQclear(res);
+    return NULL;
+}
+
+static void SipBenchGetCallData(uint64_t ops)
+{
+    Hd hd;
+
+    while (ops--) {
+        CLEAR_HD(&hd);
+        SipGetCallData(&hd, bench_result);
+    }
+}
+
+static void SipBenchProbabilities(uint64_t ops)
+{
+    while (ops--)
+        SipCalcHDProbabilities(&bench_testing);
+}
+
+static void SipBenchHellinger(uint64_t ops)
+{
+    while (ops--) {
+        bench_testing.distance_value = 0.0;
+        SipCalcHellingerDistance(&bench_detection, &bench_testing);
+    }
+}
+
+static void SipBenchThreshold(uint64_t ops)
+{
+    while (ops--)
+        SipUpdateHDThreshold(&bench_detection, &bench_testing);
+}
+
+/* Sweep the calls of the result, which start within 10000 seconds, in to
+ * one window */
+static void SipBenchConcurrency(uint64_t ops)
+{
+    SipConcStats cs;
+    struct tm tm = { 0, 0, 0, 11, 0, 110, 0, 0, -1 };
+    time_t from = mktime(&tm);
+
+    while (ops--)
+        SipGetConcurrency(&cs, bench_result, from, from + bench_rows);
+}
+
+static void SipBenchConfGet(uint64_t ops)
+{
+    char *value = NULL;
+    uint64_t i = 0;
+
+    for (i = 0; i < ops; i++)
+        SipConfGet((char *)bench_conf_keys[i & 3], &value);
+}
+
+static void SipBenchConfGetDouble(uint64_t ops)
+{
+    double value = 0.0;
+
+    while (ops--) {
+        SipConfGetDouble("ad-algo.sensitivity", &value);
+        __asm__ volatile("" ::: "memory");
+    }
+}
+
+/* Move a scheduled tenant to a new due time, within its interval */
+static void SipBenchWheelAdd(uint64_t ops)
+{
+    SipWheelEntry *e = NULL;
+    uint64_t i = 0;
+
+    for (i = 0; i < ops; i++) {
+        e = &bench_tenants[(i * 7919) % BENCH_WHEEL_TENANTS];
+        SipWheelAdd(&bench_wheel, e, bench_wheel.now + 1 +
+                (i % (uintptr_t)e->data));
+    }
+}
+
+/* Turn the wheel by one second, the due tenants are scheduled again at the
+ * end of their next interval */
+static void SipBenchWheelTurn(uint64_t ops)
+{
+    SipWheelList due;
+    SipWheelEntry *e = NULL;
+
+    TAILQ_INIT(&due);
+    while (ops--) {
+        SipWheelExpire(&bench_wheel, bench_wheel.now + 1, &due);
+        while ((e = TAILQ_FIRST(&due)) != NULL) {
+            TAILQ_REMOVE(&due, e, next);
+            SipWheelAdd(&bench_wheel, e, e->due + (uintptr_t)e->data);
+        }
+    }
+}
+
+static void SipBenchLogFiltered(uint64_t ops)
+{
+    while (ops--) {
+        SipLog(SIP_LOG_DEBUG, SIP_LOG_LOCATION, "Distance Value %f", 0.25);
+        /* the log level has to be read for every message, as it is in the
+         * engine, otherwise the whole loop is optimized away */
+        __asm__ volatile("" ::: "memory");
+    }
+}
+
+static void SipBenchLogFormat(uint64_t ops)
+{
+    while (ops--)
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Distance Value %f threshold"
+                " %f of %s", 0.25, 0.5, "Test");
+}
+
+static SipBench benchmarks[] = {
+    { "get-call-data", 0, SipBenchGetCallData },
+    { "calc-probabilities", 1, SipBenchProbabilities },
+    { "hellinger-distance", 1, SipBenchHellinger },
+    { "update-threshold", 1, SipBenchThreshold },
+    { "concurrency", 0, SipBenchConcurrency },
+    { "conf-get", 1, SipBenchConfGet },
+    { "conf-get-double", 1, SipBenchConfGetDouble },
+    { "wheel-add", 1, SipBenchWheelAdd },
+    { "wheel-turn", 0, SipBenchWheelTurn },
+    { "log-filtered", 1, SipBenchLogFiltered },
+    { "log-format", 1, SipBenchLogFormat },
+};
+
+/**
+ * \brief   Function to load the baseline, written by an earlier run.
+ */
+static int SipBenchLoadBaseline(const char *file)
+{
+    FILE *fp = NULL;
+    char line[256];
+    char *name = NULL;
+    char *ns = NULL;
+    size_t len = 0;
+
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in opening the"
+                " baseline %s", file);
+        return SIP_ERROR;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL &&
+            baseline_cnt < BENCH_MAX_BASELINE)
+    {
+        name = strstr(line, "\"name\": \"");
+        ns = strstr(line, "\"ns_per_op\": ");
+        if (name == NULL || ns == NULL)
+            continue;
+
+        name += strlen("\"name\": \"");
+        len = strcspn(name, "\"");
+        if (len >= BENCH_NAME_LEN)
+            continue;
+
+        memcpy(baseline[baseline_cnt].name, name, len);
+        baseline[baseline_cnt].name[len] = '\0';
+        baseline[baseline_cnt].ns_per_op = atof(ns + strlen("\"ns_per_op\": "));
+        baseline_cnt++;
+    }
+
+    fclose(fp);
+    return SIP_OK;
+}
+
+static double SipBenchBaselineGet(const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < baseline_cnt; i++) {
+        if (strcmp(baseline[i].name, name) == 0)
+            return baseline[i].ns_per_op;
+    }
+    return 0.0;
+}
+
+/**
+ * \brief   Function to run the benchmark until it has taken the given time,
+ *          doubling the operations per batch after the warm up.
+ *
+ * @return  nanoseconds per operation
+ */
+static double SipBenchRun(SipBench *b, double seconds, uint64_t *ops)
+{
+    uint64_t batch = 1;
+    uint64_t start = 0;
+    uint64_t ns = 0;
+    uint64_t total_ns = 0;
+
+    /* warm up the caches and the branch predictors */
+    b->run(batch);
+
+    *ops = 0;
+    while (total_ns < seconds * 1e9) {
+        start = SipTimerTicks();
+        b->run(batch);
+        ns = SipTimerNs(SipTimerTicks() - start);
+
+        total_ns += ns;
+        *ops += batch;
+        if (ns < 1e7 && batch < (1ULL << 32))
+            batch *= 2;
+    }
+
+    return total_ns > 0 ? (double)total_ns / *ops : 0.0;
+}
+
+static void SipBenchUsage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s -c <config file> [-o <output file>]"
+            " [-b <baseline file>] [-r <max regression %%>] [-n <rows>]"
+            " [-t <seconds per benchmark>]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    char *conf_filename = SIP_CONF_FILE_PATH;
+    char *out_filename = NULL;
+    char *base_filename = NULL;
+    double seconds = BENCH_DEFAULT_TIME;
+    double max_regression = 0.0;
+    double ns_per_op = 0.0;
+    double base = 0.0;
+    double change = 0.0;
+    double due_per_sec = 0.0;
+    uint64_t ops = 0;
+    uint32_t ival = 0;
+    FILE *out = NULL;
+    int regressed = 0;
+    int opt = 0;
+    size_t i = 0;
+    size_t nbench = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+    while ((opt = getopt(argc, argv, "c:o:b:r:n:t:h")) != -1) {
+        switch (opt) {
+            case 'c': conf_filename = optarg; break;
+            case 'o': out_filename = optarg; break;
+            case 'b': base_filename = optarg; break;
+            case 'r': max_regression = atof(optarg); break;
+            case 'n': bench_rows = strtoul(optarg, NULL, 10); break;
+            case 't': seconds = atof(optarg); break;
+            default:
+                SipBenchUsage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (SipConfInit(conf_filename) != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    if (base_filename != NULL && SipBenchLoadBaseline(base_filename) != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    /* The results go to the given file or to the original stdout, while the
+     * log messages of the benchmarks are discarded */
+    if (out_filename != NULL) {
+        out = fopen(out_filename, "w");
+    } else {
+        out = fdopen(dup(STDOUT_FILENO), "w");
+    }
+    if (out == NULL) {
+        perror("sipade-bench");
+        exit(EXIT_FAILURE);
+    }
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        perror("sipade-bench");
+        exit(EXIT_FAILURE);
+    }
+
+    SipInitLog();
+    log_level = SIP_LOG_INFO;
+    SipTimerInit();
+
+    if (SipAnomalyInitConfValues() != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    bench_result = SipBenchMakeResult(bench_rows);
+    if (bench_result == NULL) {
+        fprintf(stderr, "sipade-bench: failed in building the CDR result\n");
+        exit(EXIT_FAILURE);
+    }
+    benchmarks[0].items = bench_rows;
+
+    /* the detection struct is a skewed copy of the scored one, so that the
+     * distance is not zero */
+    CLEAR_HD(&bench_testing);
+    SipGetCallData(&bench_testing, bench_result);
+    SipCalcHDProbabilities(&bench_testing);
+    bench_detection = bench_testing;
+    bench_detection.call[PREMIUM].p_freq *= 0.5;
+    bench_detection.call[INTERNATIONAL].p_dur *= 0.5;
+    bench_detection.distance_value = 0.0;
+    SipCalcHellingerDistance(&bench_detection, &bench_testing);
+
+    /* the tenants due per second are the items of a turn of the wheel */
+    bench_tenants = calloc(BENCH_WHEEL_TENANTS, sizeof(SipWheelEntry));
+    if (bench_tenants == NULL) {
+        fprintf(stderr, "sipade-bench: failed in allocating the tenants\n");
+        exit(EXIT_FAILURE);
+    }
+    SipWheelInit(&bench_wheel, time(NULL));
+    for (i = 0; i < BENCH_WHEEL_TENANTS; i++) {
+        ival = bench_intervals[i % 5];
+        bench_tenants[i].data = (void *)(uintptr_t)ival;
+        SipWheelAdd(&bench_wheel, &bench_tenants[i],
+                bench_wheel.now + 1 + rand() % ival);
+        due_per_sec += 1.0 / ival;
+    }
+    for (i = 0; i < nbench; i++) {
+        if (benchmarks[i].run == SipBenchWheelTurn)
+            benchmarks[i].items = due_per_sec + 0.5;
+        if (benchmarks[i].run == SipBenchConcurrency)
+            benchmarks[i].items = bench_rows;
+    }
+
+    fprintf(out, "{\n  \"rows\": %"PRIu32",\n  \"clock\": \"%s\",\n"
+            "  \"benchmarks\": [\n", bench_rows, timer_use_tsc ? "tsc" :
+            "monotonic");
+
+    for (i = 0; i < nbench; i++) {
+        ns_per_op = SipBenchRun(&benchmarks[i], seconds, &ops);
+
+        fprintf(out, "    {\"name\": \"%s\", \"ops\": %"PRIu64", \"ns_per_op\":"
+                " %.2f, \"items_per_sec\": %.0f", benchmarks[i].name, ops,
+                ns_per_op, ns_per_op > 0.0 ?
+                benchmarks[i].items * 1e9 / ns_per_op : 0.0);
+
+        base = SipBenchBaselineGet(benchmarks[i].name);
+        if (base > 0.0 && ns_per_op > 0.0) {
+            change = (ns_per_op - base) * 100.0 / base;
+            fprintf(out, ", \"baseline_ns_per_op\": %.2f, \"change_pct\":"
+                    " %.1f", base, change);
+            if (max_regression > 0.0 && change > max_regression)
+                regressed = 1;
+        }
+        fprintf(out, "}%s\n", (i + 1 < nbench) ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+
+    PQclear(bench_result);
+    free(bench_tenants);
+    SipConfDeInit();
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,336 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   sipade-cdrgen.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Command line tool to generate synthetic CDRs with injected attacks, in to
+ * the CDR database by COPY or in to a CSV file. The attacks are written to
+ * a manifest, which tells when each of them has been running, e.g.
+ *
+ *   sipade-cdrgen -c sipade.yaml -s '2010-01-01 00:00:00' -d 28 \
+ *       -t Test,Uio -a premium:Test:30240:90 -f copy -m attacks.tsv
+ */
+
+#define _GNU_SOURCE     /* strptime */
+#include <getopt.h>
+#include "sipade.h"
+#include "util-cdrgen.h"
+#include "util-cdr.h"
+#include "util-conf.h"
+#include "util-log.h"
+#include "util-timer.h"
+
+#define CDRGEN_DEFAULT_DAYS     7
+#define CDRGEN_DEFAULT_RATE     600.0
+#define CDRGEN_DEFAULT_START    "2010-01-01 00:00:00"
+#define CDRGEN_BUF_SIZE         (256 * 1024)
+
+uint8_t run_mode;
+
+static void SipCdrGenUsage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c <config file>] [-s <start timestamp>]"
+            " [-d <days>]\n"
+            "\t[-t <tenant,...> | -T <number of tenants>] [-r <calls per hour"
+            " at the peak>]\n"
+            "\t[-a <kind:tenant:start:duration[:rate]>]... [-S <seed>]\n"
+            "\t[-f csv|copy|none] [-o <csv file>] [-m <attack manifest>]\n"
+            "attacks: premium, drip, wangiri, pbx; the start and the duration"
+            " are in minutes\n", prog);
+}
+
+/**
+ * \brief   Function to write the injected attacks to the manifest, one per
+ *          line with the kind, tenant, start, end and the rate.
+ */
+static int SipCdrGenManifest(SipCdrGen *gen, const char *file)
+{
+    SipCdrGenAttack *a = NULL;
+    struct tm tm;
+    char start[20];
+    char end[20];
+    FILE *fp = NULL;
+    uint8_t i = 0;
+
+    fp = fopen(file, "w");
+    if (fp == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in opening the"
+                " manifest %s", file);
+        return SIP_ERROR;
+    }
+
+    for (i = 0; i < gen->attack_cnt; i++) {
+        a = &gen->attacks[i];
+        localtime_r(&a->start, &tm);
+        strftime(start, sizeof(start), "%F %T", &tm);
+        localtime_r(&a->end, &tm);
+        strftime(end, sizeof(end), "%F %T", &tm);
+        fprintf(fp, "%s\t%s\t%s\t%s\t%.2f\n", sip_cdrgen_attacks[a->kind],
+                gen->tenants[a->tenant].name, start, end, a->rate);
+    }
+
+    fclose(fp);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to start the COPY in to the CDR table.
+ */
+static PGconn *SipCdrGenCopyStart()
+{
+    PGconn *conn = NULL;
+    PGresult *res = NULL;
+    char *table = NULL;
+    char query[256];
+
+    conn = SipInitCdr();
+    if (conn == NULL || PQstatus(conn) == CONNECTION_BAD)
+        return NULL;
+
+    if (SipConfGet("cdr-database.table", &table) != 1)
+        table = "cdr";
+
+    snprintf(query, sizeof(query), "copy %s (calldate,src,dst,billsec,"
+            "calltype,accountcode) from stdin", table);
+    res = PQexec(conn, query);
+    if (PQresultStatus(res) != PGRES_COPY_IN) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in starting the"
+                " copy \"%s\": %s", query, PQerrorMessage(conn));
+        PQclear(res);
+        PQfinish(conn);
+        return NULL;
+    }
+    PQclear(res);
+
+    return conn;
+}
+
+/**
+ * \brief   Function to end the COPY and to check its result.
+ */
+static int SipCdrGenCopyEnd(PGconn *conn, const char *error)
+{
+    PGresult *res = NULL;
+    int ret = SIP_OK;
+
+    if (PQputCopyEnd(conn, error) != 1)
+        ret = SIP_ERROR;
+
+    while ((res = PQgetResult(conn)) != NULL) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in copying the"
+                    " CDRs: %s", PQerrorMessage(conn));
+            ret = SIP_ERROR;
+        }
+        PQclear(res);
+    }
+
+    PQfinish(conn);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    SipCdrGen *gen = NULL;
+    SipCdr cdr;
+    struct tm tm;
+    time_t start = 0;
+    char *conf_filename = NULL;
+    char *start_s = CDRGEN_DEFAULT_START;
+    char *tenants = NULL;
+    char *format_s = "csv";
+    char *out_filename = NULL;
+    char *manifest = NULL;
+    char *attacks[SIP_CDRGEN_MAX_ATTACKS];
+    char *name = NULL;
+    char tname[SIP_CDRGEN_NAME_LEN];
+    char *buf = NULL;
+    double days = CDRGEN_DEFAULT_DAYS;
+    double rate = CDRGEN_DEFAULT_RATE;
+    double spread = 1.0;
+    double secs = 0.0;
+    uint64_t seed = 1;
+    uint64_t rows = 0;
+    uint64_t ticks = 0;
+    uint32_t ntenants = 0;
+    uint32_t i = 0;
+    int attack_cnt = 0;
+    int len = 0;
+    int opt = 0;
+    int ret = SIP_OK;
+    FILE *out = NULL;
+    PGconn *conn = NULL;
+
+    while ((opt = getopt(argc, argv, "c:s:d:t:T:r:a:S:f:o:m:h")) != -1) {
+        switch (opt) {
+            case 'c': conf_filename = optarg; break;
+            case 's': start_s = optarg; break;
+            case 'd': days = atof(optarg); break;
+            case 't': tenants = optarg; break;
+            case 'T': ntenants = strtoul(optarg, NULL, 10); break;
+            case 'r': rate = atof(optarg); break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            case 'f': format_s = optarg; break;
+            case 'o': out_filename = optarg; break;
+            case 'm': manifest = optarg; break;
+            case 'a':
+                if (attack_cnt < SIP_CDRGEN_MAX_ATTACKS)
+                    attacks[attack_cnt++] = optarg;
+                break;
+            default:
+                SipCdrGenUsage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (conf_filename != NULL && SipConfInit(conf_filename) != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    /* the generator only logs the errors, to keep stdout for the CSV */
+    log_level = SIP_LOG_ERROR;
+
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(start_s, "%F %H:%M:%S", &tm) == NULL) {
+        SipCdrGenUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    tm.tm_isdst = -1;
+    start = mktime(&tm);
+
+    gen = calloc(1, sizeof(SipCdrGen));
+    if (gen == NULL || SipCdrGenInit(gen, start, start + days * 86400,
+                seed) != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    /* The tenants are given by name, or numbered. Without either the
+     * institution of the config file is the only tenant */
+    if (tenants == NULL && ntenants == 0 &&
+            (conf_filename == NULL || SipConfGet("institution", &tenants) != 1))
+        tenants = "Test";
+
+    if (tenants != NULL) {
+        for (name = strtok(tenants, ","); name != NULL;
+                name = strtok(NULL, ","))
+        {
+            if (SipCdrGenAddTenant(gen, name, rate) != SIP_OK)
+                exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < ntenants; i++) {
+        snprintf(tname, sizeof(tname), "tenant%"PRIu32, i + 1);
+        if (SipCdrGenAddTenant(gen, tname, rate) != SIP_OK)
+            exit(EXIT_FAILURE);
+    }
+
+    /* tenants differ in size, between a quarter and twice the given rate */
+    if (gen->tenant_cnt > 1) {
+        for (i = 0; i < gen->tenant_cnt; i++) {
+            spread = 0.25 + 1.75 * ((seed * 2654435761ULL + i * 40503ULL)
+                    % 1000) / 1000.0;
+            gen->tenants[i].rate = rate * spread;
+        }
+    }
+
+    for (i = 0; i < attack_cnt; i++) {
+        if (SipCdrGenAddAttack(gen, attacks[i]) != SIP_OK)
+            exit(EXIT_FAILURE);
+    }
+
+    if (manifest != NULL && SipCdrGenManifest(gen, manifest) != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    buf = malloc(CDRGEN_BUF_SIZE);
+    if (buf == NULL)
+        exit(EXIT_FAILURE);
+
+    if (strcmp(format_s, "copy") == 0) {
+        if (conf_filename == NULL) {
+            fprintf(stderr, "The CDR database has to be given in the config"
+                    " file (-c) for the copy\n");
+            exit(EXIT_FAILURE);
+        }
+        conn = SipCdrGenCopyStart();
+        if (conn == NULL)
+            exit(EXIT_FAILURE);
+    } else if (strcmp(format_s, "csv") == 0) {
+        out = (out_filename != NULL) ? fopen(out_filename, "w") : stdout;
+        if (out == NULL) {
+            perror("sipade-cdrgen");
+            exit(EXIT_FAILURE);
+        }
+        fputs("id,calldate,src,dst,billsec,calltype,accountcode\n", out);
+    } else if (strcmp(format_s, "none") != 0) {
+        SipCdrGenUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    ticks = SipTimerTicks();
+    while ((ret = SipCdrGenNext(gen, &cdr)) == SIP_OK) {
+        rows++;
+        if (conn == NULL && out == NULL)
+            continue;
+
+        len += SipCdrGenFormat(gen, &cdr, buf + len, (conn != NULL) ?
+                SIP_CDRGEN_FORMAT_COPY : SIP_CDRGEN_FORMAT_CSV);
+        if (len < CDRGEN_BUF_SIZE - SIP_CDRGEN_LINE_LEN)
+            continue;
+
+        if (conn != NULL) {
+            if (PQputCopyData(conn, buf, len) != 1) {
+                ret = SIP_ERROR;
+                break;
+            }
+        } else if (fwrite(buf, 1, len, out) != len) {
+            ret = SIP_ERROR;
+            break;
+        }
+        len = 0;
+    }
+
+    if (ret == SIP_DONE && len > 0) {
+        if (conn != NULL) {
+            if (PQputCopyData(conn, buf, len) != 1)
+                ret = SIP_ERROR;
+        } else if (fwrite(buf, 1, len, out) != len) {
+            ret = SIP_ERROR;
+        }
+    }
+
+    if (conn != NULL) {
+        if (SipCdrGenCopyEnd(conn, (ret == SIP_DONE) ? NULL :
+                    "generation failed") != SIP_OK)
+            ret = SIP_ERROR;
+    }
+    if (out != NULL && fclose(out) != 0)
+        ret = SIP_ERROR;
+
+    secs = SipTimerNs(SipTimerTicks() - ticks) / 1e9;
+    fprintf(stderr, "%"PRIu64" CDRs of %u tenants in %.2f s, %.0f CDRs/sec\n",
+            rows, gen->tenant_cnt, secs, secs > 0 ? rows / secs : 0.0);
+
+    SipCdrGenDeInit(gen);
+    free(gen);
+    free(buf);
+    if (conf_filename != NULL)
+        SipConfDeInit();
+
+    return (ret == SIP_DONE) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
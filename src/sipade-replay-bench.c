@@ -0,0 +1,489 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   sipade-replay-bench.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * End to end benchmark of the engine, run with "make bench-replay". It runs
+ * the training and the detection in offline mode over a generated dataset
+ * with injected attacks, from memory or from the CDR database, and reports
+ * the throughput, the peak memory, the database round trips and the delay in
+ * which each attack has been detected. The range and the parameters of the
+ * detection are taken from the config file (initial-timestamp, ending-date,
+ * training-period, institution, ad-algo), the start of the attacks is in
+ * minutes from the start of the dataset. The range is replayed in one pass,
+ * or interval by interval with "replay.mode: interval". The thresholds and
+ * alerts are counted, not written.
+ *
+ *   ./sipade-replay-bench -c sipade.yaml -a premium:Test:14400:60 \
+ *       -a pbx:Test:20000:120
+ *   ./sipade-replay-bench -c sipade.yaml -D -m attacks.tsv
+ */
+
+#define _GNU_SOURCE     /* strptime */
+#include <getopt.h>
+#include <sys/resource.h>
+#include "sipade.h"
+#include "util-detection.h"
+#include "util-cdrgen.h"
+#include "util-cdr.h"
+#include "util-conf.h"
+#include "util-log.h"
+#include "util-metrics.h"
+#include "util-timer.h"
+
+#define REPLAY_DEFAULT_RATE     600.0
+#define REPLAY_DEFAULT_DAYS     28
+
+uint8_t run_mode = SIP_RUN_MODE_OFFLINE;
+
+static time_t *alerts = NULL;
+static uint64_t alert_cnt = 0;
+static uint64_t alert_size = 0;
+
+static void SipReplayUsage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s -c <config file> [-D] [-m <attack manifest>]"
+            "\n\t[-a <kind:tenant:start:duration[:rate]>]... [-T <extra"
+            " tenants>]\n\t[-r <calls per hour at the peak>] [-S <seed>]"
+            " [-o <output file>]\n", prog);
+}
+
+/**
+ * \brief   Function to convert a timestamp of the config file or of the
+ *          engine in to the time, the same way as the engine does.
+ */
+static time_t SipReplayTime(const char *ts)
+{
+    struct tm tm = {0,0,0,0,0,0,0,0,0};
+
+    if (strptime(ts, "%F %H:%M:%S", &tm) == NULL)
+        return (time_t)-1;
+    return mktime(&tm);
+}
+
+static void SipReplayFormatTime(time_t t, char *buf)
+{
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    strftime(buf, 20, "%F %T", &tm);
+}
+
+/**
+ * \brief   Function to load the attacks of the manifest written by
+ *          sipade-cdrgen, when the dataset is in the CDR database.
+ */
+static int SipReplayLoadManifest(SipCdrGen *gen, const char *file)
+{
+    SipCdrGenAttack *a = NULL;
+    FILE *fp = NULL;
+    char line[256];
+    char kind[16];
+    char tenant[SIP_CDRGEN_NAME_LEN];
+    char start[20];
+    char end[20];
+    double rate = 0.0;
+    uint8_t i = 0;
+
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in opening the"
+                " manifest %s", file);
+        return SIP_ERROR;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL &&
+            gen->attack_cnt < SIP_CDRGEN_MAX_ATTACKS)
+    {
+        if (sscanf(line, "%15[^\t]\t%31[^\t]\t%19[^\t]\t%19[^\t]\t%lf", kind,
+                    tenant, start, end, &rate) != 5)
+            continue;
+
+        for (i = 0; i < SIP_CDRGEN_ATTACK_MAX; i++) {
+            if (strcmp(kind, sip_cdrgen_attacks[i]) == 0)
+                break;
+        }
+        if (i == SIP_CDRGEN_ATTACK_MAX)
+            continue;
+
+        /* the tenants of the manifest are only used for the names */
+        if (SipCdrGenAddTenant(gen, tenant, 0.0) != SIP_OK)
+            break;
+
+        a = &gen->attacks[gen->attack_cnt++];
+        a->kind = i;
+        a->tenant = gen->tenant_cnt - 1;
+        a->start = SipReplayTime(start);
+        a->end = SipReplayTime(end);
+        a->rate = rate;
+    }
+
+    fclose(fp);
+    return SIP_OK;
+}
+
+static int SipReplayAddAlert(time_t t)
+{
+    time_t *tmp = NULL;
+
+    if (alert_cnt == alert_size) {
+        alert_size = alert_size ? 2 * alert_size : 256;
+        tmp = realloc(alerts, alert_size * sizeof(time_t));
+        if (tmp == NULL)
+            return SIP_ERROR;
+        alerts = tmp;
+    }
+
+    alerts[alert_cnt++] = t;
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to write the detection delay of each attack, and to count
+ *          the alerts which do not belong to any attack.
+ *
+ * @param origin    start of the first detection interval
+ * @param iv        length of the interval in seconds
+ *
+ * @return  number of the false alerts
+ */
+static uint64_t SipReplayAttacks(FILE *out, SipCdrGen *gen, const char *inst,
+        time_t origin, time_t iv)
+{
+    SipCdrGenAttack *a = NULL;
+    uint64_t false_alerts = 0;
+    uint64_t i = 0;
+    char start[20];
+    uint8_t *matched = NULL;
+    uint8_t n = 0;
+    int found = 0;
+
+    matched = calloc(alert_cnt + 1, 1);
+    if (matched == NULL)
+        return 0;
+
+    fprintf(out, "  \"attacks\": [");
+    for (n = 0; n < gen->attack_cnt; n++) {
+        a = &gen->attacks[n];
+        SipReplayFormatTime(a->start, start);
+        fprintf(out, "%s\n    {\"kind\": \"%s\", \"tenant\": \"%s\","
+                " \"start\": \"%s\", \"minutes\": %ld", n ? "," : "",
+                sip_cdrgen_attacks[a->kind], gen->tenants[a->tenant].name,
+                start, (long)(a->end - a->start) / 60);
+
+        if (strcmp(gen->tenants[a->tenant].name, inst) != 0) {
+            fprintf(out, ", \"detected\": null}");
+            continue;
+        }
+        if (a->start < origin) {
+            fprintf(out, ", \"detected\": null, \"note\": \"during the"
+                    " training\"}");
+            continue;
+        }
+
+        /* the alerted intervals, which overlap with the attack */
+        found = 0;
+        for (i = 0; i < alert_cnt; i++) {
+            if (alerts[i] > a->end || alerts[i] + iv < a->start)
+                continue;
+            if (!found) {
+                fprintf(out, ", \"detected\": true, \"delay_intervals\": %ld,"
+                        " \"delay_minutes\": %.1f", (long)((alerts[i] -
+                        origin) / iv - (a->start - origin) / iv),
+                        (alerts[i] + iv - a->start) / 60.0);
+                found = 1;
+            }
+            matched[i] = 1;
+        }
+        fprintf(out, "%s}", found ? "" : ", \"detected\": false");
+    }
+    fprintf(out, "\n  ],\n");
+
+    for (i = 0; i < alert_cnt; i++) {
+        if (!matched[i])
+            false_alerts++;
+    }
+
+    free(matched);
+    return false_alerts;
+}
+
+/**
+ * \brief   Function to count the intervals of the batch replay.
+ */
+static void SipReplayBenchNotify(int alert, PGresult **result)
+{
+    if (alert == TRUE &&
+            SipReplayAddAlert(SipReplayTime(SipGetTimeStamp())) != SIP_OK)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    SipCdrGen *gen = NULL;
+    SipCdrMemSource src;
+    PGconn *conn = NULL;
+    PGresult *result = NULL;
+    struct rusage usage;
+    char *conf_filename = NULL;
+    char *out_filename = NULL;
+    char *manifest = NULL;
+    char *attacks[SIP_CDRGEN_MAX_ATTACKS];
+    char *inst = NULL;
+    char *value = NULL;
+    char tname[SIP_CDRGEN_NAME_LEN];
+    double rate = REPLAY_DEFAULT_RATE;
+    double secs = 0.0;
+    double gen_secs = 0.0;
+    uint64_t seed = 1;
+    uint64_t train_period = 0;
+    uint64_t sleep_t = 0;
+    uint64_t train_intervals = 0;
+    uint64_t detect_intervals = 0;
+    uint64_t false_alerts = 0;
+    uint64_t cdrs = 0;
+    uint64_t cdr_queries = 0;
+    uint64_t threshold_writes = 0;
+    SipReplayStats stats;
+    uint64_t ticks = 0;
+    uint32_t interval = 10;
+    uint32_t extra = 0;
+    uint32_t i = 0;
+    time_t start = 0;
+    time_t end = 0;
+    time_t origin = 0;
+    int use_db = 0;
+    int batch = 0;
+    int attack_cnt = 0;
+    int opt = 0;
+    int ret = 0;
+    FILE *out = stdout;
+
+    while ((opt = getopt(argc, argv, "c:Dm:a:T:r:S:o:h")) != -1) {
+        switch (opt) {
+            case 'c': conf_filename = optarg; break;
+            case 'D': use_db = 1; break;
+            case 'm': manifest = optarg; break;
+            case 'T': extra = strtoul(optarg, NULL, 10); break;
+            case 'r': rate = atof(optarg); break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            case 'o': out_filename = optarg; break;
+            case 'a':
+                if (attack_cnt < SIP_CDRGEN_MAX_ATTACKS)
+                    attacks[attack_cnt++] = optarg;
+                break;
+            default:
+                SipReplayUsage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (conf_filename == NULL) {
+        SipReplayUsage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (SipConfInit(conf_filename) != SIP_OK)
+        exit(EXIT_FAILURE);
+    log_level = SIP_LOG_ERROR;
+    SipTimerInit();
+
+    if (SipAnomalyInitConfValues() != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    SipConfGet("institution", &inst);
+    if (SipConfGet("training-period", &value) == 1)
+        train_period = strtoul(value, NULL, 10);
+    if (SipConfGet("ad-algo.interval", &value) == 1)
+        interval = strtoul(value, NULL, 10);
+    if (SipConfGet("ending-date", &value) != 1 ||
+            (end = SipReplayTime(value)) == (time_t)-1)
+    {
+        fprintf(stderr, "The ending-date has to be given in the config"
+                " file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Without an initial-timestamp the engine starts at the first CDR, then
+     * the dataset covers the training and four weeks of detection */
+    if (SipConfGet("initial-timestamp", &value) != 1 ||
+            (start = SipReplayTime(value)) == (time_t)-1)
+    {
+        start = end - train_period * 60 - REPLAY_DEFAULT_DAYS * 86400;
+        start -= start % 86400;
+    }
+
+    /* the generator keeps the tenant names and the attacks in both modes */
+    gen = calloc(1, sizeof(SipCdrGen));
+    if (gen == NULL || SipCdrGenInit(gen, start,
+                end + 2 * interval * 60, seed) != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    if (use_db) {
+        if (manifest != NULL && SipReplayLoadManifest(gen, manifest) != SIP_OK)
+            exit(EXIT_FAILURE);
+
+        conn = SipInitCdr();
+        if (conn == NULL || PQstatus(conn) == CONNECTION_BAD)
+            exit(EXIT_FAILURE);
+    } else {
+        if (SipCdrGenAddTenant(gen, inst, rate) != SIP_OK)
+            exit(EXIT_FAILURE);
+        for (i = 0; i < extra; i++) {
+            snprintf(tname, sizeof(tname), "tenant%"PRIu32, i + 1);
+            if (SipCdrGenAddTenant(gen, tname, rate) != SIP_OK)
+                exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < attack_cnt; i++) {
+            if (SipCdrGenAddAttack(gen, attacks[i]) != SIP_OK)
+                exit(EXIT_FAILURE);
+        }
+
+        ticks = SipTimerTicks();
+        if (SipCdrMemSourceFill(&src, gen) != SIP_OK)
+            exit(EXIT_FAILURE);
+        gen_secs = SipTimerNs(SipTimerTicks() - ticks) / 1e9;
+        SipDetectionSetMemSource(&src);
+    }
+
+    if (out_filename != NULL) {
+        out = fopen(out_filename, "w");
+        if (out == NULL) {
+            perror("sipade-replay-bench");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (SipConfGet("replay.mode", &value) != 1 ||
+            strncmp(value, "interval", 8) != 0)
+    {
+        batch = 1;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    ticks = SipTimerTicks();
+
+    /* The training, the same way as in main() */
+    if (SipTrainingInitThreshold(conn) != SIP_OK)
+        exit(EXIT_FAILURE);
+
+    for (sleep_t = interval; sleep_t < train_period; sleep_t += interval) {
+        if (!batch && SipTrainingAnomalyDetection(conn) == SIP_ERROR)
+            exit(EXIT_FAILURE);
+        train_intervals++;
+    }
+    if (batch && SipTrainingAnomalyReplay(conn, train_intervals,
+                &stats) != SIP_OK)
+    {
+        exit(EXIT_FAILURE);
+    }
+    origin = SipReplayTime(SipGetTimeStamp()) + interval * 60;
+
+    /* The detection, until the ending-date */
+    if (batch) {
+        if (SipAnomalyReplay(conn, SipReplayBenchNotify, &stats) != SIP_DONE)
+            exit(EXIT_FAILURE);
+        detect_intervals = stats.intervals - train_intervals;
+    }
+
+    while (!batch && (ret = SipAnomalyDetection(conn, &result)) != SIP_DONE) {
+        if (ret == SIP_ERROR)
+            exit(EXIT_FAILURE);
+
+        detect_intervals++;
+        if (ret == TRUE) {
+            if (SipReplayAddAlert(SipReplayTime(SipGetTimeStamp())) != SIP_OK)
+                exit(EXIT_FAILURE);
+        } else if (ret == FALSE) {
+            /* main() stores the threshold of a normal interval, the idle
+             * intervals leave it as it is */
+            threshold_writes++;
+        }
+
+        PQclear(result);
+        result = NULL;
+    }
+    if (result != NULL)
+        PQclear(result);
+
+    secs = SipTimerNs(SipTimerTicks() - ticks) / 1e9;
+    getrusage(RUSAGE_SELF, &usage);
+    cdrs = SipTimerItems(SIP_TIMER_CALL_DATA);
+
+    fprintf(out, "{\n  \"source\": \"%s\",\n  \"mode\": \"%s\",\n"
+            "  \"institution\": \"%s\",\n  \"interval_minutes\": %"PRIu32
+            ",\n", use_db ? "database" : "memory", batch ? "batch" :
+            "interval", inst, interval);
+    if (!use_db) {
+        fprintf(out, "  \"generated_cdrs\": %"PRIu64",\n  \"generate_seconds\":"
+                " %.3f,\n", src.cnt, gen_secs);
+    }
+    fprintf(out, "  \"cdrs\": %"PRIu64",\n  \"training_intervals\": %"PRIu64
+            ",\n  \"detection_intervals\": %"PRIu64",\n  \"seconds\": %.3f,\n"
+            "  \"cdrs_per_sec\": %.0f,\n  \"intervals_per_sec\": %.1f,\n"
+            "  \"peak_rss_kb\": %ld,\n", cdrs, train_intervals,
+            detect_intervals, secs, secs > 0 ? cdrs / secs : 0.0,
+            secs > 0 ? (train_intervals + detect_intervals) / secs : 0.0,
+            usage.ru_maxrss);
+
+    /* The round trips the engine makes. The statements on the CDR database
+     * are counted as they are issued, with the probes, the concurrent calls
+     * and the retries. From memory, the queries answered by the in memory
+     * source stand in for them, with the statements the cursor of the batch
+     * replay would take. The thresholds are written after the training and
+     * after every normal interval or per checkpoint, and an alert log per
+     * alert */
+    if (use_db) {
+        cdr_queries = SipMetricsQueries(SIP_METRIC_STMT_INIT) +
+            SipMetricsQueries(SIP_METRIC_STMT_INTERVAL) +
+            SipMetricsQueries(SIP_METRIC_STMT_PROBE) +
+            SipMetricsQueries(SIP_METRIC_STMT_CONCURRENCY);
+    } else {
+        cdr_queries = src.queries + (batch ? stats.cdr_queries : 0);
+    }
+    if (batch)
+        threshold_writes = stats.threshold_writes;
+    threshold_writes++;
+    fprintf(out, "  \"db_round_trips\": {\"cdr_queries\": %"PRIu64", "
+            "\"threshold_writes\": %"PRIu64", \"alert_writes\": %"PRIu64", "
+            "\"total\": %"PRIu64"},\n", cdr_queries, threshold_writes,
+            alert_cnt, cdr_queries + threshold_writes + alert_cnt);
+
+    false_alerts = SipReplayAttacks(out, gen, inst, origin, interval * 60);
+    fprintf(out, "  \"alerts\": %"PRIu64",\n  \"false_alerts\": %"PRIu64"\n"
+            "}\n", alert_cnt, false_alerts);
+
+    if (out != stdout)
+        fclose(out);
+    if (conn != NULL)
+        PQfinish(conn);
+    if (!use_db)
+        SipCdrMemSourceFree(&src);
+    SipCdrGenDeInit(gen);
+    free(gen);
+    free(alerts);
+    SipDeinitAnomalyDetection();
+    SipConfDeInit();
+
+    return EXIT_SUCCESS;
+}
@@ -33,16 +33,43 @@
 #include "util-detection.h"
 #include "util-alert.h"
 #include "util-conf.h"
+#include "util-ingest.h"
 #include "util-log.h"
+#include "util-metrics.h"
+#include "util-reactor.h"
+#include "util-timer.h"
+#include "util-wheel.h"
+#include "util-db.h"
 
 
 /********* Global Variables **********/
-static PGconn *conn = NULL;    /* Pointer to connect to the CDR databse */
 static PGresult *result = NULL;
 static uint64_t train_period = 0;
 static uint32_t interval = 0;
+static char replay_batch = FALSE;
+static int tick_fd = -1;        /* timer of the wheel */
+static SipCdrQuery query;       /* query of the interval in flight */
+static int query_fd = -1;       /* its socket, -1 if none is in flight */
+static int deadline_fd = -1;    /* timer of its deadline */
+static uint8_t catchup_timedout = FALSE;   /* the backlog is fetched interval
+                                              by interval */
 uint8_t run_mode;
 
+/**
+ * Detection schedule of a tenant, queued in the timing wheel until its next
+ * interval is due.
+ */
+typedef struct SipSchedule_ {
+    SipWheelEntry entry;
+    char *tenant;
+    time_t deadline;    /* when the following interval is due */
+    uint8_t behind;     /* the last run has started after its deadline */
+} SipSchedule;
+
+static SipWheel wheel;
+static SipSchedule schedule;
+static uint32_t held_signals = 0;   /* taken while the replay threads run */
+
 
 /**
  * \brief   Function to be called, when engine has recieved the Quit, Terminate
@@ -53,12 +80,17 @@ void SipDone()
 {
     SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Shuting down the "
             "engine....");
-    PQfinish(conn);
+    SipIngestDeInit();
+    SipReactorDeInit();
     if (result != NULL) PQclear(result);
-    SipConfDeInit();
-    SipDeinitAnomalyDetection();
     SipAlertDeInitCtx();
+    SipDeinitAnomalyDetection();
+    SipDbDeInit();
+    SipMetricsDeInit();
+    SipTimerDeInit();
+    SipConfDeInit();
     SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Engine down, Bye !!");
+    SipDeInitLog();
     exit(EXIT_SUCCESS);
 }
 
@@ -67,18 +99,18 @@ void SipDone()
  */
 void SipInitConf()
 {
-    char *tr_period = NULL;
-    char *interval_s = NULL;
     char *run_mode_s = NULL;
+    char *replay_s = NULL;
+    int64_t val = 0;
 
-    if (SipConfGet("training-period", &tr_period) == 1) {
-        train_period = strtoul(tr_period, NULL, 10);
+    if (SipConfGetInt("training-period", &val) == 1 && val >= 0) {
+        train_period = val;
     } else {
         train_period = 10080;
     }
 
-    if (SipConfGet("ad-algo.interval", &interval_s) == 1) {
-        interval = strtoul(interval_s, NULL, 10);
+    if (SipConfGetInt("ad-algo.interval", &val) == 1 && val > 0) {
+        interval = val;
     } else {
         interval = 10;
     }
@@ -92,7 +124,493 @@ void SipInitConf()
     } else {
         run_mode = SIP_RUN_MODE_OFFLINE;
     }
+
+    /* In offline mode the whole range is replayed in one pass, unless the
+     * interval by interval detection has been asked for */
+    if (run_mode & SIP_RUN_MODE_OFFLINE) {
+        if (SipConfGet("replay.mode", &replay_s) != 1 ||
+                strncmp(replay_s, "interval", 8) != 0)
+        {
+            replay_batch = TRUE;
+        }
+    }
+}
+
+/**
+ * \brief   Function to handle the signals taken by the event loop. The config
+ *          file is applied between two intervals, so that each interval is
+ *          scored with one configuration.
+ */
+static void SipSignal(int sig)
+{
+    /* The engine is not reconfigured or shut down under the threads of a
+     * replay, the signal is held until they are joined. A shutdown stops
+     * them first */
+    if (sig != SIGUSR1 && SipAnomalyReplayBusy() == TRUE) {
+        if (sig != SIGHUP)
+            SipAnomalyReplayCancel();
+        held_signals |= 1U << sig;
+        return;
+    }
+
+    switch (sig) {
+        case SIGHUP:
+            if (SipConfReload() != SIP_OK)
+                break;
+            SipInitLog();
+            SipAnomalyReloadConf();
+            SipAlertReloadConf();
+            break;
+        case SIGUSR1:
+            SipTimerDump();
+            break;
+        default:
+            SipDone();
+    }
+}
+
+/**
+ * \brief   Function to handle the signals, which have been held during the
+ *          replay.
+ */
+static void SipSignalHeld()
+{
+    uint32_t held = held_signals;
+    int sig = 0;
+
+    held_signals = 0;
+    for (sig = 1; sig < 32; sig++) {
+        if (held & (1U << sig))
+            SipSignal(sig);
+    }
+}
+
+/**
+ * \brief   Function to notify the status of an interval of the batch replay.
+ */
+static void SipReplayNotify(int alert, PGresult **result)
+{
+    uint64_t start = SipTimerTicks();
+    uint64_t ns = 0;
+
+    SipSignalHeld();
+
+    SipAlertNotification(alert == TRUE ? SIP_STATUS_ALERT : SIP_STATUS_OK,
+            result);
+    ns = SipTimerRecord(SIP_TIMER_ALERT, start);
+    SipMetricsObserveStage(SIP_METRIC_STAGE_ALERT, ns / 1e9);
+}
+
+/**
+ * \brief   Function to run the detection over the whole offline range in one
+ *          pass, after which the engine is shut down.
+ */
+static void SipReplay()
+{
+    SipReplayStats stats;
+    int ret = 0;
+
+    memset(&stats, 0, sizeof(stats));
+    ret = SipAnomalyReplay(SipDbGet(SIP_DB_CDR), SipReplayNotify, &stats);
+    SipSignalHeld();
+    if (ret == SIP_ERROR) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in replaying the"
+                " CDR records");
+        SipDone();
+    }
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Replayed %"PRIu64" intervals"
+            " with %"PRIu64" calls, %"PRIu64" alerts, %"PRIu64" CDR database"
+            " statements and %"PRIu64" threshold writes", stats.intervals,
+            stats.cdrs, stats.alerts, stats.cdr_queries,
+            stats.threshold_writes);
+    SipDone();
+}
+
+/**
+ * \brief   Function to set the timer to the next turn of the timing wheel.
+ */
+static void SipScheduleArm()
+{
+    time_t next = SipWheelNext(&wheel);
+
+    if (next >= 0 && SipReactorTimerAt(tick_fd, next) != SIP_OK)
+        SipDone();
+}
+
+/**
+ * \brief   Function to queue the tenant until its next interval can be scored.
+ *          That is the end of the interval on the wall clock, put off by the
+ *          replica-delay while the CDRs are read from a replica, or right
+ *          away for the intervals in the past and in offline mode.
+ */
+static void SipDetectionSchedule()
+{
+    time_t span = SipAnomalyIntervalEnd() - SipAnomalyIntervalFrom();
+    time_t due = 0;
+
+    if (run_mode & SIP_RUN_MODE_ONLINE) {
+        due = SipAnomalyIntervalEnd();
+        if (SipIngestEnabled()) {
+            /* the calls of the next interval are checked as they arrive */
+            SipIngestWindow(due - span, due);
+            due = SipIngestReadyAt(due);
+        }
+        /* the calls of the interval are read from a replica, once it has
+         * replayed them */
+        due += SipDbReplicaDelay(SIP_DB_CDR);
+    }
+
+    schedule.deadline = due + span;
+    SipWheelAdd(&wheel, &schedule.entry, due);
+    SipScheduleArm();
+}
+
+/**
+ * \brief   Function to score the fetched interval, to notify its status and to
+ *          schedule the next interval.
+ */
+static void SipDetectionScore(PGresult *cdrs)
+{
+    uint64_t start = 0;
+    uint64_t ns = 0;
+    int ret = 0;
+
+    result = cdrs;
+    ret = SipAnomalyDetectionScore(result);
+    start = SipTimerTicks();
+    if (ret == SIP_ERROR || ret == SIP_DONE) {
+        SipDone();
+    } else if (ret == TRUE) {
+        SipAlertNotification(SIP_STATUS_ALERT, &result);
+        ns = SipTimerRecord(SIP_TIMER_ALERT, start);
+        SipMetricsObserveStage(SIP_METRIC_STAGE_ALERT, ns / 1e9);
+    } else {
+        SipAlertNotification(SIP_STATUS_OK, &result);
+        ns = SipTimerRecord(SIP_TIMER_ALERT, start);
+        SipMetricsObserveStage(SIP_METRIC_STAGE_ALERT, ns / 1e9);
+    }
+
+    /* Store the recent threshold and timestamp value in to the database,
+     * the idle intervals leave it as it is */
+    if (ret == FALSE) {
+        start = SipTimerTicks();
+        if (SipAnomalyStoreThreshold() == SIP_ERROR)
+            SipDone();
+        ns = SipTimerRecord(SIP_TIMER_STORE_THRESHOLD, start);
+        SipMetricsObserveStage(SIP_METRIC_STAGE_PERSIST, ns / 1e9);
+    }
+
+    PQclear(result);
+    result = NULL;
+
+    SipDetectionSchedule();
+}
+
+/**
+ * \brief   Function to queue the tenant again, after the CDRs of its interval
+ *          could not be fetched, as the CDR database is down. The interval is
+ *          fetched again, when the database is to be connected next.
+ */
+static void SipDetectionRetry()
+{
+    time_t due = SipDbRetryAt(SIP_DB_CDR);
+    time_t now = time(NULL);
+
+    if (query.result != NULL) {
+        PQclear(query.result);
+        query.result = NULL;
+    }
+
+    SipWheelAdd(&wheel, &schedule.entry, (due > now) ? due : now);
+    SipScheduleArm();
 }
+
+static void SipDetectionRead(int, uint32_t, void *);
+
+/**
+ * \brief   Function to wait for the result of the interval query, which has
+ *          been sent, in the event loop. It is cancelled at its deadline.
+ *
+ * @param ret   SIP_PENDING if the rest of the query has to be flushed
+ */
+static void SipDetectionWait(PGconn *conn, int ret)
+{
+    query_fd = PQsocket(conn);
+    if (SipReactorAdd(query_fd, EPOLLIN | (ret == SIP_PENDING ? EPOLLOUT : 0),
+                SipDetectionRead, NULL) != SIP_OK)
+    {
+        SipDone();
+    }
+
+    if (query.deadline > 0 &&
+            SipReactorTimerAt(deadline_fd, query.deadline) != SIP_OK)
+    {
+        SipDone();
+    }
+}
+
+/**
+ * \brief   Function to handle the interval query, which has failed. The query,
+ *          which has not returned in time, is handled by the on-timeout
+ *          policy. The one which has failed, as the CDR database is down, is
+ *          retried once it is back. Any other failure is fatal.
+ */
+static void SipDetectionFailed()
+{
+    PGconn *conn = NULL;
+    PGresult *cdrs = NULL;
+    int down = FALSE;
+    int ret = SIP_ERROR;
+
+    if (query_fd >= 0) {
+        SipReactorDel(query_fd);
+        query_fd = -1;
+    }
+
+    if (query.result != NULL) {
+        PQclear(query.result);
+        query.result = NULL;
+    }
+
+    down = SipDbFailed(SIP_DB_CDR);
+    if (query.timedout) {
+        conn = SipDbGet(SIP_DB_CDR);
+        ret = SipAnomalyDetectionTimeout(conn, &query, &cdrs);
+        if (ret == SIP_PENDING) {
+            SipDetectionWait(conn, ret);
+            return;
+        } else if (ret == SIP_OK && cdrs != NULL) {
+            SipDetectionScore(cdrs);
+            return;
+        } else if (ret == SIP_OK) {
+            SipDetectionSchedule();
+            return;
+        } else if (ret == SIP_DONE) {
+            SipDone();
+        }
+        down = SipDbFailed(SIP_DB_CDR);
+    }
+
+    if (down == FALSE)
+        SipDone();
+    SipDetectionRetry();
+}
+
+/**
+ * \brief   Function called by the deadline timer of the interval query. The
+ *          query is cancelled, if it has not returned yet, and the connection
+ *          is given up, if the cancel has not been answered either.
+ */
+static void SipDetectionDeadline(int fd, uint32_t events, void *data)
+{
+    if (query_fd < 0 || query.deadline == 0)
+        return;
+
+    if (time(NULL) < query.deadline) {
+        if (SipReactorTimerAt(fd, query.deadline) != SIP_OK)
+            SipDone();
+        return;
+    }
+
+    if (SipCdrQueryCancel(&query) == SIP_ERROR) {
+        SipDetectionFailed();
+        return;
+    }
+
+    /* the error of the cancelled query is read by SipDetectionRead() */
+    if (SipReactorTimerAt(fd, query.deadline) != SIP_OK)
+        SipDone();
+}
+
+/**
+ * \brief   Function called, when the socket of the CDR database is ready. The
+ *          rest of the interval query is sent and its result is read, as the
+ *          socket allows.
+ */
+static void SipDetectionRead(int fd, uint32_t events, void *data)
+{
+    PGresult *cdrs = NULL;
+    int ret = SIP_OK;
+
+    if (events & EPOLLOUT) {
+        ret = SipCdrQueryFlush(&query);
+        if (ret == SIP_OK)
+            ret = SipReactorMod(fd, EPOLLIN);
+    }
+
+    if (ret != SIP_ERROR && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+        ret = SipCdrQueryResult(&query, &cdrs);
+        if (ret == SIP_OK) {
+            SipReactorDel(fd);
+            query_fd = -1;
+
+            /* the probe of an idle institution is followed by the interval
+             * query, unless the interval is skipped */
+            ret = SipAnomalyDetectionResult(&query, &cdrs);
+            if (ret != SIP_ERROR && cdrs != NULL)
+                SipDetectionScore(cdrs);
+            else if (ret != SIP_ERROR)
+                SipDetectionWait(query.conn, ret);
+        }
+    }
+
+    if (ret == SIP_ERROR)
+        SipDetectionFailed();
+}
+
+/**
+ * \brief   Function to fetch the CDRs of the next interval. The query of the
+ *          CDR database is answered by SipDetectionRead(), while the event
+ *          loop goes on.
+ */
+static void SipDetectionFetch()
+{
+    PGconn *conn = SipDbGet(SIP_DB_CDR);
+    PGresult *cdrs = NULL;
+    int ret = SIP_OK;
+
+    /* pass the connection pointer to the anomaly detection function to
+     * detect the anomalies by fetching the required data from CDR
+     * database */
+    ret = SipAnomalyDetectionFetch(conn, &query, &cdrs);
+    if (ret == SIP_ERROR) {
+        SipDetectionFailed();
+        return;
+    }
+
+    if (cdrs != NULL) {
+        SipDetectionScore(cdrs);
+        return;
+    }
+
+    SipDetectionWait(conn, ret);
+}
+
+/**
+ * \brief   Function to replay the intervals, which have ended while the engine
+ *          was down, at batch speed in online mode. The calls are fetched in
+ *          bulk and the thresholds are written at the checkpoints, instead of
+ *          a query and a threshold write per interval.
+ *
+ * @return  TRUE if the backlog has been replayed, FALSE if it is too short to
+ *          be caught up in a batch, or its batch has timed out, and
+ *          SIP_PENDING if it is retried, as the CDR database is down
+ */
+static int SipDetectionCatchUp(time_t now)
+{
+    SipReplayStats stats;
+    uint64_t timeouts = SipCdrTimeouts();
+    uint64_t start = 0;
+    uint64_t cnt = 0;
+    int ret = 0;
+
+    if (!(run_mode & SIP_RUN_MODE_ONLINE))
+        return FALSE;
+
+    cnt = SipAnomalyCatchUpIntervals(now - SipDbReplicaDelay(SIP_DB_CDR));
+    if (cnt == 0)
+        catchup_timedout = FALSE;
+    if (cnt == 0 || catchup_timedout)
+        return FALSE;
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Catching up %"PRIu64" intervals"
+            " of %s", cnt, schedule.tenant);
+    SipMetricsSetCatchUp(schedule.tenant, 1);
+
+    memset(&stats, 0, sizeof(stats));
+    start = SipTimerTicks();
+    ret = SipAnomalyCatchUp(SipDbGet(SIP_DB_CDR), cnt, SipReplayNotify,
+            &stats);
+    SipSignalHeld();
+    if (ret != SIP_OK) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in catching up the"
+                " CDR records");
+        SipMetricsSetCatchUp(schedule.tenant, 0);
+        if (SipCdrTimeouts() != timeouts) {
+            /* the intervals of the backlog are fetched one by one, under
+             * the on-timeout policy */
+            SipDbFailed(SIP_DB_CDR);
+            catchup_timedout = TRUE;
+            return FALSE;
+        }
+        if (SipDbFailed(SIP_DB_CDR) == FALSE)
+            SipDone();
+        SipDetectionRetry();
+        return SIP_PENDING;
+    }
+
+    SipMetricsSetCatchUp(schedule.tenant, 0);
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Caught up %"PRIu64" intervals"
+            " with %"PRIu64" calls and %"PRIu64" alerts in %.1f s",
+            stats.intervals, stats.cdrs, stats.alerts,
+            SipTimerNs(SipTimerTicks() - start) / 1e9);
+    return TRUE;
+}
+
+/**
+ * \brief   Function to report the tenant, whose run starts after its deadline,
+ *          i.e. when its following interval is already due. It is logged when
+ *          it falls behind and when it has caught up again.
+ */
+static void SipScheduleCheck(SipSchedule *s, time_t now)
+{
+    if (!(run_mode & SIP_RUN_MODE_ONLINE))
+        return;
+
+    if (now > s->deadline) {
+        SipMetricsIncLate(s->tenant);
+        if (!s->behind) {
+            SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Detection of %s is"
+                    " behind its schedule by %ld seconds", s->tenant,
+                    (long)(now - s->deadline));
+        }
+        s->behind = 1;
+    } else if (s->behind) {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Detection of %s is back on"
+                " its schedule", s->tenant);
+        s->behind = 0;
+    }
+}
+
+/**
+ * \brief   Function called by the timer, to expire the due tenants from the
+ *          timing wheel. The tenants due in the same second are taken as one
+ *          batch and fetched with one query. The engine monitors the one
+ *          institution of the config file, so that a batch has one tenant.
+ */
+static void SipScheduleTick(int fd, uint32_t events, void *data)
+{
+    SipWheelList due;
+    SipWheelEntry *e = NULL;
+    time_t now = time(NULL);
+    uint32_t cnt = 0;
+    int ret = FALSE;
+
+    TAILQ_INIT(&due);
+    SipWheelExpire(&wheel, now, &due);
+
+    while ((e = TAILQ_FIRST(&due)) != NULL) {
+        TAILQ_REMOVE(&due, e, next);
+        SipScheduleCheck(e->data, now);
+        cnt++;
+    }
+
+    if (cnt == 0) {
+        SipScheduleArm();
+        return;
+    }
+
+    /* After a downtime the backlog is replayed first, the real time cadence
+     * is taken up from the interval after it. Otherwise the tenant is queued
+     * again, once its interval is scored */
+    ret = SipDetectionCatchUp(now);
+    if (ret == TRUE)
+        SipDetectionSchedule();
+    else if (ret == FALSE)
+        SipDetectionFetch();
+}
+
 /**
  * \brief   The main entry function for the detection system. It initializes the
  *          all module of the system and calls the detection module to
@@ -105,14 +623,19 @@ void SipInitConf()
  */
 int main(int argc, char** argv)
 {
-    signal(SIGTERM, SipDone);
-    signal(SIGINT, SipDone);
-    signal(SIGQUIT, SipDone);
+    static const int signals[] = { SIGTERM, SIGINT, SIGQUIT, SIGHUP, SIGUSR1 };
     char *conf_filename = NULL;
     char training_complete = FALSE;
     uint64_t sleep_t = 0;
     int ret = 0;
-    char run_detection = TRUE;
+
+    /* The signals are taken by the event loop, they have to be blocked
+     * before any of the module threads is started */
+    if (SipReactorInit(signals, sizeof(signals) / sizeof(signals[0]),
+                SipSignal) != SIP_OK)
+    {
+        exit(EXIT_FAILURE);
+    }
 
     /* Get the config file path name */
     if (argc > 2 && (strcmp("-c", argv[1]) == 0)) {
@@ -134,9 +657,15 @@ int main(int argc, char** argv)
     /* Initilize the logging module */
     SipInitLog();
 
-    /* Initialize the CDR databse module and make a connection to the database */
-    conn = (PGconn *)SipInitCdr();
-    if (PQstatus(conn) == CONNECTION_BAD)
+    /* Initialize the stage timers */
+    SipTimerInit();
+
+    /* Initialize the metrics module */
+    if (SipMetricsInit() != SIP_OK)
+        SipDone();
+
+    /* Connect to the CDR, threshold and alert databases */
+    if (SipDbInit() != SIP_OK)
         SipDone();
 
     /* Initialize the Alert notification module */
@@ -146,6 +675,10 @@ int main(int argc, char** argv)
     /* Get the default values to be used here in main() from the config file */
     SipInitConf();
 
+    /* Start receiving the CDRs in real time, if configured */
+    if (SipIngestInit() != SIP_OK)
+        SipDone();
+
     /* Check if we have previous threshold value */
     ret = SipInitAnomalyDetection();
     if (ret == SIP_ERROR) {
@@ -154,9 +687,26 @@ int main(int argc, char** argv)
         SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Training the engine for"
                 " detection of anomalous behavior...");
         /*Initialize the Anomaly detection module */
-        if (SipTrainingInitThreshold(conn) != SIP_OK)
+        if (SipTrainingInitThreshold(SipDbGet(SIP_DB_CDR)) != SIP_OK)
             SipDone();
 
+        /* The training intervals, which the loop below would take */
+        if (replay_batch == TRUE) {
+            SipReplayStats stats;
+
+            memset(&stats, 0, sizeof(stats));
+            ret = SipTrainingAnomalyReplay(SipDbGet(SIP_DB_CDR),
+                    train_period > interval ?
+                    (train_period + interval - 1) / interval : 1, &stats);
+            SipSignalHeld();
+            if (ret != SIP_OK) {
+                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in "
+                        "training the engine..");
+                SipDone();
+            }
+            training_complete = TRUE;
+        }
+
         while (training_complete == FALSE) {
             sleep_t += interval;
             /* Train for one week (10080 minutes) with increment of given
@@ -169,62 +719,62 @@ int main(int argc, char** argv)
             /* pass the connection pointer to the anomaly detection function to
              * train the hellinger distance algorithm over the correct data
              * without any attack in it */
-            if (SipTrainingAnomalyDetection(conn) == SIP_ERROR) {
+            if (SipTrainingAnomalyDetection(SipDbGet(SIP_DB_CDR)) ==
+                    SIP_ERROR)
+            {
                 SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in "
                         "training the engine..");
                 SipDone();
             }
 
-            usleep(1);
+            SipReactorRun(0);
+        }
+    } else {
+        /* The baselines of the concurrent calls are not stored with the
+         * threshold, they are trained over the training period before it */
+        SipReplayStats stats;
+
+        memset(&stats, 0, sizeof(stats));
+        ret = SipAnomalyConcTrain(SipDbGet(SIP_DB_CDR),
+                train_period > interval ?
+                (train_period + interval - 1) / interval : 1, &stats);
+        SipSignalHeld();
+        if (ret != SIP_OK) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in training the"
+                    " baselines of the concurrent calls");
         }
     }
+    SipAnomalyConcWarmup();
 
     /* Store the threshold obtained from the training and timestamp value in to
      * the database */
-    if (SipAnomalyStoreThreshold() != SIP_OK)
+    if (SipAnomalyStoreThreshold() == SIP_ERROR)
         SipDone();
 
     SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "SIP Anomaly Detection "
                 "Engine has been started successfully...");
 
-    while (1) {
-        if (run_detection == TRUE) {
-            /* pass the connection pointer to the anomaly detection function to
-             * detect the anomalies by fetching the required data from CDR
-             * database */
-            ret = SipAnomalyDetection(conn, &result);
-            if (ret == SIP_ERROR) {
-                SipDone();
-            } else if (ret == SIP_DONE) {
-                break;
-            } else if (ret == TRUE) {
-                SipAlertNotification(SIP_STATUS_ALERT, &result);
-            } else {
-                SipAlertNotification(SIP_STATUS_OK, &result);
-                /* Store the recent threshold and timestamp value in to the
-                 * database */
-                if (SipAnomalyStoreThreshold() != SIP_OK)
-                    SipDone();
-            }
+    if (replay_batch == TRUE)
+        SipReplay();
 
-            PQclear(result);
-            result = NULL;
-        }
+    /* The intervals are fetched and scored by the event loop, as the tenant
+     * comes due in the timing wheel */
+    tick_fd = SipReactorTimerNew(SipScheduleTick, NULL);
+    if (tick_fd < 0)
+        SipDone();
+
+    deadline_fd = SipReactorTimerNew(SipDetectionDeadline, NULL);
+    if (deadline_fd < 0)
+        SipDone();
+
+    SipWheelInit(&wheel, time(NULL));
+    if (SipConfGet("institution", &schedule.tenant) != 1)
+        schedule.tenant = "";
+    schedule.entry.data = &schedule;
+    SipDetectionSchedule();
+
+    SipReactorLoop();
 
-        if (run_mode & SIP_RUN_MODE_OFFLINE) {
-            usleep(1);
-            run_detection = TRUE;
-        } else {
-            sleep(1);
-            sleep_t += 1;
-            if (sleep_t > (interval * 60)) {
-                run_detection = TRUE;
-                sleep_t = 1;
-            } else {
-                run_detection = FALSE;
-            }
-        }
-    }
     SipDone();
     return (EXIT_SUCCESS);
 }
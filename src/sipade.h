@@ -41,12 +41,15 @@
 #define SIP_ERROR                   -1
 #define SIP_OK                      0
 #define SIP_DONE                    2
+#define SIP_PENDING                 5
+#define SIP_IDLE                    6
 
 #define SIP_THRESHOLD_RESTORE       3
 #define SIP_THRESHOLD_NOT_RESTORE   4
 
 #define SIP_STATUS_OK       "OK"
 #define SIP_STATUS_ALERT    "FATAL"
+#define SIP_STATUS_WARNING  "WARNING"
 
 #define SIP_RUN_MODE_OFFLINE        0x01
 #define SIP_RUN_MODE_ONLINE         0x02
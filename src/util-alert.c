@@ -22,18 +22,57 @@
  * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
  */
 
+#include <sys/stat.h>
+#include <time.h>
 #include "sipade.h"
 #include "util-alert.h"
 #include "util-log.h"
 #include "util-detection.h"
 #include "util-cdr.h"
 #include "util-conf.h"
+#include "util-metrics.h"
+#include "util-timer.h"
+#include "util-db.h"
+#include "util-probe.h"
 
 static SipAlertCtx *iface_ctx = NULL;
 static PGconn *alert_conn = NULL;
 static char *alert_table = NULL;
-static uintmax_t alert_id = 0;
 static char *institution = NULL;
+static char *alert_seq = NULL;
+
+/* Alert dispatcher state */
+static SipAlertQueue queue;
+static SipAlertSink sinks[SIP_ALERT_SINK_MAX];
+static pthread_t dispatcher;
+static sem_t dispatcher_sem;
+static volatile int dispatcher_stop = 0;
+static int reopen_requested = 0;
+static int dispatcher_running = 0;
+static uint32_t sink_backlog = SIP_ALERT_DEFAULT_SINK_BACKLOG;
+static uint32_t retry_min = SIP_ALERT_DEFAULT_RETRY_MIN;
+static uint32_t retry_max = SIP_ALERT_DEFAULT_RETRY_MAX;
+static uint32_t id_wait = SIP_ALERT_DEFAULT_ID_WAIT;
+
+/* Journal to which the events are spilled, when they can not be queued */
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *journal_file = NULL;
+static uint32_t journal_cnt = 0;
+
+/* Alert state of the tenants and the alert ids of their recent incidents */
+static TAILQ_HEAD(, SipAlertIncident_) incidents =
+    TAILQ_HEAD_INITIALIZER(incidents);
+static uint64_t incident_seq = 0;
+static time_t suppression_window = SIP_ALERT_DEFAULT_SUPPRESSION * 60;
+static struct {
+    uint64_t incident;
+    uintmax_t alert_id;
+} incident_ids[SIP_ALERT_INCIDENT_SLOTS];
+
+static const char *evidence_cols[SIP_ALERT_EVIDENCE_COLS] = { "id",
+    "calldate", "src", "dst", "billsec", "calltype", "accountcode" };
+
+static int SipAlertInitDispatcher();
 
 
 /**
@@ -79,9 +118,7 @@ int SipAlertInitHobbitIface()
     iface_ctx->iface |= SIP_ALERT_IFACE_HOBBIT;
     /* Ge the filename from the config file, to which we will write the alert */
     if (SipConfGet("alert-file", &filename) != 1) {
-        iface_ctx->filename = calloc(1, sizeof("/home/ica/stud/guri/"
-                                               "sip_alert.txt"));
-        iface_ctx->filename = "/home/ica/stud/guri/sip_alert.txt";
+        iface_ctx->filename = strdup("/home/ica/stud/guri/sip_alert.txt");
     } else {
         iface_ctx->filename = strdup(filename);
     }
@@ -115,7 +152,6 @@ int SipAlertInitHobbitIface()
 int SipAlertInitNotification()
 {
     char *alert_mode;
-    char conn_info[200];
 
     /*Initialize the Sip Alert Context */
     SipAlertInitCtx();
@@ -139,11 +175,11 @@ int SipAlertInitNotification()
         SipAlertInitSyslogIface();
     }
 
-    /* connect to the data base with the provided connection information */
-    alert_conn = SipConnectDB("alert-database");
-    if(PQstatus(alert_conn) == CONNECTION_BAD) {
+    /* the connection to the alert database has been made by SipDbInit() */
+    alert_conn = SipDbGet(SIP_DB_ALERT);
+    if (alert_conn == NULL) {
         SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in "
-                        "connection to database: %s", conn_info);
+                        "connection to the alert database");
         return SIP_ERROR;
     }
 
@@ -152,150 +188,1346 @@ int SipAlertInitNotification()
         alert_table = "cdr_alert";
     }
 
+    if (SipAlertInitSequence() != SIP_OK)
+        return SIP_ERROR;
+
+    if (SipAlertInitDispatcher() != SIP_OK)
+        return SIP_ERROR;
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to run a statement on the alert connection, which returns
+ *          no rows, e.g. a transaction control or a create statement.
+ */
+static int SipAlertExec(const char *query)
+{
+    PGresult *res = PQexec(alert_conn, query);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK &&
+            PQresultStatus(res) != PGRES_TUPLES_OK)
+    {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in running the"
+                " query \"%s\": %s", query, PQerrorMessage(alert_conn));
+        PQclear(res);
+        return SIP_ERROR;
+    }
+    PQclear(res);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to prepare the sequence from which the alert ids are drawn.
+ *          If the sequence does not exist yet, it is created and seeded once
+ *          with the highest alert id already present in the alert table, so
+ *          that existing deployments keep their numbering. The sequence is
+ *          looked up as the create statement resolves it, by the search path.
+ *          Engines starting at the same time create and seed it under an
+ *          advisory lock, and a sequence from which ids have been drawn
+ *          already is not seeded again.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+int SipAlertInitSequence()
+{
+    PGresult *res = NULL;
+    char query[400];
+    char *seq = NULL;
+    int exists = 0;
+
+    if (SipConfGet("alert-database.sequence", &seq) == 1) {
+        alert_seq = strdup(seq);
+    } else {
+        alert_seq = calloc(1, strlen(alert_table) + sizeof("_id_seq"));
+        if (alert_seq == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                    " the memory");
+            return SIP_ERROR;
+        }
+        sprintf(alert_seq, "%s_id_seq", alert_table);
+    }
+
+    snprintf(query, sizeof(query), "select to_regclass('%s') is not null",
+            alert_seq);
+    res = SipGetCdr(alert_conn, query, SIP_METRIC_STMT_INIT);
+    if (res == NULL)
+        return SIP_ERROR;
+    exists = (PQntuples(res) > 0 && PQgetvalue(res, 0, 0)[0] == 't');
+    PQclear(res);
+
+    if (exists)
+        return SIP_OK;
+
+    if (SipAlertExec("begin") != SIP_OK)
+        return SIP_ERROR;
+
+    snprintf(query, sizeof(query), "select pg_advisory_xact_lock("
+            "hashtext('%s'))", alert_seq);
+    if (SipAlertExec(query) != SIP_OK)
+        goto rollback;
+
+    snprintf(query, sizeof(query), "create sequence if not exists %s",
+            alert_seq);
+    if (SipAlertExec(query) != SIP_OK)
+        goto rollback;
+
+    snprintf(query, sizeof(query), "select setval('%s', coalesce((select "
+            "max(alert_id) from %s), 0) + 1, false) from %s where not"
+            " is_called", alert_seq, alert_table, alert_seq);
+    if (SipAlertExec(query) != SIP_OK)
+        goto rollback;
+
+    if (SipAlertExec("commit") != SIP_OK)
+        return SIP_ERROR;
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Created the alert id sequence %s",
+            alert_seq);
     return SIP_OK;
+
+rollback:
+    res = PQexec(alert_conn, "rollback");
+    PQclear(res);
+    return SIP_ERROR;
+}
+
+/**
+ * \brief   Function to append a value to a COPY row in the text format. The
+ *          characters which have a special meaning in the format are escaped
+ *          and a NULL value is written as \N.
+ *
+ * @param buf       pointer to the row buffer
+ * @param len       current length of the row in the buffer
+ * @param size      size of the row buffer
+ * @param value     pointer to the value to append, NULL for an SQL null
+ * @param sep       separator to write after the value
+ *
+ * @return  the new length of the row, or -1 if the row does not fit
+ */
+static int SipAlertCopyAppend(char *buf, int len, int size, const char *value,
+        char sep)
+{
+    if (value == NULL) {
+        if (len + 3 >= size)
+            return -1;
+        buf[len++] = '\\';
+        buf[len++] = 'N';
+        buf[len++] = sep;
+        return len;
+    }
+
+    for (; *value != '\0'; value++) {
+        if (len + 3 >= size)
+            return -1;
+        switch (*value) {
+            case '\\':
+                buf[len++] = '\\';
+                buf[len++] = '\\';
+                break;
+            case '\t':
+                buf[len++] = '\\';
+                buf[len++] = 't';
+                break;
+            case '\n':
+                buf[len++] = '\\';
+                buf[len++] = 'n';
+                break;
+            case '\r':
+                buf[len++] = '\\';
+                buf[len++] = 'r';
+                break;
+            default:
+                buf[len++] = *value;
+                break;
+        }
+    }
+    buf[len++] = sep;
+    return len;
 }
 
 /**
  * \brief   Function to log the transactions related to the interval, in which
  *          anomaly has been detected. It will log all the calls in that interval
- *          which are of international, mobile or permium type.
+ *          which are of international, mobile or permium type. The alert id is
+ *          drawn from the alert sequence and all the calls are written with a
+ *          single COPY inside one transaction, so the cost does not depend on
+ *          the size of the alert table.
  *
  * @param result        pointer to the result which contains the call data
+ * @param id            pointer to the alert id of the calls. If it is 0, a new
+ *                      id is drawn and returned in it
  *
  * @return  on success it returns SIP_OK and on failure SIP_ERROR
  */
-int SipAlertLogDB(PGresult *result)
+int SipAlertLogDB(PGresult *result, uintmax_t *id)
 {
     PGresult *res = NULL;
     uint32_t row = 0;
     uint32_t row_cnt = 0;
-    char query [500];
-    char *id = NULL;
-    char *calldate = NULL;
-    char *src = NULL;
-    char *dst = NULL;
-    char *billsec = NULL;
-    char *calltype = NULL;
-    char *accountcode = NULL;
-    char query_id[] = "select max(alert_id) from cdr_alert";
-    char *alert = NULL;
-
-    res = PQexec(alert_conn, query_id);
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
-                " given query \"%s\"", query);
-        PQclear(res);
-        return SIP_ERROR;
+    uint8_t col = 0;
+    char query[300];
+    char line[2048];
+    char id_s[24];
+    int len = 0;
+
+    /* Start the transaction and get the alert id in the same round trip */
+    if (*id == 0) {
+        snprintf(query, sizeof(query), "begin; select nextval('%s')",
+                alert_seq);
+        res = PQexec(alert_conn, query);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
+                    " given query \"%s\": %s", query,
+                    PQerrorMessage(alert_conn));
+            PQclear(res);
+            goto rollback;
+        }
+        *id = strtoumax(PQgetvalue(res, 0, 0), NULL, 10);
+    } else {
+        res = PQexec(alert_conn, "begin");
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in starting the"
+                    " transaction: %s", PQerrorMessage(alert_conn));
+            PQclear(res);
+            goto rollback;
+        }
     }
+    PQclear(res);
+    snprintf(id_s, sizeof(id_s), "%"PRIuMAX, *id);
 
-    alert = PQgetvalue(res, 0, 0);
-    alert_id = strtoumax(alert, NULL, 10);
-    alert_id++;
+    snprintf(query, sizeof(query), "copy %s(alert_id,cdr_id,calldate,src,dst,"
+            "billsec,calltype,accountcode) from stdin", alert_table);
+    res = PQexec(alert_conn, query);
+    if (PQresultStatus(res) != PGRES_COPY_IN) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in starting the"
+                " copy \"%s\": %s", query, PQerrorMessage(alert_conn));
+        PQclear(res);
+        goto rollback;
+    }
     PQclear(res);
 
     row_cnt = PQntuples(result);
 
+    /* The call data columns are id, calldate, src, dst, billsec, calltype and
+     * accountcode, in the same order as the alert table columns after the
+     * alert id */
     for (row = 0; row < row_cnt; row++) {
-        id = PQgetvalue(result,row,0);
-        calldate = PQgetvalue(result,row,1);
-        src = PQgetvalue(result,row,2);
-        dst = PQgetvalue(result,row,3);
-        billsec = PQgetvalue(result,row,4);
-        calltype = PQgetvalue(result,row,5);
-        accountcode = PQgetvalue(result, 0, 6);
-        snprintf(query, sizeof(query), "insert into %s(alert_id, cdr_id,"
-                "calldate,src,dst,billsec,calltype,accountcode) values "
-                "('%"PRIuMAX"','%s','%s','%s','%s','%s','%s','%s')",
-                alert_table, alert_id, id, calldate, src, dst, billsec,
-                calltype, accountcode);
+        len = SipAlertCopyAppend(line, 0, sizeof(line), id_s, '\t');
+        for (col = 0; col < 7 && len > 0; col++) {
+            len = SipAlertCopyAppend(line, len, sizeof(line),
+                    PQgetisnull(result, row, col) ? NULL :
+                    PQgetvalue(result, row, col), (col < 6) ? '\t' : '\n');
+        }
 
-        res = PQexec(alert_conn, query);
+        if (len < 0) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Call record %s is too"
+                    " large to be logged", PQgetvalue(result, row, 0));
+            PQputCopyEnd(alert_conn, "call record too large");
+            goto copy_end;
+        }
+
+        if (PQputCopyData(alert_conn, line, len) != 1) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in sending the"
+                    " alert data: %s", PQerrorMessage(alert_conn));
+            PQputCopyEnd(alert_conn, "failed in sending the alert data");
+            goto copy_end;
+        }
+    }
+
+    if (PQputCopyEnd(alert_conn, NULL) != 1) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in completing the"
+                " copy: %s", PQerrorMessage(alert_conn));
+    }
+
+copy_end:
+    /* Collect the result of the copy command */
+    while ((res = PQgetResult(alert_conn)) != NULL) {
         if (PQresultStatus(res) != PGRES_COMMAND_OK) {
             SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in inserting"
-                    " the given values \"%s\"", query);
+                    " the alert data: %s", PQerrorMessage(alert_conn));
             PQclear(res);
-            return SIP_ERROR;
+            while ((res = PQgetResult(alert_conn)) != NULL)
+                PQclear(res);
+            goto rollback;
         }
         PQclear(res);
     }
 
+    res = PQexec(alert_conn, "commit");
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in committing the"
+                " alert data: %s", PQerrorMessage(alert_conn));
+        PQclear(res);
+        return SIP_ERROR;
+    }
+    PQclear(res);
+
     return SIP_OK;
+
+rollback:
+    res = PQexec(alert_conn, "rollback");
+    PQclear(res);
+    return SIP_ERROR;
 }
 
 /**
- * \brief   Function to log the status alerts to the alert file. The file
- *          is monitored by xymon, which on alert will send the alerts to
- *          responsible person at the target institution in given method
- *          such as email, sms etc.
+ * \brief   Function to format the status line of the given event, as it is
+ *          written to the hobbit file and the syslog.
  *
- * @param status        Status of the SIP system to be logged in to the file
- * @param result        pointer to the result which contains the call data
- * 
+ * @param ev        pointer to the status event
+ * @param msg       pointer to the buffer in which the line is stored
+ * @param size      size of the buffer
  */
-void SipAlertNotification(char *status, PGresult **result)
+static void SipAlertStatusMsg(SipAlertEvent *ev, char *msg, size_t size)
 {
-    char status_msg[100];
+    uint8_t slot = ev->incident % SIP_ALERT_INCIDENT_SLOTS;
 
-    /* If the status is OK and we are in syslog mode, then no need to log it to
-     * the syslog */
-    if ((strncmp(status, SIP_STATUS_OK, 2) == 0) &&
-            iface_ctx->iface == SIP_ALERT_IFACE_SYSLOG)
+    /* The resolved incident is referred by the alert id it has been opened */
+    if (ev->kind == SIP_ALERT_EVENT_RESOLVE) {
+        snprintf(msg, size, "[%s]    %s     %s  %"PRIuMAX"\n", ev->timestamp,
+                ev->status, institution,
+                (incident_ids[slot].incident == ev->incident) ?
+                incident_ids[slot].alert_id : 0);
+    } else if (strncmp(ev->status, SIP_STATUS_ALERT, 5) == 0) {
+        snprintf(msg, size, "[%s]    %s  %s  %"PRIuMAX"\n", ev->timestamp,
+                ev->status, institution, ev->alert_id);
+    } else {
+        snprintf(msg, size, "[%s]    %s     %s\n", ev->timestamp, ev->status,
+                institution);
+    }
+}
+
+/**
+ * \brief   Alert sink to log the calls of an anomalous interval to the alert
+ *          database. A lost connection is made again before the attempt. The
+ *          calls of an ongoing incident are appended under the alert id with
+ *          which the incident has been opened.
+ *
+ * @param ev    pointer to the status event
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+static int SipAlertDeliverDB(SipAlertEvent *ev)
+{
+    uint64_t start = 0;
+    uint8_t slot = 0;
+
+    alert_conn = SipDbGet(SIP_DB_ALERT);
+    if (alert_conn == NULL)
+        return SIP_ERROR;
+
+    slot = ev->incident % SIP_ALERT_INCIDENT_SLOTS;
+    if (ev->kind == SIP_ALERT_EVENT_APPEND && ev->alert_id == 0 &&
+            incident_ids[slot].incident == ev->incident)
     {
-        return;
+        ev->alert_id = incident_ids[slot].alert_id;
     }
 
-    if (strncmp(status, SIP_STATUS_ALERT, 5) == 0) {
-        if (SipAlertLogDB(*result) != SIP_OK) {
-            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in logging"
-                    " alerts to alert_database");
-            return;
+    start = SipTimerTicks();
+    if (SipAlertLogDB(ev->result, &ev->alert_id) != SIP_OK) {
+        SipDbFailed(SIP_DB_ALERT);
+        return SIP_ERROR;
+    }
+    SipMetricsObserveQuery(SIP_METRIC_STMT_ALERT,
+            SipTimerNs(SipTimerTicks() - start) / 1e9);
+
+    incident_ids[slot].incident = ev->incident;
+    incident_ids[slot].alert_id = ev->alert_id;
+    return SIP_OK;
+}
+
+/**
+ * \brief   Alert sink to write the status line to the hobbit file. The file is
+ *          reopened on the next attempt, if the write has failed.
+ *
+ * @param ev    pointer to the status event
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+static int SipAlertDeliverHobbit(SipAlertEvent *ev)
+{
+    char status_msg[100];
+
+    if (iface_ctx->file_descr == NULL) {
+        iface_ctx->file_descr = fopen(iface_ctx->filename, "a");
+        if (iface_ctx->file_descr == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in opening the"
+                    " \"%s\" file: %s", iface_ctx->filename, strerror(errno));
+            return SIP_ERROR;
         }
+    }
 
-        snprintf(status_msg, 100, "[%s]    %s  %s  %"PRIuMAX"\n",
-                SipGetTimeStamp(), status, institution, alert_id);
+    SipAlertStatusMsg(ev, status_msg, sizeof(status_msg));
+    if (fwrite(status_msg, 1, strlen(status_msg), iface_ctx->file_descr) == 0
+            || fflush(iface_ctx->file_descr) != 0)
+    {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in writing to the"
+                " file: %s", iface_ctx->filename);
+        fclose(iface_ctx->file_descr);
+        iface_ctx->file_descr = NULL;
+        return SIP_ERROR;
+    }
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Alert sink to log the status line to the syslog.
+ *
+ * @param ev    pointer to the status event
+ *
+ * @return  it always returns SIP_OK
+ */
+static int SipAlertDeliverSyslog(SipAlertEvent *ev)
+{
+    char status_msg[100];
+
+    SipAlertStatusMsg(ev, status_msg, sizeof(status_msg));
+    if (ev->kind == SIP_ALERT_EVENT_RESOLVE) {
+        syslog(LOG_NOTICE, "%s", status_msg);
+    } else if (ev->kind == SIP_ALERT_EVENT_WARNING) {
+        syslog(LOG_WARNING, "%s", status_msg);
+    } else if (strcmp(ev->status, SIP_STATUS_OK) == 0) {
+        syslog(LOG_INFO, "%s", status_msg);
     } else {
-        snprintf(status_msg, 100, "[%s]    %s     %s\n", SipGetTimeStamp(),
-                status, institution);
+        syslog(LOG_ALERT, "%s", status_msg);
     }
 
-    /* write to the corresponding alert module as provided in the configuration
-     * file */
-    switch (iface_ctx->iface) {
-        case SIP_ALERT_IFACE_HOBBIT:
-            if (fwrite(status_msg, 1, strlen(status_msg), iface_ctx->file_descr)
-                    == 0)
-            {
-                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in "
-                        "writing to the file: %s", iface_ctx->filename);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to add an event to the alert queue. It is called only from
+ *          the detection side.
+ *
+ * @param ev    pointer to the status event
+ *
+ * @return  SIP_OK if the event has been queued and SIP_ERROR if queue is full
+ */
+static int SipAlertQueuePush(SipAlertEvent *ev)
+{
+    uint32_t tail = queue.tail;
+    uint32_t head = __atomic_load_n(&queue.head, __ATOMIC_ACQUIRE);
+
+    if (tail - head > queue.mask)
+        return SIP_ERROR;
+
+    queue.ring[tail & queue.mask] = ev;
+    __atomic_store_n(&queue.tail, tail + 1, __ATOMIC_RELEASE);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to take the oldest event from the alert queue. It is called
+ *          only from the dispatcher thread.
+ *
+ * @return  pointer to the event or NULL if the queue is empty
+ */
+static SipAlertEvent *SipAlertQueuePop()
+{
+    SipAlertEvent *ev = NULL;
+    uint32_t head = queue.head;
+    uint32_t tail = __atomic_load_n(&queue.tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return NULL;
+
+    ev = queue.ring[head & queue.mask];
+    __atomic_store_n(&queue.head, head + 1, __ATOMIC_RELEASE);
+    return ev;
+}
+
+/**
+ * \brief   Function to get the number of events waiting in the alert queue.
+ */
+uint32_t SipAlertQueueDepth()
+{
+    return __atomic_load_n(&queue.tail, __ATOMIC_RELAXED) -
+           __atomic_load_n(&queue.head, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to get the number of events waiting for the given sink.
+ */
+uint32_t SipAlertSinkBacklog(uint8_t s)
+{
+    return __atomic_load_n(&sinks[s].backlog, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to get the name of the given sink.
+ */
+const char *SipAlertSinkName(uint8_t s)
+{
+    static const char *names[SIP_ALERT_SINK_MAX] = { "database", "hobbit",
+        "syslog" };
+
+    return names[s];
+}
+
+/**
+ * \brief   Function to free the given event and the call data owned by it.
+ */
+static void SipAlertEventFree(SipAlertEvent *ev)
+{
+    if (ev->result != NULL)
+        PQclear(ev->result);
+    free(ev);
+}
+
+/**
+ * \brief   Function to append the given event to the alert journal. Only the
+ *          sinks in the given mask will process the event, when the journal
+ *          is replayed.
+ *
+ * @param ev    pointer to the status event
+ * @param mask  mask of the sinks, which have not processed the event yet
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+static int SipAlertJournalWrite(SipAlertEvent *ev, uint8_t mask)
+{
+    FILE *fp = NULL;
+    char line[2048];
+    uint32_t row = 0;
+    uint32_t row_cnt = 0;
+    uint8_t col = 0;
+    int len = 0;
+    int ret = SIP_OK;
+
+    if (ev->result != NULL)
+        row_cnt = PQntuples(ev->result);
+
+    pthread_mutex_lock(&journal_lock);
+    fp = fopen(journal_file, "a");
+    if (fp == NULL) {
+        pthread_mutex_unlock(&journal_lock);
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in opening the alert"
+                " journal \"%s\": %s. The %s event of %s is lost", journal_file,
+                strerror(errno), ev->status, ev->timestamp);
+        return SIP_ERROR;
+    }
+
+    fprintf(fp, "E\t%u\t%u\t%"PRIu64"\t%s\t%s\t%"PRIuMAX"\t%"PRIu32"\n",
+            mask, ev->kind, ev->incident, ev->status, ev->timestamp,
+            ev->alert_id, row_cnt);
+
+    for (row = 0; row < row_cnt; row++) {
+        len = 0;
+        for (col = 0; col < SIP_ALERT_EVIDENCE_COLS && len >= 0; col++) {
+            len = SipAlertCopyAppend(line, len, sizeof(line),
+                    PQgetisnull(ev->result, row, col) ? NULL :
+                    PQgetvalue(ev->result, row, col),
+                    (col < SIP_ALERT_EVIDENCE_COLS - 1) ? '\t' : '\n');
+        }
+        /* Keep the row count of the record intact with an empty row */
+        if (len < 0) {
+            strcpy(line, "\\N\t\\N\t\\N\t\\N\t\\N\t\\N\t\\N\n");
+            len = strlen(line);
+        }
+        fwrite(line, 1, len, fp);
+    }
+
+    if (fclose(fp) != 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in writing the alert"
+                " journal \"%s\": %s", journal_file, strerror(errno));
+        ret = SIP_ERROR;
+    }
+    journal_cnt++;
+    pthread_mutex_unlock(&journal_lock);
+
+    return ret;
+}
+
+/**
+ * \brief   Function to split a journal line in to its tab separated fields and
+ *          to undo the escaping of the values in place.
+ *
+ * @param line      pointer to the line, which is modified
+ * @param fields    array in which the pointers to the values are stored, NULL
+ *                  for an SQL null
+ * @param n         number of fields expected in the line
+ *
+ * @return  number of fields found in the line
+ */
+static int SipAlertJournalSplit(char *line, char **fields, int n)
+{
+    char *src = line;
+    char *dst = line;
+    int cnt = 0;
+
+    fields[cnt] = dst;
+    while (*src != '\0' && *src != '\n') {
+        if (*src == '\t') {
+            *dst++ = '\0';
+            src++;
+            if (++cnt >= n)
+                return cnt;
+            fields[cnt] = dst;
+        } else if (*src == '\\' && src[1] != '\0') {
+            src++;
+            switch (*src) {
+                case 't': *dst++ = '\t'; break;
+                case 'n': *dst++ = '\n'; break;
+                case 'r': *dst++ = '\r'; break;
+                case 'N': fields[cnt] = NULL; break;
+                default: *dst++ = *src; break;
             }
+            src++;
+        } else {
+            *dst++ = *src++;
+        }
+    }
+    *dst = '\0';
+
+    return cnt + 1;
+}
+
+static void SipAlertSinkAppend(SipAlertEvent *);
+
+/**
+ * \brief   Function to replay the events of the alert journal to the sinks and
+ *          truncate the journal afterwards. It is called from the dispatcher
+ *          thread, when all the sinks are idle. The events are read and the
+ *          journal is truncated under the journal lock, they are handed over
+ *          to the sinks only after it is released. Once a backlog is full, the
+ *          remaining events are written back to the journal in their order,
+ *          to be replayed after the backlogs have been delivered.
+ */
+static void SipAlertJournalReplay()
+{
+    FILE *fp = NULL;
+    char line[2048];
+    char *fields[SIP_ALERT_EVIDENCE_COLS + 1];
+    PGresAttDesc attrs[SIP_ALERT_EVIDENCE_COLS];
+    SipAlertEvent *ev = NULL;
+    TAILQ_HEAD(, SipAlertEvent_) replay;
+    uint32_t row = 0;
+    uint32_t row_cnt = 0;
+    uint32_t replayed = 0;
+    uint32_t kept = 0;
+    uint32_t old_format = 0;
+    uint8_t col = 0;
+    uint8_t s = 0;
+    int cnt = 0;
+
+    TAILQ_INIT(&replay);
+
+    pthread_mutex_lock(&journal_lock);
+    if (journal_cnt == 0) {
+        pthread_mutex_unlock(&journal_lock);
+        return;
+    }
+
+    fp = fopen(journal_file, "r");
+    if (fp == NULL) {
+        journal_cnt = 0;
+        pthread_mutex_unlock(&journal_lock);
+        return;
+    }
+
+    memset(attrs, 0, sizeof(attrs));
+    for (col = 0; col < SIP_ALERT_EVIDENCE_COLS; col++) {
+        attrs[col].name = (char *)evidence_cols[col];
+        attrs[col].typid = 25;  /* text */
+        attrs[col].typlen = -1;
+        attrs[col].atttypmod = -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        cnt = SipAlertJournalSplit(line, fields, 8);
+        if ((cnt != 8 && cnt != 6) || fields[0] == NULL ||
+                strcmp(fields[0], "E") != 0)
+        {
+            continue;
+        }
+
+        ev = calloc(1, sizeof(SipAlertEvent));
+        if (ev == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                    " the memory");
             break;
-        case SIP_ALERT_IFACE_SYSLOG:
-            if (strcmp(status, "OK") == 0) {
-                syslog(LOG_INFO, "%s", status_msg);
-            } else {
-                syslog(LOG_ALERT, "%s", status_msg);
+        }
+        ev->pending = atoi(fields[1]);
+        ev->queued = time(NULL);
+
+        if (cnt == 8) {
+            ev->kind = atoi(fields[2]);
+            ev->incident = strtoull(fields[3], NULL, 10);
+            strncpy(ev->status, fields[4], sizeof(ev->status) - 1);
+            strncpy(ev->timestamp, fields[5], sizeof(ev->timestamp) - 1);
+            ev->alert_id = strtoumax(fields[6], NULL, 10);
+            row_cnt = strtoul(fields[7], NULL, 10);
+        } else {
+            /* A journal written before the incidents, each of its alerts
+             * opens an alert id of its own and belongs to no incident */
+            strncpy(ev->status, fields[2], sizeof(ev->status) - 1);
+            strncpy(ev->timestamp, fields[3], sizeof(ev->timestamp) - 1);
+            ev->alert_id = strtoumax(fields[4], NULL, 10);
+            row_cnt = strtoul(fields[5], NULL, 10);
+            ev->kind = (strcmp(ev->status, SIP_STATUS_ALERT) == 0) ?
+                SIP_ALERT_EVENT_OPEN : SIP_ALERT_EVENT_STATUS;
+            ev->incident = 0;
+            old_format++;
+        }
+
+        if (row_cnt > 0) {
+            ev->result = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+            PQsetResultAttrs(ev->result, SIP_ALERT_EVIDENCE_COLS, attrs);
+        }
+
+        for (row = 0; row < row_cnt; row++) {
+            if (fgets(line, sizeof(line), fp) == NULL)
+                break;
+            memset(fields, 0, sizeof(fields));
+            SipAlertJournalSplit(line, fields, SIP_ALERT_EVIDENCE_COLS);
+            for (col = 0; col < SIP_ALERT_EVIDENCE_COLS; col++) {
+                PQsetvalue(ev->result, row, col, fields[col],
+                        fields[col] != NULL ? (int)strlen(fields[col]) : -1);
             }
-            break;
-        case SIP_ALERT_IFACE_HOBBIT | SIP_ALERT_IFACE_SYSLOG:
-            if (fwrite(status_msg, 1, strlen(status_msg), iface_ctx->file_descr)
-                    == 0)
+        }
+
+        ev->pending &= SIP_ALERT_SINK_FLAG(SIP_ALERT_SINK_MAX) - 1;
+        if (ev->pending == 0) {
+            SipAlertEventFree(ev);
+            continue;
+        }
+        TAILQ_INSERT_TAIL(&replay, ev, next[0]);
+    }
+    fclose(fp);
+
+    if (old_format > 0) {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Read %"PRIu32" alert events"
+                " of the journal format without incidents", old_format);
+    }
+
+    /* truncate the journal */
+    fp = fopen(journal_file, "w");
+    if (fp != NULL)
+        fclose(fp);
+    journal_cnt = 0;
+    pthread_mutex_unlock(&journal_lock);
+
+    while ((ev = TAILQ_FIRST(&replay)) != NULL) {
+        TAILQ_REMOVE(&replay, ev, next[0]);
+
+        for (s = 0; kept == 0 && s < SIP_ALERT_SINK_MAX; s++) {
+            if ((ev->pending & SIP_ALERT_SINK_FLAG(s)) &&
+                    sinks[s].backlog >= sink_backlog)
             {
-                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in "
-                        "writing to the file: %s", iface_ctx->filename);
+                kept = 1;
             }
+        }
 
-            if (strcmp(status, "OK") == 0) {
-                syslog(LOG_INFO, "%s", status_msg);
+        if (kept > 0) {
+            SipAlertJournalWrite(ev, ev->pending);
+            SipAlertEventFree(ev);
+            kept++;
+            continue;
+        }
+        SipAlertSinkAppend(ev);
+        replayed++;
+    }
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Replayed %"PRIu32" alert events"
+            " from the journal %s, %"PRIu32" are kept for later", replayed,
+            journal_file, (kept > 0) ? kept - 1 : 0);
+}
+
+/**
+ * \brief   Function to mark the event as processed by the given sink and to
+ *          free it, once all of its sinks are done.
+ */
+static void SipAlertEventDone(SipAlertEvent *ev, uint8_t s)
+{
+    TAILQ_REMOVE(&sinks[s].head, ev, next[s]);
+    sinks[s].backlog--;
+
+    ev->pending &= ~SIP_ALERT_SINK_FLAG(s);
+    if (ev->pending == 0)
+        SipAlertEventFree(ev);
+}
+
+/**
+ * \brief   Function to hand over the event to the backlog of each of its sinks.
+ *          If the backlog of a sink is full, its oldest event is spilled to the
+ *          journal for that sink.
+ *
+ * @param ev    pointer to the status event
+ */
+static void SipAlertSinkAppend(SipAlertEvent *ev)
+{
+    SipAlertEvent *old = NULL;
+    uint8_t s = 0;
+
+    for (s = 0; s < SIP_ALERT_SINK_MAX; s++) {
+        if (!(ev->pending & SIP_ALERT_SINK_FLAG(s)))
+            continue;
+
+        if (sinks[s].backlog >= sink_backlog) {
+            old = TAILQ_FIRST(&sinks[s].head);
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Backlog of the %s alert"
+                    " sink is full, spilling the event of %s to the journal",
+                    sinks[s].name, old->timestamp);
+            SipAlertJournalWrite(old, SIP_ALERT_SINK_FLAG(s));
+            SipAlertEventDone(old, s);
+        }
+
+        TAILQ_INSERT_TAIL(&sinks[s].head, ev, next[s]);
+        sinks[s].backlog++;
+    }
+}
+
+/**
+ * \brief   Function to deliver the backlog of the given sink in order. On
+ *          failure the sink backs off exponentially before the next attempt.
+ *
+ * @param s     index of the sink
+ * @param now   current time
+ * @param force deliver regardless of the backoff, used at shutdown
+ */
+static void SipAlertSinkFlush(uint8_t s, time_t now, int force)
+{
+    SipAlertSink *sink = &sinks[s];
+    SipAlertEvent *ev = NULL;
+
+    while ((ev = TAILQ_FIRST(&sink->head)) != NULL) {
+        if (!force && now < sink->next_try)
+            return;
+
+        /* The status line of an alert carries the alert id, which is assigned
+         * by the database sink. Wait for it for a while, before giving up */
+        if (s != SIP_ALERT_SINK_DB && !force &&
+                (ev->pending & SIP_ALERT_SINK_FLAG(SIP_ALERT_SINK_DB)) &&
+                (now - ev->queued) < id_wait)
+        {
+            return;
+        }
+
+        if (sink->deliver(ev) != SIP_OK) {
+            sink->failures++;
+            if (sink->backoff == 0) {
+                sink->backoff = retry_min;
+            } else if (sink->backoff * 2 > retry_max) {
+                sink->backoff = retry_max;
             } else {
-                syslog(LOG_ALERT, "%s", status_msg);
+                sink->backoff *= 2;
             }
+            sink->next_try = now + sink->backoff;
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in delivering the"
+                    " alert to the %s sink (%"PRIu32" failures), retrying in"
+                    " %"PRIu32" seconds", sink->name, sink->failures,
+                    sink->backoff);
+            return;
+        }
+
+        if (sink->failures > 0) {
+            SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "The %s alert sink has"
+                    " recovered after %"PRIu32" failures", sink->name,
+                    sink->failures);
+            sink->failures = 0;
+            sink->backoff = 0;
+            sink->next_try = 0;
+        }
+
+        SipAlertEventDone(ev, s);
+    }
+}
+
+/**
+ * \brief   Function to reopen the alert sinks with the settings of the reloaded
+ *          config file. It runs in the dispatcher thread, between the
+ *          deliveries, so no sink is in use while it is reopened. The failing
+ *          sinks are retried right away.
+ */
+static void SipAlertSinkReopen()
+{
+    char *val = NULL;
+    char *filename = NULL;
+    uint8_t iface = iface_ctx->iface;
+    uint8_t s = 0;
+
+    if (SipConfGet("alert-dispatch.sink-backlog", &val) == 1)
+        sink_backlog = strtoul(val, NULL, 10);
+    if (SipConfGet("alert-dispatch.retry-min", &val) == 1)
+        retry_min = strtoul(val, NULL, 10);
+    if (SipConfGet("alert-dispatch.retry-max", &val) == 1)
+        retry_max = strtoul(val, NULL, 10);
+    if (SipConfGet("alert-dispatch.id-wait", &val) == 1)
+        id_wait = strtoul(val, NULL, 10);
+    if (retry_min == 0)
+        retry_min = 1;
+    if (sink_backlog == 0)
+        sink_backlog = 1;
+
+    if (SipConfGet("alert-mode", &val) != 1 || strcmp(val, "syslog") == 0) {
+        iface = SIP_ALERT_IFACE_SYSLOG;
+    } else if (strcmp(val, "hobbit") == 0) {
+        iface = SIP_ALERT_IFACE_HOBBIT;
+    } else if (strcmp(val, "both") == 0) {
+        iface = SIP_ALERT_IFACE_HOBBIT | SIP_ALERT_IFACE_SYSLOG;
+    }
+
+    /* The hobbit file is opened again by the sink on its next delivery */
+    if (iface_ctx->file_descr != NULL) {
+        fclose(iface_ctx->file_descr);
+        iface_ctx->file_descr = NULL;
+    }
+    if (SipConfGet("alert-file", &val) == 1 &&
+            (filename = strdup(val)) != NULL)
+    {
+        if (iface_ctx->filename != NULL)
+            free(iface_ctx->filename);
+        iface_ctx->filename = filename;
+    }
+
+    if (iface & SIP_ALERT_IFACE_SYSLOG) {
+        closelog();
+        openlog(NULL, LOG_NDELAY, LOG_USER);
+    } else if (iface_ctx->iface & SIP_ALERT_IFACE_SYSLOG) {
+        closelog();
+    }
+    __atomic_store_n(&iface_ctx->iface, iface, __ATOMIC_RELEASE);
+
+    if (SipConfGet("alert-database.table", &alert_table) != 1)
+        alert_table = "cdr_alert";
+
+    /* the alert database is connected again by the next delivery */
+    SipDbReload(SIP_DB_ALERT);
+    alert_conn = NULL;
+
+    for (s = 0; s < SIP_ALERT_SINK_MAX; s++)
+        sinks[s].next_try = 0;
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "The alert sinks have been"
+            " reopened");
+}
+
+/**
+ * \brief   The alert dispatcher thread. It moves the events from the alert
+ *          queue to the sinks and delivers them, so that the detection never
+ *          waits for a slow or unavailable sink.
+ */
+static void *SipAlertDispatcher(void *arg)
+{
+    SipAlertEvent *ev = NULL;
+    struct timespec ts;
+    time_t now = 0;
+    uint8_t s = 0;
+    uint8_t idle = 0;
+
+    while (1) {
+        if (__atomic_exchange_n(&reopen_requested, 0, __ATOMIC_ACQ_REL))
+            SipAlertSinkReopen();
+
+        while ((ev = SipAlertQueuePop()) != NULL)
+            SipAlertSinkAppend(ev);
+
+        now = time(NULL);
+        for (s = 0; s < SIP_ALERT_SINK_MAX; s++)
+            SipAlertSinkFlush(s, now, 0);
+
+        if (dispatcher_stop)
             break;
-        default:
-            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "invalid alert"
-                    " mode");
-            break;
+
+        /* Replay the spilled events, once all the sinks are healthy again */
+        idle = 1;
+        for (s = 0; s < SIP_ALERT_SINK_MAX; s++) {
+            if (sinks[s].backlog > 0 || sinks[s].failures > 0)
+                idle = 0;
+        }
+        if (idle && __atomic_load_n(&journal_cnt, __ATOMIC_RELAXED) > 0) {
+            SipAlertJournalReplay();
+            continue;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        sem_timedwait(&dispatcher_sem, &ts);
+    }
+
+    /* Make a last attempt for the remaining events and keep the undelivered
+     * ones in the journal for the next start */
+    while ((ev = SipAlertQueuePop()) != NULL)
+        SipAlertSinkAppend(ev);
+
+    for (s = 0; s < SIP_ALERT_SINK_MAX; s++) {
+        if (sinks[s].failures == 0)
+            SipAlertSinkFlush(s, now, 1);
+    }
+
+    for (s = 0; s < SIP_ALERT_SINK_MAX; s++) {
+        while ((ev = TAILQ_FIRST(&sinks[s].head)) != NULL) {
+            SipAlertJournalWrite(ev, ev->pending);
+            uint8_t i = 0;
+            for (i = s; i < SIP_ALERT_SINK_MAX; i++) {
+                if (ev->pending & SIP_ALERT_SINK_FLAG(i)) {
+                    TAILQ_REMOVE(&sinks[i].head, ev, next[i]);
+                    sinks[i].backlog--;
+                }
+            }
+            SipAlertEventFree(ev);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief   Function to initialize the alert queue, the sinks and to start the
+ *          dispatcher thread.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+static int SipAlertInitDispatcher()
+{
+    char *val = NULL;
+    uint32_t size = SIP_ALERT_DEFAULT_QUEUE_SIZE;
+    uint32_t qsize = 1;
+    uint8_t s = 0;
+    struct stat st;
+
+    if (SipConfGet("alert-dispatch.queue-size", &val) == 1)
+        size = strtoul(val, NULL, 10);
+    if (SipConfGet("alert-dispatch.sink-backlog", &val) == 1)
+        sink_backlog = strtoul(val, NULL, 10);
+    if (SipConfGet("alert-dispatch.retry-min", &val) == 1)
+        retry_min = strtoul(val, NULL, 10);
+    if (SipConfGet("alert-dispatch.retry-max", &val) == 1)
+        retry_max = strtoul(val, NULL, 10);
+    if (SipConfGet("alert-dispatch.id-wait", &val) == 1)
+        id_wait = strtoul(val, NULL, 10);
+    if (SipConfGet("alert-coalesce.suppression-window", &val) == 1)
+        suppression_window = strtoul(val, NULL, 10) * 60;
+    if (SipConfGet("alert-dispatch.journal", &val) == 1) {
+        journal_file = strdup(val);
+    } else {
+        journal_file = strdup(SIP_ALERT_DEFAULT_JOURNAL);
+    }
+
+    /* the incidents are kept per institution, also when no hobbit file is
+     * written */
+    if (institution == NULL && SipConfGet("institution", &institution) != 1) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Institution code has"
+        " not been provided in the configuration file");
+        return SIP_ERROR;
+    }
+
+    if (retry_min == 0)
+        retry_min = 1;
+    if (sink_backlog == 0)
+        sink_backlog = 1;
+
+    /* The queue size has to be a power of two */
+    while (qsize < size)
+        qsize <<= 1;
+
+    queue.ring = calloc(qsize, sizeof(SipAlertEvent *));
+    if (queue.ring == NULL || journal_file == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                " the memory");
+        return SIP_ERROR;
+    }
+    queue.mask = qsize - 1;
+    queue.head = 0;
+    queue.tail = 0;
+
+    sinks[SIP_ALERT_SINK_DB].deliver = SipAlertDeliverDB;
+    sinks[SIP_ALERT_SINK_HOBBIT].deliver = SipAlertDeliverHobbit;
+    sinks[SIP_ALERT_SINK_SYSLOG].deliver = SipAlertDeliverSyslog;
+    for (s = 0; s < SIP_ALERT_SINK_MAX; s++) {
+        sinks[s].name = SipAlertSinkName(s);
+        TAILQ_INIT(&sinks[s].head);
+    }
+
+    /* Replay the events left over in the journal by the previous run */
+    if (stat(journal_file, &st) == 0 && st.st_size > 0)
+        journal_cnt = 1;
+
+    sem_init(&dispatcher_sem, 0, 0);
+    dispatcher_stop = 0;
+    if (pthread_create(&dispatcher, NULL, SipAlertDispatcher, NULL) != 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in starting the alert"
+                " dispatcher thread");
+        return SIP_ERROR;
+    }
+    dispatcher_running = 1;
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to apply the reloaded config file to the alert module.
+ *          The suppression window takes effect from the next interval on, the
+ *          sinks are reopened by the dispatcher before its next delivery.
+ */
+void SipAlertReloadConf()
+{
+    char *val = NULL;
+
+    if (SipConfGet("alert-coalesce.suppression-window", &val) == 1) {
+        suppression_window = strtoul(val, NULL, 10) * 60;
+    } else {
+        suppression_window = SIP_ALERT_DEFAULT_SUPPRESSION * 60;
+    }
+
+    if (institution == NULL)
+        SipConfGet("institution", &institution);
+
+    if (dispatcher_running) {
+        __atomic_store_n(&reopen_requested, 1, __ATOMIC_RELEASE);
+        sem_post(&dispatcher_sem);
+    }
+}
+
+/**
+ * \brief   Function to get the alert state of the given tenant. The state is
+ *          created on the first lookup.
+ *
+ * @param accountcode   pointer to the account code of the tenant
+ *
+ * @return  pointer to the alert state or NULL on failure
+ */
+static SipAlertIncident *SipAlertGetIncident(char *accountcode)
+{
+    SipAlertIncident *inc = NULL;
+
+    TAILQ_FOREACH(inc, &incidents, next) {
+        if (strcmp(inc->accountcode, accountcode) == 0)
+            return inc;
+    }
+
+    inc = calloc(1, sizeof(SipAlertIncident));
+    if (inc == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                " the memory");
+        return NULL;
+    }
+    inc->accountcode = strdup(accountcode);
+    inc->state = SIP_INCIDENT_NONE;
+    TAILQ_INSERT_TAIL(&incidents, inc, next);
+
+    return inc;
+}
+
+/**
+ * \brief   Function to convert the interval timestamp in to the seconds since
+ *          the epoch.
+ */
+static time_t SipAlertEventTime(const char *timestamp)
+{
+    struct tm tm_ts = {0,0,0,0,0,0,0,0,0};
+
+    if (sscanf(timestamp, "%d-%d-%d %d:%d:%d", &tm_ts.tm_year, &tm_ts.tm_mon,
+                &tm_ts.tm_mday, &tm_ts.tm_hour, &tm_ts.tm_min,
+                &tm_ts.tm_sec) != 6)
+    {
+        return time(NULL);
+    }
+    tm_ts.tm_year -= 1900;
+    tm_ts.tm_mon -= 1;
+    tm_ts.tm_isdst = -1;
+
+    return mktime(&tm_ts);
+}
+
+/**
+ * \brief   Function to run the alert state machine of the tenant for the
+ *          status of the last interval. An anomalous interval opens a new
+ *          incident, unless the previous anomalous interval of the tenant is
+ *          within the suppression window, in which case the interval is merged
+ *          in to the ongoing incident. The normal intervals within the window
+ *          are suppressed and the first one after the window resolves the
+ *          incident.
+ *
+ * @param inc       pointer to the alert state of the tenant
+ * @param alert     TRUE if the interval is anomalous
+ * @param ev_time   starting time of the interval
+ * @param incident  pointer in which the incident number is returned
+ *
+ * @return  kind of the event to dispatch, or -1 if it has to be suppressed
+ */
+static int SipAlertIncidentUpdate(SipAlertIncident *inc, uint8_t alert,
+        time_t ev_time, uint64_t *incident)
+{
+    uint8_t ongoing = (inc->state == SIP_INCIDENT_OPEN ||
+                       inc->state == SIP_INCIDENT_ONGOING);
+
+    if (alert) {
+        if (ongoing && suppression_window > 0 &&
+                (ev_time - inc->last_anomaly) <= suppression_window)
+        {
+            inc->state = SIP_INCIDENT_ONGOING;
+            inc->last_anomaly = ev_time;
+            inc->intervals++;
+            *incident = inc->incident;
+            return SIP_ALERT_EVENT_APPEND;
+        }
+
+        inc->state = SIP_INCIDENT_OPEN;
+        inc->incident = ++incident_seq;
+        inc->opened = ev_time;
+        inc->last_anomaly = ev_time;
+        inc->intervals = 1;
+        *incident = inc->incident;
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Opened the incident"
+                " %"PRIu64" for %s", inc->incident, inc->accountcode);
+        return SIP_ALERT_EVENT_OPEN;
     }
 
+    if (!ongoing) {
+        *incident = 0;
+        return SIP_ALERT_EVENT_STATUS;
+    }
+
+    if ((ev_time - inc->last_anomaly) <= suppression_window)
+        return -1;
+
+    inc->state = SIP_INCIDENT_RESOLVED;
+    *incident = inc->incident;
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Resolved the incident"
+            " %"PRIu64" for %s after %"PRIu32" anomalous intervals",
+            inc->incident, inc->accountcode, inc->intervals);
+    return SIP_ALERT_EVENT_RESOLVE;
+}
+
+/**
+ * \brief   Function to add a status event to the alert queue and to wake up
+ *          the dispatcher. If the queue is full, the event is spilled to the
+ *          alert journal.
+ *
+ * @param status    status of the SIP system
+ * @param timestamp starting time of the interval
+ * @param kind      kind of the event
+ * @param incident  incident number of the event, 0 if none
+ * @param pending   mask of the sinks to which the event is delivered
+ * @param result    pointer to the call data, which is taken over, or NULL
+ */
+static void SipAlertEventQueue(const char *status, const char *timestamp,
+        int kind, uint64_t incident, uint8_t pending, PGresult **result)
+{
+    SipAlertEvent *ev = NULL;
+
+    ev = calloc(1, sizeof(SipAlertEvent));
+    if (ev == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                " the memory");
+        return;
+    }
+
+    strncpy(ev->status, status, sizeof(ev->status) - 1);
+    strncpy(ev->timestamp, timestamp, sizeof(ev->timestamp) - 1);
+    ev->pending = pending;
+    ev->kind = kind;
+    ev->incident = incident;
+    ev->queued = time(NULL);
+    if (result != NULL) {
+        ev->result = *result;
+        *result = NULL;
+    }
+
+    if (SipAlertQueuePush(ev) != SIP_OK) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Alert queue is full,"
+                " spilling the %s event of %s to the journal", ev->status,
+                ev->timestamp);
+        SipAlertJournalWrite(ev, ev->pending);
+        SipAlertEventFree(ev);
+        return;
+    }
+
+    sem_post(&dispatcher_sem);
+}
+
+/**
+ * \brief   Function to hand over the status of the last interval to the alert
+ *          dispatcher. The status is logged to the alert file, which is
+ *          monitored by xymon, which on alert will send the alerts to
+ *          responsible person at the target institution in given method
+ *          such as email, sms etc. The call data of an alert is taken over by
+ *          the dispatcher and the result pointer is set to NULL. If the alert
+ *          queue is full, the event is spilled to the alert journal, so the
+ *          detection never waits for the sinks.
+ *
+ *          The repeated alerts of an incident are not notified again, only
+ *          their calls are appended to the alert database.
+ *
+ * @param status        Status of the SIP system to be logged in to the file
+ * @param result        pointer to the result which contains the call data
+ * 
+ */
+void SipAlertNotification(char *status, PGresult **result)
+{
+    SipAlertIncident *inc = NULL;
+    uint8_t pending = 0;
+    uint8_t iface = 0;
+    uint8_t alert = (strncmp(status, SIP_STATUS_ALERT, 5) == 0);
+    uint64_t incident = 0;
+    int kind = SIP_ALERT_EVENT_STATUS;
+
+    inc = SipAlertGetIncident(institution);
+    if (inc != NULL) {
+        kind = SipAlertIncidentUpdate(inc, alert,
+                SipAlertEventTime(SipGetTimeStamp()), &incident);
+        if (kind < 0)
+            return;
+    } else if (alert) {
+        kind = SIP_ALERT_EVENT_OPEN;
+    }
+
+    if (alert) {
+        pending |= SIP_ALERT_SINK_FLAG(SIP_ALERT_SINK_DB);
+        if (SIP_PROBE_ENABLED(alert__raised)) {
+            SIP_PROBE4(alert__raised, institution, SipGetTimeStamp(), kind,
+                    incident);
+        }
+    }
+
+    if (kind != SIP_ALERT_EVENT_APPEND) {
+        /* The alert mode may change by a reload of the config file */
+        iface = __atomic_load_n(&iface_ctx->iface, __ATOMIC_ACQUIRE);
+        if (iface & SIP_ALERT_IFACE_HOBBIT)
+            pending |= SIP_ALERT_SINK_FLAG(SIP_ALERT_SINK_HOBBIT);
+
+        /* If the status is OK and we are in syslog mode, then no need to log
+         * it to the syslog */
+        if ((iface & SIP_ALERT_IFACE_SYSLOG) &&
+                (kind != SIP_ALERT_EVENT_STATUS ||
+                 (iface & SIP_ALERT_IFACE_HOBBIT)))
+        {
+            pending |= SIP_ALERT_SINK_FLAG(SIP_ALERT_SINK_SYSLOG);
+        }
+    }
+
+    if (pending == 0)
+        return;
+
+    SipAlertEventQueue(status, SipGetTimeStamp(), kind, incident, pending,
+            alert ? result : NULL);
+}
+
+/**
+ * \brief   Function to hand over a provisional alert of the open interval to
+ *          the alert dispatcher. It is only written to the hobbit file and the
+ *          syslog, the calls are logged to the alert database and the incident
+ *          is opened by the decision at the end of the interval.
+ *
+ * @param timestamp     starting time of the open interval
+ */
+void SipAlertWarning(const char *timestamp)
+{
+    uint8_t pending = 0;
+    uint8_t iface = __atomic_load_n(&iface_ctx->iface, __ATOMIC_ACQUIRE);
+
+    if (iface & SIP_ALERT_IFACE_HOBBIT)
+        pending |= SIP_ALERT_SINK_FLAG(SIP_ALERT_SINK_HOBBIT);
+    if (iface & SIP_ALERT_IFACE_SYSLOG)
+        pending |= SIP_ALERT_SINK_FLAG(SIP_ALERT_SINK_SYSLOG);
+
+    if (pending == 0)
+        return;
+
+    SipAlertEventQueue(SIP_STATUS_WARNING, timestamp, SIP_ALERT_EVENT_WARNING,
+            0, pending, NULL);
 }
 
 /**
@@ -305,6 +1537,27 @@ void SipAlertNotification(char *status, PGresult **result)
  */
 void SipAlertDeInitCtx()
 {
+    /* Stop the dispatcher, it delivers or journals the remaining events */
+    if (dispatcher_running) {
+        dispatcher_stop = 1;
+        sem_post(&dispatcher_sem);
+        pthread_join(dispatcher, NULL);
+        dispatcher_running = 0;
+        sem_destroy(&dispatcher_sem);
+    }
+
+    SipAlertIncident *inc = NULL;
+    while ((inc = TAILQ_FIRST(&incidents)) != NULL) {
+        TAILQ_REMOVE(&incidents, inc, next);
+        free(inc->accountcode);
+        free(inc);
+    }
+
+    if (queue.ring != NULL)
+        free(queue.ring);
+    if (journal_file != NULL)
+        free(journal_file);
+
     if (iface_ctx != NULL) {
         switch (iface_ctx->iface) {
             case SIP_ALERT_IFACE_HOBBIT:
@@ -330,7 +1583,8 @@ void SipAlertDeInitCtx()
         }
         free(iface_ctx);
     }
-    PQfinish(alert_conn);
+    if (alert_seq != NULL)
+        free(alert_seq);
     SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Alert module has been "
             "de-initialized");
 }
\ No newline at end of file
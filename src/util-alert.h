@@ -26,20 +26,127 @@
 #define	_UTIL_ALERT_H
 
 #include <syslog.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "queue.h"
 
 #define SIP_ALERT_IFACE_SYSLOG  0x01
 #define SIP_ALERT_IFACE_HOBBIT  0x02
 
+/* Sinks to which the alert dispatcher delivers the events */
+enum {
+    SIP_ALERT_SINK_DB = 0,
+    SIP_ALERT_SINK_HOBBIT,
+    SIP_ALERT_SINK_SYSLOG,
+
+    SIP_ALERT_SINK_MAX,     /* Keep it last always */
+};
+
+#define SIP_ALERT_SINK_FLAG(s)      (1 << (s))
+
+/* Kind of the status events */
+#define SIP_ALERT_EVENT_STATUS      0   /* status of a normal interval */
+#define SIP_ALERT_EVENT_OPEN        1   /* first anomalous interval */
+#define SIP_ALERT_EVENT_APPEND      2   /* further interval of an incident */
+#define SIP_ALERT_EVENT_RESOLVE     3   /* incident has been resolved */
+#define SIP_ALERT_EVENT_WARNING     4   /* alert of the open interval */
+
+/* States of the incident of a tenant */
+enum {
+    SIP_INCIDENT_NONE = 0,
+    SIP_INCIDENT_OPEN,
+    SIP_INCIDENT_ONGOING,
+    SIP_INCIDENT_RESOLVED,
+};
+
+/* Number of recent incidents for which the dispatcher remembers the alert id */
+#define SIP_ALERT_INCIDENT_SLOTS    64
+
+#define SIP_ALERT_DEFAULT_QUEUE_SIZE    256
+#define SIP_ALERT_DEFAULT_SINK_BACKLOG  1024
+#define SIP_ALERT_DEFAULT_RETRY_MIN     1
+#define SIP_ALERT_DEFAULT_RETRY_MAX     60
+#define SIP_ALERT_DEFAULT_ID_WAIT       30
+#define SIP_ALERT_DEFAULT_JOURNAL       "/var/log/sipade/alert.journal"
+#define SIP_ALERT_DEFAULT_SUPPRESSION   30
+
+/* Number of columns of the call data, which is kept as alert evidence */
+#define SIP_ALERT_EVIDENCE_COLS     7
+
 typedef struct SipAlertCtx_ {
     char *filename;
     uint8_t iface;
     FILE *file_descr;
 }SipAlertCtx;
 
+/**
+ * Status event handed over from the detection to the alert dispatcher. The
+ * event owns the call data result and is freed, once all the sinks in the
+ * pending mask have processed it.
+ */
+typedef struct SipAlertEvent_ {
+    char status[8];
+    char timestamp[25];
+    PGresult *result;
+    uintmax_t alert_id;
+    uint64_t incident;
+    uint8_t kind;
+    uint8_t pending;
+    time_t queued;
+
+    TAILQ_ENTRY(SipAlertEvent_) next[SIP_ALERT_SINK_MAX];
+} SipAlertEvent;
+
+/**
+ * Alert sink with its own backlog of events and retry state.
+ */
+typedef struct SipAlertSink_ {
+    const char *name;
+    int (*deliver)(SipAlertEvent *);
+    uint32_t failures;
+    uint32_t backoff;
+    time_t next_try;
+    uint32_t backlog;
+
+    TAILQ_HEAD(, SipAlertEvent_) head;
+} SipAlertSink;
+
+/**
+ * Alert state of a tenant. Anomalous intervals, which follow each other within
+ * the suppression window, are merged in to one incident.
+ */
+typedef struct SipAlertIncident_ {
+    char *accountcode;
+    uint8_t state;
+    uint64_t incident;
+    time_t opened;
+    time_t last_anomaly;
+    uint32_t intervals;
+
+    TAILQ_ENTRY(SipAlertIncident_) next;
+} SipAlertIncident;
+
+/**
+ * Bounded single producer, single consumer queue between the detection and
+ * the alert dispatcher thread.
+ */
+typedef struct SipAlertQueue_ {
+    SipAlertEvent **ring;
+    uint32_t mask;
+    uint32_t head;          /* written by the dispatcher only */
+    uint32_t tail;          /* written by the detection only */
+} SipAlertQueue;
+
 int SipAlertInitNotification();
 void SipAlertNotification(char *, PGresult **);
+void SipAlertWarning(const char *);
 void SipAlertDeInitCtx();
-int SipLogAlertDB(PGresult *);
+void SipAlertReloadConf();
+int SipAlertLogDB(PGresult *, uintmax_t *);
+int SipAlertInitSequence();
+uint32_t SipAlertQueueDepth();
+uint32_t SipAlertSinkBacklog(uint8_t);
+const char *SipAlertSinkName(uint8_t);
 
 #endif	/* _UTIL_ALERT_H */
 
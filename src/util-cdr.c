@@ -22,10 +22,21 @@
  * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
  */
 
+#include <sys/socket.h>
+#include <poll.h>
+#include <errno.h>
 #include "sipade.h"
 #include "util-cdr.h"
 #include "util-log.h"
 #include "util-conf.h"
+#include "util-metrics.h"
+#include "util-timer.h"
+#include "util-probe.h"
+
+static PGresult *SipCdrQueryDone(SipCdrQuery *, PGresult *);
+
+static uint32_t query_timeout = SIP_CDR_DEFAULT_TIMEOUT;
+static uint64_t query_timeouts = 0;
 
 /**
  * \brief Function to make the connection to the cdr database.
@@ -45,7 +56,8 @@ PGconn *SipInitCdr()
 /**
  * \brief Function used to connect to the given data base with the provided
  *        credentials. It fecthes the credentials from the config file for the
- *        given database.
+ *        given database. The password is kept in the config, as the replay
+ *        threads connect again with it.
  *
  * @param conn_dbname   pointer to the database name to which connection has to
  *                      be made.
@@ -55,91 +67,392 @@ PGconn *SipInitCdr()
  */
 PGconn *SipConnectDB(char *conn_dbname)
 {
-    char *host;
+    return SipConnectDBOpts(conn_dbname, NULL);
+}
+
+/**
+ * \brief   Function to connect to the given database as SipConnectDB() does,
+ *          with further connection parameters, e.g. "replication=database".
+ *
+ * @param conn_dbname   name of the database section in the config file
+ * @param opts          further "key=value" parameters or NULL
+ *
+ * @return  the PGconn object, whose status tells whether it has connected
+ */
+PGconn *SipConnectDBOpts(char *conn_dbname, const char *opts)
+{
+    char conn_info[SIP_CONN_INFO_SIZE];
+    PGconn *conn = NULL;
+
+    SipConnInfo(conn_dbname, NULL, opts, conn_info, sizeof(conn_info));
+
+    /* connect to the data base with the provided connection information */
+    conn = PQconnectdb(conn_info);
+    if(PQstatus(conn) == CONNECTION_BAD) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
+                " connection to %s: %s", conn_dbname, PQerrorMessage(conn));
+    }
+
+    return conn;
+}
+
+/**
+ * \brief   Function to build the connection string of the given database from
+ *          its section in the config file. The password is kept in the config,
+ *          as a lost connection is made again with it.
+ *
+ * @param conn_dbname   name of the database section in the config file
+ * @param host          "host[:port]" to connect to instead of the host of the
+ *                      section, e.g. a read replica, or NULL
+ * @param opts          further "key=value" parameters or NULL
+ * @param buf           buffer in which the string is stored
+ * @param size          size of the buffer
+ */
+void SipConnInfo(char *conn_dbname, const char *host, const char *opts,
+        char *buf, size_t size)
+{
     char *dbname;
     char *user;
-    char * password;
+    char *password;
     char *port;
-    char conn_info[200];
-    PGconn *conn = NULL;
+    char *colon = NULL;
+    char host_s[128];
+    char port_s[16];
     char node_name[50];
 
     /* Get the database connection information from the configuration file */
-    snprintf(node_name, sizeof(node_name), "%s.host",conn_dbname);
-    if (SipConfGet(node_name, &host) != 1) {
-        host = calloc(1, sizeof("localhost"));
-        host = "localhost";
+    snprintf(node_name, sizeof(node_name), "%s.port",conn_dbname);
+    if (SipConfGet(node_name, &port) != 1)
+        port = "5432";
+
+    if (host != NULL) {
+        snprintf(host_s, sizeof(host_s), "%s", host);
+        colon = strrchr(host_s, ':');
+        if (colon != NULL) {
+            *colon = '\0';
+            snprintf(port_s, sizeof(port_s), "%s", colon + 1);
+            port = port_s;
+        }
+    } else {
+        snprintf(node_name, sizeof(node_name), "%s.host",conn_dbname);
+        if (SipConfGet(node_name, &dbname) != 1)
+            dbname = "localhost";
+        snprintf(host_s, sizeof(host_s), "%s", dbname);
     }
 
     snprintf(node_name, sizeof(node_name), "%s.username",conn_dbname);
-    if (SipConfGet(node_name, &user) != 1) {
-        user = calloc(1, sizeof("postgres"));
+    if (SipConfGet(node_name, &user) != 1)
         user = "postgres";
-    }
 
     snprintf(node_name, sizeof(node_name), "%s.password",conn_dbname);
-    if (SipConfGet(node_name, &password) != 1) {
+    if (SipConfGet(node_name, &password) != 1)
         password = NULL;
-    }
 
     snprintf(node_name, sizeof(node_name), "%s.database-name",conn_dbname);
-    if (SipConfGet(node_name, &dbname) != 1) {
-        dbname = calloc(1, sizeof("mydb"));
+    if (SipConfGet(node_name, &dbname) != 1)
         dbname = "mydb";
-    }
-
-    snprintf(node_name, sizeof(node_name), "%s.port",conn_dbname);
-    if (SipConfGet(node_name, &port) != 1) {
-        port = calloc(1, sizeof("5432"));
-        port = "5432";
-    }
 
     if (password != NULL) {
-        sprintf(conn_info, "dbname=%s host=%s port=%s user=%s password=%s "
-                "sslmode=disable",  dbname, host, port, user, password);
+        snprintf(buf, size, "dbname=%s host=%s port=%s user=%s password=%s"
+                " sslmode=disable %s",  dbname, host_s, port, user, password,
+                (opts != NULL) ? opts : "");
     } else {
-        sprintf(conn_info, "dbname=%s host=%s port=%s user=%s "
-                "sslmode=disable",  dbname, host, port, user);
+        snprintf(buf, size, "dbname=%s host=%s port=%s user=%s"
+                " sslmode=disable %s",  dbname, host_s, port, user,
+                (opts != NULL) ? opts : "");
     }
+}
 
-    /* connect to the data base with the provided connection information */
-    conn = PQconnectdb(conn_info);
-    if(PQstatus(conn) == CONNECTION_BAD) {
-        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
-                " connection \"%s\"", conn_info);
-    }
+/**
+ * \brief   Function to set the seconds a statement may take, before it is
+ *          cancelled. A timeout of 0 lets the statements run for ever.
+ */
+void SipCdrSetTimeout(uint32_t timeout)
+{
+    __atomic_store_n(&query_timeout, timeout, __ATOMIC_RELAXED);
+}
 
-    /* we don't need to keep password in the memory any longer */
-    if (password != NULL)
-        memset(password, 0, strlen(password));
+/**
+ * \brief   Function to get the number of the statements, which have been given
+ *          up at their deadline or cancelled by the server, so far.
+ */
+uint64_t SipCdrTimeouts()
+{
+    return __atomic_load_n(&query_timeouts, __ATOMIC_RELAXED);
+}
 
-    return conn;
+/**
+ * \brief   Function to count the statement, which has timed out.
+ */
+static void SipCdrQueryTimedOut(SipCdrQuery *q)
+{
+    if (q->timedout)
+        return;
+
+    q->timedout = 1;
+    __atomic_add_fetch(&query_timeouts, 1, __ATOMIC_RELAXED);
+    SipMetricsIncTimeout(q->stmt);
+}
+
+/**
+ * \brief   Function to wait until the socket of the query is ready for the
+ *          given events or its deadline has passed.
+ *
+ * @return  TRUE if the socket is ready, FALSE at the deadline
+ */
+static int SipCdrQueryWait(SipCdrQuery *q, short events)
+{
+    struct pollfd pfd;
+    time_t now = 0;
+    int wait = -1;
+    int ret = 0;
+
+    pfd.fd = PQsocket(q->conn);
+    pfd.events = events;
+
+    do {
+        if (q->deadline > 0) {
+            now = time(NULL);
+            if (now >= q->deadline)
+                return FALSE;
+            wait = (q->deadline - now) * 1000;
+        }
+        pfd.revents = 0;
+        ret = poll(&pfd, 1, wait);
+    } while (ret == 0 || (ret < 0 && errno == EINTR));
+
+    /* an error of the socket is reported by libpq on the next read */
+    return TRUE;
 }
 
 /**
  * \brief   Function to make the given query to the databse connected to the
- *          conn object
+ *          conn object. The query is cancelled, if it has not returned by its
+ *          deadline.
  *
  * @param conn  Connection to the provided data base
  * @param query Query string which tells that what data is required
+ * @param stmt  Statement to which the latency is accounted in the metrics,
+ *              one of the SIP_METRIC_STMT_* values
  *
  * @return On failure function returns null pointer, otherwise the function
  *         returns the Pgresult object which points to the required data
  * 
  */
-PGresult *SipGetCdr(PGconn *conn, const char *query)
+PGresult *SipGetCdr(PGconn *conn, const char *query, int stmt)
 {
     PGresult *result = NULL;
+    SipCdrQuery q;
+    int ret = SIP_OK;
 
     /* Get the required data from the data base connected to the given
      * connection */
-    result = PQexec(conn, query);
+    ret = SipCdrQuerySend(&q, conn, query, stmt);
+    while (ret == SIP_PENDING) {
+        if (SipCdrQueryWait(&q, POLLOUT) == FALSE) {
+            if (SipCdrQueryCancel(&q) == SIP_ERROR) {
+                ret = SIP_ERROR;
+                break;
+            }
+        }
+        ret = SipCdrQueryFlush(&q);
+    }
+
+    while (ret == SIP_OK || ret == SIP_PENDING) {
+        if (SipCdrQueryWait(&q, POLLIN) == FALSE) {
+            ret = SipCdrQueryCancel(&q);
+            continue;
+        }
+
+        ret = SipCdrQueryResult(&q, &result);
+        if (ret == SIP_OK)
+            break;
+    }
+
+    if (q.result != NULL)
+        PQclear(q.result);
+
+    /* the connection is used blocking by the other statements */
+    if (conn != NULL)
+        PQsetnonblocking(conn, 0);
+
+    return (ret == SIP_OK) ? result : NULL;
+}
+
+/**
+ * \brief Function to check the result of a query and to account its latency.
+ *
+ * @param q         the query
+ * @param result    result of the query, which is cleared on failure
+ *
+ * @return the result on success and NULL on failure
+ */
+static PGresult *SipCdrQueryDone(SipCdrQuery *q, PGresult *result)
+{
+    const char *state = NULL;
+    uint64_t ns = 0;
+
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
-        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
-                " given query \"%s\"", query);
+        state = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+        if (state != NULL && strcmp(state, SIP_CDR_QUERY_CANCELED) == 0) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "The given query \"%s\""
+                    " has been cancelled, it has taken too long", q->query);
+            SipCdrQueryTimedOut(q);
+        } else {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
+                    " given query \"%s\"", q->query);
+        }
         PQclear(result);
         return NULL;
     }
 
+    /* Only the interval queries are on the hot path */
+    if (q->stmt == SIP_METRIC_STMT_INTERVAL) {
+        ns = SipTimerRecord(SIP_TIMER_CDR_FETCH, q->start);
+        SipTimerRecordValue(SIP_TIMER_CDR_ROWS, PQntuples(result));
+        SipMetricsAddRows(PQntuples(result));
+    } else {
+        ns = SipTimerNs(SipTimerTicks() - q->start);
+    }
+    SipMetricsObserveQuery(q->stmt, ns / 1e9);
+    SIP_PROBE3(query__done, q->stmt, PQntuples(result), ns);
+
     return result;
-}
\ No newline at end of file
+}
+
+/**
+ * \brief Function to send the query without waiting for its result. The
+ *        connection is switched to the nonblocking mode, its result is taken
+ *        by SipCdrQueryResult() once the socket of the connection is readable.
+ *
+ * @param query     query string
+ * @param stmt      one of the SIP_METRIC_STMT_* values
+ *
+ * @return On success SIP_OK, if the query is sent out completely, SIP_PENDING
+ *         if the rest has to be flushed by SipCdrQueryFlush(), once the socket
+ *         is writable, and SIP_ERROR on failure.
+ */
+int SipCdrQuerySend(SipCdrQuery *q, PGconn *conn, const char *query,
+        int stmt)
+{
+    q->conn = conn;
+    q->stmt = stmt;
+    q->result = NULL;
+    q->start = SipTimerTicks();
+    q->cancelled = 0;
+    q->timedout = 0;
+    q->deadline = __atomic_load_n(&query_timeout, __ATOMIC_RELAXED);
+    if (q->deadline > 0)
+        q->deadline += time(NULL);
+    strncpy(q->query, query, sizeof(q->query) - 1);
+    q->query[sizeof(q->query) - 1] = '\0';
+
+    SIP_PROBE2(query__start, stmt, query);
+
+    if (PQsetnonblocking(conn, 1) != 0 || PQsendQuery(conn, query) == 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in sending the"
+                " given query \"%s\": %s", query, PQerrorMessage(conn));
+        return SIP_ERROR;
+    }
+
+    return SipCdrQueryFlush(q);
+}
+
+/**
+ * \brief Function to flush the rest of the sent query.
+ *
+ * @return SIP_OK if it is sent out, SIP_PENDING if the socket is not writable
+ *         and SIP_ERROR on failure
+ */
+int SipCdrQueryFlush(SipCdrQuery *q)
+{
+    int ret = PQflush(q->conn);
+
+    if (ret < 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in sending the"
+                " given query \"%s\": %s", q->query, PQerrorMessage(q->conn));
+        return SIP_ERROR;
+    }
+
+    return (ret == 0) ? SIP_OK : SIP_PENDING;
+}
+
+/**
+ * \brief Function to read the result of the sent query from the connection,
+ *        when its socket is readable.
+ *
+ * @param q         the sent query
+ * @param result    pointer which is set to the result, when it is complete
+ *
+ * @return SIP_OK when the result is complete, SIP_PENDING if more data has to
+ *         be read and SIP_ERROR on failure
+ */
+int SipCdrQueryResult(SipCdrQuery *q, PGresult **result)
+{
+    PGresult *res = NULL;
+
+    if (PQconsumeInput(q->conn) == 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in reading the"
+                " result of \"%s\": %s", q->query, PQerrorMessage(q->conn));
+        return SIP_ERROR;
+    }
+
+    /* the last result of the query is followed by a null */
+    while (!PQisBusy(q->conn)) {
+        res = PQgetResult(q->conn);
+        if (res == NULL) {
+            *result = SipCdrQueryDone(q, q->result);
+            q->result = NULL;
+            return (*result != NULL) ? SIP_OK : SIP_ERROR;
+        }
+
+        if (q->result != NULL)
+            PQclear(q->result);
+        q->result = res;
+    }
+
+    return SIP_PENDING;
+}
+
+/**
+ * \brief Function to cancel the query, which has not returned by its deadline.
+ *        The error of the cancelled query is then read as its result. If it
+ *        does not come within SIP_CDR_CANCEL_WAIT seconds either, the
+ *        connection is shut down, so that its status is CONNECTION_BAD.
+ *
+ * @param q     the sent query
+ *
+ * @return SIP_OK if the cancel has been sent, with the deadline moved to the
+ *         wait for the error, and SIP_ERROR if the connection is given up
+ */
+int SipCdrQueryCancel(SipCdrQuery *q)
+{
+    PGcancel *cancel = NULL;
+    char err[256];
+
+    SipCdrQueryTimedOut(q);
+
+    if (q->cancelled == 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Cancelling the given query"
+                " \"%s\", it has not returned in time", q->query);
+
+        cancel = PQgetCancel(q->conn);
+        if (cancel != NULL && PQcancel(cancel, err, sizeof(err)) == 1) {
+            PQfreeCancel(cancel);
+            q->cancelled = 1;
+            q->deadline = time(NULL) + SIP_CDR_CANCEL_WAIT;
+            return SIP_OK;
+        }
+
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in cancelling the"
+                " query: %s", (cancel != NULL) ? err : "out of memory");
+        PQfreeCancel(cancel);
+    }
+
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Giving up the connection of the"
+            " query \"%s\"", q->query);
+    shutdown(PQsocket(q->conn), SHUT_RDWR);
+    PQconsumeInput(q->conn);
+    return SIP_ERROR;
+}
+
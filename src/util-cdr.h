@@ -27,9 +27,48 @@
 #ifndef _UTIL_CDR_H
 #define	_UTIL_CDR_H
 
+/* Size of the connection string of a database */
+#define SIP_CONN_INFO_SIZE      512
+
+/* Size of the query string of an interval */
+#define DEFAULT_QUERY_SIZE      512
+
+/* Seconds a statement may take, before it is cancelled */
+#define SIP_CDR_DEFAULT_TIMEOUT 60
+
+/* Seconds waited for a cancelled statement to return, before its connection
+ * is given up */
+#define SIP_CDR_CANCEL_WAIT     5
+
+/* SQLSTATE of a statement cancelled by PQcancel() or by statement_timeout */
+#define SIP_CDR_QUERY_CANCELED  "57014"
+
+/**
+ * Query sent on a nonblocking connection, of which the result is read as the
+ * socket of the connection becomes readable.
+ */
+typedef struct SipCdrQuery_ {
+    PGconn *conn;
+    PGresult *result;       /* last result received so far */
+    int stmt;               /* SIP_METRIC_STMT_* */
+    uint64_t start;
+    time_t deadline;        /* when it is cancelled, 0 for never */
+    uint8_t cancelled;      /* the cancel has been sent */
+    uint8_t timedout;       /* given up at its deadline or by the server */
+    char query[DEFAULT_QUERY_SIZE];
+} SipCdrQuery;
+
 PGconn *SipInitCdr();
 PGconn *SipConnectDB(char *);
-PGresult *SipGetCdr(PGconn *, const char *);
+PGconn *SipConnectDBOpts(char *, const char *);
+void SipConnInfo(char *, const char *, const char *, char *, size_t);
+PGresult *SipGetCdr(PGconn *, const char *, int);
+int SipCdrQuerySend(SipCdrQuery *, PGconn *, const char *, int);
+int SipCdrQueryFlush(SipCdrQuery *);
+int SipCdrQueryResult(SipCdrQuery *, PGresult **);
+int SipCdrQueryCancel(SipCdrQuery *);
+void SipCdrSetTimeout(uint32_t);
+uint64_t SipCdrTimeouts();
 
 #endif	/* _UTIL_CDR_H */
 
@@ -0,0 +1,722 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-cdrgen.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Generator of synthetic call detail records for benchmarking the engine.
+ * The call volume of each tenant follows a diurnal and a weekly curve, the
+ * calls are spread over the calltypes by a configurable mix and their
+ * billsec is exponentially distributed per calltype. Fraud scenarios can be
+ * injected on top of the normal traffic. The CDRs are generated in the order
+ * of their call date and are reproducible for the same seed.
+ */
+
+#include <math.h>
+#include "sipade.h"
+#include "util-cdrgen.h"
+#include "util-log.h"
+
+#define SIP_CDRGEN_MAX_BILLSEC      14400   /* four hours */
+#define SIP_CDRGEN_EXTENSIONS       10000
+
+const char *sip_cdrgen_calltypes[MAX_CALLTYPE] = {
+    [INTERNATIONAL] = "INTERNATIONAL",
+    [MOBILE] = "MOBILE",
+    [PREMIUM] = "PREMIUM",
+    [SERVICE] = "SERVICE",
+    [DOMESTIC] = "DOMESTIC",
+    [EMERGENCY] = "EMERGENCY",
+};
+
+const char *sip_cdrgen_attacks[SIP_CDRGEN_ATTACK_MAX] = {
+    [SIP_CDRGEN_ATTACK_PREMIUM] = "premium",
+    [SIP_CDRGEN_ATTACK_DRIP] = "drip",
+    [SIP_CDRGEN_ATTACK_WANGIRI] = "wangiri",
+    [SIP_CDRGEN_ATTACK_PBX] = "pbx",
+};
+
+/* Default calls per minute of the attacks */
+static const double attack_rates[SIP_CDRGEN_ATTACK_MAX] = {
+    [SIP_CDRGEN_ATTACK_PREMIUM] = 4.0,
+    [SIP_CDRGEN_ATTACK_DRIP] = 0.5,
+    [SIP_CDRGEN_ATTACK_WANGIRI] = 3.0,
+    [SIP_CDRGEN_ATTACK_PBX] = 10.0,
+};
+
+/* Call volume of each hour relative to the peak of a working day */
+static const double diurnal[25] = {
+    0.03, 0.02, 0.02, 0.02, 0.03, 0.05, 0.12, 0.35, 0.75, 1.00, 1.00, 0.90,
+    0.70, 0.90, 1.00, 0.95, 0.75, 0.45, 0.25, 0.18, 0.14, 0.10, 0.07, 0.04,
+    0.03,
+};
+
+/* Call volume of each week day (Sunday first) relative to a working day */
+static const double weekly[7] = { 0.15, 1.00, 1.00, 1.00, 1.00, 0.90, 0.25 };
+
+/* Country codes of the international calls, and of the attack destinations */
+static const uint64_t countries[] = { 44, 46, 45, 49, 1, 33, 91, 48, 63, 234 };
+static const uint64_t fraud_countries[] = { 882, 252, 222, 373, 690, 239 };
+static const uint64_t emergency[] = { 110, 112, 113 };
+
+static inline uint64_t SipCdrGenRand(SipCdrGen *gen)
+{
+    uint64_t x = gen->rng;
+
+    /* xorshift64* */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    gen->rng = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double SipCdrGenUniform(SipCdrGen *gen)
+{
+    return (SipCdrGenRand(gen) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint32_t SipCdrGenExp(SipCdrGen *gen, double mean)
+{
+    double v = -mean * log(1.0 - SipCdrGenUniform(gen));
+
+    return (v > SIP_CDRGEN_MAX_BILLSEC) ? SIP_CDRGEN_MAX_BILLSEC : (uint32_t)v;
+}
+
+/**
+ * \brief   Function to draw the number of calls in a minute for the given
+ *          mean, from the Poisson distribution. Large means are approximated
+ *          by the normal distribution.
+ */
+static uint32_t SipCdrGenPoisson(SipCdrGen *gen, double mean)
+{
+    double limit = 0.0;
+    double p = 1.0;
+    double n = 0.0;
+    uint32_t k = 0;
+
+    if (mean <= 0.0)
+        return 0;
+
+    if (mean > 30.0) {
+        n = sqrt(-2.0 * log(1.0 - SipCdrGenUniform(gen))) *
+            cos(2.0 * M_PI * SipCdrGenUniform(gen));
+        n = mean + sqrt(mean) * n + 0.5;
+        return (n < 0.0) ? 0 : (uint32_t)n;
+    }
+
+    limit = exp(-mean);
+    do {
+        k++;
+        p *= SipCdrGenUniform(gen);
+    } while (p > limit);
+
+    return k - 1;
+}
+
+/**
+ * \brief   Function to initialize the generator for the given range with the
+ *          default calltype mix and billsec.
+ *
+ * @param gen   pointer to the generator
+ * @param start start of the range
+ * @param end   end of the range, excluded
+ * @param seed  seed of the random numbers
+ *
+ * @return SIP_OK on success and SIP_ERROR on failure
+ */
+int SipCdrGenInit(SipCdrGen *gen, time_t start, time_t end, uint64_t seed)
+{
+    memset(gen, 0, sizeof(SipCdrGen));
+
+    /* the generation goes minute by minute */
+    gen->start = start - (start % 60);
+    gen->end = end;
+    gen->seed = seed;
+    gen->rng = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    gen->minute = gen->start;
+    gen->next_id = 1;
+    gen->answered = 0.8;
+    gen->date_sec = -1;
+
+    gen->mix[DOMESTIC] = 0.50;
+    gen->mix[MOBILE] = 0.30;
+    gen->mix[INTERNATIONAL] = 0.08;
+    gen->mix[SERVICE] = 0.06;
+    gen->mix[PREMIUM] = 0.04;
+    gen->mix[EMERGENCY] = 0.02;
+
+    gen->billsec[DOMESTIC] = 120;
+    gen->billsec[MOBILE] = 90;
+    gen->billsec[INTERNATIONAL] = 240;
+    gen->billsec[SERVICE] = 60;
+    gen->billsec[PREMIUM] = 180;
+    gen->billsec[EMERGENCY] = 60;
+
+    gen->buf_size = 1024;
+    gen->buf = malloc(2 * gen->buf_size * sizeof(SipCdr));
+    if (gen->buf == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                " the memory");
+        return SIP_ERROR;
+    }
+
+    return SIP_OK;
+}
+
+void SipCdrGenDeInit(SipCdrGen *gen)
+{
+    if (gen->buf != NULL)
+        free(gen->buf);
+    gen->buf = NULL;
+}
+
+/**
+ * \brief   Function to add a tenant, its extensions get their own number block.
+ *
+ * @param gen   pointer to the generator
+ * @param name  account code of the tenant
+ * @param rate  calls per hour at the peak of a working day
+ */
+int SipCdrGenAddTenant(SipCdrGen *gen, const char *name, double rate)
+{
+    SipCdrGenTenant *t = NULL;
+
+    if (gen->tenant_cnt >= SIP_CDRGEN_MAX_TENANTS ||
+            strlen(name) >= SIP_CDRGEN_NAME_LEN ||
+            strpbrk(name, "\t\n\\,") != NULL)
+    {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Invalid tenant \"%s\", or"
+                " too many tenants", name);
+        return SIP_ERROR;
+    }
+
+    t = &gen->tenants[gen->tenant_cnt];
+    strcpy(t->name, name);
+    t->rate = rate;
+    t->prefix = 20000000 + (uint64_t)gen->tenant_cnt * SIP_CDRGEN_EXTENSIONS;
+    gen->tenant_cnt++;
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to add an attack given as
+ *          "kind:tenant:start:duration[:rate]", where the start is the offset
+ *          from the start of the dataset and the duration are in minutes and
+ *          the rate in calls per minute.
+ */
+int SipCdrGenAddAttack(SipCdrGen *gen, const char *spec)
+{
+    SipCdrGenAttack *a = NULL;
+    char kind[16];
+    char tenant[SIP_CDRGEN_NAME_LEN];
+    unsigned long start = 0;
+    unsigned long duration = 0;
+    double rate = 0.0;
+    int n = 0;
+    int i = 0;
+
+    n = sscanf(spec, "%15[^:]:%31[^:]:%lu:%lu:%lf", kind, tenant, &start,
+            &duration, &rate);
+    if (n < 4 || gen->attack_cnt >= SIP_CDRGEN_MAX_ATTACKS) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Invalid attack \"%s\", it"
+                " has to be kind:tenant:start:duration[:rate]", spec);
+        return SIP_ERROR;
+    }
+
+    a = &gen->attacks[gen->attack_cnt];
+    for (i = 0; i < SIP_CDRGEN_ATTACK_MAX; i++) {
+        if (strcmp(kind, sip_cdrgen_attacks[i]) == 0)
+            break;
+    }
+    if (i == SIP_CDRGEN_ATTACK_MAX) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Unknown attack \"%s\", it"
+                " has to be premium, drip, wangiri or pbx", kind);
+        return SIP_ERROR;
+    }
+    a->kind = i;
+
+    for (i = 0; i < gen->tenant_cnt; i++) {
+        if (strcmp(tenant, gen->tenants[i].name) == 0)
+            break;
+    }
+    if (i == gen->tenant_cnt) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Unknown tenant \"%s\" of"
+                " the attack", tenant);
+        return SIP_ERROR;
+    }
+    a->tenant = i;
+
+    a->start = gen->start + start * 60;
+    a->end = a->start + duration * 60;
+    a->rate = (n == 5) ? rate : attack_rates[a->kind];
+    gen->attack_cnt++;
+
+    return SIP_OK;
+}
+
+static inline SipCdr *SipCdrGenSlot(SipCdrGen *gen)
+{
+    SipCdr *buf = NULL;
+
+    if (gen->buf_cnt == gen->buf_size) {
+        buf = realloc(gen->buf, 4 * gen->buf_size * sizeof(SipCdr));
+        if (buf == NULL)
+            return NULL;
+        gen->buf = buf;
+        gen->buf_size *= 2;
+    }
+
+    return &gen->buf[gen->buf_cnt++];
+}
+
+/**
+ * \brief   Function to generate a normal call of the tenant.
+ */
+static void SipCdrGenCall(SipCdrGen *gen, SipCdr *cdr, uint16_t tenant)
+{
+    double pick = SipCdrGenUniform(gen);
+    uint64_t r = SipCdrGenRand(gen);
+    uint8_t ct = 0;
+
+    for (ct = 0; ct < MAX_CALLTYPE - 1 && pick >= gen->mix[ct]; ct++)
+        pick -= gen->mix[ct];
+
+    cdr->calltype = ct;
+    cdr->tenant = tenant;
+    cdr->attack = 0;
+    cdr->src = gen->tenants[tenant].prefix + r % SIP_CDRGEN_EXTENSIONS;
+    r /= SIP_CDRGEN_EXTENSIONS;
+
+    switch (ct) {
+        case INTERNATIONAL:
+            cdr->dst = countries[r % 10] * 1000000000ULL + (r >> 8) % 100000000;
+            break;
+        case MOBILE:
+            cdr->dst = 40000000 + r % 10000000 + (r & 1) * 50000000;
+            break;
+        case PREMIUM:
+            cdr->dst = 82000000 + r % 100000;
+            break;
+        case SERVICE:
+            cdr->dst = 80000000 + r % 100000;
+            break;
+        case EMERGENCY:
+            cdr->dst = emergency[r % 3];
+            break;
+        default:
+            cdr->dst = 20000000 + r % 80000000;
+            break;
+    }
+
+    if (ct == EMERGENCY || SipCdrGenUniform(gen) < gen->answered)
+        cdr->billsec = SipCdrGenExp(gen, gen->billsec[ct]);
+    else
+        cdr->billsec = 0;
+}
+
+/**
+ * \brief   Function to generate a fraudulent call of the given attack.
+ */
+static void SipCdrGenAttackCall(SipCdrGen *gen, SipCdr *cdr, uint8_t idx)
+{
+    SipCdrGenAttack *a = &gen->attacks[idx];
+    uint64_t prefix = gen->tenants[a->tenant].prefix;
+    uint64_t r = SipCdrGenRand(gen);
+
+    cdr->tenant = a->tenant;
+    cdr->attack = idx + 1;
+
+    switch (a->kind) {
+        case SIP_CDRGEN_ATTACK_PREMIUM:
+            /* a hijacked extension calling a few premium numbers */
+            cdr->calltype = PREMIUM;
+            cdr->src = prefix + 9999;
+            cdr->dst = 82012340 + r % 4;
+            cdr->billsec = SipCdrGenExp(gen, 900);
+            break;
+        case SIP_CDRGEN_ATTACK_DRIP:
+            /* long calls to an expensive destination, under the radar */
+            cdr->calltype = INTERNATIONAL;
+            cdr->src = prefix + r % SIP_CDRGEN_EXTENSIONS;
+            cdr->dst = fraud_countries[r % 2] * 1000000000ULL + 55500000 +
+                (r >> 8) % 10;
+            cdr->billsec = SipCdrGenExp(gen, 600);
+            break;
+        case SIP_CDRGEN_ATTACK_WANGIRI:
+            /* many victims calling back the numbers of a missed call */
+            cdr->calltype = INTERNATIONAL;
+            cdr->src = prefix + r % SIP_CDRGEN_EXTENSIONS;
+            cdr->dst = fraud_countries[2 + r % 2] * 1000000000ULL + 77700000 +
+                (r >> 8) % 20;
+            cdr->billsec = 20 + SipCdrGenExp(gen, 60);
+            break;
+        default:
+            /* a hacked PBX dialing out over a few trunks */
+            cdr->calltype = (r % 10 < 7) ? INTERNATIONAL : PREMIUM;
+            cdr->src = prefix + 9990 + r % 3;
+            if (cdr->calltype == INTERNATIONAL)
+                cdr->dst = fraud_countries[r % 6] * 1000000000ULL +
+                    (r >> 8) % 100000000;
+            else
+                cdr->dst = 82000000 + (r >> 8) % 100000;
+            cdr->billsec = SipCdrGenExp(gen, 1200);
+            break;
+    }
+}
+
+/**
+ * \brief   Function to generate the CDRs of the next minute, in the order of
+ *          their call date.
+ *
+ * @return SIP_OK on success, SIP_DONE at the end of the range and SIP_ERROR
+ *         on failure
+ */
+static int SipCdrGenMinute(SipCdrGen *gen)
+{
+    struct tm tm;
+    SipCdr *cdr = NULL;
+    SipCdr *sorted = NULL;
+    uint32_t count[61];
+    double factor = 0.0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint16_t t = 0;
+    uint8_t a = 0;
+
+    gen->buf_cnt = 0;
+    gen->buf_pos = 0;
+
+    while (gen->buf_cnt == 0) {
+        if (gen->minute >= gen->end)
+            return SIP_DONE;
+
+        localtime_r(&gen->minute, &tm);
+        factor = (diurnal[tm.tm_hour] + (diurnal[tm.tm_hour + 1] -
+                    diurnal[tm.tm_hour]) * tm.tm_min / 60.0) *
+                    weekly[tm.tm_wday];
+
+        for (t = 0; t < gen->tenant_cnt; t++) {
+            n = SipCdrGenPoisson(gen, gen->tenants[t].rate / 60.0 * factor);
+            for (i = 0; i < n; i++) {
+                if ((cdr = SipCdrGenSlot(gen)) == NULL)
+                    goto error;
+                SipCdrGenCall(gen, cdr, t);
+                cdr->calldate = gen->minute + SipCdrGenRand(gen) % 60;
+            }
+        }
+
+        for (a = 0; a < gen->attack_cnt; a++) {
+            if (gen->minute < gen->attacks[a].start ||
+                    gen->minute >= gen->attacks[a].end)
+                continue;
+
+            n = SipCdrGenPoisson(gen, gen->attacks[a].rate);
+            for (i = 0; i < n; i++) {
+                if ((cdr = SipCdrGenSlot(gen)) == NULL)
+                    goto error;
+                SipCdrGenAttackCall(gen, cdr, a);
+                cdr->calldate = gen->minute + SipCdrGenRand(gen) % 60;
+            }
+        }
+
+        gen->minute += 60;
+    }
+
+    /* counting sort on the second, in to the second half of the buffer */
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < gen->buf_cnt; i++)
+        count[gen->buf[i].calldate % 60 + 1]++;
+    for (i = 1; i < 61; i++)
+        count[i] += count[i - 1];
+
+    sorted = gen->buf + gen->buf_size;
+    for (i = 0; i < gen->buf_cnt; i++)
+        sorted[count[gen->buf[i].calldate % 60]++] = gen->buf[i];
+
+    for (i = 0; i < gen->buf_cnt; i++) {
+        sorted[i].id = gen->next_id++;
+        gen->buf[i] = sorted[i];
+    }
+
+    return SIP_OK;
+
+error:
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating the memory");
+    return SIP_ERROR;
+}
+
+/**
+ * \brief   Function to get the next CDR of the stream.
+ *
+ * @return SIP_OK on success, SIP_DONE at the end of the range and SIP_ERROR
+ *         on failure
+ */
+int SipCdrGenNext(SipCdrGen *gen, SipCdr *cdr)
+{
+    int ret = SIP_OK;
+
+    if (gen->buf_pos == gen->buf_cnt) {
+        ret = SipCdrGenMinute(gen);
+        if (ret != SIP_OK)
+            return ret;
+    }
+
+    *cdr = gen->buf[gen->buf_pos++];
+    return SIP_OK;
+}
+
+static inline int SipCdrGenItoa(char *buf, uint64_t v)
+{
+    char tmp[20];
+    int n = 0;
+    int i = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+
+    for (i = 0; i < n; i++)
+        buf[i] = tmp[n - 1 - i];
+
+    return n;
+}
+
+/**
+ * \brief   Function to format the CDR as a line of CSV with the columns of
+ *          the interval query (id,calldate,src,dst,billsec,calltype,
+ *          accountcode) or as a line of COPY text without the id, which is
+ *          left to the database.
+ *
+ * @return  length of the line
+ */
+int SipCdrGenFormat(SipCdrGen *gen, const SipCdr *cdr, char *buf, int format)
+{
+    struct tm tm;
+    char sep = (format == SIP_CDRGEN_FORMAT_CSV) ? ',' : '\t';
+    const char *s = NULL;
+    int len = 0;
+
+    if (cdr->calldate != gen->date_sec) {
+        localtime_r(&cdr->calldate, &tm);
+        strftime(gen->date_s, sizeof(gen->date_s), "%F %T", &tm);
+        gen->date_sec = cdr->calldate;
+    }
+
+    if (format == SIP_CDRGEN_FORMAT_CSV) {
+        len = SipCdrGenItoa(buf, cdr->id);
+        buf[len++] = sep;
+    }
+
+    memcpy(buf + len, gen->date_s, 19);
+    len += 19;
+    buf[len++] = sep;
+    len += SipCdrGenItoa(buf + len, cdr->src);
+    buf[len++] = sep;
+    if (cdr->calltype == INTERNATIONAL) {
+        buf[len++] = '0';
+        buf[len++] = '0';
+    }
+    len += SipCdrGenItoa(buf + len, cdr->dst);
+    buf[len++] = sep;
+    len += SipCdrGenItoa(buf + len, cdr->billsec);
+    buf[len++] = sep;
+
+    s = sip_cdrgen_calltypes[cdr->calltype];
+    while (*s != '\0')
+        buf[len++] = *s++;
+    buf[len++] = sep;
+
+    s = gen->tenants[cdr->tenant].name;
+    while (*s != '\0')
+        buf[len++] = *s++;
+    buf[len++] = '\n';
+
+    return len;
+}
+
+/**
+ * \brief   Function to generate the whole range in to the in memory source.
+ */
+int SipCdrMemSourceFill(SipCdrMemSource *src, SipCdrGen *gen)
+{
+    SipCdr *cdrs = NULL;
+    int ret = SIP_OK;
+
+    memset(src, 0, sizeof(SipCdrMemSource));
+    src->gen = gen;
+
+    while (1) {
+        if (src->cnt == src->size) {
+            src->size = src->size ? 2 * src->size : 65536;
+            cdrs = realloc(src->cdrs, src->size * sizeof(SipCdr));
+            if (cdrs == NULL) {
+                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                        " the memory for %"PRIu64" CDRs", src->size);
+                SipCdrMemSourceFree(src);
+                return SIP_ERROR;
+            }
+            src->cdrs = cdrs;
+        }
+
+        ret = SipCdrGenNext(gen, &src->cdrs[src->cnt]);
+        if (ret == SIP_DONE)
+            return SIP_OK;
+        if (ret != SIP_OK) {
+            SipCdrMemSourceFree(src);
+            return SIP_ERROR;
+        }
+        src->cnt++;
+    }
+}
+
+/**
+ * \brief   Function to find the first CDR at or after the given time.
+ *
+ * @return  index of the CDR, or the number of CDRs if there is none
+ */
+uint64_t SipCdrMemSourceFind(SipCdrMemSource *src, time_t t)
+{
+    uint64_t lo = 0;
+    uint64_t hi = src->cnt;
+    uint64_t mid = 0;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (src->cdrs[mid].calldate < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * \brief   Function to build the result of the interval query from the in
+ *          memory source, with the same columns and rows as SipGetQuery would
+ *          fetch from the CDR database. Like its "between", both the ends of
+ *          the interval are included.
+ *
+ * @param src           pointer to the in memory source
+ * @param from          start of the interval
+ * @param to            end of the interval
+ * @param accountcode   tenant of which the calls are fetched
+ * @param calltypes     bit mask of the calltypes, which are fetched
+ *
+ * @return the result on success and NULL on failure
+ */
+PGresult *SipCdrMemSourceResult(SipCdrMemSource *src, time_t from, time_t to,
+        const char *accountcode, uint8_t calltypes)
+{
+    PGresult *res = NULL;
+    PGresAttDesc attrs[7];
+    const char *names[7] = { "id", "calldate", "src", "dst", "billsec",
+                             "calltype", "accountcode" };
+    SipCdr *cdr = NULL;
+    char value[32];
+    uint64_t i = 0;
+    const char *name = NULL;
+    int tenant = -1;
+    int row = 0;
+    int len = 0;
+    int acc_len = strlen(accountcode);
+    uint8_t col = 0;
+
+    for (i = 0; i < src->gen->tenant_cnt; i++) {
+        if (strcmp(src->gen->tenants[i].name, accountcode) == 0)
+            tenant = i;
+    }
+
+    src->queries++;
+    res = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+    if (res == NULL)
+        return NULL;
+
+    memset(attrs, 0, sizeof(attrs));
+    for (col = 0; col < 7; col++) {
+        attrs[col].name = (char *)names[col];
+        attrs[col].typid = 25; /* text */
+        attrs[col].typlen = -1;
+        attrs[col].atttypmod = -1;
+    }
+    if (PQsetResultAttrs(res, 7, attrs) == 0)
+        goto error;
+
+    for (i = SipCdrMemSourceFind(src, from);
+            tenant >= 0 && i < src->cnt && src->cdrs[i].calldate <= to; i++)
+    {
+        cdr = &src->cdrs[i];
+        if (cdr->tenant != tenant || !(calltypes & (1 << cdr->calltype)))
+            continue;
+
+        if (cdr->calldate != src->gen->date_sec) {
+            struct tm tm;
+            localtime_r(&cdr->calldate, &tm);
+            strftime(src->gen->date_s, sizeof(src->gen->date_s), "%F %T", &tm);
+            src->gen->date_sec = cdr->calldate;
+        }
+
+        /* the values are copied, a length of -1 would set them to null */
+        if (PQsetvalue(res, row, 0, value, SipCdrGenItoa(value, cdr->id)) == 0)
+            goto error;
+        if (PQsetvalue(res, row, 1, src->gen->date_s, 19) == 0 ||
+                PQsetvalue(res, row, 2, value,
+                    SipCdrGenItoa(value, cdr->src)) == 0)
+        {
+            goto error;
+        }
+        len = 0;
+        if (cdr->calltype == INTERNATIONAL) {
+            value[len++] = '0';
+            value[len++] = '0';
+        }
+        len += SipCdrGenItoa(value + len, cdr->dst);
+        if (PQsetvalue(res, row, 3, value, len) == 0 ||
+                PQsetvalue(res, row, 4, value,
+                    SipCdrGenItoa(value, cdr->billsec)) == 0)
+        {
+            goto error;
+        }
+        name = sip_cdrgen_calltypes[cdr->calltype];
+        if (PQsetvalue(res, row, 5, (char *)name, strlen(name)) == 0 ||
+                PQsetvalue(res, row, 6, (char *)accountcode, acc_len) == 0)
+        {
+            goto error;
+        }
+        row++;
+    }
+
+    return res;
+
+error:
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating the memory");
+    PQclear(res);
+    return NULL;
+}
+
+void SipCdrMemSourceFree(SipCdrMemSource *src)
+{
+    if (src->cdrs != NULL)
+        free(src->cdrs);
+    memset(src, 0, sizeof(SipCdrMemSource));
+}
@@ -0,0 +1,145 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-cdrgen.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ */
+
+#ifndef _UTIL_CDRGEN_H
+#define	_UTIL_CDRGEN_H
+
+#include <time.h>
+#include <inttypes.h>
+#include "util-detection.h"
+
+#define SIP_CDRGEN_MAX_TENANTS      1024
+#define SIP_CDRGEN_MAX_ATTACKS      64
+#define SIP_CDRGEN_NAME_LEN         32
+
+/* Length of a CDR formatted as a CSV or COPY line */
+#define SIP_CDRGEN_LINE_LEN         160
+
+/* Injected fraud scenarios */
+enum {
+    SIP_CDRGEN_ATTACK_PREMIUM = 0,  /* burst of long premium rate calls */
+    SIP_CDRGEN_ATTACK_DRIP,         /* steady trickle of international calls */
+    SIP_CDRGEN_ATTACK_WANGIRI,      /* call backs to one ring numbers abroad */
+    SIP_CDRGEN_ATTACK_PBX,          /* hacked PBX dialing out off hours */
+
+    SIP_CDRGEN_ATTACK_MAX,  /* Keep it last always */
+};
+
+/* Output formats */
+enum {
+    SIP_CDRGEN_FORMAT_CSV = 0,
+    SIP_CDRGEN_FORMAT_COPY,
+};
+
+/**
+ * Generated call detail record. The numbers are kept as integers and only
+ * formatted when the record is written.
+ */
+typedef struct SipCdr_ {
+    uint64_t id;
+    time_t calldate;
+    uint64_t src;
+    uint64_t dst;
+    uint32_t billsec;
+    uint8_t calltype;       /* INTERNATIONAL, MOBILE, ... */
+    uint8_t attack;         /* 0 or the injected attack + 1 */
+    uint16_t tenant;
+} SipCdr;
+
+/**
+ * Injected attack, the start is relative to the start of the dataset.
+ */
+typedef struct SipCdrGenAttack_ {
+    uint8_t kind;
+    uint16_t tenant;
+    time_t start;
+    time_t end;
+    double rate;            /* calls per minute */
+} SipCdrGenAttack;
+
+typedef struct SipCdrGenTenant_ {
+    char name[SIP_CDRGEN_NAME_LEN];
+    double rate;            /* calls per hour at the peak of the day */
+    uint64_t prefix;        /* number block of the extensions */
+} SipCdrGenTenant;
+
+/**
+ * Generator state. The CDRs are generated one minute at a time, in the
+ * order of their call date.
+ */
+typedef struct SipCdrGen_ {
+    /* configuration */
+    time_t start;
+    time_t end;
+    uint64_t seed;
+    double mix[MAX_CALLTYPE];           /* share of each calltype */
+    double billsec[MAX_CALLTYPE];       /* mean billsec of each calltype */
+    double answered;                    /* ratio of the answered calls */
+    SipCdrGenTenant tenants[SIP_CDRGEN_MAX_TENANTS];
+    uint16_t tenant_cnt;
+    SipCdrGenAttack attacks[SIP_CDRGEN_MAX_ATTACKS];
+    uint8_t attack_cnt;
+
+    /* state */
+    uint64_t rng;
+    uint64_t next_id;
+    time_t minute;
+    SipCdr *buf;
+    uint32_t buf_size;
+    uint32_t buf_cnt;
+    uint32_t buf_pos;
+
+    /* cache of the last formatted call date */
+    time_t date_sec;
+    char date_s[20];
+} SipCdrGen;
+
+/**
+ * In memory source of CDRs, sorted by their call date.
+ */
+typedef struct SipCdrMemSource_ {
+    SipCdr *cdrs;
+    uint64_t cnt;
+    uint64_t size;
+    SipCdrGen *gen;     /* generator of the CDRs, for the tenant names */
+    uint64_t queries;   /* queries answered in place of the CDR database */
+} SipCdrMemSource;
+
+extern const char *sip_cdrgen_calltypes[MAX_CALLTYPE];
+extern const char *sip_cdrgen_attacks[SIP_CDRGEN_ATTACK_MAX];
+
+int SipCdrGenInit(SipCdrGen *, time_t, time_t, uint64_t);
+void SipCdrGenDeInit(SipCdrGen *);
+int SipCdrGenAddTenant(SipCdrGen *, const char *, double);
+int SipCdrGenAddAttack(SipCdrGen *, const char *);
+int SipCdrGenNext(SipCdrGen *, SipCdr *);
+int SipCdrGenFormat(SipCdrGen *, const SipCdr *, char *, int);
+int SipCdrMemSourceFill(SipCdrMemSource *, SipCdrGen *);
+uint64_t SipCdrMemSourceFind(SipCdrMemSource *, time_t);
+PGresult *SipCdrMemSourceResult(SipCdrMemSource *, time_t, time_t,
+        const char *, uint8_t);
+void SipCdrMemSourceFree(SipCdrMemSource *);
+
+#endif	/* _UTIL_CDRGEN_H */
+
@@ -0,0 +1,227 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-concurrency.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Sweep line over the calls, to count the calls in progress at the same
+ * time. The calls are added in the order of their start, a call lasts from
+ * its calldate for its billsec. The calls in progress are kept in a min heap
+ * by their end, so that the ends before the next start are taken from the
+ * top of it. Between two events the number of calls is constant, which gives
+ * the time weighted mean of a window. The calls in progress at the end of a
+ * window are carried over in to the next one.
+ */
+
+#include "sipade.h"
+#include "util-concurrency.h"
+#include "util-log.h"
+
+/**
+ * \brief   Function to initialize the sweep, with no calls in progress and the
+ *          window starting at the given time.
+ */
+void SipConcInit(SipConc *c, time_t from)
+{
+    memset(c, 0, sizeof(SipConc));
+    c->from = from;
+    c->now = from;
+}
+
+/**
+ * \brief   Function to drop the calls in progress and to move the sweep to the
+ *          given time, the heap is kept for the next calls.
+ */
+void SipConcReset(SipConc *c, time_t from)
+{
+    SipConcCall *heap = c->heap;
+    uint32_t size = c->size;
+
+    memset(c, 0, sizeof(SipConc));
+    c->heap = heap;
+    c->size = size;
+    c->from = from;
+    c->now = from;
+}
+
+/**
+ * \brief   Function to free the heap of the sweep.
+ */
+void SipConcFree(SipConc *c)
+{
+    if (c->heap != NULL)
+        free(c->heap);
+    memset(c, 0, sizeof(SipConc));
+}
+
+/**
+ * \brief   Function to move the sweep forward to the given time, accounting
+ *          the calls in progress to the window.
+ */
+static void SipConcAdvance(SipConc *c, time_t t)
+{
+    uint8_t i = 0;
+
+    if (t <= c->now)
+        return;
+
+    for (i = 0; i < SIP_CONC_SLOTS; i++)
+        c->area[i] += (uint64_t)c->active[i] * (t - c->now);
+    c->now = t;
+}
+
+/**
+ * \brief   Function to end the calls, which are over by the given time, and to
+ *          move the sweep to it. A call, which ends when the next one starts,
+ *          is not counted with it.
+ */
+static void SipConcSweep(SipConc *c, time_t t)
+{
+    SipConcCall top;
+    SipConcCall last;
+    uint32_t i = 0;
+    uint32_t child = 0;
+
+    while (c->cnt > 0 && c->heap[0].end <= t) {
+        top = c->heap[0];
+        SipConcAdvance(c, top.end);
+        c->active[top.type]--;
+        c->active[SIP_CONC_ALL]--;
+
+        /* the last entry is sifted down from the top */
+        last = c->heap[--c->cnt];
+        i = 0;
+        while ((child = 2 * i + 1) < c->cnt) {
+            if (child + 1 < c->cnt &&
+                    c->heap[child + 1].end < c->heap[child].end)
+            {
+                child++;
+            }
+            if (last.end <= c->heap[child].end)
+                break;
+            c->heap[i] = c->heap[child];
+            i = child;
+        }
+        c->heap[i] = last;
+    }
+
+    SipConcAdvance(c, t);
+}
+
+/**
+ * \brief   Function to start a window at the given time. The calls, which
+ *          have ended before it, are taken out, the ones in progress are
+ *          carried over and are its first peak. A window before the position
+ *          of the sweep, e.g. an interval which is scored again, starts
+ *          without the calls in progress.
+ */
+void SipConcOpen(SipConc *c, time_t from)
+{
+    if (from < c->now)
+        SipConcReset(c, from);
+
+    SipConcSweep(c, from);
+    c->from = from;
+    memcpy(c->peak, c->active, sizeof(c->peak));
+    memset(c->area, 0, sizeof(c->area));
+}
+
+/**
+ * \brief   Function to add a call to the sweep. The calls have to be added in
+ *          the order of their start, an earlier one is taken as starting at
+ *          the position of the sweep. The calls without billsec, which have
+ *          not been answered, are not counted.
+ *
+ * @param c         the sweep
+ * @param start     calldate of the call
+ * @param billsec   duration of the call
+ * @param type      calltype of the call
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+int SipConcAdd(SipConc *c, time_t start, uint32_t billsec, uint8_t type)
+{
+    SipConcCall *heap = NULL;
+    SipConcCall call;
+    uint32_t size = 0;
+    uint32_t i = 0;
+
+    if (billsec == 0 || type >= SIP_CONC_ALL)
+        return SIP_OK;
+
+    if (start < c->now)
+        start = c->now;
+    SipConcSweep(c, start);
+
+    if (c->cnt == c->size) {
+        size = c->size ? 2 * c->size : 256;
+        heap = realloc(c->heap, size * sizeof(SipConcCall));
+        if (heap == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "failed in allocating"
+                    " memory");
+            return SIP_ERROR;
+        }
+        c->heap = heap;
+        c->size = size;
+    }
+
+    /* sift the call up from the bottom */
+    call.end = start + billsec;
+    call.type = type;
+    i = c->cnt++;
+    while (i > 0 && c->heap[(i - 1) / 2].end > call.end) {
+        c->heap[i] = c->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    c->heap[i] = call;
+
+    c->active[type]++;
+    c->active[SIP_CONC_ALL]++;
+    if (c->active[type] > c->peak[type])
+        c->peak[type] = c->active[type];
+    if (c->active[SIP_CONC_ALL] > c->peak[SIP_CONC_ALL])
+        c->peak[SIP_CONC_ALL] = c->active[SIP_CONC_ALL];
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to close the window at the given time and to start the
+ *          next one from it, with the calls still in progress.
+ *
+ * @param c     the sweep
+ * @param to    end of the window
+ * @param stats pointer to the peak and the mean of the closed window
+ */
+void SipConcClose(SipConc *c, time_t to, SipConcStats *stats)
+{
+    uint8_t i = 0;
+
+    SipConcSweep(c, to);
+
+    for (i = 0; i < SIP_CONC_SLOTS; i++) {
+        stats->peak[i] = c->peak[i];
+        stats->mean[i] = (to > c->from) ?
+            (double)c->area[i] / (double)(to - c->from) : 0.0;
+    }
+
+    SipConcOpen(c, to);
+}
+
@@ -0,0 +1,77 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-concurrency.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ */
+
+#ifndef _UTIL_CONCURRENCY_H
+#define	_UTIL_CONCURRENCY_H
+
+#include <time.h>
+#include <inttypes.h>
+#include "util-detection.h"
+
+/* The calls are counted per calltype, the last slot counts all of them */
+#define SIP_CONC_ALL        MAX_CALLTYPE
+#define SIP_CONC_SLOTS      (MAX_CALLTYPE + 1)
+
+/**
+ * Call in progress, kept in the heap by its end.
+ */
+typedef struct SipConcCall_ {
+    time_t end;
+    uint8_t type;
+} SipConcCall;
+
+/**
+ * Concurrent calls of a window, the peak and the time weighted mean.
+ */
+typedef struct SipConcStats_ {
+    uint32_t peak[SIP_CONC_SLOTS];
+    double mean[SIP_CONC_SLOTS];
+} SipConcStats;
+
+/**
+ * State of the sweep over the starts and the ends of the calls. The calls in
+ * progress are kept in a min heap by their end, so that they are carried over
+ * in to the next window.
+ */
+typedef struct SipConc_ {
+    SipConcCall *heap;
+    uint32_t cnt;               /* calls in progress */
+    uint32_t size;              /* allocated entries of the heap */
+    uint32_t active[SIP_CONC_SLOTS];
+    time_t from;                /* start of the window */
+    time_t now;                 /* position of the sweep */
+    uint32_t peak[SIP_CONC_SLOTS];
+    uint64_t area[SIP_CONC_SLOTS];  /* call seconds of the window so far */
+} SipConc;
+
+void SipConcInit(SipConc *, time_t);
+void SipConcReset(SipConc *, time_t);
+void SipConcFree(SipConc *);
+void SipConcOpen(SipConc *, time_t);
+int SipConcAdd(SipConc *, time_t, uint32_t, uint8_t);
+void SipConcClose(SipConc *, time_t, SipConcStats *);
+
+#endif	/* _UTIL_CONCURRENCY_H */
+
@@ -25,11 +25,21 @@
  *              (Thanks to jason ish)
  */
 
+#include <inttypes.h>
+#include <strings.h>
 #include "sipade.h"
 #include "util-conf.h"
 #include "util-log.h"
 
-static SipConfNode *root = NULL;
+static SipConf *conf = NULL;
+static char *conf_file = NULL;
+
+/* The snapshots replaced by a reload. The modules keep pointers in to the
+ * values of the configuration, so they are only freed at shutdown */
+static SipConf **retired = NULL;
+static uint32_t retired_cnt = 0;
+
+static int SipConfYamlLoad(const char *, SipConfNode *);
 
 /**
  * \brief Allocate a new configuration node.
@@ -60,19 +70,14 @@ SipConfNode *SipConfNodeNew(void)
  */
 int SipConfInit(const char *conf_filename)
 {
-    if (root != NULL) {
+    if (conf != NULL) {
         SipLog(SIP_LOG_DEBUG, SIP_LOG_LOCATION, "already initialized");
         return SIP_OK;
     }
-    root = SipConfNodeNew();
-    if (root == NULL) {
-        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "ERROR: Failed to allocate"
-                " memory for root configuration node, aborting.");
-        exit(EXIT_FAILURE);
-    }
     SipLog(SIP_LOG_DEBUG, SIP_LOG_LOCATION, "configuration module"
             " initialized");
 
+    conf_file = strdup(conf_filename);
     if (SipConfYamlLoadFile(conf_filename) != 0)
         return SIP_ERROR;
 
@@ -107,7 +112,50 @@ SipConfNode *SipConfNodeLookupChild(SipConfNode *node, const char *name)
  */
 SipConfNode *SipConfGetRootNode(void)
 {
-    return root;
+    SipConf *cur = __atomic_load_n(&conf, __ATOMIC_ACQUIRE);
+
+    return cur != NULL ? cur->root : NULL;
+}
+
+/**
+ * \brief Hash the full dotted name of a configuration node (FNV-1a).
+ */
+static inline uint32_t SipConfHash(const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*key != '\0') {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * \brief Lookup the entry of a configuration node in the current snapshot.
+ *
+ * @param key The full name of the configuration node to lookup.
+ *
+ * @retval A pointer to the entry if found otherwise NULL.
+ */
+static SipConfEntry *SipConfLookup(const char *key)
+{
+    SipConf *cur = __atomic_load_n(&conf, __ATOMIC_ACQUIRE);
+    SipConfEntry *entry = NULL;
+    uint32_t hash = 0;
+    uint32_t idx = 0;
+
+    if (cur == NULL)
+        return NULL;
+
+    hash = SipConfHash(key);
+    for (idx = hash & cur->mask; ; idx = (idx + 1) & cur->mask) {
+        entry = &cur->table[idx];
+        if (entry->key == NULL)
+            return NULL;
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+            return entry;
+    }
 }
 
 /**
@@ -120,24 +168,9 @@ SipConfNode *SipConfGetRootNode(void)
  */
 SipConfNode *SipConfGetNode(char *key)
 {
-    SipConfNode *node = root;
-    char *saveptr = NULL;
-    char *token;
-
-    /* Need to dup the key for tokenization... */
-    char *tokstr = strdup(key);
-
-    token = strtok_r(tokstr, ".", &saveptr);
-    for (;;) {
-        node = SipConfNodeLookupChild(node, token);
-        if (node == NULL)
-            break;
-        token = strtok_r(NULL, ".", &saveptr);
-        if (token == NULL)
-            break;
-    }
-    free(tokstr);
-    return node;
+    SipConfEntry *entry = SipConfLookup(key);
+
+    return entry != NULL ? entry->node : NULL;
 }
 
 /**
@@ -170,6 +203,97 @@ int SipConfGet(char *name, char **vptr)
     }
 }
 
+/**
+ * \brief Log that the configuration node is present, but its value can not
+ *        be read as the given type, so that the caller falls back to its
+ *        default. A node without a value, e.g. a section, is not logged.
+ */
+static void SipConfTypeMismatch(SipConfEntry *entry, const char *type)
+{
+    if (entry->node->val == NULL)
+        return;
+
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Value \"%s\" of the"
+            " configuration parameter '%s' is not %s, it is ignored",
+            entry->node->val, entry->key, type);
+}
+
+/**
+ * \brief Retrieve the value of a configuration node as an integer.
+ *
+ * @param name Name of configuration parameter to get.
+ * @param val Pointer that will be set to the value.
+ *
+ * @retval 1 will be returned if the name is found and its value is an
+ *   integer, otherwise 0 will be returned. A value which is not an integer
+ *   is logged.
+ */
+int SipConfGetInt(const char *name, int64_t *val)
+{
+    SipConfEntry *entry = SipConfLookup(name);
+
+    if (entry == NULL)
+        return 0;
+    if (!(entry->flags & SIP_CONF_HAS_INT)) {
+        SipConfTypeMismatch(entry, "an integer");
+        return 0;
+    }
+
+    *val = entry->ival;
+    return 1;
+}
+
+/**
+ * \brief Retrieve the value of a configuration node as a double.
+ *
+ * @param name Name of configuration parameter to get.
+ * @param val Pointer that will be set to the value.
+ *
+ * @retval 1 will be returned if the name is found and its value is a
+ *   number, otherwise 0 will be returned. A value which is not a number is
+ *   logged.
+ */
+int SipConfGetDouble(const char *name, double *val)
+{
+    SipConfEntry *entry = SipConfLookup(name);
+
+    if (entry == NULL)
+        return 0;
+    if (!(entry->flags & SIP_CONF_HAS_DOUBLE)) {
+        SipConfTypeMismatch(entry, "a number");
+        return 0;
+    }
+
+    *val = entry->dval;
+    return 1;
+}
+
+/**
+ * \brief Retrieve the value of a configuration node as a boolean. The values
+ *        yes, true, on and 1 are true, no, false, off and 0 are false.
+ *
+ * @param name Name of configuration parameter to get.
+ * @param val Pointer that will be set to the value (1 or 0).
+ *
+ * @retval 1 will be returned if the name is found and its value is a
+ *   boolean, otherwise 0 will be returned. A value which is not a boolean is
+ *   logged.
+ */
+int SipConfGetBool(const char *name, int *val)
+{
+    SipConfEntry *entry = SipConfLookup(name);
+
+    if (entry == NULL)
+        return 0;
+    if (!(entry->flags & SIP_CONF_HAS_BOOL)) {
+        SipConfTypeMismatch(entry, "a boolean (yes or no)");
+        return 0;
+    }
+
+    *val = entry->bval;
+    return 1;
+}
+
 /**
  * \brief Free a ConfNode and all of its children.
  *
@@ -191,18 +315,240 @@ void SipConfNodeFree(SipConfNode *node)
     free(node);
 }
 
+/**
+ * \brief Parse the value of an entry in to the types it can be read as.
+ */
+static void SipConfEntryParse(SipConfEntry *entry)
+{
+    const char *val = entry->node->val;
+    char *end = NULL;
+
+    if (val == NULL || *val == '\0')
+        return;
+
+    errno = 0;
+    entry->ival = strtoll(val, &end, 10);
+    if (errno == 0 && *end == '\0')
+        entry->flags |= SIP_CONF_HAS_INT;
+
+    errno = 0;
+    entry->dval = strtod(val, &end);
+    if (errno == 0 && *end == '\0')
+        entry->flags |= SIP_CONF_HAS_DOUBLE;
+
+    if (strcasecmp(val, "yes") == 0 || strcasecmp(val, "true") == 0 ||
+            strcasecmp(val, "on") == 0 || strcmp(val, "1") == 0)
+    {
+        entry->bval = 1;
+        entry->flags |= SIP_CONF_HAS_BOOL;
+    } else if (strcasecmp(val, "no") == 0 || strcasecmp(val, "false") == 0 ||
+            strcasecmp(val, "off") == 0 || strcmp(val, "0") == 0)
+    {
+        entry->bval = 0;
+        entry->flags |= SIP_CONF_HAS_BOOL;
+    }
+}
+
+/**
+ * \brief Count the configuration nodes below the given node.
+ */
+static uint32_t SipConfNodeCount(SipConfNode *node)
+{
+    SipConfNode *child;
+    uint32_t cnt = 0;
+
+    TAILQ_FOREACH(child, &node->head, next)
+        cnt += 1 + SipConfNodeCount(child);
+
+    return cnt;
+}
+
+/**
+ * \brief Add the children of the given node to the hash table of the
+ *        snapshot, keyed by their full dotted name.
+ *
+ * @param cur The snapshot being compiled.
+ * @param node The parent configuration node.
+ * @param key Buffer with the full name of the parent node.
+ * @param len Length of the full name of the parent node.
+ */
+static void SipConfFlatten(SipConf *cur, SipConfNode *node, char *key,
+        size_t len)
+{
+    SipConfNode *child;
+    SipConfEntry *entry = NULL;
+    uint32_t hash = 0;
+    uint32_t idx = 0;
+    int n = 0;
+
+    TAILQ_FOREACH(child, &node->head, next) {
+        n = snprintf(key + len, SIP_CONF_MAX_KEY_LEN - len, "%s%s",
+                len > 0 ? "." : "", child->name);
+        if (n < 0 || len + n >= SIP_CONF_MAX_KEY_LEN) {
+            key[len] = '\0';
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Configuration node"
+                    " name below '%s' is too long, ignoring it", key);
+            continue;
+        }
+
+        /* The first node of a name wins, as it did for the tree lookup */
+        hash = SipConfHash(key);
+        for (idx = hash & cur->mask; ; idx = (idx + 1) & cur->mask) {
+            entry = &cur->table[idx];
+            if (entry->key == NULL || (entry->hash == hash &&
+                        strcmp(entry->key, key) == 0))
+                break;
+        }
+
+        if (entry->key == NULL) {
+            entry->key = strdup(key);
+            if (entry->key == NULL) {
+                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Error allocating "
+                        "memory for the configuration snapshot");
+                exit(EXIT_FAILURE);
+            }
+            entry->hash = hash;
+            entry->node = child;
+            SipConfEntryParse(entry);
+            cur->cnt++;
+        }
+
+        SipConfFlatten(cur, child, key, len + n);
+    }
+}
+
+/**
+ * \brief Compile the parsed tree in to a read-only snapshot, with a flat hash
+ *        table of all its nodes. The snapshot owns the tree.
+ *
+ * @param tree The root of the parsed configuration tree.
+ *
+ * @retval The allocated snapshot.
+ */
+static SipConf *SipConfCompile(SipConfNode *tree)
+{
+    SipConf *cur = NULL;
+    char key[SIP_CONF_MAX_KEY_LEN];
+    uint32_t size = 16;
+    uint32_t nodes = SipConfNodeCount(tree);
+
+    /* keep the table at most half full */
+    while (size < 2 * nodes)
+        size <<= 1;
+
+    cur = calloc(1, sizeof(*cur));
+    if (cur != NULL)
+        cur->table = calloc(size, sizeof(SipConfEntry));
+    if (cur == NULL || cur->table == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Error allocating memory"
+                " for the configuration snapshot");
+        exit(EXIT_FAILURE);
+    }
+
+    cur->root = tree;
+    cur->mask = size - 1;
+    key[0] = '\0';
+    SipConfFlatten(cur, tree, key, 0);
+
+    SipLog(SIP_LOG_DEBUG, SIP_LOG_LOCATION, "Configuration compiled in to"
+            " %"PRIu32" entries of %"PRIu32" slots", cur->cnt, size);
+    return cur;
+}
+
+/**
+ * \brief Free a snapshot, its hash table and its tree.
+ */
+static void SipConfFree(SipConf *cur)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i <= cur->mask; i++) {
+        if (cur->table[i].key != NULL)
+            free(cur->table[i].key);
+    }
+    free(cur->table);
+    SipConfNodeFree(cur->root);
+    free(cur);
+}
+
+/**
+ * \brief Compile the parsed tree and make it the current snapshot. The
+ *        previous snapshot is retired.
+ *
+ * @retval SIP_OK on success, SIP_ERROR on failure.
+ */
+static int SipConfInstall(SipConfNode *tree)
+{
+    SipConf *cur = SipConfCompile(tree);
+    SipConf **tmp = NULL;
+
+    if (conf != NULL) {
+        tmp = realloc(retired, (retired_cnt + 1) * sizeof(SipConf *));
+        if (tmp == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Error allocating memory"
+                    " for the configuration snapshot");
+            SipConfFree(cur);
+            return SIP_ERROR;
+        }
+        retired = tmp;
+        retired[retired_cnt++] = conf;
+    }
+
+    __atomic_store_n(&conf, cur, __ATOMIC_RELEASE);
+    return SIP_OK;
+}
+
 /**
  * \brief De-initializes the configuration system.
  */
 void SipConfDeInit(void)
 {
-    if (root != NULL)
-        SipConfNodeFree(root);
+    uint32_t i = 0;
+
+    if (conf != NULL)
+        SipConfFree(conf);
+
+    for (i = 0; i < retired_cnt; i++)
+        SipConfFree(retired[i]);
+    if (retired != NULL)
+        free(retired);
+    if (conf_file != NULL)
+        free(conf_file);
 
     SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Configuration module"
             " has been de-initialized");
 }
 
+/**
+ * \brief Reload the configuration file in to a new snapshot.
+ *
+ * The file is parsed and compiled in to a new snapshot, which replaces the
+ * current one atomically. The lookups which are in progress finish on the
+ * previous snapshot. If the file can not be parsed, the current
+ * configuration is kept.
+ *
+ * @retval SIP_OK on success, SIP_ERROR on failure.
+ */
+int SipConfReload(void)
+{
+    SipConfNode *tree = SipConfNodeNew();
+
+    if (SipConfYamlLoad(conf_file, tree) != SIP_OK) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in reloading the"
+                " configuration file %s, keeping the current configuration",
+                conf_file);
+        SipConfNodeFree(tree);
+        return SIP_ERROR;
+    }
+
+    if (SipConfInstall(tree) != SIP_OK)
+        return SIP_ERROR;
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Configuration has been reloaded"
+            " from %s", conf_file);
+    return SIP_OK;
+}
+
 /********************** Load & Parse the config File *******************/
 
 /**
@@ -310,10 +656,12 @@ static int SipConfYamlParse(yaml_parser_t *parser, SipConfNode *parent,
                 seq_node->name = calloc(1, DEFAULT_NODE_NAME_LEN);
                 snprintf(seq_node->name, DEFAULT_NODE_NAME_LEN, "%d", seq_idx++);
                 TAILQ_INSERT_TAIL(&node->head, seq_node, next);
-                SipConfYamlParse(parser, seq_node, 0);
+                if (SipConfYamlParse(parser, seq_node, 0) != 0)
+                    goto fail;
             }
             else {
-                SipConfYamlParse(parser, node, inseq);
+                if (SipConfYamlParse(parser, node, inseq) != 0)
+                    goto fail;
             }
             state = CONF_STATE_KEY;
         }
@@ -350,11 +698,30 @@ static int SipConfYamlParse(yaml_parser_t *parser, SipConfNode *parent,
  * @retval SIP_OK on success, SIP_ERROR on failure.
  */
 int SipConfYamlLoadFile(const char *filename)
+{
+    SipConfNode *tree = SipConfNodeNew();
+
+    if (SipConfYamlLoad(filename, tree) != SIP_OK) {
+        SipConfNodeFree(tree);
+        return SIP_ERROR;
+    }
+
+    return SipConfInstall(tree);
+}
+
+/**
+ * \brief Load configuration from a YAML file in to the given tree.
+ *
+ * @param filename Filename of configuration file to load.
+ * @param root The root node of the tree.
+ *
+ * @retval SIP_OK on success, SIP_ERROR on failure.
+ */
+static int SipConfYamlLoad(const char *filename, SipConfNode *root)
 {
     FILE *infile;
     yaml_parser_t parser;
     int ret;
-    SipConfNode *root = SipConfGetRootNode();
 
     if (yaml_parser_initialize(&parser) != 1) {
         SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed to initialize"
@@ -40,6 +40,14 @@
 /* Default name length for nodes in the configuration file */
 #define DEFAULT_NODE_NAME_LEN   24
 
+/* Maximum length of the full dotted name of a configuration node */
+#define SIP_CONF_MAX_KEY_LEN    256
+
+/* Types, in which the value of a configuration node could be parsed */
+#define SIP_CONF_HAS_INT        0x01
+#define SIP_CONF_HAS_DOUBLE     0x02
+#define SIP_CONF_HAS_BOOL       0x04
+
 /**
  * Structure of a configuration parameter.
  */
@@ -55,12 +63,41 @@ typedef struct SipConfNode_ {
     TAILQ_ENTRY(SipConfNode_) next;
 } SipConfNode;
 
+/**
+ * Entry of the flattened configuration, keyed by the full dotted name of the
+ * node. The value is parsed once in to the types it can be read as.
+ */
+typedef struct SipConfEntry_ {
+    char *key;
+    uint32_t hash;
+    uint8_t flags;          /* SIP_CONF_HAS_* */
+    int bval;
+    int64_t ival;
+    double dval;
+    SipConfNode *node;
+} SipConfEntry;
+
+/**
+ * Read-only snapshot of the configuration, the parsed tree and its flattened
+ * hash table (open addressing, mask + 1 slots).
+ */
+typedef struct SipConf_ {
+    SipConfNode *root;
+    SipConfEntry *table;
+    uint32_t mask;
+    uint32_t cnt;
+} SipConf;
+
 int SipConfYamlLoadFile(const char *);
 int SipConfInit(const char *);
 const char *SipConfNodeLookupChildValue(SipConfNode *, const char *);
 SipConfNode *SipConfGetNode(char *);
 void SipConfDeInit(void);
 int SipConfGet(char *, char **);
+int SipConfGetInt(const char *, int64_t *);
+int SipConfGetDouble(const char *, double *);
+int SipConfGetBool(const char *, int *);
+int SipConfReload(void);
 
 #endif	/* _UTIL_CONF_H */
 
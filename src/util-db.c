@@ -0,0 +1,565 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-db.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Connections of the engine to its databases, one for each role. The CDRs
+ * are read from the read replicas of the cdr-database, if any are given, and
+ * from the primary only when no replica answers. The thresholds and the
+ * alerts are written over their own connections to their databases.
+ *
+ * The connections are made in parallel with PQconnectStart(), each attempt
+ * bounded by the connect-timeout. A lost connection is made again on its next
+ * use, after which the attempts are spaced by an exponential backoff, so that
+ * a restart of a database is waited out instead of stopping the engine.
+ */
+
+#include <poll.h>
+#include <errno.h>
+#include "sipade.h"
+#include "util-db.h"
+#include "util-cdr.h"
+#include "util-conf.h"
+#include "util-log.h"
+
+/**
+ * Attempt to connect a pool to one of its targets, from target up to end.
+ */
+typedef struct SipDbAttempt_ {
+    SipDbPool *pool;
+    uint8_t target;
+    uint8_t end;
+    PGconn *conn;
+    PostgresPollingStatusType status;
+    time_t deadline;
+} SipDbAttempt;
+
+static const char *sections[SIP_DB_MAX] = {
+    "cdr-database", "threshold-database", "alert-database"
+};
+static const char *roles[SIP_DB_MAX] = { "CDR", "threshold", "alert" };
+
+static SipDbPool pools[SIP_DB_MAX];
+static uint32_t connect_timeout = SIP_DB_DEFAULT_CONNECT_TIMEOUT;
+static uint32_t retry_min = SIP_DB_DEFAULT_RETRY_MIN;
+static uint32_t retry_max = SIP_DB_DEFAULT_RETRY_MAX;
+static uint32_t replica_delay = SIP_DB_DEFAULT_REPLICA_DELAY;
+static uint8_t initialized = FALSE;
+
+/**
+ * \brief   Function to get the timeouts of the connections from the config
+ *          file.
+ */
+static void SipDbConf()
+{
+    char *val = NULL;
+
+    if (SipConfGet("database-connections.connect-timeout", &val) == 1)
+        connect_timeout = strtoul(val, NULL, 10);
+    if (SipConfGet("database-connections.retry-min", &val) == 1)
+        retry_min = strtoul(val, NULL, 10);
+    if (SipConfGet("database-connections.retry-max", &val) == 1)
+        retry_max = strtoul(val, NULL, 10);
+    if (SipConfGet("cdr-database.replica-delay", &val) == 1)
+        replica_delay = strtoul(val, NULL, 10);
+    if (connect_timeout == 0)
+        connect_timeout = SIP_DB_DEFAULT_CONNECT_TIMEOUT;
+    if (retry_min == 0)
+        retry_min = 1;
+    if (retry_max < retry_min)
+        retry_max = retry_min;
+}
+
+/**
+ * \brief   Function to free the targets of the pool.
+ */
+static void SipDbFreeTargets(SipDbPool *p)
+{
+    uint8_t i = 0;
+
+    for (i = 0; i < p->cnt; i++) {
+        free(p->conninfo[i]);
+        free(p->host[i]);
+    }
+    p->cnt = 0;
+}
+
+/**
+ * \brief   Function to add a server to the targets of the pool.
+ *
+ * @param host  "host[:port]" of a replica, or NULL for the host of the
+ *              database section
+ */
+static int SipDbAddTarget(SipDbPool *p, const char *host)
+{
+    char conninfo[SIP_CONN_INFO_SIZE];
+    char opts[64] = "";
+    char node_name[50];
+    char *primary = NULL;
+    char *val = NULL;
+
+    if (p->cnt == SIP_DB_MAX_TARGETS) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Too many servers for the %s"
+                " database, at most %d are used", p->role,
+                SIP_DB_MAX_TARGETS);
+        return SIP_OK;
+    }
+
+    if (host == NULL) {
+        snprintf(node_name, sizeof(node_name), "%s.host", p->section);
+        if (SipConfGet(node_name, &primary) != 1)
+            primary = "localhost";
+    }
+
+    /* The statements reading the CDRs are also cancelled by the server,
+     * should the client not get to cancel them */
+    if (p == &pools[SIP_DB_CDR] &&
+            (SipConfGet("cdr-query.statement-timeout", &val) == 1 ||
+             SipConfGet("cdr-query.timeout", &val) == 1) &&
+            strtoul(val, NULL, 10) > 0)
+    {
+        snprintf(opts, sizeof(opts), "options='-c statement_timeout=%lus'",
+                strtoul(val, NULL, 10));
+    }
+
+    SipConnInfo((char *)p->section, host, opts, conninfo, sizeof(conninfo));
+    p->conninfo[p->cnt] = strdup(conninfo);
+    p->host[p->cnt] = strdup((host != NULL) ? host : primary);
+    if (p->conninfo[p->cnt] == NULL || p->host[p->cnt] == NULL) {
+        free(p->conninfo[p->cnt]);
+        free(p->host[p->cnt]);
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating the"
+                " memory");
+        return SIP_ERROR;
+    }
+    p->cnt++;
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to build the targets of the pool from the config file.
+ *          The CDRs are read from the replicas of the cdr-database, in the
+ *          given order, with the primary as the last resort.
+ */
+static int SipDbTargets(SipDbPool *p)
+{
+    char *replicas = NULL;
+    char *list = NULL;
+    char *host = NULL;
+    char *save = NULL;
+    int ret = SIP_OK;
+
+    SipDbFreeTargets(p);
+
+    if (p == &pools[SIP_DB_CDR] &&
+            SipConfGet("cdr-database.replicas", &replicas) == 1)
+    {
+        list = strdup(replicas);
+        if (list == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                    " the memory");
+            return SIP_ERROR;
+        }
+
+        for (host = strtok_r(list, ", ", &save); host != NULL && ret == SIP_OK;
+                host = strtok_r(NULL, ", ", &save))
+        {
+            if (p->cnt < SIP_DB_MAX_TARGETS - 1)
+                ret = SipDbAddTarget(p, host);
+        }
+        free(list);
+    }
+
+    if (ret == SIP_OK)
+        ret = SipDbAddTarget(p, NULL);
+
+    return ret;
+}
+
+/**
+ * \brief   Function to start the attempt on its next target, which can be
+ *          started.
+ */
+static void SipDbStart(SipDbAttempt *a)
+{
+    SipDbPool *p = a->pool;
+
+    for (; a->target < a->end; a->target++) {
+        a->conn = PQconnectStart(p->conninfo[a->target]);
+        if (a->conn != NULL && PQstatus(a->conn) != CONNECTION_BAD) {
+            /* the socket is polled first for writing */
+            a->status = PGRES_POLLING_WRITING;
+            a->deadline = time(NULL) + connect_timeout;
+            return;
+        }
+
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in connecting to the"
+                " %s database on %s: %s", p->role, p->host[a->target],
+                (a->conn != NULL) ? PQerrorMessage(a->conn) : "out of memory");
+        PQfinish(a->conn);
+        a->conn = NULL;
+    }
+}
+
+/**
+ * \brief   Function to give up the current target of the attempt and to go
+ *          on with the next one.
+ */
+static void SipDbNext(SipDbAttempt *a, const char *reason)
+{
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in connecting to the %s"
+            " database on %s: %s", a->pool->role, a->pool->host[a->target],
+            reason);
+    PQfinish(a->conn);
+    a->conn = NULL;
+    a->target++;
+    SipDbStart(a);
+}
+
+/**
+ * \brief   Function to run the given attempts in parallel, until each of them
+ *          is connected or has run out of targets. It blocks for at most the
+ *          connect-timeout per target.
+ *
+ * @param a     the attempts, connected to a->target if a->conn is not NULL
+ * @param n     number of the attempts, at most SIP_DB_MAX
+ */
+static void SipDbOpen(SipDbAttempt *a, int n)
+{
+    struct pollfd fds[SIP_DB_MAX];
+    int idx[SIP_DB_MAX];
+    time_t now = 0;
+    int wait = 0;
+    int nfds = 0;
+    int i = 0;
+
+    for (i = 0; i < n; i++)
+        SipDbStart(&a[i]);
+
+    for (;;) {
+        now = time(NULL);
+        wait = -1;
+        nfds = 0;
+
+        for (i = 0; i < n; i++) {
+            if (a[i].conn != NULL && a[i].status != PGRES_POLLING_OK &&
+                    now >= a[i].deadline)
+            {
+                SipDbNext(&a[i], "timeout expired");
+            }
+            if (a[i].conn == NULL || a[i].status == PGRES_POLLING_OK)
+                continue;
+
+            fds[nfds].fd = PQsocket(a[i].conn);
+            fds[nfds].events = (a[i].status == PGRES_POLLING_READING) ?
+                POLLIN : POLLOUT;
+            fds[nfds].revents = 0;
+            idx[nfds++] = i;
+            if (wait < 0 || (a[i].deadline - now) * 1000 < wait)
+                wait = (a[i].deadline - now) * 1000;
+        }
+
+        if (nfds == 0)
+            break;
+
+        if (poll(fds, nfds, wait) < 0 && errno != EINTR) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in polling the"
+                    " database connections: %s", strerror(errno));
+            for (i = 0; i < nfds; i++)
+                a[idx[i]].deadline = 0;
+            continue;
+        }
+
+        for (i = 0; i < nfds; i++) {
+            if (fds[i].revents == 0)
+                continue;
+
+            a[idx[i]].status = PQconnectPoll(a[idx[i]].conn);
+            if (a[idx[i]].status == PGRES_POLLING_FAILED)
+                SipDbNext(&a[idx[i]], PQerrorMessage(a[idx[i]].conn));
+        }
+    }
+}
+
+/**
+ * \brief   Function to take the connection of a successful attempt in to use.
+ *          A connection to another target than the first one, i.e. to the
+ *          primary instead of a replica, is replaced as soon as the first
+ *          target answers again, which is checked every retry-max seconds.
+ */
+static void SipDbUse(SipDbPool *p, SipDbAttempt *a)
+{
+    if (p->conn != NULL)
+        PQfinish(p->conn);
+
+    p->conn = a->conn;
+    p->current = a->target;
+    p->backoff = 0;
+    p->retry_at = (p->current > 0) ? time(NULL) + retry_max : 0;
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Connected to the %s database on"
+            " %s", p->role, p->host[p->current]);
+}
+
+/**
+ * \brief   Function to initialize the pools from the config file and to
+ *          connect them, all in parallel.
+ *
+ * @return  SIP_OK if each role has been connected, SIP_ERROR otherwise
+ */
+int SipDbInit()
+{
+    SipDbAttempt a[SIP_DB_MAX];
+    int ret = SIP_OK;
+    int r = 0;
+
+    SipDbConf();
+
+    memset(a, 0, sizeof(a));
+    for (r = 0; r < SIP_DB_MAX; r++) {
+        pools[r].section = sections[r];
+        pools[r].role = roles[r];
+        if (SipDbTargets(&pools[r]) != SIP_OK)
+            return SIP_ERROR;
+
+        a[r].pool = &pools[r];
+        a[r].end = pools[r].cnt;
+    }
+    initialized = TRUE;
+
+    SipDbOpen(a, SIP_DB_MAX);
+
+    for (r = 0; r < SIP_DB_MAX; r++) {
+        if (a[r].conn == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in connecting to"
+                    " the %s database", roles[r]);
+            ret = SIP_ERROR;
+            continue;
+        }
+        SipDbUse(&pools[r], &a[r]);
+    }
+
+    return ret;
+}
+
+/**
+ * \brief   Function to get the connection of the given role. A lost connection
+ *          is made again, unless the last attempt is more recent than the
+ *          backoff. This blocks for the connect-timeout per target at most.
+ *          A pool is used by one thread only, the alert pool by the alert
+ *          dispatcher.
+ *
+ * @param role  SIP_DB_*
+ *
+ * @return  the connection, or NULL if it is down or the pools are not used,
+ *          as by the benchmarks
+ */
+PGconn *SipDbGet(int role)
+{
+    SipDbPool *p = &pools[role];
+    SipDbAttempt a;
+    time_t now = 0;
+
+    if (initialized == FALSE)
+        return NULL;
+
+    now = time(NULL);
+    if (p->conn != NULL) {
+        /* the first targets are tried again, while the pool has fallen back
+         * to the primary */
+        if (p->current > 0 && now >= p->retry_at) {
+            memset(&a, 0, sizeof(a));
+            a.pool = p;
+            a.end = p->current;
+            SipDbOpen(&a, 1);
+            if (a.conn != NULL)
+                SipDbUse(p, &a);
+            else
+                p->retry_at = time(NULL) + retry_max;
+        }
+        return p->conn;
+    }
+
+    if (now < p->retry_at)
+        return NULL;
+
+    memset(&a, 0, sizeof(a));
+    a.pool = p;
+    a.end = p->cnt;
+    SipDbOpen(&a, 1);
+    if (a.conn != NULL) {
+        SipDbUse(p, &a);
+        return p->conn;
+    }
+
+    if (p->backoff == 0)
+        p->backoff = retry_min;
+    else if (p->backoff * 2 > retry_max)
+        p->backoff = retry_max;
+    else
+        p->backoff *= 2;
+    p->retry_at = time(NULL) + p->backoff;
+
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "The %s database is down, trying"
+            " again in %"PRIu32" seconds", p->role, p->backoff);
+    return NULL;
+}
+
+/**
+ * \brief   Function to check, whether a statement of the given role has failed
+ *          because the connection has been lost. The lost connection is
+ *          dropped, to be made again by the next SipDbGet().
+ *
+ * @return  TRUE if the connection is down, FALSE if the statement itself has
+ *          failed
+ */
+int SipDbFailed(int role)
+{
+    SipDbPool *p = &pools[role];
+
+    if (initialized == FALSE)
+        return FALSE;
+
+    if (p->conn != NULL && PQstatus(p->conn) != CONNECTION_BAD)
+        return FALSE;
+
+    if (p->conn != NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Lost the connection to the %s"
+                " database on %s: %s", p->role, p->host[p->current],
+                PQerrorMessage(p->conn));
+        PQfinish(p->conn);
+        p->conn = NULL;
+        p->retry_at = 0;
+    }
+
+    return TRUE;
+}
+
+/**
+ * \brief   Function to get the time of the next attempt to connect the given
+ *          role, if it is down.
+ */
+time_t SipDbRetryAt(int role)
+{
+    return pools[role].retry_at;
+}
+
+/**
+ * \brief   Function to get the time, by which the reads of the given role are
+ *          put off after the end of an interval, as its calls may not have
+ *          been replayed on a replica yet. It is the replica-delay, while the
+ *          role is read from a replica, or may be once it is connected again.
+ */
+time_t SipDbReplicaDelay(int role)
+{
+    SipDbPool *p = &pools[role];
+
+    if (initialized == FALSE || p->cnt < 2)
+        return 0;
+
+    if (p->conn == NULL || p->current < p->cnt - 1)
+        return replica_delay;
+    return 0;
+}
+
+/**
+ * \brief   Function to tell, whether the pools are in use. Otherwise, as in
+ *          the benchmarks, SipDbGet() has no connection to give.
+ */
+int SipDbEnabled()
+{
+    return initialized;
+}
+
+/**
+ * \brief   Function to make a further connection of the given role, e.g. for a
+ *          thread of the replay, to the target of the pool or the targets
+ *          after it. The caller closes it with PQfinish().
+ *
+ * @return  the connection, or NULL if none of the targets answers
+ */
+PGconn *SipDbConnect(int role)
+{
+    SipDbPool *p = &pools[role];
+    SipDbAttempt a;
+    PGconn *conn = NULL;
+
+    /* the benchmarks connect to the database section directly */
+    if (initialized == FALSE) {
+        conn = SipConnectDB((char *)sections[role]);
+        if (PQstatus(conn) != CONNECTION_BAD)
+            return conn;
+        PQfinish(conn);
+        return NULL;
+    }
+
+    memset(&a, 0, sizeof(a));
+    a.pool = p;
+    a.target = p->current;
+    a.end = p->cnt;
+    SipDbOpen(&a, 1);
+
+    return a.conn;
+}
+
+/**
+ * \brief   Function to apply the changed config file to the given role. Its
+ *          connection is closed, to be made again by the next SipDbGet().
+ */
+void SipDbReload(int role)
+{
+    SipDbPool *p = &pools[role];
+
+    if (initialized == FALSE)
+        return;
+
+    if (p->conn != NULL)
+        PQfinish(p->conn);
+    p->conn = NULL;
+    p->current = 0;
+    p->backoff = 0;
+    p->retry_at = 0;
+
+    if (SipDbTargets(p) != SIP_OK)
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in reloading the %s"
+                " database", p->role);
+}
+
+/**
+ * \brief   Function to close the connections, while shutting down the engine.
+ */
+void SipDbDeInit()
+{
+    int r = 0;
+
+    if (initialized == FALSE)
+        return;
+
+    for (r = 0; r < SIP_DB_MAX; r++) {
+        if (pools[r].conn != NULL)
+            PQfinish(pools[r].conn);
+        pools[r].conn = NULL;
+        SipDbFreeTargets(&pools[r]);
+    }
+    initialized = FALSE;
+}
+
@@ -0,0 +1,78 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-db.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ */
+
+#ifndef _UTIL_DB_H
+#define	_UTIL_DB_H
+
+#include <time.h>
+#include <inttypes.h>
+#include <postgresql/libpq-fe.h>
+
+/* Roles of the connections, each with its own connection */
+enum {
+    SIP_DB_CDR = 0,     /* reads of the CDRs, from a replica if configured */
+    SIP_DB_THRESHOLD,   /* writes of the thresholds */
+    SIP_DB_ALERT,       /* writes of the alerts, by the alert dispatcher */
+    SIP_DB_MAX,
+};
+
+/* Servers a role can be connected to, the replicas and the primary */
+#define SIP_DB_MAX_TARGETS          8
+
+#define SIP_DB_DEFAULT_CONNECT_TIMEOUT  10
+#define SIP_DB_DEFAULT_RETRY_MIN    1
+#define SIP_DB_DEFAULT_RETRY_MAX    60
+#define SIP_DB_DEFAULT_REPLICA_DELAY    30
+
+/**
+ * Connection of a role. A lost connection is made again on its next use, to
+ * the first of the targets which answers. The failed attempts are spaced by
+ * an exponential backoff.
+ */
+typedef struct SipDbPool_ {
+    const char *section;            /* database section of the config file */
+    const char *role;
+    char *conninfo[SIP_DB_MAX_TARGETS];
+    char *host[SIP_DB_MAX_TARGETS]; /* for the log messages */
+    uint8_t cnt;
+    uint8_t current;                /* target of the connection */
+    PGconn *conn;
+    time_t retry_at;                /* next attempt, or to go back to the
+                                       first target */
+    uint32_t backoff;
+} SipDbPool;
+
+int SipDbInit();
+PGconn *SipDbGet(int);
+int SipDbFailed(int);
+time_t SipDbRetryAt(int);
+time_t SipDbReplicaDelay(int);
+int SipDbEnabled();
+PGconn *SipDbConnect(int);
+void SipDbReload(int);
+void SipDbDeInit();
+
+#endif	/* _UTIL_DB_H */
+
@@ -34,12 +34,22 @@
 
 #include <ctype.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include "sipade.h"
 #include "util-detection.h"
 #include "util-log.h"
 #include "util-cdr.h"
 #include "util-alert.h"
 #include "util-conf.h"
+#include "util-metrics.h"
+#include "util-timer.h"
+#include "util-probe.h"
+#include "util-cdrgen.h"
+#include "util-ingest.h"
+#include "util-reactor.h"
+#include "util-db.h"
+#include "util-concurrency.h"
 
 #define DEFAULT_TIME_INTERVAL               10
 #define DEFAULT_SENSTIVITY_VALUE            1.2
@@ -52,7 +62,34 @@
 #define DEFAULT_START_TIME                  8
 #define DEFAULT_END_TIME                    16
 
-#define DEFAULT_QUERY_SIZE                  400
+#define DEFAULT_REPLAY_FETCH_SIZE           10000
+#define DEFAULT_REPLAY_CHECKPOINT           1000
+#define DEFAULT_REPLAY_THREADS              4
+#define DEFAULT_CATCHUP_INTERVALS           3
+#define DEFAULT_TIMEOUT_RETRIES             2
+#define DEFAULT_ADAPTIVE_MAX_FACTOR         8
+#define DEFAULT_IDLE_CHECKPOINT             6
+#define DEFAULT_CONC_DEVIATIONS             5.0
+#define DEFAULT_CONC_MIN_CALLS              4
+#define DEFAULT_CONC_WARMUP                 24
+#define DEFAULT_CONC_LOOKBACK               120
+
+/* Seconds, by which the clock of the PBX may be ahead of the engine, when
+ * the probe of the new CDRs is compared with the calldate */
+#define IDLE_PROBE_SKEW                     60
+
+/* Handling of an interval query, which has not returned in time */
+enum {
+    SIP_ON_TIMEOUT_RETRY = 0,   /* send it again, then skip the interval */
+    SIP_ON_TIMEOUT_SKIP,        /* leave the interval unscored */
+    SIP_ON_TIMEOUT_AGGREGATE,   /* fetch the totals per call type instead */
+};
+
+/* Columns of the threshold table, in the order of the stored values */
+#define SIP_THRESHOLD_COLUMNS   "num_int,dur_int,p_fint,p_dint,num_mob,dur_mob," \
+    "p_fmob,p_dmob,num_prem,dur_prem,p_fprem,p_dprem,num_ser,dur_ser,p_fser," \
+    "p_dser,num_dom,dur_dom,p_fdom,p_ddom,num_emr,dur_emr,p_femr,p_demr," \
+    "num_total,dur_total,dist_value,mean_dev,threshold,last_ts"
 
 /* For the variable values check the reference article in the source file */
 static float g = 0.125; /* g = 1/pow(2,3) */
@@ -70,7 +107,6 @@ static struct tm current_time = {0,0,0,0,0,0,0,0,0};
 static time_t complete_time = 0;
 static char *table = NULL;
 static char *last_transaction_ts = NULL;
-static PGconn *threshold_conn = NULL;
 static char *threshold_table = NULL;
 static char previous_ts[25];
 static char *accountcode = NULL;
@@ -79,6 +115,135 @@ static char *detect_start_ts = NULL;
 static char *calltype = NULL;
 static int call_freq = 0;
 static int call_dur = 0;
+static SipCdrMemSource *mem_source = NULL;
+static uint32_t replay_fetch_size = DEFAULT_REPLAY_FETCH_SIZE;
+static uint32_t replay_checkpoint = DEFAULT_REPLAY_CHECKPOINT;
+static uint32_t replay_threads = DEFAULT_REPLAY_THREADS;
+static uint32_t catchup_intervals = DEFAULT_CATCHUP_INTERVALS;
+static time_t warned_from = -1;    /* open interval with a provisional alert */
+static uint8_t on_timeout = SIP_ON_TIMEOUT_RETRY;
+static uint32_t timeout_retries = DEFAULT_TIMEOUT_RETRIES;
+static uint32_t timeout_attempts = 0;  /* of the interval being fetched */
+
+/* Length of the next interval in minutes. With the adaptive interval it is
+ * doubled, while the scored intervals have too few calls for the call-freq
+ * and call-duration, and halved, while they have four times the calls */
+static uint8_t adaptive = FALSE;
+static int window = 0;
+static int window_min = 0;
+static int window_max = 0;
+
+/* The intervals without calls are not scored. While the last interval has
+ * had no calls, the CDR table is probed for the new rows of the institution,
+ * above the highest id of the table at the anchor. The interval is skipped
+ * without fetching it, if there are none since an anchor taken before it
+ * has started */
+static uint8_t idle_skip = TRUE;
+static uint32_t idle_checkpoint = DEFAULT_IDLE_CHECKPOINT;
+static uint32_t idle_intervals = 0;    /* since the last stored threshold */
+static uint8_t idle = FALSE;           /* the last interval had no calls */
+static uint8_t probing = FALSE;        /* the query in flight is the probe */
+static int64_t probe_id = -1;          /* highest id at the probe, -1 if the
+                                          probe has to be anchored first */
+static time_t probe_since = 0;         /* time of the anchor */
+
+/**
+ * Baseline of the peak of the concurrent calls of each calltype, the mean
+ * and the mean deviation are smoothed as the distance of the threshold.
+ */
+typedef struct SipConcBaseline_ {
+    double mean[SIP_CONC_SLOTS];
+    double dev[SIP_CONC_SLOTS];
+    uint32_t seen;              /* intervals in the baseline */
+} SipConcBaseline;
+
+/**
+ * Call of an interval, to be added to the sweep in the order of the start.
+ */
+typedef struct SipConcRow_ {
+    time_t start;
+    uint32_t billsec;
+    uint8_t type;
+} SipConcRow;
+
+/* The concurrent calls follow the hours of the day, so each hour has its own
+ * baseline. The sweep of the interval by interval detection carries the
+ * calls in progress from one interval to the next */
+static uint8_t conc_enabled = TRUE;
+static double conc_deviations = DEFAULT_CONC_DEVIATIONS;
+static uint32_t conc_min_calls = DEFAULT_CONC_MIN_CALLS;
+static uint32_t conc_warmup = DEFAULT_CONC_WARMUP;
+static uint32_t conc_lookback = DEFAULT_CONC_LOOKBACK * 60;
+static SipConcBaseline conc_base[24];
+static SipConc conc;
+static SipConcRow *conc_rows = NULL;
+static uint32_t conc_rows_size = 0;
+static PGresult *conc_cdrs = NULL;      /* the CDRs waiting for their
+                                           concurrent calls */
+static SipConcStats conc_stats;
+static uint8_t conc_fetching = FALSE;  /* the query in flight is the one of
+                                           the concurrent calls */
+static uint8_t conc_fetched = FALSE;
+static uint8_t conc_known = FALSE;
+
+/* Ticks at the start of the interval, which is being fetched */
+static uint64_t fetch_start = 0;
+
+/* Threshold rows of the batch replay, which are written in bulk */
+static char *threshold_rows = NULL;
+static size_t threshold_rows_len = 0;
+static size_t threshold_rows_size = 0;
+static uint32_t threshold_rows_cnt = 0;
+
+/**
+ * Call data of an interval of the batch replay.
+ */
+typedef struct SipReplayInterval_ {
+    uint32_t rows;              /* calls fetched for the interval */
+    uint32_t num[MAX_CALLTYPE];
+    uint32_t dur[MAX_CALLTYPE];
+    SipConcStats conc;
+} SipReplayInterval;
+
+/**
+ * State of the batch replay of a range of intervals. The calls of the range
+ * are aggregated in to the intervals in parallel chunks, after which the
+ * intervals are scored in order.
+ */
+typedef struct SipReplay_ {
+    time_t base;                /* start of the first interval */
+    time_t span;                /* length of an interval in seconds */
+    uint64_t cnt;               /* number of intervals in the range */
+    int training;
+    uint8_t conc;               /* the concurrent calls are swept */
+    uint8_t baseline;           /* only the concurrency baselines are trained */
+    SipReplayInterval *iv;      /* call data of the intervals */
+    SipReplayNotifyFunc notify;
+    SipReplayStats *stats;
+} SipReplay;
+
+/**
+ * Chunk of consecutive intervals of the replay range, which is fetched and
+ * aggregated by its own thread over its own connection.
+ */
+typedef struct SipReplayChunk_ {
+    SipReplay *rp;
+    PGconn *conn;
+    uint64_t first;             /* first interval of the chunk */
+    uint64_t cnt;               /* number of intervals in the chunk */
+    uint64_t cdrs;
+    uint64_t cdr_queries;
+    SipConc conc;               /* sweep of the concurrent calls */
+    uint64_t cur;               /* interval of the sweep */
+    int done_fd;                /* eventfd, which is told the chunk is done */
+    int ret;
+    pthread_t thread;
+} SipReplayChunk;
+
+/* chunks of the replay, which are fetched by their threads */
+static SipReplayChunk *replay_chunks = NULL;
+static uint32_t replay_chunk_cnt = 0;
+static int replay_cancel = 0;
 
 /**
  * \brief   Function to update the timestamp with the given time interval. This
@@ -144,6 +309,55 @@ char *SipGetTimeStamp()
     return previous_ts;
 }
 
+/**
+ * \brief   Function to get the wall clock seconds of the given broken down
+ *          local time, i.e. its seconds as if it was UTC. The calldate of the
+ *          CDR table has no time zone, so the database takes the differences
+ *          of the call dates on the wall clock, over a change of the daylight
+ *          saving time as well. The replay counts its intervals in the same
+ *          way.
+ */
+static time_t SipWallClock(const struct tm *tm)
+{
+    struct tm wall = *tm;
+
+    return timegm(&wall);
+}
+
+/**
+ * \brief   Function to get the wall clock seconds of the given time.
+ */
+static time_t SipWallClockOf(time_t t)
+{
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    return SipWallClock(&tm);
+}
+
+/**
+ * \brief   Function to format the given wall clock seconds as a timestamp.
+ */
+static void SipWallClockFormat(time_t wall, char *ts)
+{
+    struct tm tm;
+
+    gmtime_r(&wall, &tm);
+    strftime(ts, 25, "%F %H:%M:%S", &tm);
+}
+
+/**
+ * \brief   Function to get the time of the given wall clock seconds and its
+ *          broken down local time. A wall clock time, which is skipped by the
+ *          change to the daylight saving time, is moved past the change.
+ */
+static time_t SipWallClockTime(time_t wall, struct tm *tm)
+{
+    gmtime_r(&wall, tm);
+    tm->tm_isdst = -1;
+    return mktime(tm);
+}
+
 void SipSetCallTypeString()
 {
     int i = 0;
@@ -189,6 +403,128 @@ void SipGetQuery(char *query, char *timestamp, int interval)
             timestamp,interval, calltype,accountcode);
 }
 
+/**
+ * \brief   Function to make the query string of the calls from the given start
+ *          up to, but without, the given end. The replay aggregates its
+ *          intervals in the same way.
+ */
+static void SipGetRangeQuery(char *query, const char *from_ts,
+        const char *to_ts)
+{
+    snprintf(query, DEFAULT_QUERY_SIZE, "select id,calldate,src,dst,billsec,"
+            "calltype,accountcode from %s where calldate >= '%s'::timestamp"
+            " and calldate < '%s'::timestamp and calltype in (%s) and"
+            " accountcode='%s'", table, from_ts, to_ts, calltype, accountcode);
+}
+
+/**
+ * \brief   Function to make the query string of the calls, which are in
+ *          progress during the interval of the given length from the given
+ *          start, with the columns of SipGetQuery. They are read from
+ *          concurrency.lookback before the interval, in the order of their
+ *          calldate.
+ */
+static void SipGetConcQuery(char *query, size_t size, char *timestamp,
+        int interval)
+{
+    snprintf(query, size, "select null,calldate,null,null,billsec,calltype,"
+            "accountcode from %s where calldate >= '%s'::timestamp - interval"
+            " '%"PRIu32" second' and calldate < '%s'::timestamp + interval '%d"
+            " minute' and calldate + billsec * interval '1 second' > '%s'::"
+            "timestamp and calltype in (%s) and accountcode='%s' order by"
+            " calldate", table, timestamp, conc_lookback, timestamp, interval,
+            timestamp, calltype, accountcode);
+}
+
+/**
+ * \brief   Function to get the query of the totals per call type of the given
+ *          interval, which is cheaper to transfer than its calls. Each row
+ *          has the columns of the calls, with the sum of the billsec, the
+ *          first calldate and no id, src and dst, followed by the number of
+ *          the calls.
+ */
+static void SipGetAggregateQuery(char *query, char *timestamp, int interval)
+{
+    snprintf(query, DEFAULT_QUERY_SIZE, "select null,min(calldate),null,null,"
+            "sum(billsec),calltype,accountcode,count(*) from %s where calldate"
+            " between '%s'::timestamp and '%s'::timestamp + interval '%d "
+            "minute'and calltype in (%s) and accountcode='%s' group by "
+            "calltype,accountcode", table, timestamp, timestamp, interval,
+            calltype, accountcode);
+}
+
+/**
+ * \brief   Function to get the query of the probe for the new CDRs, i.e. the
+ *          highest id of the CDR table and the number of the calls of the
+ *          institution above the id of the last probe. Both are looked up by
+ *          the primary key. The first probe only takes the highest id.
+ */
+static void SipGetProbeQuery(char *query)
+{
+    if (probe_id < 0) {
+        snprintf(query, DEFAULT_QUERY_SIZE, "select max(id),null from %s",
+                table);
+        return;
+    }
+
+    snprintf(query, DEFAULT_QUERY_SIZE, "select max(id),count(case when "
+            "accountcode='%s' and calltype in (%s) then 1 end) from %s where"
+            " id > %"PRId64, accountcode, calltype, table, probe_id);
+}
+
+/**
+ * \brief   Function to set the in memory source, from which the CDRs of the
+ *          intervals are taken instead of the CDR database.
+ */
+void SipDetectionSetMemSource(SipCdrMemSource *src)
+{
+    mem_source = src;
+}
+
+/**
+ * \brief   Function to fetch the CDRs of the interval starting at the current
+ *          timestamp, from the in memory source if one is set, from the
+ *          ingest buffer if it has received the whole interval or otherwise by
+ *          the given query from the CDR database.
+ */
+static PGresult *SipGetIntervalCdr(PGconn *conn, char *query)
+{
+    time_t from = mktime(&current_time);
+    uint8_t calltypes = 0;
+    uint8_t cnt = 0;
+
+    if (mem_source == NULL && !SipIngestCovers(from))
+        return SipGetCdr(conn, query, SIP_METRIC_STMT_INTERVAL);
+
+    for (cnt = 0; cnt < MAX_CALLTYPE; cnt++) {
+        if (hd_detection.call[cnt].flag & CALLTYPE_ACTIVE)
+            calltypes |= 1 << cnt;
+    }
+
+    if (mem_source == NULL)
+        return SipIngestResult(from, from + window * 60, accountcode,
+                calltypes);
+
+    return SipCdrMemSourceResult(mem_source, from, from + window * 60,
+            accountcode, calltypes);
+}
+
+/**
+ * \brief   Function to get the start of the interval, which is scored next.
+ */
+time_t SipAnomalyIntervalFrom()
+{
+    return mktime(&current_time);
+}
+
+/**
+ * \brief   Function to get the end of the interval, which is scored next.
+ */
+time_t SipAnomalyIntervalEnd()
+{
+    return mktime(&current_time) + window * 60;
+}
+
 /**
  * \brief   Function to fetch the data rekated to different calltypes and their
  *          duration.
@@ -198,55 +534,26 @@ void SipGetQuery(char *query, char *timestamp, int interval)
  */
 void SipGetCallData(Hd *hd, PGresult *result)
 {
-    char *calltype = NULL;
-    char *billsec = NULL;
-    int i_billsec = 0;
     uint32_t row = 0;
     uint32_t row_cnt = 0;
     uint8_t cnt = 0;
+    int type = 0;
+    int totals = 0;
 
     row_cnt = PQntuples(result);
 
+    /* the rows of the aggregate query are followed by the number of calls */
+    totals = (PQnfields(result) > 7);
+
     /* Get the data for various call types */
     for (row = 0; row < row_cnt; row++) {
-        calltype = PQgetvalue(result, row, 5);
-        /* Get data for INTERNATIONAL call type */
-        if (strncmp(calltype, "INTERNATIONAL", 13) == 0) {
-            hd->call[INTERNATIONAL].num++;
-            billsec = PQgetvalue(result, row, 4);
-            i_billsec = strtoul(billsec,NULL,10);
-            hd->call[INTERNATIONAL].dur += i_billsec;
-        /* Get data for MOBILE call type */
-        } else if (strncmp(calltype, "MOBILE", 6) == 0) {
-            hd->call[MOBILE].num++;
-            billsec = PQgetvalue(result, row, 4);
-            i_billsec = strtoul(billsec,NULL,10);
-            hd->call[MOBILE].dur += i_billsec;
-        /* Get data for PREMIUM call type */
-        } else if (strncmp(calltype, "PREMIUM", 7) == 0) {
-            hd->call[PREMIUM].num++;
-            billsec = PQgetvalue(result, row, 4);
-            i_billsec = strtoul(billsec,NULL,10);
-            hd->call[PREMIUM].dur += i_billsec;
-        /* Get data for DOMESTIC call type */
-        } else if (strncmp(calltype, "DOMESTIC", 8) == 0) {
-            hd->call[DOMESTIC].num++;
-            billsec = PQgetvalue(result, row, 4);
-            i_billsec = strtoul(billsec,NULL,10);
-            hd->call[DOMESTIC].dur += i_billsec;
-        /* Get data for SERVICE call type */
-        } else if (strncmp(calltype, "SERVICE", 7) == 0) {
-            hd->call[SERVICE].num++;
-            billsec = PQgetvalue(result, row, 4);
-            i_billsec = strtoul(billsec,NULL,10);
-            hd->call[SERVICE].dur += i_billsec;
-        /* Get data for EMERGENCY call type */
-        } else if (strncmp(calltype, "EMERGENCY", 9) == 0) {
-            hd->call[EMERGENCY].num++;
-            billsec = PQgetvalue(result, row, 4);
-            i_billsec = strtoul(billsec,NULL,10);
-            hd->call[EMERGENCY].dur += i_billsec;
-        }
+        type = SipCallTypeIndex(PQgetvalue(result, row, 5));
+        if (type < 0)
+            continue;
+
+        hd->call[type].num += totals ?
+            strtoul(PQgetvalue(result, row, 7), NULL, 10) : 1;
+        hd->call[type].dur += strtoul(PQgetvalue(result, row, 4), NULL, 10);
     }
 
     /* Get the total data of the all the fetched call types */
@@ -271,6 +578,215 @@ void SipGetCallData(Hd *hd, PGresult *result)
 
 }
 
+/**
+ * \brief   Function to get the time of a calldate 'YYYY-MM-DD HH:MM:SS' in
+ *          local time. The calls of an interval are mostly within the same
+ *          hour, of which the start is converted only once.
+ *
+ * @return the time, or -1 if the calldate is not valid
+ */
+static time_t SipConcCallDate(const char *calldate)
+{
+    static char hour[14];
+    static time_t hour_start = 0;
+    struct tm tm;
+
+    if (strlen(calldate) < 19)
+        return -1;
+
+    if (strncmp(calldate, hour, 13) != 0) {
+        memset(&tm, 0, sizeof(tm));
+        if (sscanf(calldate, "%d-%d-%d %d", &tm.tm_year, &tm.tm_mon,
+                    &tm.tm_mday, &tm.tm_hour) != 4)
+        {
+            return -1;
+        }
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        hour_start = mktime(&tm);
+        memcpy(hour, calldate, 13);
+    }
+
+    return hour_start + atoi(calldate + 14) * 60 + atoi(calldate + 17);
+}
+
+static int SipConcRowCmp(const void *a, const void *b)
+{
+    const SipConcRow *ra = (const SipConcRow *)a;
+    const SipConcRow *rb = (const SipConcRow *)b;
+
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+/**
+ * \brief   Function to get the concurrent calls of the interval from its CDRs.
+ *          The calls are sorted by their calldate and swept in to the window
+ *          of the interval, after the calls which are still in progress from
+ *          the previous one. The calls before the interval, which are in
+ *          progress at its start, are swept up to it.
+ *
+ * @param stats     pointer to the peak and mean of the concurrent calls
+ * @param result    the CDRs of the interval
+ * @param from      start of the interval
+ * @param to        end of the interval
+ *
+ * @return returns TRUE upon success and FALSE if the CDRs have no single
+ *         calls, as the totals of the aggregate query
+ */
+int SipGetConcurrency(SipConcStats *stats, PGresult *result, time_t from,
+        time_t to)
+{
+    SipConcRow *rows = NULL;
+    uint32_t row = 0;
+    uint32_t row_cnt = PQntuples(result);
+    uint32_t cnt = 0;
+    uint32_t size = 0;
+    time_t start = 0;
+    int type = 0;
+    int sorted = TRUE;
+
+    if (PQnfields(result) > 7)
+        return FALSE;
+
+    if (row_cnt > conc_rows_size) {
+        size = conc_rows_size ? conc_rows_size : 1024;
+        while (size < row_cnt)
+            size *= 2;
+        rows = realloc(conc_rows, size * sizeof(SipConcRow));
+        if (rows == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "failed in allocating"
+                    " memory");
+            return FALSE;
+        }
+        conc_rows = rows;
+        conc_rows_size = size;
+    }
+
+    for (row = 0; row < row_cnt; row++) {
+        type = SipCallTypeIndex(PQgetvalue(result, row, 5));
+        start = SipConcCallDate(PQgetvalue(result, row, 1));
+        if (type < 0 || start < 0)
+            continue;
+
+        if (cnt > 0 && start < conc_rows[cnt - 1].start)
+            sorted = FALSE;
+        conc_rows[cnt].start = start;
+        conc_rows[cnt].billsec = strtoul(PQgetvalue(result, row, 4), NULL, 10);
+        conc_rows[cnt].type = type;
+        cnt++;
+    }
+
+    /* the calls from memory are in the order of their calldate already */
+    if (!sorted)
+        qsort(conc_rows, cnt, sizeof(SipConcRow), SipConcRowCmp);
+
+    for (row = 0; row < cnt && conc_rows[row].start < from; row++) {
+        if (SipConcAdd(&conc, conc_rows[row].start, conc_rows[row].billsec,
+                    conc_rows[row].type) != SIP_OK)
+        {
+            return FALSE;
+        }
+    }
+
+    SipConcOpen(&conc, from);
+    for (; row < cnt; row++) {
+        if (SipConcAdd(&conc, conc_rows[row].start, conc_rows[row].billsec,
+                    conc_rows[row].type) != SIP_OK)
+        {
+            return FALSE;
+        }
+    }
+    SipConcClose(&conc, to, stats);
+
+    SipLog(SIP_LOG_DEBUG, SIP_LOG_LOCATION, "Concurrent calls peak %"PRIu32
+            " mean %f, timestamp %s", stats->peak[SIP_CONC_ALL],
+            stats->mean[SIP_CONC_ALL], last_transaction_ts);
+    return TRUE;
+}
+
+/**
+ * \brief   Function to check, whether the concurrent calls of the interval are
+ *          fetched from the CDR database with a query of their own. That is
+ *          not the case for the calls from memory or from the ingest buffer
+ *          and for the totals per call type.
+ *
+ * @param result    the CDRs of the interval
+ *
+ * @return returns TRUE if the query is needed and FALSE otherwise
+ */
+static int SipConcQueried(PGresult *result)
+{
+    if (!conc_enabled || mem_source != NULL ||
+            SipIngestCovers(mktime(&current_time)))
+    {
+        return FALSE;
+    }
+
+    return (PQnfields(result) <= 7);
+}
+
+/**
+ * \brief   Function to get the concurrent calls of the interval, which starts
+ *          at the current timestamp, from the result of SipGetConcQuery(). The
+ *          sweep is started again at concurrency.lookback before the interval,
+ *          so that the calls of the earlier intervals are counted also after a
+ *          restart or a skipped interval.
+ *
+ * @param stats     pointer to the peak and mean of the concurrent calls
+ * @param res       the calls in progress during the interval
+ * @param span      length of the interval in minutes
+ *
+ * @return returns TRUE if the concurrent calls are known and FALSE otherwise
+ */
+static int SipConcFromCalls(SipConcStats *stats, PGresult *res, int span)
+{
+    time_t from = mktime(&current_time);
+
+    SipConcReset(&conc, from - conc_lookback);
+    return SipGetConcurrency(stats, res, from, from + span * 60);
+}
+
+/**
+ * \brief   Function to get the concurrent calls of the interval, which starts
+ *          at the current timestamp, waiting for the CDR database. The calls
+ *          from memory or from the ingest buffer are taken from the CDRs of
+ *          the interval, after the calls carried over from the previous one.
+ *
+ * @param conn      Pointer to the CDR database
+ * @param stats     pointer to the peak and mean of the concurrent calls
+ * @param result    the CDRs of the interval
+ * @param span      length of the interval in minutes
+ *
+ * @return returns TRUE if the concurrent calls are known and FALSE otherwise
+ */
+static int SipGetIntervalConcurrency(PGconn *conn, SipConcStats *stats,
+        PGresult *result, int span)
+{
+    PGresult *res = NULL;
+    char query[2 * DEFAULT_QUERY_SIZE];
+    time_t from = mktime(&current_time);
+    int known = FALSE;
+
+    if (!SipConcQueried(result))
+        return SipGetConcurrency(stats, result, from, from + span * 60);
+
+    if (conn == NULL)
+        return FALSE;
+
+    SipGetConcQuery(query, sizeof(query), last_transaction_ts, span);
+    res = SipGetCdr(conn, query, SIP_METRIC_STMT_CONCURRENCY);
+    if (res == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
+                " given query \"%s\"", query);
+        return FALSE;
+    }
+
+    known = SipConcFromCalls(stats, res, span);
+    PQclear(res);
+    return known;
+}
+
 /**
  * \brief   Function to calculate the probability of the number of different
  *          calltypes and their duration. The probabality will be calculated
@@ -341,6 +857,12 @@ void SipCalcHellingerDistance (Hd *hd_detection, Hd *hd_testing)
         hd_testing->distance_value += fcall[cnt] + dcall[cnt];
     }
 
+    if (SIP_PROBE_ENABLED(distance__computed)) {
+        SIP_PROBE2(distance__computed,
+                SIP_PROBE_FIXED(hd_testing->distance_value),
+                SIP_PROBE_FIXED(hd_detection->threshold));
+    }
+
     SipLog(SIP_LOG_DEBUG, SIP_LOG_LOCATION, "Distance Value %f",
             hd_testing->distance_value);
 }
@@ -380,6 +902,13 @@ void SipUpdateHDThreshold(Hd *hd_detection, Hd *hd_testing)
     hd_detection->threshold = (senstivity * hd_detection->distance_value) +
                             (adaptability * hd_detection->mean_deviation);
 
+    if (SIP_PROBE_ENABLED(threshold__updated)) {
+        SIP_PROBE3(threshold__updated,
+                SIP_PROBE_FIXED(hd_detection->threshold),
+                SIP_PROBE_FIXED(hd_detection->distance_value),
+                SIP_PROBE_FIXED(hd_detection->mean_deviation));
+    }
+
     for (cnt = 0; cnt < MAX_CALLTYPE &&
             (hd_detection->call[cnt].flag & CALLTYPE_ACTIVE); cnt++)
     {
@@ -453,142 +982,275 @@ void SipPrintHD(Hd *hd, FILE *fp)
 }
 
 /**
- * \brief   Function to fetch the config values related to the detection algo
- *          and traning engine.
- *
- * @return returns SIP_OK upon success and SIP_ERROR on failure
+ * \brief   Function to fetch the tunables of the detection algo from the
+ *          config file. They can be changed by reloading the config file,
+ *          without losing the trained threshold.
  */
-int SipAnomalyInitConfValues()
+static void SipAnomalyTunables()
 {
-    char *senstivity_s = NULL;
-    char *interval_s = NULL;
-    char *adaptability_s = NULL;
-    char *int_dur_s = NULL;
-    char *mob_dur_s = NULL;
-    char *prem_dur_s = NULL;
-    char *start_time_s = NULL;
-    char *end_time_s = NULL;
-    char *call_fs = NULL;
-    char *call_ds = NULL;
-    extern uint8_t run_mode;
-    char *ending_s = NULL;
-    char *calltype_s = NULL;
+    int64_t val = 0;
+    char *action = NULL;
+    int enabled = TRUE;
 
-    /* Get the table name from the database connection information given in
-     * the configuration file */
-    if (SipConfGet("cdr-database.table", &table) != 1) {
-        table = calloc(1, sizeof("cdr"));
-        table = "cdr";
+    if (SipConfGetDouble("ad-algo.sensitivity", &senstivity) != 1)
+        senstivity = DEFAULT_SENSTIVITY_VALUE;
+
+    if (SipConfGetDouble("ad-algo.adaptability", &adaptability) != 1)
+        adaptability = DEFAULT_ADAPTABILITY_VALUE;
+
+    if (SipConfGetInt("call-duration.mobile", &val) == 1) {
+        mob_dur = val * 60;
+    } else {
+        mob_dur = DEFAULT_MOBILE_DURATION;
     }
 
-    if (SipConfGet("ad-algo.sensitivity", &senstivity_s) == 1) {
-        senstivity = atof(senstivity_s);
+    if (SipConfGetInt("call-duration.international", &val) == 1) {
+        int_dur = val * 60;
     } else {
-        senstivity = DEFAULT_SENSTIVITY_VALUE;
+        int_dur = DEFAULT_INTERNATIONAL_DURATION;
     }
 
-    if (SipConfGet("ad-algo.adaptability", &adaptability_s) == 1) {
-        adaptability = atof(adaptability_s);
+    if (SipConfGetInt("call-duration.premium", &val) == 1) {
+        prem_dur = val * 60;
     } else {
-        adaptability = DEFAULT_ADAPTABILITY_VALUE;
+        prem_dur = DEFAULT_PREMIUM_DURATION;
     }
 
-    if (SipConfGet("ad-algo.interval", &interval_s) == 1) {
-        interval = atoi(interval_s);
+    if (SipConfGetInt("office-time.start_time", &val) == 1) {
+        start_time = val;
+        start_time -= 1; /* struct tm has hour values from 0-23 */
     } else {
-        interval = DEFAULT_TIME_INTERVAL;
+        start_time = DEFAULT_START_TIME;
     }
 
-    if (SipConfGet("call-duration.mobile", &mob_dur_s) == 1) {
-        mob_dur = atoi(mob_dur_s) * 60;
+    if (SipConfGetInt("office-time.end_time", &val) == 1) {
+        end_time = val;
     } else {
-        mob_dur = DEFAULT_MOBILE_DURATION;
+        end_time = DEFAULT_END_TIME;
     }
 
-    if (SipConfGet("call-duration.international", &int_dur_s) == 1) {
-        int_dur = atoi(int_dur_s) * 60;
+    if (SipConfGetInt("ad-algo.call-freq", &val) == 1) {
+        call_freq = val;
     } else {
-        int_dur = DEFAULT_INTERNATIONAL_DURATION;
+        call_freq = 0;
     }
 
-    if (SipConfGet("call-duration.premium", &prem_dur_s) == 1) {
-        prem_dur = atoi(prem_dur_s) * 60;
+    if (SipConfGetInt("ad-algo.call-duration", &val) == 1) {
+        call_dur = val * 60;
     } else {
-        prem_dur = DEFAULT_PREMIUM_DURATION;
+        call_dur = 0;
     }
 
-    if (SipConfGet("office-time.start_time", &start_time_s) == 1) {
-        start_time = atoi(start_time_s);
-        start_time -= 1; /* struct tm has hour values from 0-23 */
+    if (SipConfGetInt("replay.fetch-size", &val) == 1 && val > 0) {
+        replay_fetch_size = val;
     } else {
-        start_time = DEFAULT_START_TIME;
+        replay_fetch_size = DEFAULT_REPLAY_FETCH_SIZE;
     }
 
-    if (SipConfGet("office-time.end_time", &end_time_s) == 1) {
-        end_time = atoi(end_time_s);
+    if (SipConfGetInt("replay.checkpoint", &val) == 1 && val > 0) {
+        replay_checkpoint = val;
     } else {
-        end_time = DEFAULT_END_TIME;
+        replay_checkpoint = DEFAULT_REPLAY_CHECKPOINT;
     }
 
-    if (SipConfGet("institution", &accountcode) != 1) {
-        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Institution code has"
-        " not been provided in the configuration file. Please provide the code"
-        " to start the engine :-)");
-        return SIP_ERROR;
+    if (SipConfGetInt("replay.threads", &val) == 1 && val > 0) {
+        replay_threads = val;
+    } else {
+        replay_threads = DEFAULT_REPLAY_THREADS;
     }
 
-    if (SipConfGet("ad-algo.threshold-restore", &thresh_restore) != 1) {
-        thresh_restore = calloc(1, 4*sizeof(char));
-        thresh_restore = "yes";
+    if (SipConfGetInt("catch-up.min-intervals", &val) == 1 && val >= 0) {
+        catchup_intervals = val;
+    } else {
+        catchup_intervals = DEFAULT_CATCHUP_INTERVALS;
     }
 
-    if (SipConfGet("detection-start-ts", &detect_start_ts) != 1) {
-        detect_start_ts = NULL;
+    if (SipConfGetInt("cdr-query.timeout", &val) == 1 && val >= 0) {
+        SipCdrSetTimeout(val);
+    } else {
+        SipCdrSetTimeout(SIP_CDR_DEFAULT_TIMEOUT);
     }
 
-    if (SipConfGet("ad-algo.call-freq", &call_fs) == 1) {
-        call_freq = atoi(call_fs);
+    if (SipConfGetInt("cdr-query.retries", &val) == 1 && val >= 0) {
+        timeout_retries = val;
+    } else {
+        timeout_retries = DEFAULT_TIMEOUT_RETRIES;
     }
 
-    if (SipConfGet("ad-algo.call-duration", &call_ds) == 1) {
-        call_dur = atoi(call_ds) * 60;
+    if (SipConfGetBool("idle-skip.enabled", &enabled) != 1)
+        enabled = TRUE;
+    idle_skip = enabled;
+
+    if (SipConfGetInt("idle-skip.checkpoint", &val) == 1 && val > 0) {
+        idle_checkpoint = val;
+    } else {
+        idle_checkpoint = DEFAULT_IDLE_CHECKPOINT;
     }
 
-    if (SipConfGet("ending-date", &ending_s) == 1) {
-        struct tm ending_time = {0,0,0,0,0,0,0,0,0};
-        strptime(ending_s, "%F %H:%M:%S" ,&ending_time);
-        complete_time = mktime(&ending_time);
+    if (SipConfGetBool("concurrency.enabled", &enabled) != 1)
+        enabled = TRUE;
+    conc_enabled = enabled;
+
+    if (SipConfGetDouble("concurrency.deviations", &conc_deviations) != 1 ||
+            conc_deviations < 0.0)
+    {
+        conc_deviations = DEFAULT_CONC_DEVIATIONS;
+    }
+
+    if (SipConfGetInt("concurrency.min-calls", &val) == 1 && val >= 0) {
+        conc_min_calls = val;
     } else {
-        if (run_mode & SIP_RUN_MODE_OFFLINE) {
-            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "please mention the"
-                    " ending time while running in offline mode.");
-            return SIP_ERROR;
-        }
+        conc_min_calls = DEFAULT_CONC_MIN_CALLS;
     }
 
-     if (SipConfGet("call-type", &calltype_s) == 1) {
-         char *call_t = strtok(calltype_s, ",");
-         while( call_t != NULL ) {
+    if (SipConfGetInt("concurrency.warm-up", &val) == 1 && val >= 0) {
+        conc_warmup = val;
+    } else {
+        conc_warmup = DEFAULT_CONC_WARMUP;
+    }
 
-             /* remove the spaces */
-             while(isspace(*call_t)) {
-                 call_t++;
-             }
+    if (SipConfGetInt("concurrency.lookback", &val) == 1 && val >= 0) {
+        conc_lookback = val * 60;
+    } else {
+        conc_lookback = DEFAULT_CONC_LOOKBACK * 60;
+    }
 
-             if (strncasecmp(call_t, "All", 3) == 0) {
-                 hd_detection.call[INTERNATIONAL].flag |= CALLTYPE_ACTIVE;
-                 hd_detection.call[INTERNATIONAL].name = "INTERNATIONAL";
-                 hd_detection.call[MOBILE].flag |= CALLTYPE_ACTIVE;
-                 hd_detection.call[MOBILE].name = "MOBILE";
-                 hd_detection.call[PREMIUM].flag |= CALLTYPE_ACTIVE;
-                 hd_detection.call[PREMIUM].name = "PREMIUM";
-                 hd_detection.call[DOMESTIC].flag |= CALLTYPE_ACTIVE;
-                 hd_detection.call[DOMESTIC].name = "DOMESTIC";
-                 hd_detection.call[EMERGENCY].flag |= CALLTYPE_ACTIVE;
-                 hd_detection.call[EMERGENCY].name = "EMERGENCY";
-                 hd_detection.call[SERVICE].flag |= CALLTYPE_ACTIVE;
-                 hd_detection.call[SERVICE].name = "SERVICE";
-                 break;
+    if (SipConfGet("cdr-query.on-timeout", &action) != 1) {
+        on_timeout = SIP_ON_TIMEOUT_RETRY;
+    } else if (strcmp(action, "skip") == 0) {
+        on_timeout = SIP_ON_TIMEOUT_SKIP;
+    } else if (strcmp(action, "aggregate") == 0) {
+        on_timeout = SIP_ON_TIMEOUT_AGGREGATE;
+    } else {
+        on_timeout = SIP_ON_TIMEOUT_RETRY;
+    }
+}
+
+/**
+ * \brief   Function to fetch the bounds of the adaptive interval from the
+ *          config file. They are kept around the configured interval, which
+ *          is the length of the trained intervals. The next interval is
+ *          brought in to the bounds, it is the configured one when the
+ *          adaptive interval is disabled.
+ */
+static void SipAnomalyWindowConf()
+{
+    int64_t val = 0;
+    int enabled = FALSE;
+
+    if (SipConfGetBool("adaptive-interval.enabled", &enabled) != 1)
+        enabled = FALSE;
+    adaptive = enabled;
+
+    window_min = interval;
+    window_max = interval * DEFAULT_ADAPTIVE_MAX_FACTOR;
+
+    if (SipConfGetInt("adaptive-interval.min-interval", &val) == 1 && val > 0)
+        window_min = val;
+    if (SipConfGetInt("adaptive-interval.max-interval", &val) == 1 && val > 0)
+        window_max = val;
+
+    if (window_min > interval)
+        window_min = interval;
+    if (window_max < interval)
+        window_max = interval;
+
+    if (!adaptive || window == 0)
+        window = interval;
+    if (window < window_min)
+        window = window_min;
+    if (window > window_max)
+        window = window_max;
+
+    SipMetricsSetInterval(accountcode, window * 60);
+}
+
+/**
+ * \brief   Function to fetch the config values related to the detection algo
+ *          and traning engine.
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+int SipAnomalyInitConfValues()
+{
+    extern uint8_t run_mode;
+    char *ending_s = NULL;
+    char *calltype_s = NULL;
+    char *ts = NULL;
+    int64_t val = 0;
+
+    /* Get the table name from the database connection information given in
+     * the configuration file */
+    if (SipConfGet("cdr-database.table", &table) != 1) {
+        table = calloc(1, sizeof("cdr"));
+        table = "cdr";
+    }
+
+    SipAnomalyTunables();
+
+    if (SipConfGetInt("ad-algo.interval", &val) == 1 && val > 0) {
+        interval = val;
+    } else {
+        interval = DEFAULT_TIME_INTERVAL;
+    }
+
+    if (SipConfGet("institution", &accountcode) != 1) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Institution code has"
+        " not been provided in the configuration file. Please provide the code"
+        " to start the engine :-)");
+        return SIP_ERROR;
+    }
+
+    SipAnomalyWindowConf();
+
+    if (SipConfGet("ad-algo.threshold-restore", &thresh_restore) != 1) {
+        thresh_restore = calloc(1, 4*sizeof(char));
+        thresh_restore = "yes";
+    }
+
+    if (SipConfGet("detection-start-ts", &detect_start_ts) != 1) {
+        detect_start_ts = NULL;
+    }
+
+    if (SipConfGet("initial-timestamp", &ts) == 1) {
+        last_transaction_ts = strdup(ts);
+    }
+
+    if (SipConfGet("ending-date", &ending_s) == 1) {
+        struct tm ending_time = {0,0,0,0,0,0,0,0,0};
+        strptime(ending_s, "%F %H:%M:%S" ,&ending_time);
+        complete_time = mktime(&ending_time);
+    } else {
+        if (run_mode & SIP_RUN_MODE_OFFLINE) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "please mention the"
+                    " ending time while running in offline mode.");
+            return SIP_ERROR;
+        }
+    }
+
+     if (SipConfGet("call-type", &calltype_s) == 1) {
+         char *call_t = strtok(calltype_s, ",");
+         while( call_t != NULL ) {
+
+             /* remove the spaces */
+             while(isspace(*call_t)) {
+                 call_t++;
+             }
+
+             if (strncasecmp(call_t, "All", 3) == 0) {
+                 hd_detection.call[INTERNATIONAL].flag |= CALLTYPE_ACTIVE;
+                 hd_detection.call[INTERNATIONAL].name = "INTERNATIONAL";
+                 hd_detection.call[MOBILE].flag |= CALLTYPE_ACTIVE;
+                 hd_detection.call[MOBILE].name = "MOBILE";
+                 hd_detection.call[PREMIUM].flag |= CALLTYPE_ACTIVE;
+                 hd_detection.call[PREMIUM].name = "PREMIUM";
+                 hd_detection.call[DOMESTIC].flag |= CALLTYPE_ACTIVE;
+                 hd_detection.call[DOMESTIC].name = "DOMESTIC";
+                 hd_detection.call[EMERGENCY].flag |= CALLTYPE_ACTIVE;
+                 hd_detection.call[EMERGENCY].name = "EMERGENCY";
+                 hd_detection.call[SERVICE].flag |= CALLTYPE_ACTIVE;
+                 hd_detection.call[SERVICE].name = "SERVICE";
+                 break;
              } else if (strncasecmp(call_t, "International", 13) == 0) {
                  hd_detection.call[INTERNATIONAL].flag |= CALLTYPE_ACTIVE;
                  hd_detection.call[INTERNATIONAL].name = "INTERNATIONAL";
@@ -620,6 +1282,39 @@ int SipAnomalyInitConfValues()
     return SIP_OK;
 }
 
+/**
+ * \brief   Function to apply the reloaded config file to the detection. The
+ *          tunables take effect from the next interval on, the trained
+ *          threshold in hd_detection is kept. The institution, the interval
+ *          and the calltypes define what has been trained, so they are only
+ *          changed by a restart of the engine.
+ */
+void SipAnomalyReloadConf()
+{
+    char *val = NULL;
+    int64_t ival = 0;
+
+    SipAnomalyTunables();
+    SipAnomalyWindowConf();
+
+    if ((SipConfGet("institution", &val) == 1 &&
+                strcmp(val, accountcode) != 0) ||
+            (SipConfGetInt("ad-algo.interval", &ival) == 1 &&
+                ival != interval))
+    {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "The institution and the"
+                " interval are only changed by a restart of the engine,"
+                " keeping the institution %s with interval %d", accountcode,
+                interval);
+    }
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Detection has been reconfigured:"
+            " sensitivity %.2f, adaptability %.2f, durations %d/%d/%d seconds,"
+            " office hours %d-%d, the threshold %f is kept", senstivity,
+            adaptability, mob_dur, int_dur, prem_dur, start_time + 1, end_time,
+            hd_detection.threshold);
+}
+
 /**
  * \brief   Function to initialize the detection modeule. It tries to restore
  *          the threshold value from the stored threshold values, if restoration
@@ -637,24 +1332,11 @@ int SipInitAnomalyDetection()
     if (SipAnomalyInitConfValues() != SIP_OK)
         return SIP_ERROR;
 
-    /* connect to the data base with the provided connection information */
-    threshold_conn = SipConnectDB("threshold-database");
-    if(PQstatus(threshold_conn) == CONNECTION_BAD) {
-        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in "
-                        "connecting to threshold-database");
-        return SIP_ERROR;
-    }
-
     if (SipConfGet("threshold-database.table", &threshold_table) != 1) {
         threshold_table = calloc(1, sizeof("threshold"));
         threshold_table = "threshold";
     }
 
-    char *ts = NULL;
-    if (SipConfGet("initial-timestamp", &ts) == 1) {
-        last_transaction_ts = strdup(ts);
-    }
-
     if (strncmp(thresh_restore, "no", 2) == 0) {
         return SIP_THRESHOLD_NOT_RESTORE;
     }
@@ -665,7 +1347,8 @@ int SipInitAnomalyDetection()
 
     snprintf(query, sizeof(query), "select max(threshold_id) from %s",
                 threshold_table);
-    PGresult *res = SipGetCdr(threshold_conn, query);
+    PGresult *res = SipGetCdr(SipDbGet(SIP_DB_THRESHOLD), query,
+            SIP_METRIC_STMT_RESTORE);
     if (res == NULL) {
         SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
                 " given query \"%s\"", query);
@@ -688,7 +1371,8 @@ int SipInitAnomalyDetection()
 
         snprintf(query, 75, "select * from %s where threshold_id='%"PRIu64"'",
                 threshold_table, threshold_id);
-        res = SipGetCdr(threshold_conn, query);
+        res = SipGetCdr(SipDbGet(SIP_DB_THRESHOLD), query,
+                SIP_METRIC_STMT_RESTORE);
         if (res == NULL) {
             SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making "
                     "the given query \"%s\"", query);
@@ -752,20 +1436,22 @@ int SipInitAnomalyDetection()
 /**
  * \brief Function to store the current threshold value in the threshold databse
  *        which will be used for restoring the detection engine upon failure or
- *        restart.
+ *        restart. While the threshold database is down, the threshold is
+ *        not stored, the one of a later interval is stored instead.
  *
- * @return returns SIP_OK upon success and SIP_ERROR on failure
+ * @return returns SIP_OK upon success, SIP_PENDING if the threshold database
+ *         is down and SIP_ERROR on failure
  */
 int SipAnomalyStoreThreshold()
 {
+    PGconn *conn = SipDbGet(SIP_DB_THRESHOLD);
     char query[1000];
 
-    snprintf(query, sizeof (query), "insert into %s(num_int,dur_int,p_fint,"
-            "p_dint,num_mob,dur_mob,p_fmob,p_dmob,num_prem,dur_prem,p_fprem,"
-            "p_dprem,num_ser,dur_ser,p_fser,p_dser,num_dom,dur_dom,p_fdom,"
-            "p_ddom,num_emr,dur_emr,p_femr,p_demr,num_total,dur_total,"
-            "dist_value, mean_dev,threshold, last_ts) "
-            "values ('%"PRIu32"','%"PRIu32"','%f','%f',"
+    if (conn == NULL)
+        return SIP_PENDING;
+
+    snprintf(query, sizeof (query), "insert into %s(" SIP_THRESHOLD_COLUMNS
+            ") values ('%"PRIu32"','%"PRIu32"','%f','%f',"
             "'%"PRIu32"','%"PRIu32"','%f','%f','%"PRIu32"','%"PRIu32"','%f','%f',"
             "'%"PRIu32"','%"PRIu32"','%f','%f','%"PRIu32"','%"PRIu32"','%f','%f',"
             "'%"PRIu32"','%"PRIu32"','%f','%f','%"PRIu64"','%"PRIu64"','%f','%f',"
@@ -787,17 +1473,192 @@ int SipAnomalyStoreThreshold()
             hd_detection.mean_deviation, hd_detection.threshold,
             last_transaction_ts);
 
-    PGresult *res = PQexec(threshold_conn, query);
+    uint64_t start = SipTimerTicks();
+    PGresult *res = PQexec(conn, query);
+    SipMetricsObserveQuery(SIP_METRIC_STMT_THRESHOLD,
+            SipTimerNs(SipTimerTicks() - start) / 1e9);
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
         SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in inserting"
                 " the given values \"%s\"", query);
         PQclear(res);
-        return SIP_ERROR;
+        return SipDbFailed(SIP_DB_THRESHOLD) ? SIP_PENDING : SIP_ERROR;
     }
 
     PQclear(res);
     return SIP_OK;
 }
+/**
+ * \brief   Function to scale the calls of an interval of the given length to
+ *          the configured interval, which the threshold and the allowed
+ *          durations are given for. The probabilities are not changed.
+ */
+static void SipAnomalyNormalize(Hd *hd, int span)
+{
+    double scale = (double)interval / (double)span;
+    uint8_t cnt = 0;
+
+    hd->num_total = 0;
+    hd->dur_total = 0;
+    for (cnt = 0; cnt < MAX_CALLTYPE; cnt++) {
+        hd->call[cnt].num = lround(hd->call[cnt].num * scale);
+        hd->call[cnt].dur = lround(hd->call[cnt].dur * scale);
+        hd->num_total += hd->call[cnt].num;
+        hd->dur_total += hd->call[cnt].dur;
+    }
+}
+
+/**
+ * \brief   Function to get the limit of the concurrent calls of the given
+ *          slot, above which the peak of an interval is anomalous. It is
+ *          never below the concurrency.min-calls.
+ */
+static double SipConcLimit(SipConcBaseline *base, uint8_t slot)
+{
+    double limit = senstivity * base->mean[slot] +
+        conc_deviations * base->dev[slot];
+
+    return (limit < conc_min_calls) ? conc_min_calls : limit;
+}
+
+/**
+ * \brief   Function to check the peak of the concurrent calls of an interval
+ *          against the baseline of its hour of the day, for all the calls
+ *          and for each calltype. The baseline adapts to every interval
+ *          while training, in the detection only to the normal ones. A
+ *          baseline decides only after concurrency.warm-up intervals, e.g.
+ *          after the threshold has been restored.
+ *
+ * @param cs        pointer to the concurrent calls of the interval
+ * @param tm        pointer to the time of the interval
+ * @param training  TRUE while training the engine
+ * @param anomalous TRUE if the distance has already found the interval
+ *                  anomalous
+ *
+ * @return returns TRUE if the concurrent calls are anomalous and FALSE
+ *         otherwise
+ */
+static int SipAnomalyConcurrency(const SipConcStats *cs, struct tm *tm,
+        int training, int anomalous)
+{
+    SipConcBaseline *base = NULL;
+    const char *name = NULL;
+    double limit = 0.0;
+    double error = 0.0;
+    uint8_t slot = 0;
+    int ret_value = FALSE;
+
+    base = &conc_base[tm->tm_hour];
+
+    for (slot = 0; slot < SIP_CONC_SLOTS && !training &&
+            base->seen >= conc_warmup; slot++)
+    {
+        if (slot != SIP_CONC_ALL &&
+                !(hd_detection.call[slot].flag & CALLTYPE_ACTIVE))
+        {
+            continue;
+        }
+
+        limit = SipConcLimit(base, slot);
+        if (cs->peak[slot] <= limit)
+            continue;
+
+        name = (slot == SIP_CONC_ALL) ? "all" : hd_detection.call[slot].name;
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Concurrent calls of %s, %s"
+                " calls peak %"PRIu32" mean %.2f, are above the limit %.2f,"
+                " timestamp %s", accountcode, name, cs->peak[slot],
+                cs->mean[slot], limit, last_transaction_ts);
+        ret_value = TRUE;
+    }
+
+    SipMetricsSetConcurrency(accountcode, cs->peak[SIP_CONC_ALL],
+            cs->mean[SIP_CONC_ALL], (base->seen >= conc_warmup) ?
+            SipConcLimit(base, SIP_CONC_ALL) : 0.0);
+
+    if (ret_value == TRUE || (anomalous && !training))
+        return ret_value;
+
+    for (slot = 0; slot < SIP_CONC_SLOTS; slot++) {
+        if (base->seen == 0) {
+            base->mean[slot] = cs->peak[slot];
+            base->dev[slot] = cs->peak[slot] / 2.0;
+            continue;
+        }
+
+        error = cs->peak[slot] - base->mean[slot];
+        base->mean[slot] += g * error;
+        base->dev[slot] += h * (fabs(error) - base->dev[slot]);
+    }
+    base->seen++;
+
+    return FALSE;
+}
+
+/**
+ * \brief   Function to score the call data of an interval against the trained
+ *          threshold. While training, the threshold adapts to every interval
+ *          with calls, in the detection only to the intervals below it. The
+ *          concurrent calls are checked against their baseline, if they are
+ *          known.
+ *
+ * @param hd_testing    pointer to the call data of the interval
+ * @param cs            pointer to the concurrent calls of the interval, or
+ *                      NULL if they are not known
+ * @param tm            pointer to the time of the interval
+ * @param span          length of the interval in minutes
+ * @param training      TRUE while training the engine
+ *
+ * @return returns TRUE if the interval is anomalous and FALSE otherwise
+ */
+static int SipAnomalyScore(Hd *hd_testing, const SipConcStats *cs,
+        struct tm *tm, int span, int training)
+{
+    int ret_value = FALSE;
+    uint64_t start = SipTimerTicks();
+    uint64_t ns = 0;
+
+    /* Calculate the probablity for each call type */
+    SipCalcHDProbabilities(hd_testing);
+
+    /* Calculate the hellinger distance value against hd_detection */
+    SipCalcHellingerDistance(&hd_detection, hd_testing);
+
+    /* The decision and the threshold are on the calls per configured
+     * interval */
+    if (span != interval)
+        SipAnomalyNormalize(hd_testing, span);
+
+    if (training) {
+        if (hd_testing->distance_value > 0)
+            SipUpdateHDThreshold(&hd_detection, hd_testing);
+    } else if (hd_testing->distance_value > hd_detection.threshold) {
+        ret_value = SipAnomalyDecision(&hd_detection, hd_testing, tm);
+    }
+
+    if (cs != NULL && conc_enabled &&
+            SipAnomalyConcurrency(cs, tm, training, ret_value) == TRUE)
+    {
+        ret_value = TRUE;
+    }
+
+    /* In the detection the threshold adapts to the normal intervals below
+     * it */
+    if (!training && ret_value == FALSE && hd_testing->distance_value > 0 &&
+            hd_testing->distance_value <= hd_detection.threshold)
+    {
+        SipUpdateHDThreshold(&hd_detection, hd_testing);
+    }
+
+    ns = SipTimerRecord(SIP_TIMER_HELLINGER, start);
+    SipMetricsObserveStage(SIP_METRIC_STAGE_SCORE, ns / 1e9);
+    SipMetricsIncIntervals();
+    if (ret_value == TRUE)
+        SipMetricsIncAlerts();
+    SipMetricsSetTenant(accountcode, hd_testing->distance_value,
+            hd_detection.threshold);
+
+    return ret_value;
+}
+
 /**
  * \brief   Function to initialize the threshold value. It fetches the first
  *          two cdr records for the given time interval and initialize the engine
@@ -824,22 +1685,27 @@ int SipTrainingInitThreshold(PGconn *conn)
             return SIP_ERROR;
         }
 
-        /* Fetch the initial timestamp data from the cdr database with the given
-         * query */
-        result = (PGresult *) SipGetCdr(conn, query);
-        if (result == NULL) {
-            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making "
-                    "the given query \"%s\"", query);
-            return SIP_ERROR;
-        }
+        if (mem_source != NULL && mem_source->cnt > 1) {
+            snprintf(last_transaction_ts, 25, "%ld",
+                    (long)mem_source->cdrs[1].calldate);
+        } else {
+            /* Fetch the initial timestamp data from the cdr database with the
+             * given query */
+            result = (PGresult *) SipGetCdr(conn, query, SIP_METRIC_STMT_INIT);
+            if (result == NULL) {
+                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making "
+                        "the given query \"%s\"", query);
+                return SIP_ERROR;
+            }
 
-        strncpy(last_transaction_ts, PQgetvalue(result, 1, 0),
-                strlen(PQgetvalue(result, 1, 0)));
+            strncpy(last_transaction_ts, PQgetvalue(result, 1, 0),
+                    strlen(PQgetvalue(result, 1, 0)));
+            PQclear(result);
+        }
 
         /* Convert to timetsamp value */
         strptime(last_transaction_ts, "%s" ,&current_time);
         SipUpdateTimeStamp(0);
-        PQclear(result);
     } else {
         strptime(last_transaction_ts, "%F %H:%M:%S" ,&current_time);
     }
@@ -847,7 +1713,7 @@ int SipTrainingInitThreshold(PGconn *conn)
     //printf("ts is %s\n", last_transaction_ts);
     /* Initialize the initial hellinger distance value */
     SipGetQuery(query, last_transaction_ts, interval);
-    result = (PGresult *)SipGetCdr(conn, query);
+    result = SipGetIntervalCdr(conn, query);
     if (result == NULL) {
         SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
                 " given query \"%s\"", query);
@@ -864,7 +1730,7 @@ int SipTrainingInitThreshold(PGconn *conn)
 
     SipUpdateTimeStamp(interval);
     SipGetQuery(query, last_transaction_ts, interval);
-    result = (PGresult *)SipGetCdr(conn, query);
+    result = SipGetIntervalCdr(conn, query);
     if (result == NULL) {
         SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
                 " given query \"%s\"", query);
@@ -904,34 +1770,46 @@ int SipTrainingAnomalyDetection(PGconn *conn)
 {
     PGresult *result = NULL;
     Hd hd_train;
+    SipConcStats cs;
     char query[DEFAULT_QUERY_SIZE];
+    uint64_t start = SipTimerTicks();
+    uint64_t ns = 0;
+    int known = FALSE;
+    int ret_value = FALSE;
+
+    SIP_PROBE2(interval__start, last_transaction_ts, 1);
 
     /* Fetch the required data from the cdr database with the given query for
      * next interval */
     SipGetQuery(query, last_transaction_ts, interval);
-    result = (PGresult *)SipGetCdr(conn, query);
+    result = SipGetIntervalCdr(conn, query);
     if (result == NULL) {
         SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
                 " given query \"%s\"", query);
         return SIP_ERROR;
     }
 
+    SipMetricsObserveStage(SIP_METRIC_STAGE_FETCH,
+            SipTimerNs(SipTimerTicks() - start) / 1e9);
+
     CLEAR_HD(&hd_train);
 
     /* Get different call type data */
+    start = SipTimerTicks();
     SipGetCallData(&hd_train, result);
+    if (conc_enabled)
+        known = SipGetIntervalConcurrency(conn, &cs, result, interval);
+    ns = SipTimerRecord(SIP_TIMER_CALL_DATA, start);
+    SipTimerAddItems(SIP_TIMER_CALL_DATA, PQntuples(result));
+    SIP_PROBE3(cdr__aggregate, PQntuples(result), hd_train.num_total,
+            hd_train.dur_total);
+    SipMetricsObserveStage(SIP_METRIC_STAGE_AGGREGATE, ns / 1e9);
     PQclear(result);
 
-    /* Calculate the probablity for each call type */
-    SipCalcHDProbabilities(&hd_train);
-
-    /* Calculate the initial hellinger distance value to be stored in
-     * hd_detection */
-    SipCalcHellingerDistance(&hd_detection, &hd_train);
-
-    /* Initialize the threshold values*/
-    if (hd_train.distance_value > 0)
-        SipUpdateHDThreshold(&hd_detection, &hd_train);
+    /* Calculate the hellinger distance and adapt the threshold values */
+    ret_value = SipAnomalyScore(&hd_train, known ? &cs : NULL, &current_time,
+            interval, TRUE);
+    SIP_PROBE2(interval__done, last_transaction_ts, ret_value);
 
     /* Update the timestamp to fetch date for next time interval. The increment
      * is equal to 10 minutes */
@@ -942,115 +1820,1538 @@ int SipTrainingAnomalyDetection(PGconn *conn)
 }
 
 /**
- * \brief   Function to detect the anomaly using the trained hellinger
- *          distance algorithm over the testing period. After initialization
- *          new threshold value will be calculated which will reflect the
- *          current traffic bahavior of the institute.
+ * \brief   Function to decide whether an interval, of which the distance is
+ *          above the threshold, is anomalous. During the office hours the
+ *          paid calls are compared with the allowed durations and with the
+ *          trained number of calls, outside of them with the total number of
+ *          calls in the interval.
  *
- * @param conn      Pointer to the CDR database
- * @param result    pointer to the result which will contains the call data
- * 
- * @return returns TRUE upon anomaly detection and FALSE upon normal behavior
+ * @param hd_detection  pointer to the trained detection struct
+ * @param hd_testing    pointer to the scored interval
+ * @param tm            pointer to the time of the interval
+ *
+ * @return returns TRUE if the interval is anomalous and FALSE otherwise
  */
-int SipAnomalyDetection(PGconn *conn, PGresult **result)
+int SipAnomalyDecision(Hd *hd_detection, Hd *hd_testing, struct tm *tm)
 {
-    Hd hd_testing;
-    int ret_value = FALSE;
-    char query[DEFAULT_QUERY_SIZE];
-
-    /* Initialize the timestamp to start detection from the given detection
-     * start time in the config file */
-    if (detect_start_ts != NULL && !(hd_detection.flags & THRESHOLD_RESTORED)) {
-        strncpy(last_transaction_ts, detect_start_ts,
-                strlen(last_transaction_ts));
-        detect_start_ts = NULL;
-        strptime(last_transaction_ts, "%F %H:%M:%S" ,&current_time);
+    if ((tm->tm_hour > start_time) && (tm->tm_hour < end_time)) {
+        if (hd_testing->call[MOBILE].dur > mob_dur ||
+                (hd_testing->call[INTERNATIONAL].dur > int_dur) ||
+                (hd_testing->call[PREMIUM].dur > prem_dur) ||
+                ((hd_testing->call[INTERNATIONAL].num >
+                    senstivity*hd_detection->call[INTERNATIONAL].num) &&
+                (hd_detection->call[INTERNATIONAL].num > 0)) ||
+                ((hd_testing->call[PREMIUM].num >
+                    senstivity*hd_detection->call[PREMIUM].num) &&
+                (hd_detection->call[PREMIUM].num > 0)))
+        {
+            return TRUE;
+        }
+    } else if (hd_testing->call[MOBILE].dur > mob_dur ||
+                (hd_testing->call[INTERNATIONAL].num >
+                    (hd_testing->num_total/senstivity)) ||
+                (hd_testing->call[PREMIUM].num >
+                    (hd_testing->num_total/senstivity)))
+    {
+        return TRUE;
     }
 
-    /* Fetch the required data from the cdr database with the given query for
-     * next interval */
-    SipGetQuery(query, last_transaction_ts, interval);
-    *result = (PGresult *)SipGetCdr(conn, query);
-    if (*result == NULL) {
-        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
-                " given query \"%s\"", query);
-        return SIP_ERROR;
+    if ((hd_testing->call[DOMESTIC].flag & CALLTYPE_ACTIVE) ||
+            (hd_testing->call[SERVICE].flag & CALLTYPE_ACTIVE) ||
+            (hd_testing->call[EMERGENCY].flag & CALLTYPE_ACTIVE))
+    {
+        return TRUE;
     }
 
-    CLEAR_HD(&hd_testing);
+    return FALSE;
+}
 
-    /* Get different call type data */
-    SipGetCallData(&hd_testing, *result);
+/**
+ * \brief   Function to check the open interval with the calls received so far.
+ *          The durations of the paid calls can only grow until the end of the
+ *          interval, so a provisional alert is raised as soon as they cross
+ *          the allowed durations, once per interval. The distance of the
+ *          interval is projected from the elapsed part to its whole span and
+ *          reported to the metrics. The decision at the end of the interval is
+ *          not changed.
+ *
+ * @param from  start of the open interval
+ * @param to    end of the open interval
+ * @param num   number of the calls of each calltype received so far
+ * @param dur   duration of the calls of each calltype received so far
+ *
+ * @return returns TRUE if a provisional alert has been raised and FALSE
+ *         otherwise
+ */
+int SipAnomalyEarlyWarning(time_t from, time_t to, const uint32_t *num,
+        const uint32_t *dur)
+{
+    Hd hd_partial;
+    struct tm tm;
+    char ts[25];
+    const char *reason = NULL;
+    time_t elapsed = time(NULL) - from;
+    double scale = 0.0;
+    double allowed = 0.0;
+    uint8_t cnt = 0;
 
-    /* Calculate the probablity for each call type */
-    SipCalcHDProbabilities(&hd_testing);
+    if (to <= from)
+        return FALSE;
 
-    /* Calculate the initial hellinger distance value to be stored in
-     * hd_detection */
-    SipCalcHellingerDistance(&hd_detection, &hd_testing);
+    CLEAR_HD(&hd_partial);
+    for (cnt = 0; cnt < MAX_CALLTYPE; cnt++) {
+        if (!(hd_detection.call[cnt].flag & CALLTYPE_ACTIVE))
+            continue;
+        hd_partial.call[cnt].num = num[cnt];
+        hd_partial.call[cnt].dur = dur[cnt];
+    }
+
+    /* The first minute is not projected, a single call would dominate it */
+    if (elapsed < 60)
+        elapsed = 60;
+    if (elapsed > to - from)
+        elapsed = to - from;
+    scale = (double)(to - from) / (double)elapsed;
 
-    if (hd_testing.distance_value > hd_detection.threshold)
+    for (cnt = 0; cnt < MAX_CALLTYPE; cnt++) {
+        hd_partial.call[cnt].num *= scale;
+        hd_partial.call[cnt].dur *= scale;
+        hd_partial.num_total += hd_partial.call[cnt].num;
+        hd_partial.dur_total += hd_partial.call[cnt].dur;
+    }
+    SipCalcHDProbabilities(&hd_partial);
+    SipCalcHellingerDistance(&hd_detection, &hd_partial);
+    SipMetricsSetProjected(accountcode, hd_partial.distance_value);
+
+    if (from == warned_from)
+        return FALSE;
+
+    /* The allowed durations are checked with the calls received, not with
+     * the projected ones, as in SipAnomalyDecision(). They are given for the
+     * configured interval, the adaptive one can be shorter or longer */
+    allowed = (double)(to - from) / (double)(interval * 60);
+    localtime_r(&from, &tm);
+    if ((hd_detection.call[MOBILE].flag & CALLTYPE_ACTIVE) &&
+            dur[MOBILE] > mob_dur * allowed)
     {
-        if ((current_time.tm_hour > start_time) &&
-                (current_time.tm_hour < end_time))
+        reason = "mobile";
+    } else if ((tm.tm_hour > start_time) && (tm.tm_hour < end_time)) {
+        if ((hd_detection.call[INTERNATIONAL].flag & CALLTYPE_ACTIVE) &&
+                dur[INTERNATIONAL] > int_dur * allowed)
         {
-            if (hd_testing.call[MOBILE].dur > mob_dur ||
-                    (hd_testing.call[INTERNATIONAL].dur > int_dur) ||
-                    (hd_testing.call[PREMIUM].dur > prem_dur) ||
-                    ((hd_testing.call[INTERNATIONAL].num >
-                        senstivity*hd_detection.call[INTERNATIONAL].num) &&
-                    (hd_detection.call[INTERNATIONAL].num > 0)) ||
-                    ((hd_testing.call[PREMIUM].num >
-                        senstivity*hd_detection.call[PREMIUM].num) &&
-                    (hd_detection.call[PREMIUM].num > 0)))
-            {
-                ret_value = TRUE;
-            } else if ((hd_testing.call[DOMESTIC].flag & CALLTYPE_ACTIVE) ||
-                        (hd_testing.call[SERVICE].flag & CALLTYPE_ACTIVE) ||
-                        (hd_testing.call[EMERGENCY].flag & CALLTYPE_ACTIVE))
-            {
-                ret_value = TRUE;
-            }
-        } else if (hd_testing.call[MOBILE].dur > mob_dur ||
-                    (hd_testing.call[INTERNATIONAL].num >
-                        (hd_testing.num_total/senstivity)) ||
-                    (hd_testing.call[PREMIUM].num > (hd_testing.num_total/senstivity)))
+            reason = "international";
+        } else if ((hd_detection.call[PREMIUM].flag & CALLTYPE_ACTIVE) &&
+                dur[PREMIUM] > prem_dur * allowed)
         {
-            ret_value = TRUE;
-        } else if ((hd_testing.call[DOMESTIC].flag & CALLTYPE_ACTIVE) ||
-                        (hd_testing.call[SERVICE].flag & CALLTYPE_ACTIVE) ||
-                        (hd_testing.call[EMERGENCY].flag & CALLTYPE_ACTIVE))
-            {
-                ret_value = TRUE;
-            }
-    } else if (hd_testing.distance_value > 0) {
-        SipUpdateHDThreshold(&hd_detection, &hd_testing);
+            reason = "premium";
+        }
     }
 
-    /* Update the timestamp to fetch date for next time interval. The increment
-     * is equal to given interval minutes */
-    if (SipUpdateTimeStamp(interval) == SIP_DONE)
-        return SIP_DONE;
+    if (reason == NULL)
+        return FALSE;
 
-    return ret_value;
+    warned_from = from;
+    strftime(ts, sizeof(ts), "%F %H:%M:%S", &tm);
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Provisional alert for the"
+            " interval of %s, the duration of the %s calls is above the"
+            " allowed one, projected distance %f threshold %f", ts, reason,
+            hd_partial.distance_value, hd_detection.threshold);
+    SipMetricsIncWarnings(accountcode);
+    SipAlertWarning(ts);
+
+    return TRUE;
 }
 
 /**
- * \brief   Function to clear the memory and close the connection to threshold
- *          database, while shutting down the engine.
+ * \brief   Function to initialize the timestamp to start the detection from
+ *          the given detection start time in the config file.
  */
-void SipDeinitAnomalyDetection()
+static void SipDetectionStartTimeStamp()
 {
-    if (last_transaction_ts != NULL) {
-        free (last_transaction_ts);
-    }
-
-    if (threshold_conn != NULL) {
-        PQfinish(threshold_conn);
+    if (detect_start_ts != NULL && !(hd_detection.flags & THRESHOLD_RESTORED)) {
+        strncpy(last_transaction_ts, detect_start_ts,
+                strlen(last_transaction_ts));
+        detect_start_ts = NULL;
+        strptime(last_transaction_ts, "%F %H:%M:%S" ,&current_time);
+    }
+}
+
+/**
+ * \brief   Function to start the next interval, by making the query string for
+ *          its CDRs.
+ */
+static void SipAnomalyIntervalStart(char *query)
+{
+    fetch_start = SipTimerTicks();
+
+    SipDetectionStartTimeStamp();
+
+    SIP_PROBE2(interval__start, last_transaction_ts, 0);
+
+    SipGetQuery(query, last_transaction_ts, window);
+}
+
+/**
+ * \brief   Function to adapt the length of the next interval to the calls of
+ *          the scored one. An interval with too few calls to be scored, by
+ *          the call-freq and call-duration, doubles the next one, so that an
+ *          idle tenant is queried less often. An interval with four times
+ *          the calls needed, so that each half would still have twice as
+ *          many, halves it, for a finer resolution of a busy tenant.
+ *
+ * @param num   number of the calls of the scored interval
+ * @param dur   duration of the calls of the scored interval
+ */
+static void SipAnomalyAdaptWindow(uint64_t num, uint64_t dur)
+{
+    int next = window;
+
+    if (!adaptive)
+        return;
+
+    if (num <= (uint64_t)call_freq && dur <= (uint64_t)call_dur) {
+        next = window * 2;
+        if (next > window_max)
+            next = window_max;
+    } else if (num >= 4 * ((uint64_t)call_freq + 1)) {
+        next = window / 2;
+        if (next < window_min)
+            next = window_min;
+    }
+
+    if (next == window)
+        return;
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Interval of %s changed from %d to"
+            " %d minutes, after %"PRIu64" calls of %"PRIu64" seconds from %s",
+            accountcode, window, next, num, dur, previous_ts);
+    window = next;
+    SipMetricsSetInterval(accountcode, window * 60);
+}
+
+/**
+ * \brief   Function to detect the anomaly using the trained hellinger
+ *          distance algorithm over the testing period. After initialization
+ *          new threshold value will be calculated which will reflect the
+ *          current traffic bahavior of the institute.
+ *
+ * @param conn      Pointer to the CDR database
+ * @param result    pointer to the result which will contains the call data
+ * 
+ * @return returns TRUE upon anomaly detection and FALSE upon normal behavior
+ */
+int SipAnomalyDetection(PGconn *conn, PGresult **result)
+{
+    char query[DEFAULT_QUERY_SIZE];
+
+    SipAnomalyIntervalStart(query);
+
+    /* Fetch the required data from the cdr database with the given query for
+     * next interval */
+    *result = SipGetIntervalCdr(conn, query);
+    if (*result == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
+                " given query \"%s\"", query);
+        return SIP_ERROR;
+    }
+
+    if (SipConcQueried(*result) && !(idle_skip && PQntuples(*result) == 0)) {
+        conc_known = SipGetIntervalConcurrency(conn, &conc_stats, *result,
+                window);
+        conc_fetched = TRUE;
+    }
+
+    return SipAnomalyDetectionScore(*result);
+}
+
+/**
+ * \brief   Function to start fetching the CDRs of the next interval, without
+ *          waiting for the CDR database. The calls from memory or from the
+ *          ingest buffer are returned right away, otherwise the query is sent
+ *          on the connection in nonblocking mode. Its result is read by
+ *          SipCdrQueryResult() and passed to SipAnomalyDetectionResult().
+ *          After an interval without calls, the probe for the new CDRs is
+ *          sent instead.
+ *
+ * @param conn      Pointer to the CDR database
+ * @param q         the query, which is sent
+ * @param result    pointer to the result, set when it is available right away
+ *
+ * @return SIP_OK if the result is set or the query has been sent, SIP_PENDING
+ *         if the rest of the query waits for the connection to be writable
+ *         and SIP_ERROR on failure
+ */
+int SipAnomalyDetectionFetch(PGconn *conn, SipCdrQuery *q, PGresult **result)
+{
+    char query[DEFAULT_QUERY_SIZE];
+
+    *result = NULL;
+    timeout_attempts = 0;
+    q->timedout = 0;
+    probing = FALSE;
+    conc_fetching = FALSE;
+    conc_fetched = FALSE;
+    if (conc_cdrs != NULL) {
+        PQclear(conc_cdrs);
+        conc_cdrs = NULL;
+    }
+    SipAnomalyIntervalStart(query);
+
+    if (mem_source == NULL && !SipIngestCovers(mktime(&current_time))) {
+        if (conn == NULL)
+            return SIP_ERROR;
+        if (idle_skip && idle) {
+            probing = TRUE;
+            SipGetProbeQuery(query);
+            return SipCdrQuerySend(q, conn, query, SIP_METRIC_STMT_PROBE);
+        }
+        return SipCdrQuerySend(q, conn, query, SIP_METRIC_STMT_INTERVAL);
+    }
+
+    *result = SipGetIntervalCdr(conn, query);
+    return (*result != NULL) ? SIP_OK : SIP_ERROR;
+}
+
+/**
+ * \brief   Function to take the result of the query sent by
+ *          SipAnomalyDetectionFetch(). The CDRs of the interval are kept back,
+ *          while the query of their concurrent calls is sent, and passed on
+ *          with its result. The result of the probe is used up: the interval
+ *          is skipped with an empty result, if the institution has no new CDRs
+ *          since an anchor taken before the interval has started, otherwise
+ *          the query of its CDRs is sent.
+ *
+ * @param q         the query, of which the result has been read
+ * @param result    pointer to its result, replaced by the CDRs of the interval
+ *                  or set to NULL, if the next query has been sent
+ *
+ * @return SIP_OK if the result is set or the query has been sent, SIP_PENDING
+ *         if the rest of the query waits for the connection to be writable
+ *         and SIP_ERROR on failure
+ */
+int SipAnomalyDetectionResult(SipCdrQuery *q, PGresult **result)
+{
+    char query[DEFAULT_QUERY_SIZE];
+    char conc_query[2 * DEFAULT_QUERY_SIZE];
+    PGresult *res = *result;
+    time_t now = time(NULL);
+    uint64_t cnt = 1;
+
+    if (conc_fetching) {
+        conc_fetching = FALSE;
+        conc_known = SipConcFromCalls(&conc_stats, res, window);
+        conc_fetched = TRUE;
+        PQclear(res);
+        *result = conc_cdrs;
+        conc_cdrs = NULL;
+        return SIP_OK;
+    }
+
+    if (!probing) {
+        if (!SipConcQueried(res) || (idle_skip && PQntuples(res) == 0))
+            return SIP_OK;
+
+        conc_cdrs = res;
+        conc_fetching = TRUE;
+        *result = NULL;
+        SipGetConcQuery(conc_query, sizeof(conc_query), last_transaction_ts,
+                window);
+        return SipCdrQuerySend(q, q->conn, conc_query,
+                SIP_METRIC_STMT_CONCURRENCY);
+    }
+
+    probing = FALSE;
+    *result = NULL;
+
+    if (PQntuples(res) == 1 && PQnfields(res) == 2) {
+        if (!PQgetisnull(res, 0, 1))
+            cnt = strtoull(PQgetvalue(res, 0, 1), NULL, 10);
+        if (!PQgetisnull(res, 0, 0)) {
+            probe_id = strtoll(PQgetvalue(res, 0, 0), NULL, 10);
+        } else if (probe_id < 0) {
+            probe_id = 0;   /* the table is empty */
+        }
+    }
+    PQclear(res);
+
+    /* The calls of the interval are written after it has started, so that
+     * they are above the highest id at an anchor taken before */
+    if (cnt > 0) {
+        probe_since = now;
+    } else if (probe_since + IDLE_PROBE_SKEW <= mktime(&current_time)) {
+        *result = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+        if (*result == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating"
+                    " the memory");
+            return SIP_ERROR;
+        }
+        return SIP_OK;
+    }
+
+    SipGetQuery(query, last_transaction_ts, window);
+    return SipCdrQuerySend(q, q->conn, query, SIP_METRIC_STMT_INTERVAL);
+}
+
+/**
+ * \brief   Function to handle the interval query, which has not returned in
+ *          time, by the on-timeout policy. The query is sent again up to the
+ *          given retries, or the totals per call type are queried instead,
+ *          once. After that, or with the skip policy, the interval is left
+ *          unscored and the detection moves on to the next one. A probe,
+ *          which has not returned in time, is given up for the interval
+ *          query. The interval, of which only the concurrent calls have not
+ *          returned in time, is scored without them.
+ *
+ * @param conn      Pointer to the CDR database, NULL if it is down
+ * @param q         the query, which has timed out
+ * @param result    pointer to the CDRs of the interval, set if it is to be
+ *                  scored without its concurrent calls
+ *
+ * @return SIP_PENDING if a query has been sent, to be read as the one by
+ *         SipAnomalyDetectionFetch(), SIP_OK if the interval has been skipped
+ *         or its result is set, SIP_DONE if it was the last one of the offline
+ *         range and SIP_ERROR on failure
+ */
+int SipAnomalyDetectionTimeout(PGconn *conn, SipCdrQuery *q, PGresult **result)
+{
+    char query[DEFAULT_QUERY_SIZE];
+    int ret = SIP_OK;
+
+    *result = NULL;
+    if (conc_fetching) {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Scoring the interval from %s"
+                " without its concurrent calls, they could not be fetched in"
+                " time", last_transaction_ts);
+        conc_fetching = FALSE;
+        conc_known = FALSE;
+        conc_fetched = TRUE;
+        *result = conc_cdrs;
+        conc_cdrs = NULL;
+        return SIP_OK;
+    }
+
+    if (probing) {
+        probing = FALSE;
+        probe_id = -1;
+        SipGetQuery(query, last_transaction_ts, window);
+        ret = SipCdrQuerySend(q, conn, query, SIP_METRIC_STMT_INTERVAL);
+        return (ret == SIP_ERROR) ? SIP_ERROR : SIP_PENDING;
+    }
+
+    timeout_attempts++;
+
+    if (on_timeout == SIP_ON_TIMEOUT_RETRY &&
+            timeout_attempts <= timeout_retries)
+    {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Fetching the interval from %s"
+                " again, attempt %"PRIu32" of %"PRIu32, last_transaction_ts,
+                timeout_attempts, timeout_retries);
+        snprintf(query, sizeof(query), "%s", q->query);
+    } else if (on_timeout == SIP_ON_TIMEOUT_AGGREGATE &&
+            timeout_attempts == 1)
+    {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Fetching the totals of the"
+                " interval from %s instead of its calls", last_transaction_ts);
+        SipGetAggregateQuery(query, last_transaction_ts, window);
+    } else {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Skipping the interval from"
+                " %s, its calls could not be fetched in time",
+                last_transaction_ts);
+        ret = SipUpdateTimeStamp(window);
+        SipMetricsSetLag(accountcode,
+                difftime(time(NULL), mktime(&current_time)));
+        return (ret == SIP_DONE) ? SIP_DONE : SIP_OK;
+    }
+
+    ret = SipCdrQuerySend(q, conn, query, SIP_METRIC_STMT_INTERVAL);
+    return (ret == SIP_ERROR) ? SIP_ERROR : SIP_PENDING;
+}
+
+/**
+ * \brief   Function to move on from an interval without calls, without scoring
+ *          it. It would have a distance of 0, which is neither anomalous nor
+ *          adapts the threshold, so that only the timestamp is advanced. The
+ *          threshold is stored after every idle-skip.checkpoint of them, for
+ *          the timestamp to be restored after a restart.
+ *
+ * @return returns SIP_IDLE, FALSE if the threshold is to be stored and
+ *         SIP_DONE when the offline range is complete
+ */
+static int SipAnomalyDetectionIdle()
+{
+    int ret = SIP_OK;
+
+    idle = TRUE;
+    SIP_PROBE2(interval__done, last_transaction_ts, FALSE);
+    SipMetricsIncIdle();
+    SipMetricsSetTenant(accountcode, 0.0, hd_detection.threshold);
+
+    ret = SipUpdateTimeStamp(window);
+    SipMetricsSetLag(accountcode, difftime(time(NULL), mktime(&current_time)));
+    SipAnomalyAdaptWindow(0, 0);
+
+    if (ret == SIP_DONE)
+        return SIP_DONE;
+
+    if (++idle_intervals < idle_checkpoint)
+        return SIP_IDLE;
+
+    idle_intervals = 0;
+    return FALSE;
+}
+
+/**
+ * \brief   Function to score the interval, of which the CDRs have been fetched,
+ *          and to move on to the next interval. An interval without any row
+ *          is not scored, if the idle-skip is enabled.
+ *
+ * @param result    the CDRs of the interval
+ *
+ * @return returns TRUE upon anomaly detection, FALSE upon normal behavior,
+ *         SIP_IDLE for an interval without calls, of which the threshold
+ *         needs not be stored, and SIP_DONE when the offline range is
+ *         complete
+ */
+int SipAnomalyDetectionScore(PGresult *result)
+{
+    Hd hd_testing;
+    SipConcStats cs;
+    time_t from = mktime(&current_time);
+    int ret_value = FALSE;
+    int ret = SIP_OK;
+    int known = FALSE;
+    uint64_t start = 0;
+    uint64_t ns = 0;
+    uint64_t num = 0;
+    uint64_t dur = 0;
+
+    SipMetricsObserveStage(SIP_METRIC_STAGE_FETCH,
+            SipTimerNs(SipTimerTicks() - fetch_start) / 1e9);
+
+    if (idle_skip && PQntuples(result) == 0) {
+        /* the calls carried over end in the skipped interval */
+        if (conc_enabled && conc.cnt > 0)
+            SipConcClose(&conc, from + window * 60, &cs);
+        return SipAnomalyDetectionIdle();
+    }
+
+    CLEAR_HD(&hd_testing);
+
+    /* Get different call type data */
+    start = SipTimerTicks();
+    SipGetCallData(&hd_testing, result);
+    if (conc_fetched) {
+        known = conc_known;
+        cs = conc_stats;
+    } else if (conc_enabled) {
+        known = SipGetConcurrency(&cs, result, from, from + window * 60);
+    }
+    conc_fetched = FALSE;
+    ns = SipTimerRecord(SIP_TIMER_CALL_DATA, start);
+    SipTimerAddItems(SIP_TIMER_CALL_DATA, PQntuples(result));
+    SIP_PROBE3(cdr__aggregate, PQntuples(result), hd_testing.num_total,
+            hd_testing.dur_total);
+    SipMetricsObserveStage(SIP_METRIC_STAGE_AGGREGATE, ns / 1e9);
+    num = hd_testing.num_total;
+    dur = hd_testing.dur_total;
+
+    /* the probe is anchored again, once the institution is idle */
+    idle = (num == 0);
+    if (!idle)
+        probe_id = -1;
+    idle_intervals = 0;
+
+    /* Calculate the hellinger distance and decide on the interval */
+    ret_value = SipAnomalyScore(&hd_testing, known ? &cs : NULL,
+            &current_time, window, FALSE);
+    SIP_PROBE2(interval__done, last_transaction_ts, ret_value);
+
+    /* Update the timestamp to fetch date for next time interval. The increment
+     * is equal to the length of the scored interval, the next one is adapted
+     * to its calls */
+    ret = SipUpdateTimeStamp(window);
+    SipAnomalyAdaptWindow(num, dur);
+
+    /* The start of the next interval is the end of the scored one */
+    SipMetricsSetLag(accountcode, difftime(time(NULL), mktime(&current_time)));
+
+    if (ret == SIP_DONE)
+        return SIP_DONE;
+
+    return ret_value;
+}
+
+/**
+ * \brief   Function to queue the current threshold value as a row of the
+ *          threshold table. The rows are written in bulk by
+ *          SipAnomalyFlushThresholds().
+ *
+ * @param ts    timestamp of the row, the start of the next interval
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+static int SipAnomalyQueueThreshold(const char *ts)
+{
+    char *tmp = NULL;
+    size_t size = 0;
+    uint8_t cnt = 0;
+
+    /* A row takes less than 1k */
+    if (threshold_rows_size - threshold_rows_len < 1024) {
+        size = threshold_rows_size ? 2 * threshold_rows_size : 64 * 1024;
+        tmp = realloc(threshold_rows, size);
+        if (tmp == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "failed in allocating"
+                    " memory");
+            return SIP_ERROR;
+        }
+        threshold_rows = tmp;
+        threshold_rows_size = size;
+    }
+
+    for (cnt = 0; cnt < MAX_CALLTYPE; cnt++) {
+        threshold_rows_len += snprintf(threshold_rows + threshold_rows_len,
+                threshold_rows_size - threshold_rows_len, "%"PRIu32"\t%"
+                PRIu32"\t%f\t%f\t", hd_detection.call[cnt].num,
+                hd_detection.call[cnt].dur, hd_detection.call[cnt].p_freq,
+                hd_detection.call[cnt].p_dur);
+    }
+
+    threshold_rows_len += snprintf(threshold_rows + threshold_rows_len,
+            threshold_rows_size - threshold_rows_len, "%"PRIu64"\t%"PRIu64
+            "\t%f\t%f\t%f\t%s\n", hd_detection.num_total,
+            hd_detection.dur_total, hd_detection.distance_value,
+            hd_detection.mean_deviation, hd_detection.threshold, ts);
+    threshold_rows_cnt++;
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to write the queued threshold rows with one COPY to the
+ *          threshold database. Without a connection to the threshold database,
+ *          as in the replay benchmark, the rows are only counted. While the
+ *          threshold database is down, the rows are kept for the next flush.
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+static int SipAnomalyFlushThresholds(SipReplayStats *stats)
+{
+    PGconn *threshold_conn = SipDbGet(SIP_DB_THRESHOLD);
+    PGresult *res = NULL;
+    char query[DEFAULT_QUERY_SIZE];
+    uint64_t start = SipTimerTicks();
+    uint64_t ns = 0;
+    int ret = SIP_OK;
+
+    if (threshold_rows_cnt == 0)
+        return SIP_OK;
+
+    if (threshold_conn == NULL && SipDbEnabled())
+        return SIP_OK;
+
+    if (threshold_conn != NULL) {
+        snprintf(query, sizeof(query), "copy %s(" SIP_THRESHOLD_COLUMNS
+                ") from stdin", threshold_table);
+        res = PQexec(threshold_conn, query);
+        if (PQresultStatus(res) != PGRES_COPY_IN) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
+                    " given query \"%s\": %s", query,
+                    PQerrorMessage(threshold_conn));
+            PQclear(res);
+            return SipDbFailed(SIP_DB_THRESHOLD) ? SIP_OK : SIP_ERROR;
+        }
+        PQclear(res);
+
+        if (PQputCopyData(threshold_conn, threshold_rows,
+                    threshold_rows_len) != 1)
+        {
+            PQputCopyEnd(threshold_conn, "failed in sending the rows");
+        } else {
+            PQputCopyEnd(threshold_conn, NULL);
+        }
+
+        while ((res = PQgetResult(threshold_conn)) != NULL) {
+            if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in storing"
+                        " %"PRIu32" threshold values: %s", threshold_rows_cnt,
+                        PQerrorMessage(threshold_conn));
+                ret = SIP_ERROR;
+            }
+            PQclear(res);
+        }
+
+        if (ret == SIP_ERROR && SipDbFailed(SIP_DB_THRESHOLD))
+            return SIP_OK;
+    }
+
+    ns = SipTimerRecord(SIP_TIMER_STORE_THRESHOLD, start);
+    SipMetricsObserveQuery(SIP_METRIC_STMT_THRESHOLD, ns / 1e9);
+    SipMetricsObserveStage(SIP_METRIC_STAGE_PERSIST, ns / 1e9);
+    stats->threshold_writes++;
+
+    threshold_rows_len = 0;
+    threshold_rows_cnt = 0;
+    return ret;
+}
+
+/**
+ * \brief   Function to run a statement without result on the CDR database.
+ */
+static int SipReplayCommand(PGconn *conn, const char *command,
+        SipReplayStats *stats)
+{
+    uint64_t start = SipTimerTicks();
+    PGresult *res = PQexec(conn, command);
+
+    SipMetricsObserveQuery(SIP_METRIC_STMT_INTERVAL,
+            SipTimerNs(SipTimerTicks() - start) / 1e9);
+    stats->cdr_queries++;
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the given"
+                " query \"%s\": %s", command, PQerrorMessage(conn));
+        PQclear(res);
+        return SIP_ERROR;
+    }
+
+    PQclear(res);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to fetch the calls of an anomalous interval of the replay
+ *          for the alert, from its start up to, but without, its end, as they
+ *          have been aggregated. They are taken from the in memory source or
+ *          the ingest buffer as SipGetIntervalCdr() would, otherwise by the
+ *          given query.
+ *
+ * @param conn  Pointer to the CDR database
+ * @param query query of the calls of the interval
+ * @param from  start of the interval
+ * @param to    end of the interval
+ *
+ * @return the result on success and NULL on failure
+ */
+static PGresult *SipReplayEvidence(PGconn *conn, char *query, time_t from,
+        time_t to)
+{
+    uint8_t calltypes = 0;
+    uint8_t cnt = 0;
+
+    if (mem_source == NULL && !SipIngestCovers(from))
+        return SipGetCdr(conn, query, SIP_METRIC_STMT_INTERVAL);
+
+    for (cnt = 0; cnt < MAX_CALLTYPE; cnt++) {
+        if (hd_detection.call[cnt].flag & CALLTYPE_ACTIVE)
+            calltypes |= 1 << cnt;
+    }
+
+    /* both take the calls up to their end, the call dates are in seconds */
+    if (mem_source == NULL)
+        return SipIngestResult(from, to - 1, accountcode, calltypes);
+
+    return SipCdrMemSourceResult(mem_source, from, to - 1, accountcode,
+            calltypes);
+}
+
+/**
+ * \brief   Function to score the given interval of the replay. In the
+ *          detection the threshold of a normal interval is queued and written
+ *          at the next checkpoint, the calls of an anomalous interval are
+ *          fetched for the alert. The interval is then passed to the notify
+ *          function.
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+static int SipReplayScore(PGconn *conn, SipReplay *rp, uint64_t idx)
+{
+    PGresult *result = NULL;
+    Hd hd_testing;
+    char query[DEFAULT_QUERY_SIZE];
+    char next_ts[25];
+    struct tm next_tm;
+    time_t wall = 0;
+    time_t from = 0;
+    time_t next = 0;
+    int ret_value = FALSE;
+    uint8_t cnt = 0;
+
+    CLEAR_HD(&hd_testing);
+    for (cnt = 0; cnt < MAX_CALLTYPE; cnt++) {
+        hd_testing.call[cnt].num = rp->iv[idx].num[cnt];
+        hd_testing.call[cnt].dur = rp->iv[idx].dur[cnt];
+        hd_testing.num_total += hd_testing.call[cnt].num;
+        hd_testing.dur_total += hd_testing.call[cnt].dur;
+    }
+
+    /* The interval is labelled by its wall clock time, as its calls have been
+     * aggregated */
+    wall = rp->base + idx * rp->span;
+    SipWallClockFormat(wall, previous_ts);
+    SipWallClockFormat(wall + rp->span, next_ts);
+    from = SipWallClockTime(wall, &current_time);
+    next = SipWallClockTime(wall + rp->span, &next_tm);
+
+    /* the restored threshold is kept, only the baselines adapt */
+    if (rp->baseline) {
+        SipAnomalyConcurrency(&rp->iv[idx].conc, &current_time, TRUE, FALSE);
+        rp->stats->intervals++;
+        return SIP_OK;
+    }
+
+    SIP_PROBE2(interval__start, previous_ts, rp->training);
+    SIP_PROBE3(cdr__aggregate, rp->iv[idx].rows, hd_testing.num_total,
+            hd_testing.dur_total);
+    ret_value = SipAnomalyScore(&hd_testing,
+            rp->conc ? &rp->iv[idx].conc : NULL, &current_time, interval,
+            rp->training);
+    SIP_PROBE2(interval__done, previous_ts, ret_value);
+    rp->stats->intervals++;
+
+    if (rp->training)
+        return SIP_OK;
+
+    SipMetricsSetLag(accountcode, difftime(time(NULL), next));
+
+    if (ret_value == TRUE) {
+        SipGetRangeQuery(query, previous_ts, next_ts);
+        result = SipReplayEvidence(conn, query, from, next);
+        rp->stats->cdr_queries++;
+        if (result == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in making the"
+                    " given query \"%s\"", query);
+            return SIP_ERROR;
+        }
+        rp->stats->alerts++;
+    } else {
+        if (SipAnomalyQueueThreshold(next_ts) != SIP_OK)
+            return SIP_ERROR;
+        rp->stats->threshold_rows++;
+
+        if (threshold_rows_cnt >= replay_checkpoint &&
+                SipAnomalyFlushThresholds(rp->stats) != SIP_OK)
+        {
+            return SIP_ERROR;
+        }
+    }
+
+    if (rp->notify != NULL)
+        rp->notify(ret_value, &result);
+    if (result != NULL)
+        PQclear(result);
+
+    /* the signals are taken between the intervals of the replay */
+    SipReactorRun(0);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to close the intervals of the chunk, which have ended by
+ *          the given time, with the concurrent calls swept so far. The first
+ *          interval is opened, once the calls before the chunk have been
+ *          swept.
+ */
+static void SipReplayConcUntil(SipReplayChunk *ck, time_t t)
+{
+    SipReplay *rp = ck->rp;
+    time_t start = rp->base + ck->first * rp->span;
+    time_t end = 0;
+
+    if (t < start)
+        return;
+
+    if (ck->conc.from < start)
+        SipConcOpen(&ck->conc, start);
+
+    while (ck->cur < ck->first + ck->cnt &&
+            (end = rp->base + (ck->cur + 1) * rp->span) <= t)
+    {
+        SipConcClose(&ck->conc, end, &rp->iv[ck->cur].conc);
+        ck->cur++;
+    }
+}
+
+/**
+ * \brief   Function to add a call of the chunk, at the given offset from the
+ *          start of the range, to the sweep of the concurrent calls.
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+static int SipReplayConcAdd(SipReplayChunk *ck, int64_t offset,
+        uint32_t billsec, uint8_t type)
+{
+    time_t t = ck->rp->base + offset;
+
+    SipReplayConcUntil(ck, t);
+    return SipConcAdd(&ck->conc, t, billsec, type);
+}
+
+/**
+ * \brief   Function to fetch the calls of a chunk of the replay range from the
+ *          CDR database and to aggregate them in to their intervals. The
+ *          calls are read through a cursor, fetch-size calls per round trip.
+ *          For the concurrent calls, they are read in the order of their
+ *          calldate, from concurrency.lookback before the chunk, so that
+ *          the calls in progress at its start are swept as well.
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+static int SipReplayFetch(SipReplayChunk *ck)
+{
+    SipReplay *rp = ck->rp;
+    SipReplayStats stats;
+    PGresult *res = NULL;
+    char query[2 * DEFAULT_QUERY_SIZE];
+    char fetch[64];
+    char base_ts[25];
+    int64_t first = ck->first * rp->span;
+    int64_t offset = 0;
+    uint64_t idx = 0;
+    uint32_t billsec = 0;
+    uint32_t row = 0;
+    uint32_t row_cnt = 0;
+    int type = 0;
+
+    if (rp->conc)
+        first -= conc_lookback;
+
+    memset(&stats, 0, sizeof(stats));
+    SipWallClockFormat(rp->base, base_ts);
+
+    /* The offset of a call from the start of the range is taken by the
+     * database on the wall clock, as the range is counted, so that no call
+     * date has to be parsed here */
+    snprintf(query, sizeof(query), "declare sipade_replay no scroll cursor"
+            " for select floor(extract(epoch from calldate - '%s'::timestamp))"
+            "::bigint,billsec,calltype from %s where calldate >= '%s'::timestamp"
+            " + interval '%"PRId64" second' and calldate < '%s'::timestamp +"
+            " interval '%"PRIu64" minute' and calltype in (%s) and"
+            " accountcode='%s'%s", base_ts, table, base_ts, first, base_ts,
+            (ck->first + ck->cnt) * interval, calltype, accountcode,
+            rp->conc ? " order by calldate" : "");
+    snprintf(fetch, sizeof(fetch), "fetch %"PRIu32" from sipade_replay",
+            replay_fetch_size);
+
+    if (SipReplayCommand(ck->conn, "begin", &stats) != SIP_OK)
+        goto error;
+    if (SipReplayCommand(ck->conn, query, &stats) != SIP_OK)
+        goto rollback;
+
+    do {
+        if (__atomic_load_n(&replay_cancel, __ATOMIC_RELAXED))
+            goto rollback;
+        res = SipGetCdr(ck->conn, fetch, SIP_METRIC_STMT_INTERVAL);
+        stats.cdr_queries++;
+        if (res == NULL)
+            goto rollback;
+
+        row_cnt = PQntuples(res);
+        for (row = 0; row < row_cnt; row++) {
+            type = SipCallTypeIndex(PQgetvalue(res, row, 2));
+            if (type < 0)
+                continue;
+
+            offset = strtoll(PQgetvalue(res, row, 0), NULL, 10);
+            billsec = strtoul(PQgetvalue(res, row, 1), NULL, 10);
+            if (rp->conc &&
+                    SipReplayConcAdd(ck, offset, billsec, type) != SIP_OK)
+            {
+                PQclear(res);
+                goto rollback;
+            }
+
+            /* the calls before the chunk are only swept */
+            if (offset < (int64_t)(ck->first * rp->span))
+                continue;
+
+            idx = offset / rp->span;
+            if (idx >= rp->cnt)
+                continue;
+
+            rp->iv[idx].rows++;
+            rp->iv[idx].num[type]++;
+            rp->iv[idx].dur[type] += billsec;
+            ck->cdrs++;
+        }
+        PQclear(res);
+    } while (row_cnt == replay_fetch_size);
+
+    if (SipReplayCommand(ck->conn, "close sipade_replay", &stats) != SIP_OK)
+        goto rollback;
+    if (SipReplayCommand(ck->conn, "commit", &stats) != SIP_OK)
+        goto error;
+
+    ck->cdr_queries = stats.cdr_queries;
+    return SIP_OK;
+
+rollback:
+    PQclear(PQexec(ck->conn, "rollback"));
+error:
+    ck->cdr_queries = stats.cdr_queries;
+    return SIP_ERROR;
+}
+
+/**
+ * \brief   Function to aggregate the calls of a chunk of the replay range
+ *          from the in memory source, which is sorted by the call date. The
+ *          calls from concurrency.lookback before the chunk are swept too.
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+static int SipReplayMemSource(SipReplayChunk *ck)
+{
+    SipReplay *rp = ck->rp;
+    SipCdr *cdr = NULL;
+    struct tm tm;
+    time_t start = rp->base + ck->first * rp->span;
+    time_t end = rp->base + (ck->first + ck->cnt) * rp->span;
+    time_t from = start - (rp->conc ? conc_lookback : 0);
+    time_t wall = 0;
+    time_t quarter = -1;
+    time_t offset = 0;
+    uint64_t idx = 0;
+    uint64_t i = 0;
+    uint8_t calltypes = 0;
+    uint8_t cnt = 0;
+    int tenant = -1;
+
+    for (cnt = 0; cnt < MAX_CALLTYPE; cnt++) {
+        if (hd_detection.call[cnt].flag & CALLTYPE_ACTIVE)
+            calltypes |= 1 << cnt;
+    }
+
+    for (i = 0; i < mem_source->gen->tenant_cnt; i++) {
+        if (strcmp(mem_source->gen->tenants[i].name, accountcode) == 0)
+            tenant = i;
+    }
+
+    /* The call dates are taken to the wall clock as the database does. The
+     * offset of the wall clock changes at most on a quarter of an hour, so it
+     * is looked up once per quarter. Around the end of the daylight saving
+     * time the wall clock goes back, so the calls are scanned from an hour
+     * before the chunk to an hour after it */
+    for (i = SipCdrMemSourceFind(mem_source,
+                SipWallClockTime(from, &tm) - 3600);
+            tenant >= 0 && i < mem_source->cnt; i++)
+    {
+        if ((i & 0xffff) == 0 &&
+                __atomic_load_n(&replay_cancel, __ATOMIC_RELAXED))
+        {
+            return SIP_ERROR;
+        }
+
+        cdr = &mem_source->cdrs[i];
+        if (cdr->calldate / 900 != quarter) {
+            quarter = cdr->calldate / 900;
+            offset = SipWallClockOf(cdr->calldate) - cdr->calldate;
+        }
+        wall = cdr->calldate + offset;
+        if (wall >= end + 3600)
+            break;
+
+        if (cdr->tenant != tenant || !(calltypes & (1 << cdr->calltype)) ||
+                wall < from || wall >= end)
+        {
+            continue;
+        }
+
+        if (rp->conc && SipReplayConcAdd(ck, wall - rp->base,
+                    cdr->billsec, cdr->calltype) != SIP_OK)
+        {
+            return SIP_ERROR;
+        }
+
+        if (wall < start)
+            continue;
+
+        idx = (wall - rp->base) / rp->span;
+        rp->iv[idx].rows++;
+        rp->iv[idx].num[cdr->calltype]++;
+        rp->iv[idx].dur[cdr->calltype] += cdr->billsec;
+        ck->cdrs++;
+    }
+
+    /* The statements the cursor would take: begin, declare, the fetches,
+     * close and commit */
+    ck->cdr_queries = 4 + ck->cdrs / replay_fetch_size + 1;
+    return SIP_OK;
+}
+
+/**
+ * \brief   Thread function to fetch and aggregate a chunk of the replay range.
+ */
+static void *SipReplayChunkRun(void *arg)
+{
+    SipReplayChunk *ck = (SipReplayChunk *)arg;
+    SipReplay *rp = ck->rp;
+    time_t start = rp->base + ck->first * rp->span;
+
+    SipConcInit(&ck->conc, start - conc_lookback);
+    ck->cur = ck->first;
+
+    if (mem_source != NULL)
+        ck->ret = SipReplayMemSource(ck);
+    else
+        ck->ret = SipReplayFetch(ck);
+
+    /* the intervals after the last call are closed as well */
+    if (rp->conc && ck->ret == SIP_OK)
+        SipReplayConcUntil(ck, start + ck->cnt * rp->span);
+    SipConcFree(&ck->conc);
+
+    SipTimerAddItems(SIP_TIMER_CALL_DATA, ck->cdrs);
+    if (ck->done_fd >= 0 && eventfd_write(ck->done_fd, 1) != 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in telling the"
+                " end of the replay chunk: %s", strerror(errno));
+    }
+    return NULL;
+}
+
+/**
+ * \brief   Function to count the chunks of the replay, which are done.
+ */
+static void SipReplayChunkDone(int fd, uint32_t events, void *data)
+{
+    eventfd_t cnt = 0;
+
+    if (eventfd_read(fd, &cnt) == 0)
+        *(uint64_t *)data += cnt;
+}
+
+/**
+ * \brief   Function to check, if the chunks of a replay are being fetched.
+ *
+ * @return  TRUE if the replay threads are running, FALSE otherwise
+ */
+int SipAnomalyReplayBusy()
+{
+    return (replay_chunks != NULL) ? TRUE : FALSE;
+}
+
+/**
+ * \brief   Function to stop the threads of the replay. They stop before their
+ *          next fetch and the queries in progress are cancelled, so the
+ *          replay fails with the chunks it has not fetched.
+ */
+void SipAnomalyReplayCancel()
+{
+    PGcancel *cancel = NULL;
+    char err[256];
+    uint32_t i = 0;
+
+    if (replay_chunks == NULL)
+        return;
+
+    __atomic_store_n(&replay_cancel, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < replay_chunk_cnt && mem_source == NULL; i++) {
+        cancel = PQgetCancel(replay_chunks[i].conn);
+        if (cancel == NULL)
+            continue;
+        if (PQcancel(cancel, err, sizeof(err)) == 0) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in cancelling"
+                    " the replay query: %s", err);
+        }
+        PQfreeCancel(cancel);
+    }
+}
+
+/**
+ * \brief   Function to fetch and aggregate the calls of the replay range. The
+ *          range is split in to chunks of consecutive intervals, which are
+ *          fetched concurrently by their threads, each over its own
+ *          connection, the first one over the given connection. Meanwhile the
+ *          calling thread runs the event loop, so that the signals are taken
+ *          and a shutdown stops the threads.
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+static int SipReplayAggregate(PGconn *conn, SipReplay *rp)
+{
+    SipReplayChunk *chunks = NULL;
+    uint64_t per = 0;
+    uint64_t done = 0;
+    uint32_t threads = replay_threads;
+    uint32_t started = 0;
+    uint32_t i = 0;
+    int done_fd = -1;
+    int ret = SIP_OK;
+
+    if (threads > rp->cnt)
+        threads = rp->cnt;
+    per = (rp->cnt + threads - 1) / threads;
+    threads = (rp->cnt + per - 1) / per;
+
+    chunks = calloc(threads, sizeof(SipReplayChunk));
+    if (chunks == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "failed in allocating"
+                " memory");
+        return SIP_ERROR;
+    }
+
+    for (i = 0; i < threads; i++) {
+        chunks[i].rp = rp;
+        chunks[i].first = i * per;
+        chunks[i].cnt = (i == threads - 1) ? rp->cnt - i * per : per;
+        chunks[i].conn = conn;
+
+        if (i > 0 && mem_source == NULL) {
+            chunks[i].conn = SipDbConnect(SIP_DB_CDR);
+            if (chunks[i].conn == NULL) {
+                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in "
+                        "connecting to cdr-database for the replay");
+                threads = i + 1;
+                ret = SIP_ERROR;
+                break;
+            }
+        }
+    }
+
+    /* the tools, which run the engine without the event loop, only wait
+     * for the threads */
+    if (SipReactorEnabled() == TRUE) {
+        done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (done_fd >= 0 && SipReactorAdd(done_fd, EPOLLIN,
+                    SipReplayChunkDone, &done) != SIP_OK)
+        {
+            close(done_fd);
+            done_fd = -1;
+        }
+    }
+
+    replay_chunks = chunks;
+    replay_chunk_cnt = threads;
+    replay_cancel = 0;
+    for (i = 0; i < threads && ret == SIP_OK; i++) {
+        chunks[i].done_fd = done_fd;
+        if (pthread_create(&chunks[i].thread, NULL, SipReplayChunkRun,
+                    &chunks[i]) != 0)
+        {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in creating"
+                    " the replay thread");
+            SipAnomalyReplayCancel();
+            ret = SIP_ERROR;
+            break;
+        }
+        started = i + 1;
+    }
+
+    while (done_fd >= 0 && done < started) {
+        if (SipReactorRun(-1) == SIP_ERROR)
+            break;
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (i < started)
+            pthread_join(chunks[i].thread, NULL);
+        if (i > 0 && chunks[i].conn != conn)
+            PQfinish(chunks[i].conn);
+
+        if (chunks[i].ret != SIP_OK)
+            ret = SIP_ERROR;
+        rp->stats->cdrs += chunks[i].cdrs;
+        rp->stats->cdr_queries += chunks[i].cdr_queries;
+    }
+
+    if (replay_cancel)
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "The replay has been stopped");
+    replay_chunks = NULL;
+    replay_chunk_cnt = 0;
+    if (done_fd >= 0) {
+        SipReactorDel(done_fd);
+        close(done_fd);
+    }
+
+    free(chunks);
+    return ret;
+}
+
+/**
+ * \brief   Function to replay all the intervals of the range and to leave the
+ *          timestamps at the start of the next interval, where the interval
+ *          by interval path would leave them. They are moved after each
+ *          scored interval, so that a failed replay is taken over from the
+ *          first interval, which has not been scored.
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+static int SipReplayRange(PGconn *conn, SipReplay *rp)
+{
+    time_t next = 0;
+    uint64_t idx = 0;
+    int ret = SIP_OK;
+
+    if (rp->cnt == 0)
+        return SIP_OK;
+
+    rp->conc = conc_enabled;
+    rp->iv = calloc(rp->cnt, sizeof(SipReplayInterval));
+    if (rp->iv == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "failed in allocating"
+                " memory");
+        return SIP_ERROR;
+    }
+
+    ret = SipReplayAggregate(conn, rp);
+    if (ret != SIP_OK) {
+        free(rp->iv);
+        rp->iv = NULL;
+        return ret;
+    }
+
+    /* The threshold update depends on the previous interval, so the
+     * intervals are scored in order */
+    for (idx = 0; idx < rp->cnt; idx++) {
+        ret = SipReplayScore(conn, rp, idx);
+        if (ret != SIP_OK)
+            break;
+
+        next = rp->base + (idx + 1) * rp->span;
+        SipWallClockFormat(next, last_transaction_ts);
+        SipWallClockTime(next, &current_time);
+    }
+
+    free(rp->iv);
+    rp->iv = NULL;
+    return ret;
+}
+
+/**
+ * \brief   Function to train the detection module over the given number of
+ *          intervals in one pass. The calls of all the intervals are streamed
+ *          with one query, instead of a query per interval.
+ *
+ * @param conn      Pointer to the CDR database
+ * @param intervals number of the training intervals
+ * @param stats     pointer to the counters of the replay
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+int SipTrainingAnomalyReplay(PGconn *conn, uint64_t intervals,
+        SipReplayStats *stats)
+{
+    SipReplay rp;
+
+    memset(&rp, 0, sizeof(rp));
+    rp.base = SipWallClock(&current_time);
+    rp.span = interval * 60;
+    rp.cnt = intervals;
+    rp.training = TRUE;
+    rp.stats = stats;
+
+    return SipReplayRange(conn, &rp);
+}
+
+/**
+ * \brief   Function to train the baselines of the concurrent calls over the
+ *          given number of intervals before the current timestamp, after the
+ *          threshold has been restored, as they are not stored with it. The
+ *          threshold and the timestamp are left as they have been restored.
+ *
+ * @param conn      Pointer to the CDR database
+ * @param intervals number of the training intervals
+ * @param stats     pointer to the counters of the replay
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+int SipAnomalyConcTrain(PGconn *conn, uint64_t intervals,
+        SipReplayStats *stats)
+{
+    SipReplay rp;
+    struct tm restored = current_time;
+    char ts[25];
+    int ret = SIP_OK;
+
+    if (!conc_enabled || intervals == 0)
+        return SIP_OK;
+
+    memset(&rp, 0, sizeof(rp));
+    rp.span = interval * 60;
+    rp.base = SipWallClock(&current_time) - intervals * rp.span;
+    rp.cnt = intervals;
+    rp.training = TRUE;
+    rp.baseline = TRUE;
+    rp.stats = stats;
+
+    snprintf(ts, sizeof(ts), "%s", last_transaction_ts);
+    ret = SipReplayRange(conn, &rp);
+    strcpy(last_transaction_ts, ts);
+    current_time = restored;
+
+    if (ret == SIP_OK) {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Trained the baselines of the"
+                " concurrent calls over %"PRIu64" intervals before %s",
+                intervals, last_transaction_ts);
+    }
+    return ret;
+}
+
+/**
+ * \brief   Function to log the hours of the day, of which the baseline of the
+ *          concurrent calls has not seen concurrency.warm-up intervals yet.
+ *          The concurrent calls are not checked in them until it has.
+ */
+void SipAnomalyConcWarmup()
+{
+    uint32_t cnt = 0;
+    uint8_t hour = 0;
+
+    if (!conc_enabled)
+        return;
+
+    for (hour = 0; hour < 24; hour++) {
+        if (conc_base[hour].seen < conc_warmup)
+            cnt++;
+    }
+
+    if (cnt > 0) {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "The concurrent calls are not"
+                " checked in %"PRIu32" of the 24 hours of the day, until their"
+                " baselines have seen the %"PRIu32" intervals of the warm-up",
+                cnt, conc_warmup);
+    }
+}
+
+/**
+ * \brief   Function to run the detection over all the intervals up to the
+ *          ending date in offline mode. The calls are streamed in the order of
+ *          their call date and aggregated in memory, the intervals are scored
+ *          in order and the thresholds are written in bulk at every checkpoint
+ *          and at the end.
+ *
+ * @param conn      Pointer to the CDR database
+ * @param notify    function to be called for every scored interval
+ * @param stats     pointer to the counters of the replay
+ *
+ * @return returns SIP_DONE upon completion and SIP_ERROR on failure
+ */
+int SipAnomalyReplay(PGconn *conn, SipReplayNotifyFunc notify,
+        SipReplayStats *stats)
+{
+    SipReplay rp;
+    time_t end = 0;
+
+    SipDetectionStartTimeStamp();
+
+    memset(&rp, 0, sizeof(rp));
+    rp.base = SipWallClock(&current_time);
+    rp.span = interval * 60;
+    rp.notify = notify;
+    rp.stats = stats;
+
+    /* The intervals, which start up to the ending date */
+    end = SipWallClockOf(complete_time);
+    if (end >= rp.base)
+        rp.cnt = (end - rp.base) / rp.span + 1;
+
+    if (SipReplayRange(conn, &rp) != SIP_OK)
+        return SIP_ERROR;
+
+    if (SipAnomalyFlushThresholds(stats) != SIP_OK)
+        return SIP_ERROR;
+
+    return SIP_DONE;
+}
+
+/**
+ * \brief   Function to get the number of the intervals, which have ended by
+ *          the given time and are still to be scored in online mode. The
+ *          intervals covered by the ingest buffer are not counted, they are
+ *          scored from memory anyway. The intervals, which the next adaptive
+ *          interval is longer by, are no backlog.
+ *
+ * @return the number of the intervals, or 0 if they are fewer than the
+ *         catch-up.min-intervals or the catch-up is disabled
+ */
+uint64_t SipAnomalyCatchUpIntervals(time_t until)
+{
+    struct tm tm;
+    time_t base = 0;
+    time_t span = interval * 60;
+    uint64_t extra = (window - 1) / interval;
+    uint64_t cnt = 0;
+
+    if (catchup_intervals == 0)
+        return 0;
+
+    /* The intervals are counted on the wall clock, as the replay does */
+    SipDetectionStartTimeStamp();
+    base = SipWallClock(&current_time);
+    until = SipWallClockOf(until);
+    if (until < base + span)
+        return 0;
+
+    cnt = (until - base) / span;
+    while (cnt > 0 && SipIngestCovers(SipWallClockTime(base + (cnt - 1) * span,
+                    &tm)))
+    {
+        cnt--;
+    }
+
+    if (cnt <= extra || cnt - extra < catchup_intervals)
+        return 0;
+
+    return cnt;
+}
+
+/**
+ * \brief   Function to catch up with the wall clock, after the engine has been
+ *          down. The given number of the intervals are replayed in one pass as
+ *          in offline mode, with the calls fetched in bulk and the thresholds
+ *          written at the checkpoints and at the end. The timestamps are left
+ *          at the start of the next interval, for the real time detection.
+ *
+ * @param conn      Pointer to the CDR database
+ * @param cnt       number of the intervals, from SipAnomalyCatchUpIntervals()
+ * @param notify    function to be called for every scored interval
+ * @param stats     pointer to the counters of the replay
+ *
+ * @return returns SIP_OK upon success and SIP_ERROR on failure
+ */
+int SipAnomalyCatchUp(PGconn *conn, uint64_t cnt, SipReplayNotifyFunc notify,
+        SipReplayStats *stats)
+{
+    SipReplay rp;
+
+    memset(&rp, 0, sizeof(rp));
+    rp.base = SipWallClock(&current_time);
+    rp.span = interval * 60;
+    rp.cnt = cnt;
+    rp.notify = notify;
+    rp.stats = stats;
+
+    if (SipReplayRange(conn, &rp) != SIP_OK) {
+        /* the thresholds of the intervals, which have been scored, are
+         * kept for the interval by interval path */
+        SipAnomalyFlushThresholds(stats);
+        return SIP_ERROR;
+    }
+
+    return SipAnomalyFlushThresholds(stats);
+}
+
+/**
+ * \brief   Function to clear the memory, while shutting down the engine.
+ */
+void SipDeinitAnomalyDetection()
+{
+    if (last_transaction_ts != NULL) {
+        free (last_transaction_ts);
     }
 
     if (calltype != NULL) {
         free (calltype);
     }
 
+    if (threshold_rows != NULL) {
+        free (threshold_rows);
+    }
+
+    if (conc_rows != NULL) {
+        free (conc_rows);
+    }
+    if (conc_cdrs != NULL) {
+        PQclear(conc_cdrs);
+    }
+    SipConcFree(&conc);
+
 }
\ No newline at end of file
@@ -28,6 +28,8 @@
 #include <math.h>
 #include <netinet/in.h>
 #include <inttypes.h>
+#include <string.h>
+#include <time.h>
 
 
 #define CALLTYPE_INACTIVE       0x00
@@ -84,13 +86,94 @@ typedef struct HellingerDistance {
     uint8_t flags;
 }Hd;
 
+/**
+ * \brief   Function to match the calltype name against the given name. The
+ *          name has to end after it or be padded by blanks, as a char(n)
+ *          column is, so that e.g. "MOBILEXYZ" is not taken as "MOBILE".
+ */
+static inline int SipCallTypeIs(const char *calltype, const char *name,
+        size_t len)
+{
+    return strncmp(calltype, name, len) == 0 &&
+        (calltype[len] == '\0' || calltype[len] == ' ');
+}
+
+/**
+ * \brief   Function to get the calltype of the given calltype name.
+ *
+ * @return returns the calltype or -1 if the name is not known
+ */
+static inline int SipCallTypeIndex(const char *calltype)
+{
+    if (SipCallTypeIs(calltype, "INTERNATIONAL", 13))
+        return INTERNATIONAL;
+    else if (SipCallTypeIs(calltype, "MOBILE", 6))
+        return MOBILE;
+    else if (SipCallTypeIs(calltype, "PREMIUM", 7))
+        return PREMIUM;
+    else if (SipCallTypeIs(calltype, "DOMESTIC", 8))
+        return DOMESTIC;
+    else if (SipCallTypeIs(calltype, "SERVICE", 7))
+        return SERVICE;
+    else if (SipCallTypeIs(calltype, "EMERGENCY", 9))
+        return EMERGENCY;
+
+    return -1;
+}
+
+/**
+ * Counters of the batch replay, the round trips are also counted when the
+ * calls come from memory.
+ */
+typedef struct SipReplayStats_ {
+    uint64_t intervals;         /* scored intervals */
+    uint64_t alerts;            /* anomalous intervals */
+    uint64_t cdrs;              /* aggregated calls */
+    uint64_t cdr_queries;       /* statements on the CDR database */
+    uint64_t threshold_rows;    /* queued threshold rows */
+    uint64_t threshold_writes;  /* bulk writes of the threshold rows */
+} SipReplayStats;
+
+/* Called for every scored interval of the detection, with the status (TRUE
+ * for an anomaly) and the calls of an anomalous interval */
+typedef void (*SipReplayNotifyFunc)(int, PGresult **);
+
 int SipInitAnomalyDetection();
 int SipAnomalyDetection(PGconn *, PGresult **);
+struct SipCdrQuery_;
+int SipAnomalyDetectionFetch(PGconn *, struct SipCdrQuery_ *, PGresult **);
+int SipAnomalyDetectionResult(struct SipCdrQuery_ *, PGresult **);
+int SipAnomalyDetectionScore(PGresult *);
+int SipAnomalyDetectionTimeout(PGconn *, struct SipCdrQuery_ *, PGresult **);
 int SipTrainingAnomalyDetection(PGconn *);
 void SipDeinitAnomalyDetection();
 char *SipGetTimeStamp();
 int SipTrainingInitThreshold(PGconn *);
 int SipAnomalyStoreThreshold();
+int SipAnomalyInitConfValues();
+void SipAnomalyReloadConf();
+time_t SipAnomalyIntervalFrom();
+time_t SipAnomalyIntervalEnd();
+void SipGetCallData(Hd *, PGresult *);
+struct SipConcStats_;
+int SipGetConcurrency(struct SipConcStats_ *, PGresult *, time_t, time_t);
+void SipCalcHDProbabilities(Hd *);
+void SipCalcHellingerDistance(Hd *, Hd *);
+void SipUpdateHDThreshold(Hd *, Hd *);
+int SipAnomalyDecision(Hd *, Hd *, struct tm *);
+int SipAnomalyEarlyWarning(time_t, time_t, const uint32_t *,
+        const uint32_t *);
+struct SipCdrMemSource_;
+void SipDetectionSetMemSource(struct SipCdrMemSource_ *);
+int SipTrainingAnomalyReplay(PGconn *, uint64_t, SipReplayStats *);
+int SipAnomalyReplay(PGconn *, SipReplayNotifyFunc, SipReplayStats *);
+uint64_t SipAnomalyCatchUpIntervals(time_t);
+int SipAnomalyCatchUp(PGconn *, uint64_t, SipReplayNotifyFunc,
+        SipReplayStats *);
+int SipAnomalyConcTrain(PGconn *, uint64_t, SipReplayStats *);
+void SipAnomalyConcWarmup();
+int SipAnomalyReplayBusy();
+void SipAnomalyReplayCancel();
 
 #endif	/* _UTIL_DETECTION_H */
 
@@ -0,0 +1,752 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-ingest.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Real time ingest of the CDRs. The listener takes datagrams on a Unix socket
+ * ("unix:/path/to/socket") or on UDP ("host:port"), each with one or more CDR
+ * lines, and buffers the calls of the monitored institution in memory. The
+ * socket is watched by the event loop of the engine. The calls can also be
+ * streamed from the CDR database by logical replication (util-repl.c). The
+ * detection takes the calls of an interval from the buffer as soon as the
+ * interval has ended, instead of querying the CDR database.
+ */
+
+#define _GNU_SOURCE     /* strptime */
+#include <ctype.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "sipade.h"
+#include "util-detection.h"
+#include "util-ingest.h"
+#include "util-metrics.h"
+#include "util-reactor.h"
+#include "util-repl.h"
+#include "util-log.h"
+#include "util-conf.h"
+
+static const char *calltype_names[MAX_CALLTYPE] = {
+    [INTERNATIONAL] = "INTERNATIONAL",
+    [MOBILE] = "MOBILE",
+    [PREMIUM] = "PREMIUM",
+    [SERVICE] = "SERVICE",
+    [DOMESTIC] = "DOMESTIC",
+    [EMERGENCY] = "EMERGENCY",
+};
+
+static int ingest_fd = -1;
+static char *unix_path = NULL;
+static char *institution = NULL;
+static char *dgram = NULL;
+static SipIngestCdr batch[SIP_INGEST_BATCH];
+static uint32_t batch_cnt = 0;
+static time_t ingest_start = 0;
+static uint32_t grace = SIP_INGEST_DEFAULT_GRACE;
+static uint64_t max_cdrs = SIP_INGEST_DEFAULT_MAX_CDRS;
+
+/* Calls received for the intervals, which have not been scored yet */
+static SipIngestCdr *cdrs = NULL;
+static uint64_t cdr_cnt = 0;
+static uint64_t cdr_size = 0;
+static uint64_t dropped = 0;    /* since the last scored interval */
+static time_t watermark = 0;    /* end of the last scored interval */
+
+/* Sums of the calls received for the open interval, for the early warning */
+static int early_warning = 1;
+static time_t win_from = 1;
+static time_t win_to = 0;
+static uint32_t win_num[MAX_CALLTYPE];
+static uint32_t win_dur[MAX_CALLTYPE];
+static uint8_t win_changed = 0;
+
+/* cache of the last parsed call date */
+static char date_s[20];
+static time_t date_sec = 0;
+
+/**
+ * \brief   Function to split the next field of a CDR line at the separator.
+ *          The double quotes around the field, as written by the Asterisk
+ *          cdr_custom templates, are removed.
+ *
+ * @return  the field, or NULL if there are no more fields
+ */
+static char *SipIngestField(char **pos, char sep)
+{
+    char *field = *pos;
+    char *end = NULL;
+    size_t len = 0;
+
+    if (field == NULL)
+        return NULL;
+
+    end = strchr(field, sep);
+    if (end != NULL) {
+        *end = '\0';
+        *pos = end + 1;
+    } else {
+        *pos = NULL;
+    }
+
+    len = strlen(field);
+    if (len >= 2 && field[0] == '"' && field[len - 1] == '"') {
+        field[len - 1] = '\0';
+        field++;
+    }
+
+    return field;
+}
+
+/**
+ * \brief   Function to parse the call date, either as local time in the
+ *          format "YYYY-MM-DD HH:MM:SS" or as seconds since the epoch.
+ *
+ * @return  the call date or -1 if it is not valid
+ */
+static time_t SipIngestDate(const char *s)
+{
+    struct tm tm;
+    const char *p = s;
+    char *end = NULL;
+
+    while (isdigit((unsigned char)*p))
+        p++;
+    if (*p == '\0' && p != s)
+        return (time_t)strtoll(s, NULL, 10);
+
+    /* the calls of a burst share their call date */
+    if (date_sec != 0 && strcmp(s, date_s) == 0)
+        return date_sec;
+
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(s, "%F %T", &tm);
+    if (end == NULL || *end != '\0')
+        return -1;
+    tm.tm_isdst = -1;
+
+    strncpy(date_s, s, sizeof(date_s) - 1);
+    date_sec = mktime(&tm);
+    return date_sec;
+}
+
+static int SipIngestFill(char **, const char *, SipIngestCdr *);
+
+/**
+ * \brief   Function to parse a CDR line with the columns of the interval query
+ *          "id,calldate,src,dst,billsec,calltype,accountcode", separated by
+ *          commas or by tabs. The id can be left out.
+ *
+ * @param line  the line, which is split in place
+ * @param cdr   pointer to the CDR, which is filled in
+ *
+ * @return  SIP_METRIC_INGEST_ACCEPTED for a call of the monitored institution,
+ *          SIP_METRIC_INGEST_IGNORED for the other calls and
+ *          SIP_METRIC_INGEST_MALFORMED if the line can not be parsed
+ */
+static int SipIngestParse(char *line, SipIngestCdr *cdr)
+{
+    char *fields[7];
+    char **f = fields;
+    char *pos = line;
+    const char *id = "";
+    char sep = (strchr(line, '\t') != NULL) ? '\t' : ',';
+    uint8_t n = 0;
+
+    while (n < 7 && (fields[n] = SipIngestField(&pos, sep)) != NULL)
+        n++;
+    if (n < 6 || pos != NULL)
+        return SIP_METRIC_INGEST_MALFORMED;
+
+    if (n == 7)
+        id = *f++;
+
+    return SipIngestFill(f, id, cdr);
+}
+
+/**
+ * \brief   Function to fill the CDR from its columns, of the monitored
+ *          institution only.
+ *
+ * @param f     columns "calldate,src,dst,billsec,calltype,accountcode"
+ * @param id    id of the call, which may be empty
+ * @param cdr   pointer to the CDR, which is filled
+ *
+ * @return  SIP_METRIC_INGEST_ACCEPTED, SIP_METRIC_INGEST_IGNORED for a call
+ *          of another institution or SIP_METRIC_INGEST_MALFORMED
+ */
+static int SipIngestFill(char **f, const char *id, SipIngestCdr *cdr)
+{
+    char *end = NULL;
+    int type = 0;
+
+    if (strcmp(f[5], institution) != 0)
+        return SIP_METRIC_INGEST_IGNORED;
+
+    if (strlen(id) >= SIP_INGEST_ID_LEN ||
+            strlen(f[1]) >= SIP_INGEST_NUMBER_LEN ||
+            strlen(f[2]) >= SIP_INGEST_NUMBER_LEN)
+    {
+        return SIP_METRIC_INGEST_MALFORMED;
+    }
+
+    cdr->calldate = SipIngestDate(f[0]);
+    if (cdr->calldate < 0)
+        return SIP_METRIC_INGEST_MALFORMED;
+
+    cdr->billsec = strtoul(f[3], &end, 10);
+    if (end == f[3] || *end != '\0')
+        return SIP_METRIC_INGEST_MALFORMED;
+
+    type = SipCallTypeIndex(f[4]);
+    if (type < 0)
+        return SIP_METRIC_INGEST_MALFORMED;
+    cdr->calltype = type;
+
+    strcpy(cdr->id, id);
+    strcpy(cdr->src, f[1]);
+    strcpy(cdr->dst, f[2]);
+    return SIP_METRIC_INGEST_ACCEPTED;
+}
+
+/**
+ * \brief   Function to add the parsed CDRs to the buffer. The calls of the
+ *          intervals which have been scored already are late and dropped, as
+ *          are the calls which do not fit in to the buffer.
+ */
+static void SipIngestAdd()
+{
+    SipIngestCdr *tmp = NULL;
+    uint64_t size = 0;
+    uint32_t cnt = batch_cnt;
+    uint32_t late = 0;
+    uint32_t full = 0;
+    uint32_t i = 0;
+
+    batch_cnt = 0;
+
+    for (i = 0; i < cnt; i++) {
+        if (batch[i].calldate < watermark) {
+            late++;
+            continue;
+        }
+
+        if (cdr_cnt == cdr_size) {
+            size = cdr_size ? 2 * cdr_size : 4096;
+            if (size > max_cdrs)
+                size = max_cdrs;
+            tmp = (size > cdr_size) ?
+                realloc(cdrs, size * sizeof(SipIngestCdr)) : NULL;
+            if (tmp == NULL) {
+                full++;
+                continue;
+            }
+            cdrs = tmp;
+            cdr_size = size;
+        }
+
+        cdrs[cdr_cnt++] = batch[i];
+
+        if (batch[i].calldate >= win_from && batch[i].calldate <= win_to) {
+            win_num[batch[i].calltype]++;
+            win_dur[batch[i].calltype] += batch[i].billsec;
+            win_changed = 1;
+        }
+    }
+    dropped += full;
+
+    SipMetricsAddIngest(SIP_METRIC_INGEST_ACCEPTED, cnt - late - full);
+    SipMetricsAddIngest(SIP_METRIC_INGEST_LATE, late);
+    SipMetricsAddIngest(SIP_METRIC_INGEST_DROPPED, full);
+}
+
+/**
+ * \brief   Function to receive the datagrams, which are waiting on the socket.
+ *          The lines are parsed and the calls are added to the buffer in
+ *          batches. At most SIP_INGEST_MAX_DGRAMS are taken at once, so that
+ *          a flood does not delay the timers of the event loop.
+ */
+static void SipIngestReceive(int fd, uint32_t events, void *data)
+{
+    char *line = NULL;
+    char *next = NULL;
+    ssize_t len = 0;
+    uint32_t n = 0;
+    int status = 0;
+
+    for (n = 0; n < SIP_INGEST_MAX_DGRAMS; n++) {
+        len = recv(fd, dgram, SIP_INGEST_DGRAM_SIZE, MSG_TRUNC);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in receiving"
+                        " the CDRs: %s", strerror(errno));
+            }
+            break;
+        }
+
+        /* the last line of a truncated datagram is incomplete */
+        if (len > SIP_INGEST_DGRAM_SIZE) {
+            dgram[SIP_INGEST_DGRAM_SIZE] = '\0';
+            next = strrchr(dgram, '\n');
+            len = (next != NULL) ? next - dgram : 0;
+            SipMetricsAddIngest(SIP_METRIC_INGEST_MALFORMED, 1);
+        }
+        dgram[len] = '\0';
+
+        for (line = dgram; line != NULL; line = next) {
+            next = strchr(line, '\n');
+            if (next != NULL)
+                *next++ = '\0';
+            if (*line != '\0' && line[strlen(line) - 1] == '\r')
+                line[strlen(line) - 1] = '\0';
+            if (*line == '\0')
+                continue;
+
+            status = SipIngestParse(line, &batch[batch_cnt]);
+            if (status != SIP_METRIC_INGEST_ACCEPTED) {
+                SipMetricsAddIngest(status, 1);
+                continue;
+            }
+
+            if (++batch_cnt == SIP_INGEST_BATCH)
+                SipIngestAdd();
+        }
+    }
+
+    SipIngestCommit();
+}
+
+/**
+ * \brief   Function to add a call, which has been decoded by another source
+ *          than the listener, e.g. the replication stream. The calls are added
+ *          to the buffer in batches, the last batch by SipIngestCommit().
+ *
+ * @param fields    columns "id,calldate,src,dst,billsec,calltype,accountcode"
+ *                  of the call, the id can be NULL
+ *
+ * @return  SIP_METRIC_INGEST_ACCEPTED, SIP_METRIC_INGEST_IGNORED for a call
+ *          of another institution or SIP_METRIC_INGEST_MALFORMED
+ */
+int SipIngestRow(char **fields)
+{
+    int status = 0;
+    uint8_t i = 0;
+
+    /* only the id can be null */
+    for (i = 1; i < 7; i++) {
+        if (fields[i] == NULL) {
+            SipMetricsAddIngest(SIP_METRIC_INGEST_MALFORMED, 1);
+            return SIP_METRIC_INGEST_MALFORMED;
+        }
+    }
+
+    status = SipIngestFill(fields + 1, (fields[0] != NULL) ? fields[0] : "",
+            &batch[batch_cnt]);
+    if (status != SIP_METRIC_INGEST_ACCEPTED) {
+        SipMetricsAddIngest(status, 1);
+        return status;
+    }
+
+    if (++batch_cnt == SIP_INGEST_BATCH)
+        SipIngestAdd();
+    return status;
+}
+
+/**
+ * \brief   Function to add the calls, which are still in the batch, to the
+ *          buffer and to check the open interval with them.
+ */
+void SipIngestCommit()
+{
+    if (batch_cnt > 0)
+        SipIngestAdd();
+
+    if (win_changed) {
+        win_changed = 0;
+        SipAnomalyEarlyWarning(win_from, win_to, win_num, win_dur);
+    }
+}
+
+/**
+ * \brief   Function to open the datagram socket for the given address, which
+ *          is either "host:port" or "unix:/path".
+ *
+ * @return  socket descriptor or -1 on failure
+ */
+static int SipIngestBind(const char *listen_s)
+{
+    struct sockaddr_in sin;
+    struct sockaddr_un sun;
+    char host[64];
+    char *port = NULL;
+    int rcvbuf = SIP_INGEST_RCVBUF;
+    int fd = -1;
+    int on = 1;
+
+    if (strncmp(listen_s, "unix:", 5) == 0) {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strncpy(sun.sun_path, listen_s + 5, sizeof(sun.sun_path) - 1);
+        unix_path = strdup(sun.sun_path);
+        unlink(unix_path);
+
+        fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+            goto fail;
+    } else {
+        strncpy(host, listen_s, sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+        port = strrchr(host, ':');
+        if (port == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Invalid ingest listen"
+                    " address \"%s\"", listen_s);
+            return -1;
+        }
+        *port++ = '\0';
+
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(atoi(port));
+        if (inet_pton(AF_INET, host, &sin.sin_addr) != 1) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Invalid ingest listen"
+                    " address \"%s\"", listen_s);
+            return -1;
+        }
+
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd < 0)
+            goto fail;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+            goto fail;
+    }
+
+    /* A burst is absorbed by the socket, while an interval is scored */
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    return fd;
+
+fail:
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in listening on \"%s\""
+            " for the CDRs: %s", listen_s, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+/**
+ * \brief   Function to initialize the ingest module and to add the listener to
+ *          the event loop, if it has been enabled in the config file. The CDRs
+ *          are only received in online mode.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+int SipIngestInit()
+{
+    extern uint8_t run_mode;
+    char *listen_s = NULL;
+    char *source = NULL;
+    char *inst = NULL;
+    int64_t val = 0;
+    int enabled = 0;
+
+    if (SipConfGetBool("ingest.enabled", &enabled) != 1 || !enabled)
+        return SIP_OK;
+
+    if (run_mode & SIP_RUN_MODE_OFFLINE) {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "The CDR ingest is not used"
+                " in offline mode");
+        return SIP_OK;
+    }
+
+    if (SipConfGet("institution", &inst) != 1) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Institution name is not"
+                " given in the config file");
+        return SIP_ERROR;
+    }
+    institution = strdup(inst);
+
+    if (SipConfGet("ingest.listen", &listen_s) != 1)
+        listen_s = SIP_INGEST_DEFAULT_LISTEN;
+    if (SipConfGetInt("ingest.grace", &val) == 1 && val >= 0)
+        grace = val;
+    if (SipConfGetInt("ingest.max-cdrs", &val) == 1 && val > 0)
+        max_cdrs = val;
+    if (SipConfGetBool("ingest.early-warning", &enabled) == 1)
+        early_warning = enabled;
+
+    /* The inserts of the CDR table are streamed from the CDR database */
+    if (SipConfGet("ingest.source", &source) == 1 &&
+            strcmp(source, "replication") == 0)
+    {
+        if (SipReplInit() != SIP_OK)
+            return SIP_ERROR;
+        ingest_start = time(NULL);
+        return SIP_OK;
+    }
+
+    dgram = malloc(SIP_INGEST_DGRAM_SIZE + 1);
+    if (dgram == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating the"
+                " memory");
+        return SIP_ERROR;
+    }
+
+    ingest_fd = SipIngestBind(listen_s);
+    if (ingest_fd < 0)
+        return SIP_ERROR;
+
+    if (SipReactorAdd(ingest_fd, EPOLLIN, SipIngestReceive, NULL) != SIP_OK) {
+        close(ingest_fd);
+        ingest_fd = -1;
+        return SIP_ERROR;
+    }
+    ingest_start = time(NULL);
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Receiving the CDRs on %s",
+            listen_s);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to stop using the buffer for the intervals, when the
+ *          source of the calls has failed. They are fetched from the CDR
+ *          database, until the source is resumed.
+ */
+void SipIngestSuspend()
+{
+    ingest_start = LONG_MAX;
+}
+
+/**
+ * \brief   Function to use the buffer again, after the source of the calls has
+ *          been restored. As after a restart, only the intervals which start
+ *          from now on are covered by it.
+ */
+void SipIngestResume()
+{
+    ingest_start = time(NULL);
+}
+
+/**
+ * \brief   Function to check whether the CDRs are received by the listener.
+ */
+int SipIngestEnabled()
+{
+    return ingest_start > 0;
+}
+
+/**
+ * \brief   Function to check whether the calls of the interval starting at the
+ *          given time are all in the buffer. The intervals which have started
+ *          before the listener, are fetched from the CDR database.
+ */
+int SipIngestCovers(time_t from)
+{
+    return ingest_start > 0 && from >= ingest_start;
+}
+
+/**
+ * \brief   Function to get the time, at which the interval ending at the given
+ *          time can be scored. The late calls are waited for the grace seconds.
+ */
+time_t SipIngestReadyAt(time_t end)
+{
+    return end + (time_t)grace;
+}
+
+/**
+ * \brief   Function to set the open interval, of which the calls are summed up
+ *          as they are received, for the early warning. The calls already in
+ *          the buffer are counted in.
+ *
+ * @param from  start of the interval
+ * @param to    end of the interval, which is included like in SipIngestResult
+ */
+void SipIngestWindow(time_t from, time_t to)
+{
+    uint64_t i = 0;
+
+    memset(win_num, 0, sizeof(win_num));
+    memset(win_dur, 0, sizeof(win_dur));
+    win_changed = 0;
+
+    /* an empty window, to which no call belongs */
+    win_from = 1;
+    win_to = 0;
+    if (ingest_start == 0 || !early_warning)
+        return;
+
+    win_from = from;
+    win_to = to;
+    for (i = 0; i < cdr_cnt; i++) {
+        if (cdrs[i].calldate >= from && cdrs[i].calldate <= to) {
+            win_num[cdrs[i].calltype]++;
+            win_dur[cdrs[i].calltype] += cdrs[i].billsec;
+            win_changed = 1;
+        }
+    }
+}
+
+/**
+ * \brief   Function to build the result of the interval query from the buffer,
+ *          with the same columns and rows as SipGetQuery would fetch from the
+ *          CDR database. Like its "between", both the ends of the interval
+ *          are included. The calls before the end of the interval are removed
+ *          from the buffer, the calls which arrive for it later are late.
+ *
+ * @param from          start of the interval
+ * @param to            end of the interval
+ * @param accountcode   institution of the calls
+ * @param calltypes     bit mask of the calltypes, which are fetched
+ *
+ * @return the result on success and NULL on failure
+ */
+PGresult *SipIngestResult(time_t from, time_t to, const char *accountcode,
+        uint8_t calltypes)
+{
+    PGresult *res = NULL;
+    PGresAttDesc attrs[7];
+    const char *names[7] = { "id", "calldate", "src", "dst", "billsec",
+                             "calltype", "accountcode" };
+    SipIngestCdr *cdr = NULL;
+    struct tm tm;
+    char calldate[20];
+    char billsec[16];
+    time_t calldate_sec = -1;
+    uint64_t full = 0;
+    uint64_t kept = 0;
+    uint64_t i = 0;
+    int acc_len = strlen(accountcode);
+    int row = 0;
+    int ok = 1;
+    uint8_t col = 0;
+
+    res = PQmakeEmptyPGresult(NULL, PGRES_TUPLES_OK);
+    if (res == NULL)
+        return NULL;
+
+    memset(attrs, 0, sizeof(attrs));
+    for (col = 0; col < 7; col++) {
+        attrs[col].name = (char *)names[col];
+        attrs[col].typid = 25; /* text */
+        attrs[col].typlen = -1;
+        attrs[col].atttypmod = -1;
+    }
+    if (PQsetResultAttrs(res, 7, attrs) == 0)
+        goto error;
+
+    for (i = 0; i < cdr_cnt && ok; i++) {
+        cdr = &cdrs[i];
+        if (cdr->calldate < from || cdr->calldate > to ||
+                !(calltypes & (1 << cdr->calltype)))
+        {
+            continue;
+        }
+
+        if (cdr->calldate != calldate_sec) {
+            localtime_r(&cdr->calldate, &tm);
+            strftime(calldate, sizeof(calldate), "%F %T", &tm);
+            calldate_sec = cdr->calldate;
+        }
+
+        /* the values are copied, a length of -1 sets the id to null */
+        ok = PQsetvalue(res, row, 0, cdr->id,
+                (cdr->id[0] != '\0') ? (int)strlen(cdr->id) : -1);
+        ok = ok && PQsetvalue(res, row, 1, calldate, 19);
+        ok = ok && PQsetvalue(res, row, 2, cdr->src, strlen(cdr->src));
+        ok = ok && PQsetvalue(res, row, 3, cdr->dst, strlen(cdr->dst));
+        ok = ok && PQsetvalue(res, row, 4, billsec,
+                snprintf(billsec, sizeof(billsec), "%"PRIu32, cdr->billsec));
+        ok = ok && PQsetvalue(res, row, 5,
+                (char *)calltype_names[cdr->calltype],
+                strlen(calltype_names[cdr->calltype]));
+        ok = ok && PQsetvalue(res, row, 6, (char *)accountcode, acc_len);
+        row++;
+    }
+
+    /* The call at the end belongs to the next interval as well */
+    for (i = 0; i < cdr_cnt && ok; i++) {
+        if (cdrs[i].calldate >= to)
+            cdrs[kept++] = cdrs[i];
+    }
+    if (ok) {
+        cdr_cnt = kept;
+        watermark = to;
+    }
+    full = dropped;
+    dropped = 0;
+
+    if (!ok)
+        goto error;
+
+    if (full > 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Dropped %"PRIu64" received"
+                " CDRs, the ingest buffer of %"PRIu64" calls is full", full,
+                max_cdrs);
+    }
+
+    return res;
+
+error:
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating the memory");
+    PQclear(res);
+    return NULL;
+}
+
+/**
+ * \brief   Function to close the listener and to free the memory of the ingest
+ *          module.
+ */
+void SipIngestDeInit()
+{
+    SipReplDeInit();
+    ingest_start = 0;
+
+    if (ingest_fd >= 0) {
+        SipReactorDel(ingest_fd);
+        close(ingest_fd);
+        ingest_fd = -1;
+    }
+
+    if (unix_path != NULL) {
+        unlink(unix_path);
+        free(unix_path);
+        unix_path = NULL;
+    }
+
+    if (institution != NULL) {
+        free(institution);
+        institution = NULL;
+    }
+
+    if (dgram != NULL) {
+        free(dgram);
+        dgram = NULL;
+    }
+
+    if (cdrs != NULL) {
+        free(cdrs);
+        cdrs = NULL;
+    }
+    cdr_cnt = cdr_size = 0;
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-ingest.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ */
+
+#ifndef _UTIL_INGEST_H
+#define	_UTIL_INGEST_H
+
+#include <time.h>
+#include <inttypes.h>
+
+#define SIP_INGEST_DEFAULT_LISTEN   "unix:/var/run/sipade/cdr.sock"
+#define SIP_INGEST_DEFAULT_GRACE    2           /* seconds */
+#define SIP_INGEST_DEFAULT_MAX_CDRS 1000000
+
+/* Size of the largest datagram and of the socket receive buffer */
+#define SIP_INGEST_DGRAM_SIZE       65536
+#define SIP_INGEST_RCVBUF           (4 * 1024 * 1024)
+
+/* Number of the datagrams, which are received at once */
+#define SIP_INGEST_MAX_DGRAMS       64
+
+/* Number of the parsed CDRs, which are added to the buffer at once */
+#define SIP_INGEST_BATCH            256
+
+/* Longest id and number of a received CDR */
+#define SIP_INGEST_ID_LEN           32
+#define SIP_INGEST_NUMBER_LEN       40
+
+/**
+ * CDR received by the ingest listener, of the monitored institution.
+ */
+typedef struct SipIngestCdr_ {
+    time_t calldate;
+    uint32_t billsec;
+    uint8_t calltype;       /* INTERNATIONAL, MOBILE, ... */
+    char id[SIP_INGEST_ID_LEN];
+    char src[SIP_INGEST_NUMBER_LEN];
+    char dst[SIP_INGEST_NUMBER_LEN];
+} SipIngestCdr;
+
+int SipIngestInit();
+void SipIngestDeInit();
+int SipIngestEnabled();
+int SipIngestCovers(time_t);
+time_t SipIngestReadyAt(time_t);
+void SipIngestWindow(time_t, time_t);
+int SipIngestRow(char **);
+void SipIngestCommit();
+void SipIngestSuspend();
+void SipIngestResume();
+PGresult *SipIngestResult(time_t, time_t, const char *, uint8_t);
+
+#endif	/* _UTIL_INGEST_H */
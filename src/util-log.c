@@ -29,12 +29,90 @@
 
 int log_level = SIP_LOG_ERROR;
 
+/* Ring of formatted messages, drained by the log writer thread */
+static SipLogSlot *ring = NULL;
+static uint32_t enqueue_pos = 0;
+static uint32_t dequeue_pos = 0;
+static pthread_t writer;
+static sem_t writer_sem;
+static int writer_sleeping = 0;
+static volatile int writer_stop = 0;
+static int writer_running = 0;
+
+/* Formatted timestamp of the current second, per thread */
+static __thread time_t cached_sec = 0;
+static __thread char cached_ts[32];
+static __thread int cached_len = 0;
+
+/**
+ * \brief   Function to write the given message to the output of its level.
+ */
+static void SipLogWrite(uint8_t level, const char *msg, uint16_t len)
+{
+    if (level == SIP_LOG_ERROR) {
+        fwrite(msg, 1, len, stderr);
+    } else {
+        fwrite(msg, 1, len, stdout);
+    }
+}
+
+/**
+ * \brief   The log writer thread, it writes the messages from the log ring to
+ *          the output, so that the logging threads never wait for the output.
+ */
+static void *SipLogWriter(void *arg)
+{
+    SipLogSlot *slot = NULL;
+    uint32_t seq = 0;
+    uint32_t cnt = 0;
+
+    while (1) {
+        slot = &ring[dequeue_pos & (SIP_LOG_RING_SIZE - 1)];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq == dequeue_pos + 1) {
+            SipLogWrite(slot->level, slot->msg, slot->len);
+            __atomic_store_n(&slot->seq, dequeue_pos + SIP_LOG_RING_SIZE,
+                    __ATOMIC_RELEASE);
+            dequeue_pos++;
+            cnt++;
+            continue;
+        }
+
+        /* The ring is empty */
+        if (cnt > 0) {
+            fflush(stdout);
+            fflush(stderr);
+            cnt = 0;
+        }
+
+        if (writer_stop)
+            break;
+
+        /* Announce that we are going to sleep and check the ring once more,
+         * the producers wake us up only when we have announced it */
+        __atomic_store_n(&writer_sleeping, 1, __ATOMIC_SEQ_CST);
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST);
+        if (seq == dequeue_pos + 1 || writer_stop) {
+            __atomic_store_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        sem_wait(&writer_sem);
+    }
+
+    return NULL;
+}
+
 /**
- * \brief   Function intialize the log level from the config file
+ * \brief   Function intialize the log level from the config file and to start
+ *          the log writer thread, unless synchronous logging is configured.
  */
 void SipInitLog()
 {
     char *mode = NULL;
+    int async = 1;
+    uint32_t i = 0;
+
     if ((SipConfGet("logging-mode", &mode)) == 1) {
         /* check the logging mode given in the config file */
         if (strcmp(mode, "error") == 0) {
@@ -45,61 +123,197 @@ void SipInitLog()
             log_level = SIP_LOG_DEBUG;
         }
     }
+
+    if (SipConfGetBool("logging-async", &async) == 1 && !async)
+        return;
+
+    if (writer_running)
+        return;
+
+    ring = calloc(SIP_LOG_RING_SIZE, sizeof(SipLogSlot));
+    if (ring == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating the"
+                " memory for the log ring, logging synchronously");
+        return;
+    }
+
+    for (i = 0; i < SIP_LOG_RING_SIZE; i++)
+        ring[i].seq = i;
+
+    sem_init(&writer_sem, 0, 0);
+    writer_stop = 0;
+    if (pthread_create(&writer, NULL, SipLogWriter, NULL) != 0) {
+        free(ring);
+        ring = NULL;
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in starting the log"
+                " writer thread, logging synchronously");
+        return;
+    }
+    __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+
+    /* make sure the queued messages are written, however we exit */
+    atexit(SipDeInitLog);
 }
 
 /**
- * \brief   Function to log the given message with the privded log level to the
- *          given file
- *
- * @param level     log level to which the given message belongs
- * @param filename  pointer to the filename from which the message is going
- *                  to be logged
- * @param line      line number in the given file, from where the message has
- *                  originated
- * @param fmt       pointer format string to print the given message
+ * \brief   Function to stop the log writer thread, after it has written all
+ *          the queued messages. Further messages are written synchronously.
  */
-void SipLog(int level, char *filename, int line, const char *fmt, ...)
+void SipDeInitLog()
 {
-    if ((log_level > level) || (log_level == 0))
+    if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE))
         return;
 
-    char buf[1024];
-    va_list args;
-    struct timeval tval;
-    struct tm *tms = NULL;
-    gettimeofday(&tval, NULL);
-    tms = localtime(&tval.tv_sec);
-    char temp[30];
-    snprintf(temp, 30, "%d/%d/%04d -- %02d:%02d:%02d",tms->tm_mday, tms->tm_mon
-            + 1, tms->tm_year + 1900, tms->tm_hour, tms->tm_min, tms->tm_sec);
+    writer_stop = 1;
+    sem_post(&writer_sem);
+    pthread_join(writer, NULL);
+    __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+    sem_destroy(&writer_sem);
 
-    va_start(args, fmt);
+    fflush(stdout);
+    fflush(stderr);
+}
 
-    int r = vsnprintf(buf, 1023, fmt, args);
+/**
+ * \brief   Function to get the formatted timestamp of the current second. It
+ *          is formatted only once per second and thread.
+ *
+ * @param len   pointer in which the length of the timestamp is returned
+ *
+ * @return  pointer to the formatted timestamp
+ */
+static const char *SipLogTimeStamp(int *len)
+{
+    time_t now = time(NULL);
+    struct tm tms;
 
-    if (r < 0) {
-        snprintf(buf, 1024, "[vnsprintf returned error %d]", r);
+    if (now != cached_sec || cached_len == 0) {
+        localtime_r(&now, &tms);
+        cached_len = snprintf(cached_ts, sizeof(cached_ts), "[%d/%d/%04d --"
+                " %02d:%02d:%02d]", tms.tm_mday, tms.tm_mon + 1,
+                tms.tm_year + 1900, tms.tm_hour, tms.tm_min, tms.tm_sec);
+        if (cached_len >= (int)sizeof(cached_ts))
+            cached_len = sizeof(cached_ts) - 1;
+        cached_sec = now;
     }
 
-    /* Indicate overflow with a '+' at the end */
-    if (r > 1023) {
-        buf[1022] = '+';
-        buf[1023] = '\0';
-    }
+    *len = cached_len;
+    return cached_ts;
+}
+
+/**
+ * \brief   Function to format the message in to the given buffer.
+ *
+ * @return  length of the formatted message including the new line
+ */
+static uint16_t SipLogFormat(char *buf, int level, char *filename, int line,
+        const char *fmt, va_list args)
+{
+    const char *ts = NULL;
+    int ts_len = 0;
+    int len = 0;
+    int r = 0;
+    int size = SIP_LOG_MSG_LEN - 1; /* keep place for the new line */
+
+    ts = SipLogTimeStamp(&ts_len);
+    memcpy(buf, ts, ts_len);
+    len = ts_len;
 
     switch(level) {
         case SIP_LOG_INFO:
-            fprintf(stdout, "[%s] <INFO> %s\n", temp, buf);
+            len += snprintf(buf + len, size - len, " <INFO> ");
             break;
         case SIP_LOG_DEBUG:
-            fprintf(stdout, "[%s] <DEBUG> [%s:%d] %s\n", temp, filename, line,
-                    buf);
+            len += snprintf(buf + len, size - len, " <DEBUG> [%s:%d] ",
+                    filename, line);
             break;
-        case SIP_LOG_ERROR:
-            fprintf(stderr, "[%s] <ERROR> [%s:%d] %s\n", temp, filename, line,
-                    buf);
+        default:
+            len += snprintf(buf + len, size - len, " <ERROR> [%s:%d] ",
+                    filename, line);
             break;
     }
+    if (len > size - 1)
+        len = size - 1;
+
+    r = vsnprintf(buf + len, size - len, fmt, args);
+    if (r < 0) {
+        r = snprintf(buf + len, size - len, "[vnsprintf returned error %d]", r);
+    }
+
+    /* Indicate overflow with a '+' at the end */
+    if (r >= size - len) {
+        len = size;
+        buf[len - 1] = '+';
+    } else {
+        len += r;
+    }
+    buf[len++] = '\n';
+
+    return len;
+}
+
+/**
+ * \brief   Function to log the given message with the privded log level to the
+ *          given file. The message is formatted in to a free slot of the log
+ *          ring and written by the log writer thread. If the writer is not
+ *          running or the ring is full, the message is written directly.
+ *          Use the SipLog() macro, which filters on the log level before the
+ *          arguments are evaluated.
+ *
+ * @param level     log level to which the given message belongs
+ * @param filename  pointer to the filename from which the message is going
+ *                  to be logged
+ * @param line      line number in the given file, from where the message has
+ *                  originated
+ * @param fmt       pointer format string to print the given message
+ */
+void SipLogMessage(int level, char *filename, int line, const char *fmt, ...)
+{
+    SipLogSlot *slot = NULL;
+    uint32_t pos = 0;
+    uint32_t seq = 0;
+    va_list args;
+    char buf[SIP_LOG_MSG_LEN];
+    uint16_t len = 0;
+
+    va_start(args, fmt);
+
+    if (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        while (1) {
+            slot = &ring[pos & (SIP_LOG_RING_SIZE - 1)];
+            seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq == pos) {
+                /* the slot is free, claim it */
+                if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 0,
+                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    break;
+                }
+            } else if ((int32_t)(seq - pos) < 0) {
+                /* the ring is full */
+                slot = NULL;
+                break;
+            } else {
+                pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+            }
+        }
+
+        if (slot != NULL) {
+            slot->level = level;
+            slot->len = SipLogFormat(slot->msg, level, filename, line, fmt,
+                    args);
+            __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            va_end(args);
+
+            if (__atomic_exchange_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST))
+                sem_post(&writer_sem);
+            return;
+        }
+    }
 
+    len = SipLogFormat(buf, level, filename, line, fmt, args);
+    SipLogWrite(level, buf, len);
     va_end(args);
 }
@@ -28,6 +28,8 @@
 #define	_UTIL_LOG_H
 
 #include <stdarg.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #define SIP_LOG_LOCATION    __FILE__,__LINE__
 
@@ -35,8 +37,40 @@
 #define SIP_LOG_INFO    2
 #define SIP_LOG_ERROR   3
 
+/* Number of messages the log ring can hold, has to be a power of two */
+#define SIP_LOG_RING_SIZE   1024
+#define SIP_LOG_MSG_LEN     1200
+
+/* The debug messages can be compiled out, then their arguments are not even
+ * evaluated (make NODEBUGLOG=y) */
+#ifdef SIP_LOG_DISABLE_DEBUG
+#define SIP_LOG_COMPILED(level) ((level) != SIP_LOG_DEBUG)
+#else
+#define SIP_LOG_COMPILED(level) 1
+#endif
+
+/**
+ * Slot of the log ring. The sequence tells whether the slot is free for the
+ * producers or holds a message for the writer thread.
+ */
+typedef struct SipLogSlot_ {
+    uint32_t seq;
+    uint8_t level;
+    uint16_t len;
+    char msg[SIP_LOG_MSG_LEN];
+} SipLogSlot;
+
+extern int log_level;
+
+#define SipLog(level, ...) do { \
+        if (SIP_LOG_COMPILED(level) && log_level != 0 && \
+                (level) >= log_level) \
+            SipLogMessage((level), __VA_ARGS__); \
+    } while (0)
+
 void SipInitLog();
-void SipLog(int , char *, int , const char *, ...);
+void SipDeInitLog();
+void SipLogMessage(int , char *, int , const char *, ...);
 
 #endif	/* _UTIL_LOG_H */
 
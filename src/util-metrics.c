@@ -0,0 +1,674 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-metrics.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Metrics of the engine in the Prometheus text format. The metrics are
+ * recorded with atomic operations from any thread and are served over HTTP
+ * by a small server thread, either on a local TCP port or on a Unix socket
+ * ("unix:/path/to/socket").
+ */
+
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "sipade.h"
+#include "util-metrics.h"
+#include "util-alert.h"
+#include "util-log.h"
+#include "util-conf.h"
+
+/* Upper bounds of the latency buckets in seconds, the last one is +Inf */
+static const double buckets[SIP_METRIC_BUCKETS - 1] = { 0.0005, 0.001,
+    0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0 };
+
+static const char *stmt_names[SIP_METRIC_STMT_MAX] = { "interval", "init",
+    "restore", "threshold", "alert", "probe", "concurrency" };
+
+static const char *stage_names[SIP_METRIC_STAGE_MAX] = { "fetch",
+    "aggregate", "score", "persist", "alert" };
+
+static const char *ingest_names[SIP_METRIC_INGEST_MAX] = { "accepted",
+    "ignored", "late", "dropped", "malformed" };
+
+static uint64_t cdr_rows = 0;
+static uint64_t intervals = 0;
+static uint64_t alerts = 0;
+static uint64_t idle_intervals = 0;
+static uint64_t ingest_cdrs[SIP_METRIC_INGEST_MAX];
+static SipHistogram query_hist[SIP_METRIC_STMT_MAX];
+static uint64_t query_timeouts[SIP_METRIC_STMT_MAX];
+static SipHistogram stage_hist[SIP_METRIC_STAGE_MAX];
+
+static pthread_mutex_t tenant_lock = PTHREAD_MUTEX_INITIALIZER;
+static TAILQ_HEAD(, SipMetricsTenant_) tenants =
+    TAILQ_HEAD_INITIALIZER(tenants);
+
+static int listen_fd = -1;
+static char *unix_path = NULL;
+static pthread_t server;
+static int server_running = 0;
+
+/**
+ * \brief   Function to record the given duration in the histogram.
+ */
+static void SipHistogramObserve(SipHistogram *hist, double seconds)
+{
+    uint8_t i = 0;
+
+    while (i < SIP_METRIC_BUCKETS - 1 && seconds > buckets[i])
+        i++;
+
+    __atomic_add_fetch(&hist->bucket[i], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->sum_usec, (uint64_t)(seconds * 1e6),
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+}
+
+void SipMetricsAddRows(uint64_t rows)
+{
+    __atomic_add_fetch(&cdr_rows, rows, __ATOMIC_RELAXED);
+}
+
+void SipMetricsIncIntervals()
+{
+    __atomic_add_fetch(&intervals, 1, __ATOMIC_RELAXED);
+}
+
+void SipMetricsIncAlerts()
+{
+    __atomic_add_fetch(&alerts, 1, __ATOMIC_RELAXED);
+}
+
+void SipMetricsIncIdle()
+{
+    __atomic_add_fetch(&idle_intervals, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to count the CDRs received by the ingest listener.
+ *
+ * @param status    outcome, one of the SIP_METRIC_INGEST_* values
+ * @param cnt       number of the CDRs
+ */
+void SipMetricsAddIngest(int status, uint64_t cnt)
+{
+    if (cnt > 0 && status >= 0 && status < SIP_METRIC_INGEST_MAX)
+        __atomic_add_fetch(&ingest_cdrs[status], cnt, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to record the latency of a database statement.
+ *
+ * @param stmt      statement, one of the SIP_METRIC_STMT_* values
+ * @param seconds   duration of the statement
+ */
+void SipMetricsObserveQuery(int stmt, double seconds)
+{
+    if (stmt >= 0 && stmt < SIP_METRIC_STMT_MAX)
+        SipHistogramObserve(&query_hist[stmt], seconds);
+}
+
+/**
+ * \brief   Function to get the number of the database statements of the given
+ *          kind, which have been made so far.
+ *
+ * @param stmt      statement, one of the SIP_METRIC_STMT_* values
+ */
+uint64_t SipMetricsQueries(int stmt)
+{
+    if (stmt < 0 || stmt >= SIP_METRIC_STMT_MAX)
+        return 0;
+
+    return __atomic_load_n(&query_hist[stmt].count, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to count a database statement, which has been cancelled
+ *          as it has taken too long.
+ *
+ * @param stmt      statement, one of the SIP_METRIC_STMT_* values
+ */
+void SipMetricsIncTimeout(int stmt)
+{
+    if (stmt >= 0 && stmt < SIP_METRIC_STMT_MAX)
+        __atomic_add_fetch(&query_timeouts[stmt], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to record the time spent in a stage of the interval.
+ *
+ * @param stage     stage, one of the SIP_METRIC_STAGE_* values
+ * @param seconds   duration of the stage
+ */
+void SipMetricsObserveStage(int stage, double seconds)
+{
+    if (stage >= 0 && stage < SIP_METRIC_STAGE_MAX)
+        SipHistogramObserve(&stage_hist[stage], seconds);
+}
+
+/**
+ * \brief   Function to get the metrics of the given tenant, they are created
+ *          on the first lookup. The tenant lock has to be held.
+ */
+static SipMetricsTenant *SipMetricsGetTenant(const char *name)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        if (strcmp(tenant->name, name) == 0)
+            return tenant;
+    }
+
+    tenant = calloc(1, sizeof(SipMetricsTenant));
+    if (tenant == NULL)
+        return NULL;
+    tenant->name = strdup(name);
+    TAILQ_INSERT_TAIL(&tenants, tenant, next);
+
+    return tenant;
+}
+
+/**
+ * \brief   Function to report the distance of the last interval and the
+ *          current threshold of the tenant.
+ */
+void SipMetricsSetTenant(const char *name, double distance, double threshold)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    pthread_mutex_lock(&tenant_lock);
+    tenant = SipMetricsGetTenant(name);
+    if (tenant != NULL) {
+        tenant->distance = distance;
+        tenant->threshold = threshold;
+    }
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to report the lag between the wall clock and the end of
+ *          the last interval processed for the tenant.
+ */
+void SipMetricsSetLag(const char *name, double lag)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    pthread_mutex_lock(&tenant_lock);
+    tenant = SipMetricsGetTenant(name);
+    if (tenant != NULL)
+        tenant->lag = lag;
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to count a detection run of the tenant, which has started
+ *          after its deadline.
+ */
+void SipMetricsIncLate(const char *name)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    pthread_mutex_lock(&tenant_lock);
+    tenant = SipMetricsGetTenant(name);
+    if (tenant != NULL)
+        tenant->late++;
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to report, whether the backlog of the tenant is being
+ *          replayed after a downtime.
+ */
+void SipMetricsSetCatchUp(const char *name, uint8_t catchup)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    pthread_mutex_lock(&tenant_lock);
+    tenant = SipMetricsGetTenant(name);
+    if (tenant != NULL)
+        tenant->catchup = catchup;
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to report the distance, which is projected for the open
+ *          interval of the tenant from the calls received so far.
+ */
+void SipMetricsSetProjected(const char *name, double distance)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    pthread_mutex_lock(&tenant_lock);
+    tenant = SipMetricsGetTenant(name);
+    if (tenant != NULL)
+        tenant->projected = distance;
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to report the length of the next interval of the tenant,
+ *          which is adapted to its traffic.
+ */
+void SipMetricsSetInterval(const char *name, double interval)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    pthread_mutex_lock(&tenant_lock);
+    tenant = SipMetricsGetTenant(name);
+    if (tenant != NULL)
+        tenant->interval = interval;
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to report the peak and the time weighted mean of the
+ *          concurrent calls of the last interval of the tenant, and the limit
+ *          of the peak.
+ */
+void SipMetricsSetConcurrency(const char *name, double peak, double mean,
+        double limit)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    pthread_mutex_lock(&tenant_lock);
+    tenant = SipMetricsGetTenant(name);
+    if (tenant != NULL) {
+        tenant->conc_peak = peak;
+        tenant->conc_mean = mean;
+        tenant->conc_limit = limit;
+    }
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to count a provisional alert of the tenant, raised before
+ *          the end of the interval.
+ */
+void SipMetricsIncWarnings(const char *name)
+{
+    SipMetricsTenant *tenant = NULL;
+
+    pthread_mutex_lock(&tenant_lock);
+    tenant = SipMetricsGetTenant(name);
+    if (tenant != NULL)
+        tenant->warnings++;
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to write the given histogram in the Prometheus format.
+ */
+static void SipMetricsWriteHistogram(FILE *fp, const char *name,
+        const char *label, const char *value, SipHistogram *hist)
+{
+    uint64_t cumulated = 0;
+    uint8_t i = 0;
+
+    for (i = 0; i < SIP_METRIC_BUCKETS; i++) {
+        cumulated += __atomic_load_n(&hist->bucket[i], __ATOMIC_RELAXED);
+        if (i < SIP_METRIC_BUCKETS - 1) {
+            fprintf(fp, "%s_bucket{%s=\"%s\",le=\"%g\"} %"PRIu64"\n", name,
+                    label, value, buckets[i], cumulated);
+        } else {
+            fprintf(fp, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %"PRIu64"\n", name,
+                    label, value, cumulated);
+        }
+    }
+    fprintf(fp, "%s_sum{%s=\"%s\"} %.6f\n", name, label, value,
+            __atomic_load_n(&hist->sum_usec, __ATOMIC_RELAXED) / 1e6);
+    fprintf(fp, "%s_count{%s=\"%s\"} %"PRIu64"\n", name, label, value,
+            __atomic_load_n(&hist->count, __ATOMIC_RELAXED));
+}
+
+/**
+ * \brief   Function to write all the metrics in the Prometheus text format.
+ */
+static void SipMetricsWrite(FILE *fp)
+{
+    SipMetricsTenant *tenant = NULL;
+    uint8_t i = 0;
+
+    fprintf(fp, "# HELP sipade_cdr_rows_fetched_total CDR rows fetched from"
+            " the cdr database.\n# TYPE sipade_cdr_rows_fetched_total counter\n"
+            "sipade_cdr_rows_fetched_total %"PRIu64"\n",
+            __atomic_load_n(&cdr_rows, __ATOMIC_RELAXED));
+    fprintf(fp, "# HELP sipade_intervals_total Intervals scored.\n"
+            "# TYPE sipade_intervals_total counter\n"
+            "sipade_intervals_total %"PRIu64"\n",
+            __atomic_load_n(&intervals, __ATOMIC_RELAXED));
+    fprintf(fp, "# HELP sipade_alerts_total Anomalous intervals.\n"
+            "# TYPE sipade_alerts_total counter\n"
+            "sipade_alerts_total %"PRIu64"\n",
+            __atomic_load_n(&alerts, __ATOMIC_RELAXED));
+    fprintf(fp, "# HELP sipade_idle_intervals_total Intervals without calls,"
+            " which have not been scored.\n"
+            "# TYPE sipade_idle_intervals_total counter\n"
+            "sipade_idle_intervals_total %"PRIu64"\n",
+            __atomic_load_n(&idle_intervals, __ATOMIC_RELAXED));
+
+    fprintf(fp, "# HELP sipade_ingest_cdrs_total CDRs received by the ingest"
+            " listener.\n# TYPE sipade_ingest_cdrs_total counter\n");
+    for (i = 0; i < SIP_METRIC_INGEST_MAX; i++) {
+        fprintf(fp, "sipade_ingest_cdrs_total{status=\"%s\"} %"PRIu64"\n",
+                ingest_names[i],
+                __atomic_load_n(&ingest_cdrs[i], __ATOMIC_RELAXED));
+    }
+
+    fprintf(fp, "# HELP sipade_query_duration_seconds Latency of the database"
+            " statements.\n# TYPE sipade_query_duration_seconds histogram\n");
+    for (i = 0; i < SIP_METRIC_STMT_MAX; i++) {
+        SipMetricsWriteHistogram(fp, "sipade_query_duration_seconds",
+                "statement", stmt_names[i], &query_hist[i]);
+    }
+
+    fprintf(fp, "# HELP sipade_query_timeouts_total Database statements"
+            " cancelled, as they have taken too long.\n"
+            "# TYPE sipade_query_timeouts_total counter\n");
+    for (i = 0; i < SIP_METRIC_STMT_MAX; i++) {
+        fprintf(fp, "sipade_query_timeouts_total{statement=\"%s\"} %"PRIu64
+                "\n", stmt_names[i],
+                __atomic_load_n(&query_timeouts[i], __ATOMIC_RELAXED));
+    }
+
+    fprintf(fp, "# HELP sipade_stage_duration_seconds Time spent in each"
+            " stage of an interval.\n"
+            "# TYPE sipade_stage_duration_seconds histogram\n");
+    for (i = 0; i < SIP_METRIC_STAGE_MAX; i++) {
+        SipMetricsWriteHistogram(fp, "sipade_stage_duration_seconds",
+                "stage", stage_names[i], &stage_hist[i]);
+    }
+
+    fprintf(fp, "# HELP sipade_alert_queue_depth Events waiting for the"
+            " alert dispatcher.\n# TYPE sipade_alert_queue_depth gauge\n"
+            "sipade_alert_queue_depth %"PRIu32"\n", SipAlertQueueDepth());
+    fprintf(fp, "# HELP sipade_alert_sink_backlog Events waiting for an"
+            " alert sink.\n# TYPE sipade_alert_sink_backlog gauge\n");
+    for (i = 0; i < SIP_ALERT_SINK_MAX; i++) {
+        fprintf(fp, "sipade_alert_sink_backlog{sink=\"%s\"} %"PRIu32"\n",
+                SipAlertSinkName(i), SipAlertSinkBacklog(i));
+    }
+
+    pthread_mutex_lock(&tenant_lock);
+    fprintf(fp, "# HELP sipade_distance Hellinger distance of the last"
+            " interval.\n# TYPE sipade_distance gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_distance{tenant=\"%s\"} %f\n", tenant->name,
+                tenant->distance);
+    }
+    fprintf(fp, "# HELP sipade_threshold Current detection threshold.\n"
+            "# TYPE sipade_threshold gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_threshold{tenant=\"%s\"} %f\n", tenant->name,
+                tenant->threshold);
+    }
+    fprintf(fp, "# HELP sipade_event_lag_seconds Wall time minus the end of"
+            " the last processed interval.\n"
+            "# TYPE sipade_event_lag_seconds gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_event_lag_seconds{tenant=\"%s\"} %.0f\n",
+                tenant->name, tenant->lag);
+    }
+    fprintf(fp, "# HELP sipade_catchup Whether the backlog of the intervals"
+            " is being replayed.\n# TYPE sipade_catchup gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_catchup{tenant=\"%s\"} %"PRIu8"\n", tenant->name,
+                tenant->catchup);
+    }
+    fprintf(fp, "# HELP sipade_schedule_late_total Detection runs started"
+            " after their deadline.\n"
+            "# TYPE sipade_schedule_late_total counter\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_schedule_late_total{tenant=\"%s\"} %"PRIu64"\n",
+                tenant->name, tenant->late);
+    }
+    fprintf(fp, "# HELP sipade_projected_distance Hellinger distance"
+            " projected for the open interval.\n"
+            "# TYPE sipade_projected_distance gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_projected_distance{tenant=\"%s\"} %f\n",
+                tenant->name, tenant->projected);
+    }
+    fprintf(fp, "# HELP sipade_early_warnings_total Provisional alerts raised"
+            " before the end of the interval.\n"
+            "# TYPE sipade_early_warnings_total counter\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_early_warnings_total{tenant=\"%s\"} %"PRIu64"\n",
+                tenant->name, tenant->warnings);
+    }
+    fprintf(fp, "# HELP sipade_interval_seconds Length of the next interval"
+            " of the detection.\n# TYPE sipade_interval_seconds gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_interval_seconds{tenant=\"%s\"} %.0f\n",
+                tenant->name, tenant->interval);
+    }
+    fprintf(fp, "# HELP sipade_concurrent_calls_peak Most calls in progress"
+            " at the same time in the last interval.\n"
+            "# TYPE sipade_concurrent_calls_peak gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_concurrent_calls_peak{tenant=\"%s\"} %.0f\n",
+                tenant->name, tenant->conc_peak);
+    }
+    fprintf(fp, "# HELP sipade_concurrent_calls_mean Time weighted mean of"
+            " the calls in progress in the last interval.\n"
+            "# TYPE sipade_concurrent_calls_mean gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_concurrent_calls_mean{tenant=\"%s\"} %f\n",
+                tenant->name, tenant->conc_mean);
+    }
+    fprintf(fp, "# HELP sipade_concurrent_calls_limit Peak of the concurrent"
+            " calls above which an interval is anomalous.\n"
+            "# TYPE sipade_concurrent_calls_limit gauge\n");
+    TAILQ_FOREACH(tenant, &tenants, next) {
+        fprintf(fp, "sipade_concurrent_calls_limit{tenant=\"%s\"} %f\n",
+                tenant->name, tenant->conc_limit);
+    }
+    pthread_mutex_unlock(&tenant_lock);
+}
+
+/**
+ * \brief   Function to answer a HTTP request on the given connection with the
+ *          current metrics.
+ */
+static void SipMetricsServe(int fd)
+{
+    char req[1024];
+    char header[160];
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *fp = NULL;
+    struct timeval tv = { 2, 0 };
+
+    /* We do not care about the request, but do not let a client hang us */
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (recv(fd, req, sizeof(req), 0) <= 0)
+        return;
+
+    fp = open_memstream(&body, &body_len);
+    if (fp == NULL)
+        return;
+    SipMetricsWrite(fp);
+    fclose(fp);
+
+    snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: "
+            "text/plain; version=0.0.4\r\nContent-Length: %zu\r\n"
+            "Connection: close\r\n\r\n", body_len);
+    if (send(fd, header, strlen(header), MSG_NOSIGNAL) > 0)
+        send(fd, body, body_len, MSG_NOSIGNAL);
+    free(body);
+}
+
+/**
+ * \brief   The metrics server thread. It serves the requests one by one, until
+ *          the listening socket is shut down.
+ */
+static void *SipMetricsServer(void *arg)
+{
+    int fd = -1;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0 ||
+            errno == EINTR || errno == ECONNABORTED)
+    {
+        if (fd < 0)
+            continue;
+        SipMetricsServe(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief   Function to open the listening socket for the given address, which
+ *          is either "host:port" or "unix:/path".
+ *
+ * @return  socket descriptor or -1 on failure
+ */
+static int SipMetricsListen(const char *listen_s)
+{
+    struct sockaddr_in sin;
+    struct sockaddr_un sun;
+    char host[64];
+    char *port = NULL;
+    int fd = -1;
+    int on = 1;
+
+    if (strncmp(listen_s, "unix:", 5) == 0) {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strncpy(sun.sun_path, listen_s + 5, sizeof(sun.sun_path) - 1);
+        unix_path = strdup(sun.sun_path);
+        unlink(unix_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+            goto fail;
+    } else {
+        strncpy(host, listen_s, sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+        port = strrchr(host, ':');
+        if (port == NULL) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Invalid metrics listen"
+                    " address \"%s\"", listen_s);
+            return -1;
+        }
+        *port++ = '\0';
+
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(atoi(port));
+        if (inet_pton(AF_INET, host, &sin.sin_addr) != 1) {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Invalid metrics listen"
+                    " address \"%s\"", listen_s);
+            return -1;
+        }
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            goto fail;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+            goto fail;
+    }
+
+    if (listen(fd, 8) < 0)
+        goto fail;
+
+    return fd;
+
+fail:
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in listening on \"%s\""
+            " for the metrics: %s", listen_s, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+/**
+ * \brief   Function to initialize the metrics module and to start the metrics
+ *          server, if it has been enabled in the config file.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+int SipMetricsInit()
+{
+    int enabled = 0;
+    char *listen_s = NULL;
+
+    if (SipConfGetBool("metrics.enabled", &enabled) != 1 || !enabled)
+        return SIP_OK;
+
+    if (SipConfGet("metrics.listen", &listen_s) != 1)
+        listen_s = SIP_METRICS_DEFAULT_LISTEN;
+
+    listen_fd = SipMetricsListen(listen_s);
+    if (listen_fd < 0)
+        return SIP_ERROR;
+
+    if (pthread_create(&server, NULL, SipMetricsServer, NULL) != 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in starting the"
+                " metrics server thread");
+        close(listen_fd);
+        listen_fd = -1;
+        return SIP_ERROR;
+    }
+    server_running = 1;
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Serving the metrics on %s",
+            listen_s);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to stop the metrics server and to free the memory of the
+ *          metrics module.
+ */
+void SipMetricsDeInit()
+{
+    SipMetricsTenant *tenant = NULL;
+
+    if (server_running) {
+        shutdown(listen_fd, SHUT_RDWR);
+        pthread_join(server, NULL);
+        server_running = 0;
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+
+    if (unix_path != NULL) {
+        unlink(unix_path);
+        free(unix_path);
+        unix_path = NULL;
+    }
+
+    pthread_mutex_lock(&tenant_lock);
+    while ((tenant = TAILQ_FIRST(&tenants)) != NULL) {
+        TAILQ_REMOVE(&tenants, tenant, next);
+        free(tenant->name);
+        free(tenant);
+    }
+    pthread_mutex_unlock(&tenant_lock);
+}
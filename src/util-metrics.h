@@ -0,0 +1,123 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-metrics.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ */
+
+#ifndef _UTIL_METRICS_H
+#define	_UTIL_METRICS_H
+
+#include <inttypes.h>
+#include <pthread.h>
+#include "queue.h"
+
+#define SIP_METRICS_DEFAULT_LISTEN  "127.0.0.1:9187"
+
+/* Statements of which the latency is measured */
+enum {
+    SIP_METRIC_STMT_INTERVAL = 0,   /* call data of an interval */
+    SIP_METRIC_STMT_INIT,           /* initial timestamp of the training */
+    SIP_METRIC_STMT_RESTORE,        /* restoring the threshold */
+    SIP_METRIC_STMT_THRESHOLD,      /* storing the threshold */
+    SIP_METRIC_STMT_ALERT,          /* logging the alert calls */
+    SIP_METRIC_STMT_PROBE,          /* new CDRs of an idle institution */
+    SIP_METRIC_STMT_CONCURRENCY,    /* calls in progress of an interval */
+
+    SIP_METRIC_STMT_MAX,    /* Keep it last always */
+};
+
+/* Stages of the processing of an interval */
+enum {
+    SIP_METRIC_STAGE_FETCH = 0,
+    SIP_METRIC_STAGE_AGGREGATE,
+    SIP_METRIC_STAGE_SCORE,
+    SIP_METRIC_STAGE_PERSIST,
+    SIP_METRIC_STAGE_ALERT,
+
+    SIP_METRIC_STAGE_MAX,   /* Keep it last always */
+};
+
+/* Outcome of the CDRs received by the ingest listener */
+enum {
+    SIP_METRIC_INGEST_ACCEPTED = 0,
+    SIP_METRIC_INGEST_IGNORED,      /* call of another institution */
+    SIP_METRIC_INGEST_LATE,         /* its interval has been scored */
+    SIP_METRIC_INGEST_DROPPED,      /* the buffer is full */
+    SIP_METRIC_INGEST_MALFORMED,
+
+    SIP_METRIC_INGEST_MAX,  /* Keep it last always */
+};
+
+/* Number of the latency histogram buckets including +Inf */
+#define SIP_METRIC_BUCKETS  15
+
+/**
+ * Latency histogram in the Prometheus format, the buckets are cumulated only
+ * when exposed.
+ */
+typedef struct SipHistogram_ {
+    uint64_t bucket[SIP_METRIC_BUCKETS];
+    uint64_t count;
+    uint64_t sum_usec;
+} SipHistogram;
+
+/**
+ * Detection state of a tenant, as last reported by the detection.
+ */
+typedef struct SipMetricsTenant_ {
+    char *name;
+    double distance;
+    double threshold;
+    double lag;
+    uint64_t late;      /* runs started after their deadline */
+    uint8_t catchup;    /* the backlog is being replayed */
+    double projected;   /* projected distance of the open interval */
+    uint64_t warnings;  /* provisional alerts of the open intervals */
+    double interval;    /* length of the next interval, in seconds */
+    double conc_peak;   /* concurrent calls of the last interval */
+    double conc_mean;
+    double conc_limit;  /* 0 while the baseline is warming up */
+
+    TAILQ_ENTRY(SipMetricsTenant_) next;
+} SipMetricsTenant;
+
+int SipMetricsInit();
+void SipMetricsDeInit();
+void SipMetricsAddRows(uint64_t);
+void SipMetricsIncIntervals();
+void SipMetricsIncAlerts();
+void SipMetricsIncIdle();
+void SipMetricsAddIngest(int, uint64_t);
+void SipMetricsObserveQuery(int, double);
+uint64_t SipMetricsQueries(int);
+void SipMetricsIncTimeout(int);
+void SipMetricsObserveStage(int, double);
+void SipMetricsSetTenant(const char *, double, double);
+void SipMetricsSetLag(const char *, double);
+void SipMetricsIncLate(const char *);
+void SipMetricsSetCatchUp(const char *, uint8_t);
+void SipMetricsSetProjected(const char *, double);
+void SipMetricsIncWarnings(const char *);
+void SipMetricsSetInterval(const char *, double);
+void SipMetricsSetConcurrency(const char *, double, double, double);
+
+#endif	/* _UTIL_METRICS_H */
+
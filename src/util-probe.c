@@ -0,0 +1,48 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+/*
+ * File:   util-probe.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Semaphores of the USDT probes. A tracer increments the semaphore of a probe
+ * while it is attached to it, so that the costly arguments of the probe are
+ * only computed then.
+ */
+
+#include "sipade.h"
+#include "util-probe.h"
+
+#ifdef HAVE_SYS_SDT_H
+
+#define SIP_PROBE_SEMAPHORE_DEFINE(name)                                    \
+    __extension__ unsigned short sipade_##name##_semaphore                  \
+    __attribute__((unused)) __attribute__((section(".probes")))
+
+SIP_PROBE_SEMAPHORE_DEFINE(interval__start);
+SIP_PROBE_SEMAPHORE_DEFINE(interval__done);
+SIP_PROBE_SEMAPHORE_DEFINE(query__start);
+SIP_PROBE_SEMAPHORE_DEFINE(query__done);
+SIP_PROBE_SEMAPHORE_DEFINE(cdr__aggregate);
+SIP_PROBE_SEMAPHORE_DEFINE(distance__computed);
+SIP_PROBE_SEMAPHORE_DEFINE(threshold__updated);
+SIP_PROBE_SEMAPHORE_DEFINE(alert__raised);
+
+#endif	/* HAVE_SYS_SDT_H */
@@ -0,0 +1,100 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-probe.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Static user space probes (USDT) of the engine, in the "sipade" provider.
+ * A probe is a single nop in the binary, until a tracer such as perf or
+ * bpftrace attaches to it, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/local/sbin/sipade:sipade:query__done
+ *                { @ns[arg0] = hist(arg2); }'
+ *
+ * The probes are built when <sys/sdt.h> (systemtap-sdt-dev) is available,
+ * otherwise they expand to nothing. Floating point values are passed as
+ * integers scaled by SIP_PROBE_SCALE. Each probe has a semaphore, which the
+ * tracer raises while it is attached, the arguments which take more than a
+ * load are only computed under SIP_PROBE_ENABLED().
+ *
+ * Probes and their arguments:
+ *   interval__start   (char *timestamp, int training)
+ *   interval__done    (char *timestamp, int anomaly)
+ *   query__start      (int stmt, char *query)
+ *   query__done       (int stmt, int rows, uint64_t ns)
+ *   cdr__aggregate    (int rows, uint64_t calls, uint64_t duration)
+ *   distance__computed(int64_t distance, int64_t threshold)
+ *   threshold__updated(int64_t threshold, int64_t distance,
+ *                      int64_t mean_deviation)
+ *   alert__raised     (char *institution, char *timestamp, int kind,
+ *                      uint64_t incident)
+ */
+
+#ifndef _UTIL_PROBE_H
+#define	_UTIL_PROBE_H
+
+#define SIP_PROBE_SCALE     1000000.0
+#define SIP_PROBE_FIXED(v)  ((int64_t)((v) * SIP_PROBE_SCALE))
+
+#ifdef HAVE_SYS_SDT_H
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* The semaphores are defined in util-probe.c */
+#define SIP_PROBE_SEMAPHORE(name)                                           \
+    __extension__ extern unsigned short sipade_##name##_semaphore           \
+    __attribute__((unused)) __attribute__((section(".probes")))
+
+SIP_PROBE_SEMAPHORE(interval__start);
+SIP_PROBE_SEMAPHORE(interval__done);
+SIP_PROBE_SEMAPHORE(query__start);
+SIP_PROBE_SEMAPHORE(query__done);
+SIP_PROBE_SEMAPHORE(cdr__aggregate);
+SIP_PROBE_SEMAPHORE(distance__computed);
+SIP_PROBE_SEMAPHORE(threshold__updated);
+SIP_PROBE_SEMAPHORE(alert__raised);
+
+#define SIP_PROBE_ENABLED(name)         \
+    __builtin_expect(sipade_##name##_semaphore != 0, 0)
+
+#define SIP_PROBE0(name)                DTRACE_PROBE(sipade, name)
+#define SIP_PROBE1(name, a)             DTRACE_PROBE1(sipade, name, a)
+#define SIP_PROBE2(name, a, b)          DTRACE_PROBE2(sipade, name, a, b)
+#define SIP_PROBE3(name, a, b, c)       DTRACE_PROBE3(sipade, name, a, b, c)
+#define SIP_PROBE4(name, a, b, c, d)    DTRACE_PROBE4(sipade, name, a, b, c, d)
+
+#else
+
+/* The arguments are not evaluated, only taken as used */
+#define SIP_PROBE_ENABLED(name)         0
+#define SIP_PROBE0(name)                do { } while (0)
+#define SIP_PROBE1(name, a)             do { (void)sizeof(a); } while (0)
+#define SIP_PROBE2(name, a, b)          \
+    do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define SIP_PROBE3(name, a, b, c)       \
+    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#define SIP_PROBE4(name, a, b, c, d)    \
+    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c);              \
+        (void)sizeof(d); } while (0)
+
+#endif	/* HAVE_SYS_SDT_H */
+
+#endif	/* _UTIL_PROBE_H */
+
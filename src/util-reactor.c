@@ -0,0 +1,399 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-reactor.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Event loop of the engine on epoll. The database and ingest sockets, the
+ * timers (timerfd) and the signals (signalfd) are all descriptors, whose
+ * handlers are called from the main thread when they are ready. The signals
+ * are blocked before any thread is started, so that they are only taken
+ * from the signalfd and never interrupt the engine.
+ */
+
+#include <errno.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "sipade.h"
+#include "util-reactor.h"
+#include "util-log.h"
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int running = 0;
+static int dispatching = 0;
+static SipReactorSignalFunc signal_func = NULL;
+
+static void SipReactorTimerFire(int, uint32_t, void *);
+
+static TAILQ_HEAD(, SipReactorHandler_) handlers =
+    TAILQ_HEAD_INITIALIZER(handlers);
+
+/**
+ * \brief   Function to take the pending signals from the signalfd and to pass
+ *          them to the signal function.
+ */
+static void SipReactorSignal(int fd, uint32_t events, void *data)
+{
+    struct signalfd_siginfo si;
+
+    while (read(fd, &si, sizeof(si)) == sizeof(si))
+        signal_func(si.ssi_signo);
+}
+
+/**
+ * \brief   Function to initialize the reactor. The given signals are blocked
+ *          and taken from a signalfd instead, it has to be called before any
+ *          thread is started, which would inherit the signal mask otherwise.
+ *
+ * @param signals   signals, which are handled by the reactor
+ * @param cnt       number of the signals
+ * @param func      function called with each received signal
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+int SipReactorInit(const int *signals, int cnt, SipReactorSignalFunc func)
+{
+    sigset_t mask;
+    int i = 0;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in creating the"
+                " event loop: %s", strerror(errno));
+        return SIP_ERROR;
+    }
+
+    sigemptyset(&mask);
+    for (i = 0; i < cnt; i++)
+        sigaddset(&mask, signals[i]);
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in blocking the"
+                " signals");
+        return SIP_ERROR;
+    }
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in creating the"
+                " signalfd: %s", strerror(errno));
+        return SIP_ERROR;
+    }
+
+    signal_func = func;
+    return SipReactorAdd(signal_fd, EPOLLIN, SipReactorSignal, NULL);
+}
+
+/**
+ * \brief   Function to watch the descriptor for the given events.
+ *
+ * @param fd        descriptor to watch
+ * @param events    epoll events, e.g. EPOLLIN
+ * @param func      function called, when the descriptor is ready
+ * @param data      pointer passed to the function
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+int SipReactorAdd(int fd, uint32_t events, SipReactorFunc func, void *data)
+{
+    SipReactorHandler *h = NULL;
+    struct epoll_event ev;
+
+    h = calloc(1, sizeof(SipReactorHandler));
+    if (h == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating the"
+                " memory");
+        return SIP_ERROR;
+    }
+    h->fd = fd;
+    h->func = func;
+    h->data = data;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in watching the"
+                " descriptor %d: %s", fd, strerror(errno));
+        free(h);
+        return SIP_ERROR;
+    }
+
+    TAILQ_INSERT_TAIL(&handlers, h, next);
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to get the handler of a watched descriptor.
+ */
+static SipReactorHandler *SipReactorLookup(int fd)
+{
+    SipReactorHandler *h = NULL;
+
+    TAILQ_FOREACH(h, &handlers, next) {
+        if (h->fd == fd && !h->removed)
+            return h;
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief   Function to change the events, for which the descriptor is watched.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+int SipReactorMod(int fd, uint32_t events)
+{
+    SipReactorHandler *h = SipReactorLookup(fd);
+    struct epoll_event ev;
+
+    if (h == NULL)
+        return SIP_ERROR;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in watching the"
+                " descriptor %d: %s", fd, strerror(errno));
+        return SIP_ERROR;
+    }
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to stop watching the descriptor. Its handler is freed after
+ *          the current dispatch, as further events of it may be pending. The
+ *          descriptor is not closed, other than a timer, which the reactor
+ *          has created.
+ */
+void SipReactorDel(int fd)
+{
+    SipReactorHandler *h = SipReactorLookup(fd);
+
+    if (h == NULL)
+        return;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    h->removed = 1;
+    if (h->func == SipReactorTimerFire)
+        close(fd);
+}
+
+/**
+ * \brief   Function to free the handlers removed during the dispatch.
+ */
+static void SipReactorPurge()
+{
+    SipReactorHandler *h = NULL;
+    SipReactorHandler *tmp = NULL;
+
+    for (h = TAILQ_FIRST(&handlers); h != NULL; h = tmp) {
+        tmp = TAILQ_NEXT(h, next);
+        if (h->removed) {
+            TAILQ_REMOVE(&handlers, h, next);
+            /* the handler of the timer function */
+            if (h->func == SipReactorTimerFire)
+                free(h->data);
+            free(h);
+        }
+    }
+}
+
+/**
+ * \brief   Function to read the expirations of a timer, before its handler is
+ *          called.
+ */
+static void SipReactorTimerFire(int fd, uint32_t events, void *data)
+{
+    SipReactorHandler *h = data;
+    uint64_t expired = 0;
+
+    if (read(fd, &expired, sizeof(expired)) != sizeof(expired))
+        return;
+
+    h->func(fd, events, h->data);
+}
+
+/**
+ * \brief   Function to create a wall clock timer, which calls the given
+ *          function when it expires. It is disarmed, until it is set by
+ *          SipReactorTimerAt().
+ *
+ * @return  descriptor of the timer or -1 on failure
+ */
+int SipReactorTimerNew(SipReactorFunc func, void *data)
+{
+    SipReactorHandler *h = NULL;
+    int fd = -1;
+
+    fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in creating the"
+                " timer: %s", strerror(errno));
+        return -1;
+    }
+
+    /* the handler of the timer is passed to the expiration reader, which
+     * calls the function of the timer */
+    h = calloc(1, sizeof(SipReactorHandler));
+    if (h == NULL) {
+        close(fd);
+        return -1;
+    }
+    h->func = func;
+    h->data = data;
+
+    if (SipReactorAdd(fd, EPOLLIN, SipReactorTimerFire, h) != SIP_OK) {
+        free(h);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * \brief   Function to set the timer to expire at the given wall clock time.
+ *          A time in the past expires right away. The timer follows the
+ *          changes of the wall clock, so that it is aligned to the intervals
+ *          of the CDRs.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+int SipReactorTimerAt(int fd, time_t when)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    /* an expiration of zero would disarm the timer */
+    its.it_value.tv_sec = (when > 0) ? when : 0;
+    its.it_value.tv_nsec = (when > 0) ? 0 : 1;
+
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in setting the"
+                " timer: %s", strerror(errno));
+        return SIP_ERROR;
+    }
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to wait for the events and to call their handlers once.
+ *
+ * @param timeout   milliseconds to wait, 0 to only take the pending events
+ *                  and -1 to wait until an event is ready
+ *
+ * @return  number of the dispatched events or SIP_ERROR on failure
+ */
+int SipReactorRun(int timeout)
+{
+    struct epoll_event events[SIP_REACTOR_MAX_EVENTS];
+    SipReactorHandler *h = NULL;
+    int cnt = 0;
+    int i = 0;
+
+    /* the tools, which run the engine without the event loop */
+    if (epoll_fd < 0)
+        return 0;
+
+    cnt = epoll_wait(epoll_fd, events, SIP_REACTOR_MAX_EVENTS, timeout);
+    if (cnt < 0) {
+        if (errno == EINTR)
+            return 0;
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in waiting for the"
+                " events: %s", strerror(errno));
+        return SIP_ERROR;
+    }
+
+    dispatching++;
+    for (i = 0; i < cnt; i++) {
+        h = events[i].data.ptr;
+        if (!h->removed)
+            h->func(h->fd, events[i].events, h->data);
+    }
+    dispatching--;
+
+    /* a nested dispatch may still hold the events of the removed handlers */
+    if (dispatching == 0)
+        SipReactorPurge();
+    return cnt;
+}
+
+/**
+ * \brief   Function to run the event loop, until it is stopped.
+ */
+void SipReactorLoop()
+{
+    running = 1;
+    while (running) {
+        if (SipReactorRun(-1) == SIP_ERROR)
+            break;
+    }
+}
+
+/**
+ * \brief   Function to stop the event loop, after the current dispatch.
+ */
+void SipReactorStop()
+{
+    running = 0;
+}
+
+/**
+ * \brief   Function to check, if the reactor has been initialized.
+ *
+ * @return  TRUE if the events can be waited for, FALSE otherwise
+ */
+int SipReactorEnabled()
+{
+    return (epoll_fd >= 0) ? TRUE : FALSE;
+}
+
+/**
+ * \brief   Function to free the reactor, the watched descriptors other than
+ *          the timers and the signalfd are not closed.
+ */
+void SipReactorDeInit()
+{
+    SipReactorHandler *h = NULL;
+
+    while ((h = TAILQ_FIRST(&handlers)) != NULL) {
+        TAILQ_REMOVE(&handlers, h, next);
+        if (h->func == SipReactorTimerFire) {
+            close(h->fd);
+            free(h->data);
+        }
+        free(h);
+    }
+
+    if (signal_fd >= 0) {
+        close(signal_fd);
+        signal_fd = -1;
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-reactor.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ */
+
+#ifndef _UTIL_REACTOR_H
+#define	_UTIL_REACTOR_H
+
+#include <signal.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "queue.h"
+
+/* Number of the events, which are taken from epoll at once */
+#define SIP_REACTOR_MAX_EVENTS  16
+
+/* Called with the descriptor and the epoll events which are ready on it */
+typedef void (*SipReactorFunc)(int, uint32_t, void *);
+
+/* Called with the number of a signal taken from the signalfd */
+typedef void (*SipReactorSignalFunc)(int);
+
+/**
+ * Descriptor watched by the reactor.
+ */
+typedef struct SipReactorHandler_ {
+    int fd;
+    int removed;            /* freed after the current dispatch */
+    SipReactorFunc func;
+    void *data;
+
+    TAILQ_ENTRY(SipReactorHandler_) next;
+} SipReactorHandler;
+
+int SipReactorInit(const int *, int, SipReactorSignalFunc);
+void SipReactorDeInit();
+int SipReactorAdd(int, uint32_t, SipReactorFunc, void *);
+int SipReactorMod(int, uint32_t);
+void SipReactorDel(int);
+int SipReactorTimerNew(SipReactorFunc, void *);
+int SipReactorTimerAt(int, time_t);
+int SipReactorRun(int);
+void SipReactorLoop();
+void SipReactorStop();
+int SipReactorEnabled();
+
+#endif	/* _UTIL_REACTOR_H */
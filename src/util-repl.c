@@ -0,0 +1,552 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-repl.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Source of the ingest, which streams the inserts of the CDR table from the
+ * CDR database by logical replication, on a slot with the test_decoding
+ * output plugin. The decoded calls are added to the ingest buffer, so that
+ * the intervals are scored without querying the table.
+ *
+ * The end of the last decoded transaction is saved to the lsn-file, and only
+ * the saved position is confirmed to the server, so that the stream resumes
+ * after it on a restart. The calls streamed again after it are of the
+ * intervals before the restart, which are fetched from the CDR database
+ * anyway (see SipIngestCovers()).
+ */
+
+#include <sys/time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include "sipade.h"
+#include "util-repl.h"
+#include "util-ingest.h"
+#include "util-reactor.h"
+#include "util-cdr.h"
+#include "util-conf.h"
+#include "util-log.h"
+
+static const char *column_names[SIP_REPL_COLUMNS] = { "id", "calldate", "src",
+    "dst", "billsec", "calltype", "accountcode" };
+
+static PGconn *repl_conn = NULL;
+static int repl_fd = -1;
+static int status_fd = -1;
+static char *slot = NULL;
+static char *lsn_file = NULL;
+static char *table = NULL;
+static uint64_t received_lsn = 0;   /* end of the last decoded transaction */
+static uint64_t saved_lsn = 0;      /* position in the lsn-file */
+
+/**
+ * \brief   Function to read a 64 bit integer in the network byte order.
+ */
+static uint64_t SipReplGet64(const char *p)
+{
+    uint64_t v = 0;
+    uint8_t i = 0;
+
+    for (i = 0; i < 8; i++)
+        v = (v << 8) | (uint8_t)p[i];
+    return v;
+}
+
+/**
+ * \brief   Function to write a 64 bit integer in the network byte order.
+ */
+static void SipReplPut64(char *p, uint64_t v)
+{
+    int8_t i = 0;
+
+    for (i = 7; i >= 0; i--) {
+        p[i] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+/**
+ * \brief   Function to read the saved position of the stream, if any.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+static int SipReplLoad()
+{
+    FILE *fp = NULL;
+    uint32_t hi = 0;
+    uint32_t lo = 0;
+
+    fp = fopen(lsn_file, "r");
+    if (fp == NULL)
+        return (errno == ENOENT) ? SIP_OK : SIP_ERROR;
+
+    if (fscanf(fp, "%X/%X", &hi, &lo) != 2) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "The position in \"%s\" is"
+                " not valid", lsn_file);
+        fclose(fp);
+        return SIP_ERROR;
+    }
+    fclose(fp);
+
+    received_lsn = saved_lsn = ((uint64_t)hi << 32) | lo;
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to save the position of the stream. The file is replaced
+ *          in one step, so that it always holds a complete position.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+static int SipReplSave()
+{
+    char tmp[PATH_MAX];
+    FILE *fp = NULL;
+    uint64_t lsn = received_lsn;
+
+    if (lsn == saved_lsn)
+        return SIP_OK;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", lsn_file);
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in opening the"
+                " \"%s\" file: %s", tmp, strerror(errno));
+        return SIP_ERROR;
+    }
+
+    fprintf(fp, "%X/%X\n", (uint32_t)(lsn >> 32), (uint32_t)lsn);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in writing to the"
+                " file: %s", tmp);
+        fclose(fp);
+        return SIP_ERROR;
+    }
+    fclose(fp);
+
+    if (rename(tmp, lsn_file) != 0) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in renaming the"
+                " \"%s\" file: %s", tmp, strerror(errno));
+        return SIP_ERROR;
+    }
+
+    saved_lsn = lsn;
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to send the status update to the server. The decoded
+ *          position is reported as written and the saved one as flushed, up
+ *          to which the server may release the WAL of the slot.
+ */
+static void SipReplFeedback()
+{
+    char msg[34];
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    msg[0] = 'r';
+    SipReplPut64(&msg[1], received_lsn);
+    SipReplPut64(&msg[9], saved_lsn);
+    SipReplPut64(&msg[17], saved_lsn);
+    SipReplPut64(&msg[25], (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec -
+            SIP_REPL_EPOCH_OFFSET);
+    msg[33] = 0;
+
+    if (PQputCopyData(repl_conn, msg, sizeof(msg)) != 1 ||
+            PQflush(repl_conn) < 0)
+    {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in sending the"
+                " status to the server: %s", PQerrorMessage(repl_conn));
+    }
+}
+
+/**
+ * \brief   Function to check whether the changes of the given table, as named
+ *          by test_decoding, are of the CDR table.
+ */
+static int SipReplTable(const char *name)
+{
+    const char *dot = NULL;
+
+    if (strchr(table, '.') != NULL)
+        return strcmp(name, table) == 0;
+
+    dot = strchr(name, '.');
+    return strcmp((dot != NULL) ? dot + 1 : name, table) == 0;
+}
+
+/**
+ * \brief   Function to decode the columns of an inserted row, as written by
+ *          test_decoding: name[type]:value, separated by spaces. The strings
+ *          are quoted with the quotes doubled inside, a null is "null". The
+ *          columns are decoded in place.
+ *
+ * @param cols      the columns of the row
+ * @param fields    pointer to the values of the CDR columns, in the order of
+ *                  the interval query, NULL for the missing ones
+ */
+static void SipReplColumns(char *cols, char **fields)
+{
+    char *p = cols;
+    char *name = NULL;
+    char *value = NULL;
+    char *w = NULL;
+    size_t len = 0;
+    uint8_t i = 0;
+
+    memset(fields, 0, SIP_REPL_COLUMNS * sizeof(char *));
+
+    while (*p != '\0') {
+        name = p;
+        p = strchr(p, '[');
+        if (p == NULL)
+            return;
+        *p++ = '\0';
+
+        /* the type can have brackets itself, e.g. integer[] */
+        p = strstr(p, "]:");
+        if (p == NULL)
+            return;
+        p += 2;
+
+        if (*p == '\'') {
+            value = w = ++p;
+            while (*p != '\0') {
+                if (*p == '\'' && p[1] == '\'') {
+                    *w++ = '\'';
+                    p += 2;
+                } else if (*p == '\'') {
+                    p++;
+                    break;
+                } else {
+                    *w++ = *p++;
+                }
+            }
+            *w = '\0';
+            if (*p == ' ')
+                p++;
+        } else {
+            value = p;
+            p += strcspn(p, " ");
+            if (*p != '\0')
+                *p++ = '\0';
+            if (strcmp(value, "null") == 0)
+                value = NULL;
+        }
+
+        /* the names, which are not lower case, are quoted */
+        len = strlen(name);
+        if (len >= 2 && name[0] == '"' && name[len - 1] == '"') {
+            name[len - 1] = '\0';
+            name++;
+        }
+
+        for (i = 0; i < SIP_REPL_COLUMNS; i++) {
+            if (strcmp(name, column_names[i]) == 0) {
+                fields[i] = value;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * \brief   Function to decode a change of the stream. The inserts of the CDR
+ *          table are added to the ingest buffer, which is checked at the end
+ *          of each transaction.
+ *
+ * @param msg   the change, as written by test_decoding
+ * @param lsn   position of the change
+ */
+static void SipReplDecode(char *msg, uint64_t lsn)
+{
+    char *fields[SIP_REPL_COLUMNS];
+    char *name = NULL;
+    char *action = NULL;
+
+    if (strncmp(msg, "COMMIT", 6) == 0) {
+        SipIngestCommit();
+        /* the position of a commit is the end of its transaction */
+        received_lsn = lsn;
+        return;
+    }
+
+    if (strncmp(msg, "table ", 6) != 0)
+        return;
+
+    name = msg + 6;
+    action = strstr(name, ": ");
+    if (action == NULL)
+        return;
+    *action = '\0';
+    action += 2;
+
+    if (strncmp(action, "INSERT: ", 8) != 0 || !SipReplTable(name))
+        return;
+
+    SipReplColumns(action + 8, fields);
+
+    /* the fraction of the seconds and the time zone are not used */
+    if (fields[1] != NULL && strlen(fields[1]) > 19)
+        fields[1][19] = '\0';
+
+    SipIngestRow(fields);
+}
+
+/**
+ * \brief   Function to handle a message of the replication protocol, the WAL
+ *          data ('w') or the keepalive of the server ('k').
+ */
+static void SipReplMessage(char *buf, int len)
+{
+    if (buf[0] == 'w' && len >= 25) {
+        SipReplDecode(buf + 25, SipReplGet64(buf + 1));
+    } else if (buf[0] == 'k' && len >= 18 && buf[17]) {
+        SipReplFeedback();
+    }
+}
+
+/**
+ * \brief   Function to close the replication connection.
+ */
+static void SipReplStop()
+{
+    if (repl_fd >= 0) {
+        SipReactorDel(repl_fd);
+        repl_fd = -1;
+    }
+
+    if (repl_conn != NULL) {
+        PQfinish(repl_conn);
+        repl_conn = NULL;
+    }
+}
+
+/**
+ * \brief   Function to give up the stream after a failure. The intervals are
+ *          fetched from the CDR database, until it is started again.
+ */
+static void SipReplFail()
+{
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "The replication stream has"
+            " failed: %s", PQerrorMessage(repl_conn));
+    SipReplStop();
+    SipIngestSuspend();
+}
+
+/**
+ * \brief   Function to take the messages of the stream, as they arrive.
+ */
+static void SipReplRead(int fd, uint32_t events, void *data)
+{
+    char *buf = NULL;
+    int len = 0;
+
+    if (PQconsumeInput(repl_conn) == 0) {
+        SipReplFail();
+        return;
+    }
+
+    while ((len = PQgetCopyData(repl_conn, &buf, 1)) > 0) {
+        SipReplMessage(buf, len);
+        PQfreemem(buf);
+    }
+
+    /* -1 is the end of the stream, -2 a failure */
+    if (len < 0) {
+        SipReplFail();
+        return;
+    }
+
+    /* a status update, which did not fit in to the socket */
+    PQflush(repl_conn);
+}
+
+/**
+ * \brief   Function to connect to the CDR database and to start the stream
+ *          after the decoded position. The slot is created on the first
+ *          start.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+static int SipReplStart()
+{
+    PGresult *res = NULL;
+    char cmd[256];
+    const char *state = NULL;
+
+    repl_conn = SipConnectDBOpts("cdr-database", "replication=database");
+    if (PQstatus(repl_conn) == CONNECTION_BAD)
+        goto error;
+
+    snprintf(cmd, sizeof(cmd), "CREATE_REPLICATION_SLOT %s LOGICAL"
+            " test_decoding", slot);
+    res = PQexec(repl_conn, cmd);
+    state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+    if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Created the replication slot"
+                " %s", slot);
+    } else if (state == NULL || strcmp(state, "42710") != 0) {
+        /* other than a duplicate object, the slot exists already */
+        PQclear(res);
+        goto error;
+    }
+    PQclear(res);
+
+    snprintf(cmd, sizeof(cmd), "START_REPLICATION SLOT %s LOGICAL %X/%X"
+            " (\"include-xids\" '0')", slot, (uint32_t)(received_lsn >> 32),
+            (uint32_t)received_lsn);
+    res = PQexec(repl_conn, cmd);
+    if (PQresultStatus(res) != PGRES_COPY_BOTH) {
+        PQclear(res);
+        goto error;
+    }
+    PQclear(res);
+
+    repl_fd = PQsocket(repl_conn);
+    if (PQsetnonblocking(repl_conn, 1) != 0 ||
+            SipReactorAdd(repl_fd, EPOLLIN, SipReplRead, NULL) != SIP_OK)
+    {
+        repl_fd = -1;
+        goto error;
+    }
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Streaming the CDRs from the slot"
+            " %s after %X/%X", slot, (uint32_t)(received_lsn >> 32),
+            (uint32_t)received_lsn);
+    return SIP_OK;
+
+error:
+    SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in starting the"
+            " replication stream: %s", PQerrorMessage(repl_conn));
+    SipReplStop();
+    return SIP_ERROR;
+}
+
+/**
+ * \brief   Function to save the position and to send the status update at
+ *          every SIP_REPL_STATUS_INTERVAL, or to start the stream again after
+ *          a failure.
+ */
+static void SipReplTick(int fd, uint32_t events, void *data)
+{
+    if (slot == NULL)
+        return;
+
+    if (repl_conn != NULL) {
+        SipReplSave();
+        SipReplFeedback();
+    } else if (SipReplStart() == SIP_OK) {
+        SipIngestResume();
+    }
+
+    SipReactorTimerAt(status_fd, time(NULL) + SIP_REPL_STATUS_INTERVAL);
+}
+
+/**
+ * \brief   Function to initialize the replication stream and to add it to the
+ *          event loop.
+ *
+ * @return  on success it returns SIP_OK and on failure SIP_ERROR
+ */
+int SipReplInit()
+{
+    char *val = NULL;
+    char *p = NULL;
+
+    if (SipConfGet("ingest.slot", &val) != 1)
+        val = SIP_REPL_DEFAULT_SLOT;
+    for (p = val; *p != '\0'; p++) {
+        if (!islower((unsigned char)*p) && !isdigit((unsigned char)*p) &&
+                *p != '_')
+        {
+            SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "The replication slot"
+                    " name \"%s\" can only have lower case letters, digits"
+                    " and underscores", val);
+            return SIP_ERROR;
+        }
+    }
+    slot = strdup(val);
+
+    if (SipConfGet("ingest.lsn-file", &val) != 1)
+        val = SIP_REPL_DEFAULT_LSN_FILE;
+    lsn_file = strdup(val);
+
+    if (SipConfGet("cdr-database.table", &val) != 1)
+        val = "cdr";
+    table = strdup(val);
+
+    if (slot == NULL || lsn_file == NULL || table == NULL) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "error in allocating the"
+                " memory");
+        return SIP_ERROR;
+    }
+
+    if (SipReplLoad() != SIP_OK) {
+        SipLog(SIP_LOG_ERROR, SIP_LOG_LOCATION, "Failed in reading the"
+                " position of the stream from \"%s\"", lsn_file);
+        return SIP_ERROR;
+    }
+
+    if (SipReplStart() != SIP_OK)
+        return SIP_ERROR;
+
+    status_fd = SipReactorTimerNew(SipReplTick, NULL);
+    if (status_fd < 0 || SipReactorTimerAt(status_fd,
+                time(NULL) + SIP_REPL_STATUS_INTERVAL) != SIP_OK)
+    {
+        return SIP_ERROR;
+    }
+
+    return SIP_OK;
+}
+
+/**
+ * \brief   Function to save the position, to confirm it to the server and to
+ *          close the stream. The timer is freed with the event loop.
+ */
+void SipReplDeInit()
+{
+    if (slot == NULL)
+        return;
+
+    SipReplSave();
+    if (repl_conn != NULL) {
+        PQsetnonblocking(repl_conn, 0);
+        SipReplFeedback();
+    }
+    SipReplStop();
+
+    free(slot);
+    slot = NULL;
+    if (lsn_file != NULL) {
+        free(lsn_file);
+        lsn_file = NULL;
+    }
+    if (table != NULL) {
+        free(table);
+        table = NULL;
+    }
+    status_fd = -1;
+}
+
@@ -0,0 +1,48 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-repl.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ */
+
+#ifndef _UTIL_REPL_H
+#define	_UTIL_REPL_H
+
+#include <inttypes.h>
+
+#define SIP_REPL_DEFAULT_SLOT       "sipade"
+#define SIP_REPL_DEFAULT_LSN_FILE   "/var/lib/sipade/cdr.lsn"
+
+/* Seconds between the status updates to the server, at which the position is
+ * also saved, and between the attempts to reconnect */
+#define SIP_REPL_STATUS_INTERVAL    10
+
+/* Microseconds between the Unix and the PostgreSQL epoch (2000-01-01) */
+#define SIP_REPL_EPOCH_OFFSET       946684800000000LL
+
+/* Columns of the CDR table, in the order of the interval query */
+#define SIP_REPL_COLUMNS            7
+
+int SipReplInit();
+void SipReplDeInit();
+
+#endif	/* _UTIL_REPL_H */
+
@@ -0,0 +1,310 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-timer.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Low overhead timers for the stages of the hot path. The durations are
+ * taken from the invariant time stamp counter, when the CPU has one, and
+ * from CLOCK_MONOTONIC otherwise. They are recorded in to HDR histograms,
+ * of which a summary is logged on SIGUSR1 and at shutdown.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "sipade.h"
+#include "util-timer.h"
+#include "util-log.h"
+#include "util-conf.h"
+
+int timer_use_tsc = 0;
+static double ns_per_tick = 1.0;
+
+static SipTimerStage stages[SIP_TIMER_MAX] = {
+    [SIP_TIMER_CDR_FETCH]       = { .name = "cdr-fetch", .unit = "us" },
+    [SIP_TIMER_CDR_ROWS]        = { .name = "cdr-rows", .unit = NULL },
+    [SIP_TIMER_CALL_DATA]       = { .name = "call-data", .unit = "us" },
+    [SIP_TIMER_HELLINGER]       = { .name = "hellinger", .unit = "us" },
+    [SIP_TIMER_STORE_THRESHOLD] = { .name = "store-threshold", .unit = "us" },
+    [SIP_TIMER_ALERT]           = { .name = "alert-notify", .unit = "us" },
+};
+
+/**
+ * \brief   Function to get the bucket of the given value in a HDR histogram.
+ */
+static uint32_t SipHdrIndex(uint64_t value)
+{
+    uint32_t msb = 0;
+    uint32_t shift = 0;
+
+    if (value < 2 * SIP_HDR_SUB_COUNT)
+        return value;
+
+    msb = 63 - __builtin_clzll(value);
+    if (msb > SIP_HDR_MAX_BITS)
+        return SIP_HDR_BUCKETS - 1;
+
+    shift = msb - SIP_HDR_SUB_BITS;
+    return (shift + 1) * SIP_HDR_SUB_COUNT + (value >> shift) -
+        SIP_HDR_SUB_COUNT;
+}
+
+/**
+ * \brief   Function to get the highest value, which falls in to the given
+ *          bucket of a HDR histogram.
+ */
+static uint64_t SipHdrValue(uint32_t idx)
+{
+    uint32_t shift = 0;
+
+    if (idx < 2 * SIP_HDR_SUB_COUNT)
+        return idx;
+
+    shift = idx / SIP_HDR_SUB_COUNT - 1;
+    return ((uint64_t)(idx % SIP_HDR_SUB_COUNT + SIP_HDR_SUB_COUNT) << shift)
+        + ((1ULL << shift) - 1);
+}
+
+/**
+ * \brief   Function to record the given value in the HDR histogram.
+ */
+void SipHdrRecord(SipHdr *hdr, uint64_t value)
+{
+    uint64_t cur = 0;
+
+    __atomic_add_fetch(&hdr->bucket[SipHdrIndex(value)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hdr->sum, value, __ATOMIC_RELAXED);
+
+    /* the first value sets the minimum */
+    if (__atomic_fetch_add(&hdr->count, 1, __ATOMIC_RELAXED) == 0)
+        __atomic_store_n(&hdr->min, value, __ATOMIC_RELAXED);
+
+    cur = __atomic_load_n(&hdr->min, __ATOMIC_RELAXED);
+    while (value < cur && !__atomic_compare_exchange_n(&hdr->min, &cur,
+                value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    cur = __atomic_load_n(&hdr->max, __ATOMIC_RELAXED);
+    while (value > cur && !__atomic_compare_exchange_n(&hdr->max, &cur,
+                value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * \brief   Function to get the value at the given percentile of the HDR
+ *          histogram.
+ *
+ * @param hdr       pointer to the histogram
+ * @param percent   percentile in the range of (0.0-100.0)
+ */
+uint64_t SipHdrPercentile(SipHdr *hdr, double percent)
+{
+    uint64_t target = 0;
+    uint64_t cumulated = 0;
+    uint32_t idx = 0;
+
+    if (hdr->count == 0)
+        return 0;
+
+    target = (uint64_t)(hdr->count * percent / 100.0 + 0.5);
+    if (target == 0)
+        target = 1;
+
+    for (idx = 0; idx < SIP_HDR_BUCKETS; idx++) {
+        cumulated += hdr->bucket[idx];
+        if (cumulated >= target)
+            break;
+    }
+
+    if (SipHdrValue(idx) > hdr->max)
+        return hdr->max;
+    return SipHdrValue(idx);
+}
+
+/**
+ * \brief   Function to convert the timer ticks in to nanoseconds.
+ */
+uint64_t SipTimerNs(uint64_t ticks)
+{
+    if (timer_use_tsc)
+        return (uint64_t)(ticks * ns_per_tick);
+    return ticks;
+}
+
+/**
+ * \brief   Function to record the time elapsed since the given ticks for the
+ *          stage.
+ *
+ * @param stage     stage, one of the SIP_TIMER_* values
+ * @param start     ticks at the start of the stage
+ *
+ * @return  elapsed time in nanoseconds
+ */
+uint64_t SipTimerRecord(int stage, uint64_t start)
+{
+    uint64_t ns = SipTimerNs(SipTimerTicks() - start);
+
+    SipHdrRecord(&stages[stage].hist, ns);
+    return ns;
+}
+
+/**
+ * \brief   Function to record a value, such as the number of rows, for the
+ *          stage.
+ */
+void SipTimerRecordValue(int stage, uint64_t value)
+{
+    SipHdrRecord(&stages[stage].hist, value);
+}
+
+/**
+ * \brief   Function to account the items processed in the stage, which are
+ *          reported as throughput.
+ */
+void SipTimerAddItems(int stage, uint64_t items)
+{
+    __atomic_add_fetch(&stages[stage].items, items, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to get the number of the recorded durations of the stage.
+ */
+uint64_t SipTimerCount(int stage)
+{
+    return __atomic_load_n(&stages[stage].hist.count, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to get the number of the items processed in the stage.
+ */
+uint64_t SipTimerItems(int stage)
+{
+    return __atomic_load_n(&stages[stage].items, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief   Function to check whether the time stamp counter runs at a constant
+ *          rate, independent of the frequency and sleep states of the CPU.
+ */
+static int SipTimerTscInvariant()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0)
+        return 0;
+    return (edx & (1 << 8)) != 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \brief   Function to initialize the stage timers. It calibrates the time
+ *          stamp counter against the monotonic clock, unless it has been
+ *          disabled in the config file or is not invariant.
+ */
+void SipTimerInit()
+{
+    int tsc = 1;
+    struct timespec ts0, ts1;
+    struct timespec wait = { 0, 20000000 };
+    uint64_t t0 = 0;
+    uint64_t t1 = 0;
+
+    if (SipConfGetBool("stage-timers.tsc", &tsc) == 1 && !tsc)
+        return;
+
+    if (!SipTimerTscInvariant()) {
+        SipLog(SIP_LOG_DEBUG, SIP_LOG_LOCATION, "No invariant TSC, the stage"
+                " timers use the monotonic clock");
+        return;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    t0 = __rdtsc();
+    nanosleep(&wait, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    t1 = __rdtsc();
+
+    if (t1 <= t0)
+        return;
+
+    ns_per_tick = ((ts1.tv_sec - ts0.tv_sec) * 1e9 +
+            (ts1.tv_nsec - ts0.tv_nsec)) / (double)(t1 - t0);
+    timer_use_tsc = 1;
+    SipLog(SIP_LOG_DEBUG, SIP_LOG_LOCATION, "Stage timers use the TSC at"
+            " %.3f GHz", 1.0 / ns_per_tick);
+#endif
+}
+
+/**
+ * \brief   Function to log the summary of all the stage timers.
+ */
+void SipTimerDump()
+{
+    SipTimerStage *st = NULL;
+    double mean = 0.0;
+    double rate = 0.0;
+    uint8_t i = 0;
+
+    SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "Stage timers (%s):",
+            timer_use_tsc ? "tsc" : "monotonic clock");
+
+    for (i = 0; i < SIP_TIMER_MAX; i++) {
+        st = &stages[i];
+        if (st->hist.count == 0)
+            continue;
+
+        mean = (double)st->hist.sum / st->hist.count;
+        if (st->unit == NULL) {
+            SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "  %-16s count %"PRIu64
+                    " mean %.1f p50 %"PRIu64" p90 %"PRIu64" p99 %"PRIu64
+                    " p99.9 %"PRIu64" max %"PRIu64, st->name, st->hist.count,
+                    mean, SipHdrPercentile(&st->hist, 50.0),
+                    SipHdrPercentile(&st->hist, 90.0),
+                    SipHdrPercentile(&st->hist, 99.0),
+                    SipHdrPercentile(&st->hist, 99.9), st->hist.max);
+            continue;
+        }
+
+        rate = 0.0;
+        if (st->items > 0 && st->hist.sum > 0)
+            rate = st->items / (st->hist.sum / 1e9);
+
+        SipLog(SIP_LOG_INFO, SIP_LOG_LOCATION, "  %-16s count %"PRIu64
+                " mean %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f %s"
+                "%s%.0f%s", st->name, st->hist.count, mean / 1e3,
+                SipHdrPercentile(&st->hist, 50.0) / 1e3,
+                SipHdrPercentile(&st->hist, 90.0) / 1e3,
+                SipHdrPercentile(&st->hist, 99.0) / 1e3,
+                SipHdrPercentile(&st->hist, 99.9) / 1e3,
+                st->hist.max / 1e3, st->unit, rate > 0 ? ", " : "",
+                rate, rate > 0 ? " items/sec" : "");
+    }
+}
+
+/**
+ * \brief   Function to log the final summary of the stage timers.
+ */
+void SipTimerDeInit()
+{
+    SipTimerDump();
+}
@@ -0,0 +1,107 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-timer.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ */
+
+#ifndef _UTIL_TIMER_H
+#define	_UTIL_TIMER_H
+
+#include <time.h>
+#include <inttypes.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* The HDR histogram keeps 2^SIP_HDR_SUB_BITS sub buckets per power of two,
+ * which gives a relative error below 1% up to 2^SIP_HDR_MAX_BITS */
+#define SIP_HDR_SUB_BITS    7
+#define SIP_HDR_SUB_COUNT   (1 << SIP_HDR_SUB_BITS)
+#define SIP_HDR_MAX_BITS    47
+#define SIP_HDR_BUCKETS     ((SIP_HDR_MAX_BITS - SIP_HDR_SUB_BITS + 2) * \
+                             SIP_HDR_SUB_COUNT)
+
+/* Stages of the hot path which are timed */
+enum {
+    SIP_TIMER_CDR_FETCH = 0,    /* SipGetCdr wall time */
+    SIP_TIMER_CDR_ROWS,         /* rows returned by the interval query */
+    SIP_TIMER_CALL_DATA,        /* SipGetCallData */
+    SIP_TIMER_HELLINGER,        /* probabilities, distance and decision */
+    SIP_TIMER_STORE_THRESHOLD,  /* SipAnomalyStoreThreshold */
+    SIP_TIMER_ALERT,            /* SipAlertNotification */
+
+    SIP_TIMER_MAX,      /* Keep it last always */
+};
+
+/**
+ * High dynamic range histogram with log-linear buckets.
+ */
+typedef struct SipHdr_ {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t bucket[SIP_HDR_BUCKETS];
+} SipHdr;
+
+/**
+ * Stage timer, the durations are recorded in nanoseconds. A stage which
+ * records values instead of durations has no unit.
+ */
+typedef struct SipTimerStage_ {
+    const char *name;
+    const char *unit;
+    uint64_t items;     /* items processed, to report the throughput */
+    SipHdr hist;
+} SipTimerStage;
+
+extern int timer_use_tsc;
+
+/**
+ * \brief   Function to read the timer ticks. It uses the time stamp counter if
+ *          it is invariant, otherwise the monotonic clock in nanoseconds.
+ */
+static inline uint64_t SipTimerTicks(void)
+{
+    struct timespec ts;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (timer_use_tsc)
+        return __rdtsc();
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void SipTimerInit();
+void SipTimerDeInit();
+uint64_t SipTimerNs(uint64_t);
+uint64_t SipTimerRecord(int, uint64_t);
+void SipTimerRecordValue(int, uint64_t);
+void SipTimerAddItems(int, uint64_t);
+uint64_t SipTimerCount(int);
+uint64_t SipTimerItems(int);
+void SipTimerDump();
+void SipHdrRecord(SipHdr *, uint64_t);
+uint64_t SipHdrPercentile(SipHdr *, double);
+
+#endif	/* _UTIL_TIMER_H */
+
@@ -0,0 +1,268 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-wheel.c
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ * Hierarchical timing wheel for the due times of the detection schedules. An
+ * entry is put in the slot of the lowest level, whose span covers its due
+ * time, so that adding and removing it take constant time. As the wheel
+ * turns, the slots of the upper levels are cascaded in to the lower ones and
+ * the entries of the lowest level expire in the order of their due time.
+ */
+
+#include "sipade.h"
+#include "util-wheel.h"
+
+/**
+ * \brief   Function to initialize the wheel, with the given time as the last
+ *          expired second.
+ */
+void SipWheelInit(SipWheel *w, time_t now)
+{
+    uint8_t l = 0;
+    uint8_t i = 0;
+
+    memset(w, 0, sizeof(SipWheel));
+    w->now = now;
+    TAILQ_INIT(&w->ready);
+    for (l = 0; l < SIP_WHEEL_LEVELS; l++) {
+        for (i = 0; i < SIP_WHEEL_SLOTS; i++)
+            TAILQ_INIT(&w->slots[l][i]);
+    }
+}
+
+/**
+ * \brief   Function to put the entry in to the slot of its due time, relative
+ *          to the current time of the wheel.
+ */
+static void SipWheelPlace(SipWheel *w, SipWheelEntry *e)
+{
+    uint64_t delta = 0;
+    uint64_t due = 0;
+    uint8_t level = 0;
+    uint8_t slot = 0;
+
+    if (e->due <= w->now) {
+        e->list = &w->ready;
+        TAILQ_INSERT_TAIL(&w->ready, e, next);
+        return;
+    }
+
+    delta = e->due - w->now;
+    due = e->due;
+    if (delta >= SIP_WHEEL_RANGE)
+        due = w->now + SIP_WHEEL_RANGE - 1;
+
+    while (level < SIP_WHEEL_LEVELS - 1 &&
+            delta >= (1ULL << (SIP_WHEEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    slot = (due >> (SIP_WHEEL_BITS * level)) & SIP_WHEEL_MASK;
+    e->list = &w->slots[level][slot];
+    TAILQ_INSERT_TAIL(e->list, e, next);
+    w->occupied[level] |= 1ULL << slot;
+}
+
+/**
+ * \brief   Function to schedule the entry at the given time. An entry, which
+ *          is already scheduled, is moved.
+ */
+void SipWheelAdd(SipWheel *w, SipWheelEntry *e, time_t due)
+{
+    if (e->list != NULL)
+        SipWheelDel(w, e);
+
+    e->due = due;
+    SipWheelPlace(w, e);
+    w->cnt++;
+}
+
+/**
+ * \brief   Function to remove the entry from the wheel, if it is scheduled.
+ */
+void SipWheelDel(SipWheel *w, SipWheelEntry *e)
+{
+    uint64_t idx = 0;
+
+    if (e->list == NULL)
+        return;
+
+    TAILQ_REMOVE(e->list, e, next);
+    if (e->list != &w->ready && TAILQ_EMPTY(e->list)) {
+        idx = e->list - &w->slots[0][0];
+        w->occupied[idx / SIP_WHEEL_SLOTS] &=
+            ~(1ULL << (idx % SIP_WHEEL_SLOTS));
+    }
+    e->list = NULL;
+    w->cnt--;
+}
+
+/**
+ * \brief   Function to take all the entries of the given slot.
+ */
+static void SipWheelTake(SipWheel *w, uint8_t level, uint8_t slot,
+        SipWheelList *list)
+{
+    SipWheelEntry *e = NULL;
+
+    while ((e = TAILQ_FIRST(&w->slots[level][slot])) != NULL) {
+        TAILQ_REMOVE(&w->slots[level][slot], e, next);
+        TAILQ_INSERT_TAIL(list, e, next);
+    }
+    w->occupied[level] &= ~(1ULL << slot);
+}
+
+/**
+ * \brief   Function to move the entries to the expired list, or back in to the
+ *          wheel if they are not due yet.
+ */
+static void SipWheelRelease(SipWheel *w, SipWheelList *list,
+        SipWheelList *expired)
+{
+    SipWheelEntry *e = NULL;
+
+    while ((e = TAILQ_FIRST(list)) != NULL) {
+        TAILQ_REMOVE(list, e, next);
+        if (e->due <= w->now) {
+            e->list = NULL;
+            w->cnt--;
+            TAILQ_INSERT_TAIL(expired, e, next);
+        } else {
+            SipWheelPlace(w, e);
+        }
+    }
+}
+
+/**
+ * \brief   Function to turn the wheel by one second. The slots of the upper
+ *          levels, whose span starts now, are cascaded from the top down, so
+ *          that their entries reach the lowest level before it expires.
+ */
+static void SipWheelTick(SipWheel *w, SipWheelList *expired)
+{
+    SipWheelList list;
+    uint64_t now = ++w->now;
+    int8_t top = 0;
+    int8_t l = 0;
+
+    TAILQ_INIT(&list);
+
+    while (top < SIP_WHEEL_LEVELS - 1 &&
+            ((now >> (SIP_WHEEL_BITS * top)) & SIP_WHEEL_MASK) == 0)
+    {
+        top++;
+    }
+
+    for (l = top; l > 0; l--) {
+        SipWheelTake(w, l, (now >> (SIP_WHEEL_BITS * l)) & SIP_WHEEL_MASK,
+                &list);
+        SipWheelRelease(w, &list, expired);
+    }
+
+    SipWheelTake(w, 0, now & SIP_WHEEL_MASK, &list);
+    SipWheelRelease(w, &list, expired);
+}
+
+/**
+ * \brief   Function to expire all the entries, which are due by the given
+ *          time. They are appended to the expired list in the order of their
+ *          due time, the ones which were added when already due first.
+ *
+ * @param w         the wheel
+ * @param now       current time
+ * @param expired   list to which the expired entries are appended
+ */
+void SipWheelExpire(SipWheel *w, time_t now, SipWheelList *expired)
+{
+    SipWheelList list;
+    SipWheelEntry *e = NULL;
+    uint8_t l = 0;
+    uint8_t i = 0;
+
+    TAILQ_INIT(&list);
+
+    while ((e = TAILQ_FIRST(&w->ready)) != NULL) {
+        TAILQ_REMOVE(&w->ready, e, next);
+        TAILQ_INSERT_TAIL(&list, e, next);
+    }
+    SipWheelRelease(w, &list, expired);
+
+    if (now <= w->now)
+        return;
+
+    /* Nothing to cascade, or a jump of the clock past the whole wheel, every
+     * entry is placed again from the new time */
+    if (w->cnt == 0 || (uint64_t)(now - w->now) >= SIP_WHEEL_RANGE) {
+        for (l = 0; l < SIP_WHEEL_LEVELS && w->cnt > 0; l++) {
+            for (i = 0; i < SIP_WHEEL_SLOTS; i++)
+                SipWheelTake(w, l, i, &list);
+        }
+        w->now = now;
+        SipWheelRelease(w, &list, expired);
+        return;
+    }
+
+    while (w->now < now)
+        SipWheelTick(w, expired);
+}
+
+/**
+ * \brief   Function to get the time at which the wheel has to be turned next.
+ *          It is the due time of the next entry of the lowest level or the
+ *          start of the next slot of an upper level, to be cascaded.
+ *
+ * @return  the time, or -1 if the wheel is empty
+ */
+time_t SipWheelNext(SipWheel *w)
+{
+    uint64_t now = w->now;
+    uint64_t block = 0;
+    uint64_t bits = 0;
+    uint64_t next = 0;
+    uint64_t when = 0;
+    uint8_t shift = 0;
+    uint8_t l = 0;
+
+    if (!TAILQ_EMPTY(&w->ready))
+        return w->now;
+
+    for (l = 0; l < SIP_WHEEL_LEVELS; l++) {
+        if (w->occupied[l] == 0)
+            continue;
+
+        /* rotate the bitmap, so that the slot after the current one comes
+         * first */
+        block = now >> (SIP_WHEEL_BITS * l);
+        shift = (block + 1) & SIP_WHEEL_MASK;
+        bits = w->occupied[l];
+        if (shift != 0)
+            bits = (bits >> shift) | (bits << (SIP_WHEEL_SLOTS - shift));
+
+        when = (block + __builtin_ctzll(bits) + 1) << (SIP_WHEEL_BITS * l);
+        if (next == 0 || when < next)
+            next = when;
+    }
+
+    return (next == 0) ? -1 : (time_t)next;
+}
+
@@ -0,0 +1,77 @@
+/* Copyright (c) 2010 UNINETT AS
+ *
+ * This file is a part of SipADE engine.
+ *
+ * SipADE is a free software, You can copy, redistribute or modify this
+ * Program under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * SipADE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/*
+ * File:   util-wheel.h
+ * Author: Gurvinder Singh <gurvinder.singh@uninett.no>
+ *
+ */
+
+#ifndef _UTIL_WHEEL_H
+#define	_UTIL_WHEEL_H
+
+#include <time.h>
+#include <inttypes.h>
+#include "queue.h"
+
+/* Each level has 2^SIP_WHEEL_BITS slots, of one second at the lowest level.
+ * Four levels cover 2^24 seconds (194 days), later entries are parked in the
+ * last slot of the top level and placed again when they are cascaded */
+#define SIP_WHEEL_BITS      6
+#define SIP_WHEEL_SLOTS     (1 << SIP_WHEEL_BITS)
+#define SIP_WHEEL_MASK      (SIP_WHEEL_SLOTS - 1)
+#define SIP_WHEEL_LEVELS    4
+#define SIP_WHEEL_RANGE     (1ULL << (SIP_WHEEL_BITS * SIP_WHEEL_LEVELS))
+
+struct SipWheelList_;
+
+/**
+ * Entry of the wheel, embedded in the scheduled object. It is not allocated
+ * by the wheel, so that adding and removing it never fail.
+ */
+typedef struct SipWheelEntry_ {
+    time_t due;
+    void *data;
+    struct SipWheelList_ *list;     /* slot holding it, NULL if not queued */
+
+    TAILQ_ENTRY(SipWheelEntry_) next;
+} SipWheelEntry;
+
+TAILQ_HEAD(SipWheelList_, SipWheelEntry_);
+typedef struct SipWheelList_ SipWheelList;
+
+/**
+ * Hierarchical timing wheel with a resolution of one second.
+ */
+typedef struct SipWheel_ {
+    time_t now;                 /* last expired second */
+    uint64_t cnt;               /* queued entries */
+    uint64_t occupied[SIP_WHEEL_LEVELS];    /* bitmap of non empty slots */
+    SipWheelList ready;         /* entries added when already due */
+    SipWheelList slots[SIP_WHEEL_LEVELS][SIP_WHEEL_SLOTS];
+} SipWheel;
+
+void SipWheelInit(SipWheel *, time_t);
+void SipWheelAdd(SipWheel *, SipWheelEntry *, time_t);
+void SipWheelDel(SipWheel *, SipWheelEntry *);
+void SipWheelExpire(SipWheel *, time_t, SipWheelList *);
+time_t SipWheelNext(SipWheel *);
+
+#endif	/* _UTIL_WHEEL_H */
+